@@ -0,0 +1,232 @@
+#include "AssetIndex.h"
+#include "BakeCacheFile.h"
+#include "Hash.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+
+// longest name stored in the index, guards the allocation against broken files
+static constexpr uint32_t kMaxAssetNameLength = 4096;
+
+uint64_t MakeAssetStamp(uint64_t nSize, int64_t nModifiedTime, uint64_t nOffset)
+{
+	uint64_t nStamp = kHashSeed;
+	nStamp = HashBytes(nStamp, &nSize, sizeof(nSize));
+	nStamp = HashBytes(nStamp, &nModifiedTime, sizeof(nModifiedTime));
+	nStamp = HashBytes(nStamp, &nOffset, sizeof(nOffset));
+	return nStamp ? nStamp : 1;
+}
+
+std::string CAssetIndex::GetKey(EAssetType eType, const std::string& sName)
+{
+	std::string sKey(1, (char)('0' + eType));
+	sKey += sName;
+	std::replace(sKey.begin(), sKey.end(), '\\', '/');
+	std::transform(sKey.begin(), sKey.end(), sKey.begin(), [](unsigned char c) { return (char)tolower(c); });
+	return sKey;
+}
+
+bool CAssetIndex::Load(const std::string& sPath, std::string& sError)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+	m_bDirty = false;
+
+	std::ifstream file(sPath, std::ios::binary);
+	if (!file)
+		return true;
+
+	uint32_t nMagic = 0, nVersion = 0, nColormapSize = 0, nMaterialSize = 0;
+	if (!ReadCacheValue(file, nMagic) || !ReadCacheValue(file, nVersion) || !ReadCacheValue(file, nColormapSize) || !ReadCacheValue(file, nMaterialSize)
+		|| nMagic != kAssetIndexMagic)
+	{
+		sError = "Not an asset index";
+		return false;
+	}
+
+	if (nVersion != kAssetIndexVersion || nColormapSize != sizeof(SColormap) || nMaterialSize != sizeof(SMaterialColor))
+	{
+		sError = "Asset index from another version";
+		return false;
+	}
+
+	uint64_t nNumEntries = 0;
+	bool bOk = ReadCacheValue(file, nNumEntries) && nNumEntries <= kMaxBakeCacheElements;
+	for (uint64_t i = 0; bOk && i < nNumEntries; ++i)
+	{
+		uint32_t nNameLength = 0;
+		uint8_t bHasColormap = 0;
+		bOk = ReadCacheValue(file, nNameLength) && nNameLength <= kMaxAssetNameLength;
+
+		std::string sKey(bOk ? nNameLength : 0, '\0');
+		SEntry entry;
+		bOk = bOk && file.read(&sKey[0], nNameLength)
+			&& ReadCacheValue(file, entry.nStamp)
+			&& ReadCacheValue(file, entry.material)
+			&& ReadCacheValue(file, bHasColormap);
+
+		if (bOk && bHasColormap)
+		{
+			entry.pColormap.reset(new SColormap());
+			bOk = ReadCacheValue(file, *entry.pColormap);
+		}
+
+		if (bOk)
+			m_entries[sKey] = std::move(entry);
+	}
+
+	if (!bOk)
+	{
+		m_entries.clear();
+		sError = "Truncated or broken asset index";
+		return false;
+	}
+	return true;
+}
+
+bool CAssetIndex::Save(const std::string& sPath, std::string& sError)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::ofstream file(sPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		sError = "Failed to open file for writing";
+		return false;
+	}
+
+	WriteCacheValue(file, kAssetIndexMagic);
+	WriteCacheValue(file, kAssetIndexVersion);
+	WriteCacheValue(file, (uint32_t)sizeof(SColormap));
+	WriteCacheValue(file, (uint32_t)sizeof(SMaterialColor));
+
+	WriteCacheValue(file, (uint64_t)m_entries.size());
+	for (const auto& it : m_entries)
+	{
+		const SEntry& entry = it.second;
+		WriteCacheValue(file, (uint32_t)it.first.size());
+		file.write(it.first.data(), it.first.size());
+		WriteCacheValue(file, entry.nStamp);
+		WriteCacheValue(file, entry.material);
+		WriteCacheValue(file, (uint8_t)(entry.pColormap ? 1 : 0));
+		if (entry.pColormap)
+			WriteCacheValue(file, *entry.pColormap);
+	}
+
+	if (!file)
+	{
+		sError = "Failed to write file";
+		return false;
+	}
+	m_bDirty = false;
+	return true;
+}
+
+bool CAssetIndex::Find(SAssetLoad& load) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_entries.find(GetKey(load.eType, load.sName));
+	if (it == m_entries.end() || it->second.nStamp != load.nStamp)
+		return false;
+
+	const SEntry& entry = it->second;
+	if (load.eType == EAsset_Colormap && !entry.pColormap)
+		return false;
+
+	load.bFound = true;
+	load.bLoaded = true;
+	load.material = entry.material;
+	if (entry.pColormap)
+		load.pColormap.reset(new SColormap(*entry.pColormap));
+	return true;
+}
+
+void CAssetIndex::Store(const SAssetLoad& load)
+{
+	// only parsed files, missing and broken ones are looked for again and reported every time
+	if (!load.bLoaded || !load.nStamp)
+		return;
+
+	SEntry entry;
+	entry.nStamp = load.nStamp;
+	entry.material = load.material;
+	if (load.pColormap)
+		entry.pColormap.reset(new SColormap(*load.pColormap));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries[GetKey(load.eType, load.sName)] = std::move(entry);
+	m_bDirty = true;
+}
+
+static void ParseAsset(SAssetLoad& load, const std::vector<uint8_t>& data)
+{
+	if (load.eType == EAsset_Colormap)
+	{
+		load.pColormap.reset(new SColormap());
+		load.bLoaded = ParseColormap(data.data(), data.size(), *load.pColormap, &load.sError);
+		if (!load.bLoaded)
+			load.pColormap.reset();
+	}
+	else
+	{
+		load.bLoaded = ParseMaterialColor(data.data(), data.size(), load.material, &load.sError);
+		if (!load.bLoaded)
+			load.material = SMaterialColor();
+	}
+}
+
+static void RunAssetJobs(CJobSystem* pJobSystem, int nCount, const CJobSystem::RangeFunc& func)
+{
+	if (pJobSystem)
+		pJobSystem->ParallelFor(nCount, 1, func);
+	else
+		func(0, nCount);
+}
+
+void LoadAssets(std::vector<SAssetLoad>& loads, CAssetIndex* pIndex, CJobSystem* pJobSystem, const AssetReadFunc& read, bool bParallelReads)
+{
+	std::vector<SAssetLoad*> misses;
+	for (SAssetLoad& load : loads)
+	{
+		if (!pIndex || !load.nStamp || !pIndex->Find(load))
+			misses.push_back(&load);
+	}
+
+	if (bParallelReads)
+	{
+		RunAssetJobs(pJobSystem, (int)misses.size(), [&](int nBegin, int nEnd)
+		{
+			std::vector<uint8_t> data;
+			for (int i = nBegin; i < nEnd; ++i)
+			{
+				misses[i]->bFound = read(misses[i]->sName, data);
+				if (misses[i]->bFound)
+					ParseAsset(*misses[i], data);
+			}
+		});
+	}
+	else
+	{
+		// every file is read whole in one go, only the parsing is spread over the jobs
+		std::vector<std::vector<uint8_t>> files(misses.size());
+		for (size_t i = 0; i < misses.size(); ++i)
+			misses[i]->bFound = read(misses[i]->sName, files[i]);
+
+		RunAssetJobs(pJobSystem, (int)misses.size(), [&](int nBegin, int nEnd)
+		{
+			for (int i = nBegin; i < nEnd; ++i)
+			{
+				if (misses[i]->bFound)
+					ParseAsset(*misses[i], files[i]);
+			}
+		});
+	}
+
+	if (pIndex)
+	{
+		for (const SAssetLoad* pLoad : misses)
+			pIndex->Store(*pLoad);
+	}
+}
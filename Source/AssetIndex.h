@@ -0,0 +1,86 @@
+#pragma once
+
+// Colormaps and materials of a level resolved in one stage instead of one file at a time while reading the level.
+// The frontends collect the names the level uses, LoadAssets looks them up in the persistent index and reads and parses
+// the files that are left in parallel on the job system.
+// The index (lightbake --asset-index, assets.lbindex in the JED project directory for the plugin) keeps the parsed result
+// of every file keyed by its name and a stamp of its size and modification time, a file that changed gets a new stamp
+// and is read again. Cold starts on levels with hundreds of materials then only look up the stamps.
+// The file stores the structs in their native layout, kAssetIndexVersion changes with them.
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Assets.h"
+
+class CJobSystem;
+
+static constexpr uint32_t kAssetIndexMagic = 0x4941424Cu; // "LBAI"
+static constexpr uint32_t kAssetIndexVersion = 2;
+
+enum EAssetType : uint32_t
+{
+	EAsset_Colormap,
+	EAsset_Material,
+};
+
+// a file to resolve, the frontend fills the type, name and stamp
+struct SAssetLoad
+{
+	EAssetType  eType = EAsset_Material;
+	std::string sName;
+	uint64_t    nStamp = 0;       // see MakeAssetStamp, 0 if the file can't be stamped and bypasses the index
+	bool        bFound = false;   // the file exists
+	bool        bLoaded = false;  // and parsed
+	const char* sError = nullptr; // why parsing failed
+
+	SMaterialColor             material;
+	std::unique_ptr<SColormap> pColormap;
+};
+
+// stamp of a file from its size, modification time and the offset in its container, never 0
+uint64_t MakeAssetStamp(uint64_t nSize, int64_t nModifiedTime, uint64_t nOffset);
+
+// Parsed colormaps and material colors by name and stamp, safe to use from multiple threads
+class CAssetIndex
+{
+public:
+	// a missing file leaves the index empty and isn't an error
+	bool Load(const std::string& sPath, std::string& sError);
+	bool Save(const std::string& sPath, std::string& sError);
+
+	// true if files were stored since the last Load or Save
+	bool IsDirty() const { return m_bDirty; }
+
+	// copies the result of the file to load if the index has it with the same stamp
+	bool Find(SAssetLoad& load) const;
+	void Store(const SAssetLoad& load);
+
+private:
+	struct SEntry
+	{
+		uint64_t                   nStamp = 0;
+		SMaterialColor             material;
+		std::unique_ptr<SColormap> pColormap;
+	};
+
+	// type and lowercase name
+	static std::string GetKey(EAssetType eType, const std::string& sName);
+
+	mutable std::mutex                      m_mutex;
+	std::unordered_map<std::string, SEntry> m_entries;
+	bool                                    m_bDirty = false;
+};
+
+// reads a whole file, false if it doesn't exist
+typedef std::function<bool(const std::string& sName, std::vector<uint8_t>& data)> AssetReadFunc;
+
+// Resolves the loads through the index, then reads and parses the rest and stores them in the index.
+// With bParallelReads read is called from the jobs and has to be thread safe, otherwise the files are read on the
+// calling thread and only parsed in parallel. pIndex and pJobSystem may be null.
+void LoadAssets(std::vector<SAssetLoad>& loads, CAssetIndex* pIndex, CJobSystem* pJobSystem, const AssetReadFunc& read, bool bParallelReads);
@@ -0,0 +1,343 @@
+#include "Assets.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "SimdFloat.h"
+
+float3 SColormap::GetColor(uint32_t nIndex, int nLightLevel) const
+{
+	if (nLightLevel >= 0)
+		nIndex = nLightLevels[nLightLevel * 256 + nIndex];
+
+	float3 fillColor;
+	fillColor.x = (float)colors[nIndex].r / 255.0f;
+	fillColor.y = (float)colors[nIndex].g / 255.0f;
+	fillColor.z = (float)colors[nIndex].b / 255.0f;
+	return fillColor;
+}
+
+bool ParseColormap(const uint8_t* pData, size_t nSize, SColormap& colormap, const char** psError)
+{
+	if (nSize < sizeof(SColormapHeader))
+	{
+		*psError = "Failed to read colormap header";
+		return false;
+	}
+
+	SColormapHeader colormapHeader;
+	memcpy(&colormapHeader, pData, sizeof(SColormapHeader));
+	if (strncmp(colormapHeader.magic, "CMP ", 4) != 0)
+	{
+		*psError = "Bad colormap header";
+		return false;
+	}
+
+	if (colormapHeader.nVersion < 30)
+	{
+		*psError = "Unsupported colormap version";
+		return false;
+	}
+
+	size_t nOffset = sizeof(SColormapHeader);
+	if (nSize < nOffset + sizeof(colormap.colors))
+	{
+		*psError = "Failed to read colors";
+		return false;
+	}
+	memcpy(colormap.colors, pData + nOffset, sizeof(colormap.colors));
+	nOffset += sizeof(colormap.colors);
+
+	if (nSize < nOffset + sizeof(colormap.nLightLevels))
+	{
+		*psError = "Failed to read light levels";
+		return false;
+	}
+	memcpy(colormap.nLightLevels, pData + nOffset, sizeof(colormap.nLightLevels));
+
+	return true;
+}
+
+namespace
+{
+	// bytes of all mipmaps of a texture, every mipmap halves the size of the one before
+	size_t GetTextureDataSize(const SMaterialTextureHeader& texture, uint32_t nBytesPerTexel)
+	{
+		size_t nDataSize = 0;
+		for (uint32_t nMipmap = 0; nMipmap < texture.nNumMipmaps && nMipmap < 32; ++nMipmap)
+			nDataSize += (size_t)std::max(texture.nWidth >> nMipmap, 1u) * std::max(texture.nHeight >> nMipmap, 1u) * nBytesPerTexel;
+		return nDataSize;
+	}
+
+	bool IsValidChannel(uint32_t nBits, uint32_t nShift)
+	{
+		return nBits >= 1 && nBits <= 8 && nShift + nBits <= 16;
+	}
+
+	// counts the palette indices, four histograms so runs of the same index don't wait on each other's increments
+	bool ReducePaletteTexels(const uint8_t* pTexels, size_t nCount, bool bTransparent, SMaterialColor& material)
+	{
+		uint32_t counts[4][256] = {};
+		size_t i = 0;
+		for (; i + 4 <= nCount; i += 4)
+		{
+			++counts[0][pTexels[i + 0]];
+			++counts[1][pTexels[i + 1]];
+			++counts[2][pTexels[i + 2]];
+			++counts[3][pTexels[i + 3]];
+		}
+		for (; i < nCount; ++i)
+			++counts[0][pTexels[i]];
+
+		uint64_t nTotal = 0;
+		uint32_t total[256];
+		for (int nIndex = 0; nIndex < 256; ++nIndex)
+		{
+			total[nIndex] = (bTransparent && nIndex == 0) ? 0 : counts[0][nIndex] + counts[1][nIndex] + counts[2][nIndex] + counts[3][nIndex];
+			nTotal += total[nIndex];
+		}
+		if (nTotal == 0)
+			return false;
+
+		for (int nIndex = 0; nIndex < 256; ++nIndex)
+			material.paletteWeights[nIndex] = (float)((double)total[nIndex] / (double)nTotal);
+		material.eSource = EMaterialColor_Palette;
+		return true;
+	}
+
+	// Counts the values of every channel, the averages follow from the counts so the texels are never decoded to colors.
+	// Texels with an alpha channel only count where they aren't transparent.
+	bool ReduceRgbTexels(const uint8_t* pTexels, size_t nCount, const SColorFormat& format, SMaterialColor& material)
+	{
+		const uint32_t nShifts[4] = { format.nRedShift, format.nGreenShift, format.nBlueShift, format.nAlphaShift };
+		const uint32_t nMasks[4] = { (1u << format.nRedBits) - 1, (1u << format.nGreenBits) - 1, (1u << format.nBlueBits) - 1,
+			format.nAlphaBits ? (1u << format.nAlphaBits) - 1 : 0 };
+		const bool bAlpha = format.nAlphaBits > 0;
+
+		uint32_t counts[3][256] = {};
+		uint64_t nOpaque = 0;
+		size_t i = 0;
+
+#if defined(SIMD_FLOAT_SSE2) || defined(SIMD_FLOAT_AVX2)
+		// eight texels per step, the channels are split off in 16 bit lanes
+		__m128i shifts[4], masks[4];
+		for (int nChannel = 0; nChannel < 4; ++nChannel)
+		{
+			shifts[nChannel] = _mm_cvtsi32_si128((int)nShifts[nChannel]);
+			masks[nChannel] = _mm_set1_epi16((short)nMasks[nChannel]);
+		}
+
+		alignas(16) uint16_t channels[4][8];
+		for (; i + 8 <= nCount; i += 8)
+		{
+			const __m128i texels = _mm_loadu_si128((const __m128i*)(pTexels + i * 2));
+			for (int nChannel = 0; nChannel < 4; ++nChannel)
+				_mm_store_si128((__m128i*)channels[nChannel], _mm_and_si128(_mm_srl_epi16(texels, shifts[nChannel]), masks[nChannel]));
+
+			for (int nLane = 0; nLane < 8; ++nLane)
+			{
+				if (bAlpha && !channels[3][nLane])
+					continue;
+
+				++counts[0][channels[0][nLane]];
+				++counts[1][channels[1][nLane]];
+				++counts[2][channels[2][nLane]];
+				++nOpaque;
+			}
+		}
+#endif
+
+		for (; i < nCount; ++i)
+		{
+			const uint32_t nTexel = pTexels[i * 2] | ((uint32_t)pTexels[i * 2 + 1] << 8);
+			if (bAlpha && !((nTexel >> nShifts[3]) & nMasks[3]))
+				continue;
+
+			++counts[0][(nTexel >> nShifts[0]) & nMasks[0]];
+			++counts[1][(nTexel >> nShifts[1]) & nMasks[1]];
+			++counts[2][(nTexel >> nShifts[2]) & nMasks[2]];
+			++nOpaque;
+		}
+
+		if (nOpaque == 0)
+			return false;
+
+		float average[3], linearAverage[3];
+		for (int nChannel = 0; nChannel < 3; ++nChannel)
+		{
+			double sum = 0.0, linearSum = 0.0;
+			for (uint32_t nValue = 0; nValue <= nMasks[nChannel]; ++nValue)
+			{
+				const float value = (float)nValue / (float)nMasks[nChannel];
+				sum += (double)counts[nChannel][nValue] * value;
+				linearSum += (double)counts[nChannel][nValue] * ToLinear(value);
+			}
+			average[nChannel] = (float)(sum / (double)nOpaque);
+			linearAverage[nChannel] = (float)(linearSum / (double)nOpaque);
+		}
+
+		material.average = { average[0], average[1], average[2] };
+		material.linearAverage = { linearAverage[0], linearAverage[1], linearAverage[2] };
+		material.eSource = EMaterialColor_Rgb;
+		return true;
+	}
+}
+
+bool ParseMaterialColor(const uint8_t* pData, size_t nSize, SMaterialColor& material, const char** psError)
+{
+	material = SMaterialColor();
+	if (nSize < sizeof(SMaterialFileHeader))
+	{
+		*psError = "Failed to read material header";
+		return false;
+	}
+
+	SMaterialFileHeader materialHeader;
+	memcpy(&materialHeader, pData, sizeof(SMaterialFileHeader));
+	if (memcmp(materialHeader.magic, "MAT ", 4u))
+	{
+		*psError = "Bad material header";
+		return false;
+	}
+
+	if (materialHeader.nVersion != 0x32)
+	{
+		*psError = "Unsupported material version";
+		return false;
+	}
+
+	// read the last header (emissive signs and such start at broken, we want the cel with illumination)
+	size_t nOffset = sizeof(SMaterialFileHeader);
+	SMaterialRecordHeader recordHeader;
+	SMaterialRecordHeaderExt recordHeaderExt;
+	for (uint32_t i = 0; i < materialHeader.nRecordCount; ++i)
+	{
+		if (nSize < nOffset + sizeof(SMaterialRecordHeader))
+		{
+			*psError = "Failed to read material record header";
+			return false;
+		}
+		memcpy(&recordHeader, pData + nOffset, sizeof(SMaterialRecordHeader));
+		nOffset += sizeof(SMaterialRecordHeader);
+
+		if (recordHeader.nTextureType & 8)
+		{
+			if (nSize < nOffset + sizeof(SMaterialRecordHeaderExt))
+			{
+				*psError = "Failed to read material texture header";
+				return false;
+			}
+			memcpy(&recordHeaderExt, pData + nOffset, sizeof(SMaterialRecordHeaderExt));
+			nOffset += sizeof(SMaterialRecordHeaderExt);
+		}
+	}
+
+	material.nFillColor = recordHeader.nFillColor;
+
+	// color materials keep the fill color, 16 bit tools don't write an rgb one
+	const SColorFormat& format = materialHeader.colorFormat;
+	const uint32_t nBytesPerTexel = format.nBitsPerPixel / 8;
+	if (!(recordHeader.nTextureType & 8) || recordHeaderExt.nTextureIndex >= materialHeader.nTextureCount)
+		return true;
+
+	if (nBytesPerTexel == 2 && (!IsValidChannel(format.nRedBits, format.nRedShift) || !IsValidChannel(format.nGreenBits, format.nGreenShift)
+		|| !IsValidChannel(format.nBlueBits, format.nBlueShift) || (format.nAlphaBits && !IsValidChannel(format.nAlphaBits, format.nAlphaShift))))
+	{
+		return true;
+	}
+	if (nBytesPerTexel != 1 && nBytesPerTexel != 2)
+		return true;
+
+	// the textures follow each other, skip to the one of the cel, a broken texture falls back to the fill color
+	for (uint32_t nTexture = 0; nTexture <= recordHeaderExt.nTextureIndex; ++nTexture)
+	{
+		SMaterialTextureHeader texture;
+		if (nSize < nOffset + sizeof(SMaterialTextureHeader))
+			return true;
+		memcpy(&texture, pData + nOffset, sizeof(SMaterialTextureHeader));
+		nOffset += sizeof(SMaterialTextureHeader);
+
+		const size_t nDataSize = GetTextureDataSize(texture, nBytesPerTexel);
+		if (texture.nWidth == 0 || texture.nHeight == 0 || texture.nWidth > 0x10000 || texture.nHeight > 0x10000 || nSize - nOffset < nDataSize)
+			return true;
+
+		if (nTexture == recordHeaderExt.nTextureIndex)
+		{
+			const size_t nNumTexels = (size_t)texture.nWidth * texture.nHeight;
+			if (nBytesPerTexel == 1)
+				ReducePaletteTexels(pData + nOffset, nNumTexels, texture.nTransparent != 0, material);
+			else
+				ReduceRgbTexels(pData + nOffset, nNumTexels, format, material);
+			return true;
+		}
+		nOffset += nDataSize;
+	}
+	return true;
+}
+
+void ComputeSurfaceColors(SSurface& surface, const SColormap* pColormap, const SMaterialColor* pMaterial, uint32_t nFillColor, float extraLight,
+	uint32_t nBakeFlags)
+{
+	float3 albedo = { 0.5f,0.5f,0.5f };
+	float3 emissive = { 0,0,0 };
+	if (pColormap)
+	{
+		int emissiveLightLevel = 0;
+
+		// use the light level so we can gracefully go back to 0 and still use regular emissives
+		if (nBakeFlags & ELightBake_ExtraLightEmissive)
+			emissiveLightLevel = int(std::min(std::max(extraLight, 0.0f), 1.0f) * 63.0f);
+
+		const bool bGammaCorrect = (nBakeFlags & ELightBake_GammaCorrect) != 0;
+		if (pMaterial && pMaterial->eSource == EMaterialColor_Palette)
+		{
+			// average of the texel colors, every palette entry is converted before weighting
+			albedo = { 0,0,0 };
+			for (uint32_t nIndex = 0; nIndex < 256; ++nIndex)
+			{
+				const float weight = pMaterial->paletteWeights[nIndex];
+				if (weight <= 0.0f)
+					continue;
+
+				const float3 color = pColormap->GetColor(nIndex, -1);
+				const float3 emissiveColor = pColormap->GetColor(nIndex, emissiveLightLevel);
+				albedo += (bGammaCorrect ? ToLinear(color) : color) * weight;
+				emissive += (bGammaCorrect ? ToLinear(emissiveColor) : emissiveColor) * weight;
+			}
+		}
+		else if (pMaterial && pMaterial->eSource == EMaterialColor_Rgb)
+		{
+			// 16 bit texels have no light table, the light level scales them
+			albedo = bGammaCorrect ? pMaterial->linearAverage : pMaterial->average;
+			emissive = albedo * ((float)emissiveLightLevel / 63.0f);
+		}
+		else
+		{
+			const uint32_t nColor = pMaterial ? pMaterial->nFillColor : nFillColor;
+			albedo = pColormap->GetColor(nColor, -1);
+			emissive = pColormap->GetColor(nColor, emissiveLightLevel);
+			if (bGammaCorrect)
+			{
+				albedo = ToLinear(albedo);
+				emissive = ToLinear(emissive);
+			}
+		}
+
+		// allow the extra light to increase the intensity
+		if (nBakeFlags & ELightBake_ExtraLightEmissive)
+		{
+			emissive.x = std::max(emissive.x, extraLight * emissive.x);
+			emissive.y = std::max(emissive.y, extraLight * emissive.y);
+			emissive.z = std::max(emissive.z, extraLight * emissive.z);
+		}
+	}
+	surface.albedo.x = albedo.x;
+	surface.albedo.y = albedo.y;
+	surface.albedo.z = albedo.z;
+	surface.albedo.w = (albedo.x + albedo.y + albedo.z) / 3.0f;
+
+	surface.emissive.x = emissive.x;
+	surface.emissive.y = emissive.y;
+	surface.emissive.z = emissive.z;
+	surface.emissive.w = (emissive.x + emissive.y + emissive.z) / 3.0f;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+// Portable colormap and material parsing, shared by the plugin (files read through JED) and the command line baker
+
+#include <cstddef>
+#include <cstdint>
+
+#include "BakeTypes.h"
+
+// Minimal colormap support (for reading basic color and light table)
+struct SColormapHeader
+{
+	char    magic[4]; // "CMP "
+	int32_t nVersion;
+	int32_t nFlags;
+	float3  colorTint;
+	int32_t _padding[10];
+};
+
+struct SColormap
+{
+	struct
+	{
+		uint8_t r, g, b;
+	} colors[256];
+	uint8_t nLightLevels[64 * 256];
+
+	float3 GetColor(uint32_t nIndex, int nLightLevel) const;
+};
+
+// Minimal material support (for reading material fill colors)
+struct SColorFormat
+{
+	uint32_t nColorMode = 0;
+	uint32_t nBitsPerPixel = 0;
+	uint32_t nRedBits = 0;
+	uint32_t nGreenBits = 0;
+	uint32_t nBlueBits = 0;
+	uint32_t nRedShift = 0;
+	uint32_t nGreenShift = 0;
+	uint32_t nBlueShift = 0;
+	uint32_t nRedDiff = 0;
+	uint32_t nGreenDiff = 0;
+	uint32_t nBlueDiff = 0;
+	uint32_t nAlphaBits = 0;
+	uint32_t nAlphaShift = 0;
+	uint32_t nAlphaDiff = 0;
+};
+
+struct SMaterialFileHeader
+{
+	uint8_t      magic[4];
+	uint32_t     nVersion = 0;
+	uint32_t     nType = 0;
+	uint32_t     nRecordCount = 0;
+	uint32_t     nTextureCount = 0;
+	SColorFormat colorFormat;
+};
+
+struct SMaterialRecordHeader
+{
+	uint32_t nTextureType = 0;
+	uint32_t nFillColor = 0;
+	uint32_t nUnknown1 = 0;
+	uint32_t nUnknown2 = 0;
+	uint32_t nUnknown3 = 0;
+	uint32_t nUnknown4 = 0;
+};
+
+struct SMaterialRecordHeaderExt
+{
+	uint32_t nUnknown = 0;
+	uint32_t nHeight = 0;
+	uint32_t nTransparentColor = 0;
+	uint32_t nTextureIndex = 0;
+};
+
+// follows the records for every texture, then its mipmaps from the largest down
+struct SMaterialTextureHeader
+{
+	uint32_t nWidth = 0;
+	uint32_t nHeight = 0;
+	uint32_t nTransparent = 0; // palette index 0 is transparent in 8 bit textures
+	uint32_t nPadding[2] = {};
+	uint32_t nNumMipmaps = 0;
+};
+
+// where the bake colors of a material come from
+enum EMaterialColor : uint32_t
+{
+	EMaterialColor_Fill,    // palette index of the last cel, color materials and textures that can't be read
+	EMaterialColor_Palette, // 8 bit texture, looked up in the sector colormap
+	EMaterialColor_Rgb,     // 16 bit texture, averaged per channel
+};
+
+// Colors of a material as the bake uses them, reduced from the texels of the first mipmap of the last cel
+struct SMaterialColor
+{
+	EMaterialColor eSource = EMaterialColor_Fill;
+	uint32_t       nFillColor = 0;
+	float          paletteWeights[256] = {}; // share of the (opaque) texels with every palette index
+	float3         average = { 0,0,0 };      // of the texels as stored
+	float3         linearAverage = { 0,0,0 }; // of the texels converted to linear
+};
+
+// Parse a colormap file already loaded in memory, on failure psError describes the problem
+bool ParseColormap(const uint8_t* pData, size_t nSize, SColormap& colormap, const char** psError);
+
+// Parse the colors of the last cel of a material already loaded in memory, on failure psError describes the problem.
+// 8 and 16 bit textures are averaged without decoding them, a texture that doesn't fit the file falls back to the fill color.
+bool ParseMaterialColor(const uint8_t* pData, size_t nSize, SMaterialColor& material, const char** psError);
+
+// Compute the albedo and emissive colors of a surface from its material (or the fill color without one), same rules for every frontend
+void ComputeSurfaceColors(SSurface& surface, const SColormap* pColormap, const SMaterialColor* pMaterial, uint32_t nFillColor, float extraLight,
+	uint32_t nBakeFlags);
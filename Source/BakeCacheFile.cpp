@@ -0,0 +1,104 @@
+#include "BakeCacheFile.h"
+#include "BakeScheduler.h"
+#include "Hash.h"
+#include "LightCache.h"
+
+#include <fstream>
+
+uint64_t HashBakeResult(const SBakeScene& scene, int nIndirectBounces, const SBakeScheduleSettings& settings)
+{
+	// the final color conversion happens when applying, a cached result works for either setting
+	SLevelInfo levelInfo = scene.levelInfo;
+	levelInfo.nBakeFlags &= ~(ELightBake_GammaCorrect | ELightBake_ToneMap);
+
+	const int nBounces = (levelInfo.nBakeFlags & ELightBake_Indirect) ? nIndirectBounces : 0;
+	const int nBatchRays = settings.nBatchRays;
+
+	uint64_t nHash = kHashSeed;
+	nHash = HashBytes(nHash, &levelInfo, sizeof(levelInfo));
+	nHash = HashBytes(nHash, &nBounces, sizeof(nBounces));
+	nHash = HashBytes(nHash, &nBatchRays, sizeof(nBatchRays));
+	nHash = HashVector(nHash, scene.sectorMasks);
+	nHash = HashVector(nHash, scene.layerMasks);
+	nHash = HashVector(nHash, scene.sectors);
+	nHash = HashVector(nHash, scene.surfaces);
+	nHash = HashVector(nHash, scene.vertices);
+	nHash = HashVector(nHash, scene.lights);
+	nHash = HashVector(nHash, scene.normals);
+
+	// the compact layout interpolates the bounces from the quantized positions
+	if (!scene.vertexCompact.empty())
+		nHash = HashVector(nHash, scene.vertexCompact);
+	return nHash;
+}
+
+std::string GetBakeCachePath(const std::string& sLevelPath)
+{
+	return sLevelPath + ".lbcache";
+}
+
+bool SaveBakeCache(const std::string& sPath, const SBakeCacheResult& result, const CLightCache& lightCache, std::string& sError)
+{
+	std::ofstream file(sPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		sError = "Failed to open file for writing";
+		return false;
+	}
+
+	WriteCacheValue(file, kBakeCacheMagic);
+	WriteCacheValue(file, kBakeCacheVersion);
+	WriteCacheValue(file, (uint32_t)sizeof(SLevelInfo));
+	WriteCacheValue(file, (uint32_t)sizeof(SLight));
+
+	WriteCacheValue(file, result.nResultHash);
+	WriteCacheValue(file, result.levelInfo);
+	WriteCacheValue(file, result.nIndirectBounces);
+	WriteCacheVector(file, result.vertexColors);
+
+	lightCache.Write(file);
+
+	if (!file)
+	{
+		sError = "Failed to write file";
+		return false;
+	}
+	return true;
+}
+
+bool LoadBakeCache(const std::string& sPath, SBakeCacheResult& result, CLightCache& lightCache, std::string& sError)
+{
+	result = SBakeCacheResult();
+	lightCache.Clear();
+
+	std::ifstream file(sPath, std::ios::binary);
+	if (!file)
+	{
+		sError = "Failed to open file";
+		return false;
+	}
+
+	uint32_t nMagic = 0, nVersion = 0, nLevelInfoSize = 0, nLightSize = 0;
+	if (!ReadCacheValue(file, nMagic) || !ReadCacheValue(file, nVersion) || !ReadCacheValue(file, nLevelInfoSize) || !ReadCacheValue(file, nLightSize)
+		|| nMagic != kBakeCacheMagic)
+	{
+		sError = "Not a bake cache file";
+		return false;
+	}
+
+	if (nVersion != kBakeCacheVersion || nLevelInfoSize != sizeof(SLevelInfo) || nLightSize != sizeof(SLight))
+	{
+		sError = "Bake cache from another version";
+		return false;
+	}
+
+	if (!ReadCacheValue(file, result.nResultHash) || !ReadCacheValue(file, result.levelInfo) || !ReadCacheValue(file, result.nIndirectBounces)
+		|| !ReadCacheVector(file, result.vertexColors) || !lightCache.Read(file))
+	{
+		result = SBakeCacheResult();
+		lightCache.Clear();
+		sError = "Truncated or broken bake cache";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// On disk cache of the last finished bake of a level, kept next to the level file (level.jkl.lbcache).
+// It holds the accumulated vertex colors keyed by a hash of the scene and every setting that changes them, reopening an
+// unchanged level applies those without tracing. It also holds the light cache, a level that only differs in its point
+// lights rebakes those lights and the bounces, see CLightCache.
+// The file stores the structs in their native layout, kBakeCacheVersion changes with them.
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "BakeScene.h"
+
+class CLightCache;
+struct SBakeScheduleSettings;
+
+static constexpr uint32_t kBakeCacheMagic = 0x4348424Cu; // "LBHC"
+static constexpr uint32_t kBakeCacheVersion = 1;
+
+// upper bound for the element count of a stored array, guards the allocation against broken files
+static constexpr uint64_t kMaxBakeCacheElements = 1ull << 28;
+
+struct SBakeCacheResult
+{
+	uint64_t            nResultHash = 0;      // HashBakeResult of the bake
+	SLevelInfo          levelInfo = {};       // settings the result was baked with
+	int                 nIndirectBounces = 0;
+	std::vector<float4> vertexColors;         // accumulated colors before ResolveVertexColor
+};
+
+// Hash of everything the final vertex colors depend on, take it before baking (smoothing changes the normals).
+// The tile size and welding don't change the result, the batch size changes the ray sequence of adaptive bakes.
+uint64_t HashBakeResult(const SBakeScene& scene, int nIndirectBounces, const SBakeScheduleSettings& settings);
+
+std::string GetBakeCachePath(const std::string& sLevelPath);
+
+bool SaveBakeCache(const std::string& sPath, const SBakeCacheResult& result, const CLightCache& lightCache, std::string& sError);
+
+// a file from another version or with a broken layout fails, lightCache is cleared then
+bool LoadBakeCache(const std::string& sPath, SBakeCacheResult& result, CLightCache& lightCache, std::string& sError);
+
+// binary helpers shared with CLightCache::Write/Read
+template <typename T>
+inline void WriteCacheValue(std::ostream& file, const T& value)
+{
+	file.write((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+inline bool ReadCacheValue(std::istream& file, T& value)
+{
+	return (bool)file.read((char*)&value, sizeof(T));
+}
+
+template <typename T>
+inline void WriteCacheVector(std::ostream& file, const std::vector<T>& values)
+{
+	WriteCacheValue(file, (uint64_t)values.size());
+	if (!values.empty())
+		file.write((const char*)values.data(), values.size() * sizeof(T));
+}
+
+template <typename T>
+inline bool ReadCacheVector(std::istream& file, std::vector<T>& values)
+{
+	uint64_t nCount = 0;
+	if (!ReadCacheValue(file, nCount) || nCount > kMaxBakeCacheElements)
+		return false;
+
+	values.resize((size_t)nCount);
+	return nCount == 0 || (bool)file.read((char*)values.data(), nCount * sizeof(T));
+}
@@ -1,6 +1,7 @@
 #include "Baking.hlsli"
 
-#define LIGHTS_PER_GROUP 256
+// the sector light lists are short, a smaller group wastes fewer threads
+#define LIGHTS_PER_GROUP 64
 
 groupshared float4 g_sharedAcc[LIGHTS_PER_GROUP];
 
@@ -10,13 +11,16 @@ void main(int3 dispatchThreadID : SV_DispatchThreadID,
 		  int3 groupID          : SV_GroupID)
 {
 	SVertexData vertexData;
-	if (!GetVertexData(vertexData, groupID.x))
+	if (!GetVertexData(vertexData, g_levelInfo.nFirstVertex + groupID.x))
 		return;
 
-	// each thread processes g_levelInfo.nTotalLights / LIGHTS_PER_GROUP lights
+	// each thread processes every LIGHTS_PER_GROUP-th light that can reach the sector of the vertex
+	const uint nFirstEntry = aSectorLightOffsets[vertexData.nSectorIndex];
+	const uint nEndEntry = aSectorLightOffsets[vertexData.nSectorIndex + 1];
 	float4 localAcc = float4(0,0,0,0);
-	for(int nLightIndex = groupThreadID.x; nLightIndex < g_levelInfo.nTotalLights; nLightIndex += LIGHTS_PER_GROUP)
+	for(uint nEntry = nFirstEntry + groupThreadID.x; nEntry < nEndEntry; nEntry += LIGHTS_PER_GROUP)
 	{
+		const int nLightIndex = aSectorLights[nEntry];
 		int nLightSectorIndex = aLights[nLightIndex].nSectorIndex;
 		if (nLightSectorIndex < 0 || (aLights[nLightIndex].nFlags & ELight_Sun) || (aLights[nLightIndex].nFlags & ELight_Sky)) // invalid sector or a sun/sky light
 			continue;
@@ -10,16 +10,26 @@ void main(int3 dispatchThreadID : SV_DispatchThreadID,
 		  int3 groupID          : SV_GroupID)
 {
 	SVertexData vertexData;
-	if (!GetVertexData(vertexData, groupID.x))
+	if (!GetVertexData(vertexData, g_levelInfo.nFirstVertex + groupID.x))
+		return;
+
+	// the adaptive bake is done with this vertex for the pass
+	if (IsSampleConverged(aSampleStats[vertexData.nVertexIndex], aVertexAccumulation[vertexData.nVertexIndex]))
 		return;
 
 	const float3x3 frame = GenerateTangentFrame(vertexData.normal);
 
-	// each thread processes g_levelInfo.nIndirectRays / RAYS_PER_GROUP rays
+	// each thread processes every RAYS_PER_GROUP-th ray of the batch, one ray per block of nRayStride rays
+	const int nRayStride = max(g_levelInfo.nRayStride, 1);
+	const int nRaySet = GetBatchRaySet();
 	float4 localAcc = float4(0,0,0,0);
-	for(int nRayIndex = groupThreadID.x; nRayIndex < g_levelInfo.nIndirectRays; nRayIndex += RAYS_PER_GROUP)
+	for(int nBlock = groupThreadID.x; nBlock * nRayStride < g_levelInfo.nIndirectRays; nBlock += RAYS_PER_GROUP)
 	{
-		float3 rayDir = GenRay(nRayIndex, g_levelInfo.nIndirectRays);
+		const int nRayIndex = GetBatchRayIndex(nBlock);
+		if (nRayIndex >= g_levelInfo.nIndirectRays)
+			continue;
+
+		float3 rayDir = GenRay(nRayIndex, g_levelInfo.nIndirectRays, nRaySet);
 		rayDir = mul(rayDir, frame);
 
 		const float3 rayTarget = kSkyDistance * rayDir + vertexData.vertex;
@@ -54,13 +64,17 @@ void main(int3 dispatchThreadID : SV_DispatchThreadID,
 	// only thread 0 writes final result for this vertex
 	if(groupThreadID.x == 0)
 	{
-		float4 result = g_sharedAcc[0] / (float)g_levelInfo.nIndirectRays;
-		
+		// running mean of the bounce over the batches so far
+		SVertexSampleStats stats = aSampleStats[vertexData.nVertexIndex];
+		const float4 prevMean = stats.mean;
+		AddSampleBatch(stats, g_sharedAcc[0], GetBatchRayCount(g_levelInfo.nIndirectRays));
+		aSampleStats[vertexData.nVertexIndex] = stats;
+
 		// store for next bounce
-		aVertexColorsWrite[vertexData.nVertexIndex] = result;
+		aVertexColorsWrite[vertexData.nVertexIndex] = stats.mean;
 
-		// accumulate this bunce
+		// accumulate this bunce, replacing the estimate of the previous batches
 		float4 prevResult = aVertexAccumulation[vertexData.nVertexIndex];
-		aVertexAccumulation[vertexData.nVertexIndex] = prevResult + result;
+		aVertexAccumulation[vertexData.nVertexIndex] = prevResult + (stats.mean - prevMean);
 	}
 }
\ No newline at end of file
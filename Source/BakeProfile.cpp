@@ -0,0 +1,253 @@
+#include "BakeProfile.h"
+
+#include <cstdio>
+#include <fstream>
+
+// innermost running timer of the thread, nested timers hand their time to it
+static thread_local CScopedBakeTimer* g_pCurrentTimer = nullptr;
+
+void SBakeProfile::Clear()
+{
+	totalSeconds = 0.0;
+	stages.clear();
+}
+
+SBakeStageProfile& SBakeProfile::GetStage(EBakeStage eStage)
+{
+	for (SBakeStageProfile& stage : stages)
+	{
+		if (stage.eStage == eStage)
+			return stage;
+	}
+
+	stages.emplace_back();
+	stages.back().eStage = eStage;
+	return stages.back();
+}
+
+SBakeStageProfile& SBakeProfile::GetPass(EBakePass ePass, int nBounce)
+{
+	for (SBakeStageProfile& stage : stages)
+	{
+		if (stage.eStage == EBakeStage_Pass && stage.ePass == ePass && stage.nBounce == nBounce)
+			return stage;
+	}
+
+	stages.emplace_back();
+	SBakeStageProfile& stage = stages.back();
+	stage.eStage = EBakeStage_Pass;
+	stage.ePass = ePass;
+	stage.nBounce = nBounce;
+	return stage;
+}
+
+const char* GetBakePassName(EBakePass ePass)
+{
+	switch (ePass)
+	{
+	case EBakePass_SmoothNormals: return "smooth_normals";
+	case EBakePass_WeldVertices:  return "weld_vertices";
+	case EBakePass_Sun:           return "sun";
+	case EBakePass_Direct:        return "direct";
+	case EBakePass_SkyEmissive:   return "sky_emissive";
+	case EBakePass_Indirect:      return "indirect";
+	}
+	return "unknown";
+}
+
+std::string GetBakeStageName(const SBakeStageProfile& stage)
+{
+	switch (stage.eStage)
+	{
+	case EBakeStage_Extract:       return "extract";
+	case EBakeStage_Materials:     return "materials";
+	case EBakeStage_BuildScene:    return "build_scene";
+	case EBakeStage_Upload:        return "upload";
+	case EBakeStage_ChangedLights: return "changed_lights";
+	case EBakeStage_Workers:       return "workers";
+	case EBakeStage_Readback:      return "readback";
+	case EBakeStage_Writeback:     return "writeback";
+	case EBakeStage_CacheFile:     return "cache_file";
+	case EBakeStage_Lightmap:      return "lightmap";
+	case EBakeStage_Probes:        return "probes";
+	case EBakeStage_Pass:
+		if (stage.ePass == EBakePass_Indirect)
+			return "indirect_" + std::to_string(stage.nBounce + 1);
+		return GetBakePassName(stage.ePass);
+	}
+	return "unknown";
+}
+
+std::string FormatBakeStage(const SBakeStageProfile& stage)
+{
+	char line[256];
+	int nLength = snprintf(line, sizeof(line), "%-16s %9.3f s", GetBakeStageName(stage).c_str(), stage.seconds);
+	if (stage.gpuSeconds >= 0.0)
+		nLength += snprintf(line + nLength, sizeof(line) - nLength, ", GPU %.3f s", stage.gpuSeconds);
+
+	const STraceCounters& counters = stage.counters;
+	if (counters.nRays > 0)
+	{
+		const double seconds = stage.gpuSeconds >= 0.0 ? stage.gpuSeconds : stage.seconds;
+		nLength += snprintf(line + nLength, sizeof(line) - nLength, ", %lld rays (%.2f M/s)",
+			(long long)counters.nRays, seconds > 0.0 ? (double)counters.nRays / seconds * 1e-6 : 0.0);
+		if (stage.bCountedHops)
+		{
+			snprintf(line + nLength, sizeof(line) - nLength, ", %.2f adjoins per ray, %lld cut off at the recursion limit",
+				counters.GetAverageHops(), (long long)counters.nMaxRecursionRays);
+		}
+	}
+	return line;
+}
+
+std::string GetBakeProfilePath(const std::string& sLevelPath)
+{
+	return sLevelPath + ".lbprofile.csv";
+}
+
+static bool IsCsvPath(const std::string& sPath)
+{
+	return sPath.size() >= 4 && sPath.compare(sPath.size() - 4, 4, ".csv") == 0;
+}
+
+static void WriteCsv(std::ofstream& file, const std::vector<SBakeProfile>& profiles)
+{
+	file << "level,stage,calls,seconds,gpu_seconds,rays,adjoin_hops,max_recursion_rays\n";
+	for (const SBakeProfile& profile : profiles)
+	{
+		for (const SBakeStageProfile& stage : profile.stages)
+		{
+			char line[512];
+			snprintf(line, sizeof(line), "\"%s\",%s,%d,%.6f,", profile.sLevel.c_str(), GetBakeStageName(stage).c_str(), stage.nCalls, stage.seconds);
+			file << line;
+
+			// empty cells for what wasn't measured
+			if (stage.gpuSeconds >= 0.0)
+			{
+				snprintf(line, sizeof(line), "%.6f", stage.gpuSeconds);
+				file << line;
+			}
+			file << ',' << stage.counters.nRays << ',';
+			if (stage.bCountedHops)
+				file << stage.counters.nAdjoinHops << ',' << stage.counters.nMaxRecursionRays;
+			else
+				file << ',';
+			file << '\n';
+		}
+		char line[512];
+		snprintf(line, sizeof(line), "\"%s\",total,1,%.6f,,,,\n", profile.sLevel.c_str(), profile.totalSeconds);
+		file << line;
+	}
+}
+
+static void WriteJson(std::ofstream& file, const std::vector<SBakeProfile>& profiles)
+{
+	file << "{\n  \"levels\": [";
+	for (size_t nProfile = 0; nProfile < profiles.size(); ++nProfile)
+	{
+		const SBakeProfile& profile = profiles[nProfile];
+
+		char line[512];
+		snprintf(line, sizeof(line), "%s\n    {\n      \"level\": \"%s\",\n      \"seconds\": %.6f,\n      \"stages\": [",
+			nProfile ? "," : "", profile.sLevel.c_str(), profile.totalSeconds);
+		file << line;
+
+		for (size_t nStage = 0; nStage < profile.stages.size(); ++nStage)
+		{
+			const SBakeStageProfile& stage = profile.stages[nStage];
+			snprintf(line, sizeof(line), "%s\n        { \"stage\": \"%s\", \"calls\": %d, \"seconds\": %.6f",
+				nStage ? "," : "", GetBakeStageName(stage).c_str(), stage.nCalls, stage.seconds);
+			file << line;
+
+			if (stage.gpuSeconds >= 0.0)
+			{
+				snprintf(line, sizeof(line), ", \"gpu_seconds\": %.6f", stage.gpuSeconds);
+				file << line;
+			}
+			if (stage.counters.nRays > 0)
+			{
+				snprintf(line, sizeof(line), ", \"rays\": %lld", (long long)stage.counters.nRays);
+				file << line;
+			}
+			if (stage.bCountedHops && stage.counters.nRays > 0)
+			{
+				snprintf(line, sizeof(line), ", \"adjoin_hops_per_ray\": %.4f, \"max_recursion_rays\": %lld",
+					stage.counters.GetAverageHops(), (long long)stage.counters.nMaxRecursionRays);
+				file << line;
+			}
+			file << " }";
+		}
+		file << "\n      ]\n    }";
+	}
+	file << "\n  ]\n}\n";
+}
+
+bool SaveBakeProfiles(const std::string& sPath, const std::vector<SBakeProfile>& profiles, std::string& sError)
+{
+	std::ofstream file(sPath, std::ios::trunc);
+	if (!file)
+	{
+		sError = "Failed to open file for writing";
+		return false;
+	}
+
+	if (IsCsvPath(sPath))
+		WriteCsv(file, profiles);
+	else
+		WriteJson(file, profiles);
+
+	if (!file)
+	{
+		sError = "Failed to write file";
+		return false;
+	}
+	return true;
+}
+
+CScopedBakeTimer::CScopedBakeTimer(SBakeProfile* pProfile, EBakeStage eStage)
+	: m_pProfile(pProfile)
+	, m_eStage(eStage)
+{
+	Start();
+}
+
+CScopedBakeTimer::CScopedBakeTimer(SBakeProfile* pProfile, EBakePass ePass, int nBounce)
+	: m_pProfile(pProfile)
+	, m_eStage(EBakeStage_Pass)
+	, m_ePass(ePass)
+	, m_nBounce(nBounce)
+{
+	Start();
+}
+
+void CScopedBakeTimer::Start()
+{
+	if (!m_pProfile)
+		return;
+
+	// the entry is made up front so the stages stay in the order they started
+	if (m_eStage == EBakeStage_Pass)
+		m_pProfile->GetPass(m_ePass, m_nBounce);
+	else
+		m_pProfile->GetStage(m_eStage);
+
+	m_pOuter = g_pCurrentTimer;
+	g_pCurrentTimer = this;
+	m_startTime = std::chrono::high_resolution_clock::now();
+}
+
+CScopedBakeTimer::~CScopedBakeTimer()
+{
+	if (!m_pProfile)
+		return;
+
+	const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - m_startTime;
+	g_pCurrentTimer = m_pOuter;
+	if (m_pOuter)
+		m_pOuter->m_nestedSeconds += elapsed.count();
+
+	// looked up again, the stages can grow while the timer runs
+	SBakeStageProfile& stage = (m_eStage == EBakeStage_Pass) ? m_pProfile->GetPass(m_ePass, m_nBounce) : m_pProfile->GetStage(m_eStage);
+	stage.seconds += elapsed.count() - m_nestedSeconds;
+	++stage.nCalls;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// Where a bake spends its time: wall clock time per stage of the bake (reading the level, loading materials, uploading,
+// every pass and every indirect bounce, reading the result back and writing it to the level), the GPU time of the passes
+// that ran on the GPU and the rays the CPU tracer traced in them.
+// Stages are timed with CScopedBakeTimer. Times are exclusive, a stage timed inside another one (the materials loaded
+// while reading the level) is taken out of the outer stage, so the stages add up to the time of the bake.
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "BakeScheduler.h"
+
+enum EBakeStage
+{
+	EBakeStage_Extract,       // reading the level (or scene file) into the snapshot
+	EBakeStage_Materials,     // colormaps and materials loaded while reading the level
+	EBakeStage_BuildScene,    // BuildBakeScene, the sector bvhs and light lists
+	EBakeStage_Upload,        // scene buffers to the GPU
+	EBakeStage_ChangedLights, // light cache update of the changed point lights
+	EBakeStage_Pass,          // a pass of the bake, every indirect bounce is its own stage
+	EBakeStage_Workers,       // a distributed bake, the passes run on the workers
+	EBakeStage_Readback,      // results from the GPU, also for the previews
+	EBakeStage_Writeback,     // colors and sector ambient to the level, also for the previews
+	EBakeStage_CacheFile,     // bake cache file
+	EBakeStage_Lightmap,      // texels of the lightmap atlas (lightbake --lightmap)
+	EBakeStage_Probes,        // sector probes for the ambient
+};
+
+struct SBakeStageProfile
+{
+	EBakeStage     eStage = EBakeStage_Extract;
+	EBakePass      ePass = EBakePass_SmoothNormals; // of EBakeStage_Pass
+	int            nBounce = 0;
+	int            nCalls = 0;        // timed scopes added up in this stage
+	double         seconds = 0.0;     // wall clock, without the stages timed inside it
+	double         gpuSeconds = -1.0; // timestamp queries of the work items, negative if nothing ran on the GPU
+	STraceCounters counters;
+	bool           bCountedHops = false; // counters come from the CPU tracer, the GPU only counts the rays of the ray passes
+
+	void AddGpuSeconds(double value) { gpuSeconds = (gpuSeconds < 0.0 ? 0.0 : gpuSeconds) + value; }
+};
+
+struct SBakeProfile
+{
+	std::string                    sLevel;
+	double                         totalSeconds = 0.0;
+	std::vector<SBakeStageProfile> stages; // in the order they first ran
+
+	void Clear();
+
+	// the entry of a stage or pass, added on first use
+	SBakeStageProfile& GetStage(EBakeStage eStage);
+	SBakeStageProfile& GetPass(EBakePass ePass, int nBounce);
+};
+
+const char* GetBakePassName(EBakePass ePass);
+
+// "sun", "indirect_2" for the second bounce, "materials", ...
+std::string GetBakeStageName(const SBakeStageProfile& stage);
+
+// one line per stage for the message pane or the console
+std::string FormatBakeStage(const SBakeStageProfile& stage);
+
+// <level>.lbprofile.csv next to the level, where the plugin writes the profile of its last bake
+std::string GetBakeProfilePath(const std::string& sLevelPath);
+
+// the profiles of one or more levels, as CSV if the path ends in .csv and JSON otherwise
+bool SaveBakeProfiles(const std::string& sPath, const std::vector<SBakeProfile>& profiles, std::string& sError);
+
+// Adds the time until it goes out of scope to a stage of the profile, does nothing without a profile.
+// The time of timers nested on the same thread is taken out of this one.
+class CScopedBakeTimer
+{
+public:
+	CScopedBakeTimer(SBakeProfile* pProfile, EBakeStage eStage);
+	CScopedBakeTimer(SBakeProfile* pProfile, EBakePass ePass, int nBounce);
+	~CScopedBakeTimer();
+
+	CScopedBakeTimer(const CScopedBakeTimer&) = delete;
+	CScopedBakeTimer& operator=(const CScopedBakeTimer&) = delete;
+
+private:
+	void Start();
+
+	SBakeProfile*     m_pProfile;
+	EBakeStage        m_eStage;
+	EBakePass         m_ePass = EBakePass_SmoothNormals;
+	int               m_nBounce = 0;
+	double            m_nestedSeconds = 0.0;
+	CScopedBakeTimer* m_pOuter = nullptr;
+	std::chrono::high_resolution_clock::time_point m_startTime;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+// CPU side copy of everything the bake passes read, this is what gets uploaded to the GPU or traced by the CPU baker
+
+#include <cmath>
+#include <vector>
+
+#include "BakeTypes.h"
+
+struct SBakeScene
+{
+	SLevelInfo            levelInfo = {};
+
+	std::vector<uint32_t> sectorMasks;
+	std::vector<uint32_t> layerMasks;
+	std::vector<SSector>  sectors;
+	std::vector<SSurface> surfaces;
+	std::vector<SVertex>  vertices;
+	std::vector<SLight>   lights;
+	std::vector<int4>     normals;
+
+	// light samples of the emissive surfaces, see BuildEmissiveSurfaces
+	std::vector<SEmissiveSurface> emissiveSurfaces;    // ascending power CDF
+	std::vector<float>            emissiveTriangleCdf; // per fan triangle the area of it and the previous ones over the surface area
+
+	// tracing acceleration, see BuildSectorBvhs
+	std::vector<float4>   edgePlanes;  // one per surface vertex, xyz = cross(normal, next - vertex), w = dot(xyz, vertex)
+	std::vector<SBvhNode> bvhNodes;
+	std::vector<uint32_t> bvhSurfaces; // surface indices referenced by the leaves, ascending within a leaf
+
+	// sector to sector visibility, see BuildSectorVisibility
+	std::vector<uint32_t> sectorVisibilityOffsets; // per sector the first byte of its row, one more entry at the end
+	std::vector<uint8_t>  sectorVisibility;        // run length compressed bitsets of the sectors each sector can see
+
+	// direct light culling, see BuildSectorLightLists
+	std::vector<uint32_t> sectorLightOffsets; // per sector the first entry in sectorLights, one more entry at the end
+	std::vector<uint32_t> sectorLights;       // the point lights that can reach each sector, ascending per sector
+
+	// per vertex the vertex traced in its place (itself if it's traced), empty traces every vertex, see BuildVertexWelds
+	std::vector<uint32_t> vertexWelds;
+
+	// optional compact copy of what the tracer reads, see BuildCompactLayout, empty traces the arrays above
+	std::vector<SSurfaceHot>    surfaceHot;
+	std::vector<SSurfaceCold>   surfaceCold;
+	std::vector<SVertexCompact> vertexCompact;
+	std::vector<float4>         sectorQuantization; // xyz the sector center, w the size of a quantization step
+
+	void Clear()
+	{
+		levelInfo = {};
+		sectorMasks.clear();
+		layerMasks.clear();
+		sectors.clear();
+		surfaces.clear();
+		vertices.clear();
+		lights.clear();
+		normals.clear();
+		emissiveSurfaces.clear();
+		emissiveTriangleCdf.clear();
+		edgePlanes.clear();
+		bvhNodes.clear();
+		bvhSurfaces.clear();
+		sectorVisibilityOffsets.clear();
+		sectorVisibility.clear();
+		sectorLightOffsets.clear();
+		sectorLights.clear();
+		vertexWelds.clear();
+		surfaceHot.clear();
+		surfaceCold.clear();
+		vertexCompact.clear();
+		sectorQuantization.clear();
+	}
+};
+
+// Number of 32 bit buckets needed for a bitmask of nCount bits, never empty so it can always be bound/tested
+inline uint32_t GetMaskBucketCount(int nCount)
+{
+	return nCount > 0 ? (uint32_t)((nCount + 31) / 32) : 1u;
+}
+
+// Test if a bit is in the bitmask
+inline bool TestMaskBit(const uint32_t* paMasks, int nIndex)
+{
+	const uint32_t nBucketIndex = nIndex / 32u;
+	const uint32_t nBucketPlace = nIndex % 32u;
+	return (paMasks[nBucketIndex] & (1u << nBucketPlace));
+}
+
+// Set a bit in the bitmask
+inline void SetMaskBit(uint32_t* paMasks, int nIndex)
+{
+	const uint32_t nBucketIndex = nIndex / 32u;
+	const uint32_t nBucketPlace = nIndex % 32u;
+	paMasks[nBucketIndex] |= 1u << nBucketPlace;
+}
+
+// Converts an accumulated vertex color to the value stored in the level (optional tone mapping and gamma)
+inline float4 ResolveVertexColor(float4 color, uint32_t nBakeFlags)
+{
+	if (nBakeFlags & ELightBake_ToneMap)
+	{
+		float a = 2.51f;
+		float b = 0.03f;
+		float c = 2.43f;
+		float d = 0.59f;
+		float e = 0.14f;
+		color = ((color * (a * color + b)) / (color * (c * color + d) + e));
+	}
+
+	if (nBakeFlags & ELightBake_GammaCorrect)
+		color = ToSRGB(color);
+
+	return color;
+}
+
+// Levels store light values with 4 decimals, a writeback leaves values alone that would be stored the same
+inline bool IsSameStoredLight(float a, float b)
+{
+	return std::lround(a * 10000.0f) == std::lround(b * 10000.0f);
+}
+
+inline bool IsSameStoredLight(const float4& a, const float4& b)
+{
+	return IsSameStoredLight(a.x, b.x) && IsSameStoredLight(a.y, b.y) && IsSameStoredLight(a.z, b.z) && IsSameStoredLight(a.w, b.w);
+}
@@ -0,0 +1,215 @@
+#include "BakeScheduler.h"
+
+#include <algorithm>
+
+void CBakeScheduler::Begin(const SLevelInfo& levelInfo, int nIndirectBounces, const SBakeScheduleSettings& settings)
+{
+	m_items.clear();
+	m_nNextItem = 0;
+	m_nTotalVertices = levelInfo.nTotalVertices;
+	m_nFirstVertex = std::clamp(settings.nFirstVertex, 0, m_nTotalVertices);
+	m_nEndVertex = (settings.nEndVertex > 0) ? std::clamp(settings.nEndVertex, m_nFirstVertex, m_nTotalVertices) : m_nTotalVertices;
+	const int nRangeVertices = m_nEndVertex - m_nFirstVertex;
+	m_nTileVertices = (settings.nTileVertices > 0 && settings.nTileVertices < nRangeVertices) ? settings.nTileVertices : std::max(nRangeVertices, 1);
+	m_nBatchRays = settings.nBatchRays;
+	m_bAdaptive = (levelInfo.nBakeFlags & ELightBake_Adaptive) != 0;
+	if (m_bAdaptive)
+	{
+		// kAdaptiveMinBatches batches fit in the rays a vertex traces before it can stop
+		if (m_nBatchRays <= 0)
+			m_nBatchRays = kDefaultAdaptiveBatchRays;
+		m_nBatchRays = std::clamp(levelInfo.nMinAdaptiveRays / kAdaptiveMinBatches, 1, m_nBatchRays);
+	}
+	m_totalCost = 0.0;
+	m_doneCost = 0.0;
+	m_bCancelled = false;
+
+	if (m_nTotalVertices <= 0)
+		return;
+
+	const uint32_t nBakeFlags = levelInfo.nBakeFlags;
+
+	// a smoothing angle of 0 can't match anything, smoothing isn't split since vertices read their neighbours
+	if (levelInfo.normalSmoothCos < 1.0f)
+	{
+		const SBakeWorkItem item = { EBakePass_SmoothNormals, 0, 0, m_nTotalVertices, 0, 1 };
+		m_items.push_back({ item, (double)m_nTotalVertices, (int)m_items.size(), 1, 1, 0 });
+	}
+
+	// the welds depend on the smoothed normals
+	if (settings.bWeldVertices)
+	{
+		const SBakeWorkItem item = { EBakePass_WeldVertices, 0, 0, m_nTotalVertices, 0, 1 };
+		m_items.push_back({ item, (double)m_nTotalVertices, (int)m_items.size(), 1, 1, 0 });
+	}
+
+	if (nBakeFlags & ELightBake_Sun)
+		AddPass(EBakePass_Sun, 0, 1, 1.0);
+
+	if (nBakeFlags & ELightBake_Lights)
+		AddPass(EBakePass_Direct, 0, 1, levelInfo.nTotalLights > 1 ? (double)levelInfo.nTotalLights : 1.0);
+
+	if ((nBakeFlags & ELightBake_Sky) || (nBakeFlags & ELightBake_Emissive))
+		AddPass(EBakePass_SkyEmissive, 0, levelInfo.nSkyEmissiveRays, 1.0);
+
+	if (nBakeFlags & ELightBake_Indirect)
+	{
+		for (int nBounce = 0; nBounce < nIndirectBounces; ++nBounce)
+			AddPass(EBakePass_Indirect, nBounce, levelInfo.nIndirectRays, 1.0);
+	}
+
+	for (const SPlannedItem& planned : m_items)
+		m_totalCost += planned.cost;
+}
+
+// Ray offsets of the batches in bit reversed order (leaving out the ones past the stride). Any number of batches from
+// the start of a pass is spread evenly over every block of rays, an adaptive pass that stops early still covers the
+// whole hemisphere and not only the first rays of each block.
+static void GetBatchOffsets(int nBatches, std::vector<int>& offsets)
+{
+	int nBits = 0;
+	while ((1 << nBits) < nBatches)
+		++nBits;
+
+	offsets.clear();
+	for (uint32_t nIndex = 0; nIndex < (1u << nBits); ++nIndex)
+	{
+		uint32_t nReversed = 0;
+		for (int nBit = 0; nBit < nBits; ++nBit)
+			nReversed |= ((nIndex >> nBit) & 1u) << (nBits - 1 - nBit);
+		if (nReversed < (uint32_t)nBatches)
+			offsets.push_back((int)nReversed);
+	}
+}
+
+void CBakeScheduler::AddPass(EBakePass ePass, int nBounce, int nNumRays, double costPerVertex)
+{
+	const bool bHemisphere = (ePass == EBakePass_SkyEmissive) || (ePass == EBakePass_Indirect);
+
+	// every batch needs at least one ray
+	int nBatches = 1;
+	if (bHemisphere && m_nBatchRays > 0 && nNumRays > m_nBatchRays)
+		nBatches = (nNumRays + m_nBatchRays - 1) / m_nBatchRays;
+
+	// an adaptive pass plans every ray set and stops once its budget is used up
+	const bool bBudget = bHemisphere && m_bAdaptive;
+	const int nRaySets = bBudget ? kAdaptiveMaxRayScale : 1;
+
+	std::vector<int> batchOffsets;
+	GetBatchOffsets(nBatches, batchOffsets);
+
+	const int nNumTiles = (m_nEndVertex - m_nFirstVertex + m_nTileVertices - 1) / m_nTileVertices;
+	const int nPassFirstItem = (int)m_items.size();
+	for (int nRaySet = 0; nRaySet < nRaySets; ++nRaySet)
+	{
+		for (int nBatchOffset : batchOffsets)
+		{
+			const int nBatchRays = bHemisphere ? GetBatchRayCount(nNumRays, nBatchOffset, nBatches) : 1;
+			for (int nTile = 0; nTile < nNumTiles; ++nTile)
+			{
+				const int nFirstVertex = m_nFirstVertex + nTile * m_nTileVertices;
+				const int nNumVertices = (m_nEndVertex - nFirstVertex < m_nTileVertices) ? m_nEndVertex - nFirstVertex : m_nTileVertices;
+				const SBakeWorkItem item = { ePass, nBounce, nFirstVertex, nNumVertices, nRaySet * nBatches + nBatchOffset, nBatches };
+				m_items.push_back({ item, (double)nNumVertices * nBatchRays * costPerVertex, nPassFirstItem, nRaySets * nBatches * nNumTiles,
+					nBatchRays, bBudget ? nNumRays : 0 });
+			}
+		}
+	}
+}
+
+void EnableAdaptiveRays(SLevelInfo& levelInfo, float threshold)
+{
+	// a vertex traces at least a share of the selected rays of the smaller pass before it can stop
+	int nMinRays = levelInfo.nSkyEmissiveRays;
+	if (levelInfo.nIndirectRays > 0 && (nMinRays <= 0 || levelInfo.nIndirectRays < nMinRays))
+		nMinRays = levelInfo.nIndirectRays;
+
+	levelInfo.nBakeFlags |= ELightBake_Adaptive;
+	levelInfo.adaptiveThreshold = threshold;
+	levelInfo.nMinAdaptiveRays = std::max(nMinRays / kAdaptiveMaxRayScale, 1);
+}
+
+void SRayPassStats::Add(const SVertexSampleStats* paStats, int nNumVertices)
+{
+	for (int nVertexIndex = 0; nVertexIndex < nNumVertices; ++nVertexIndex)
+	{
+		if (paStats[nVertexIndex].nRays <= 0)
+			continue;
+
+		nRays += paStats[nVertexIndex].nRays;
+		++nVertices;
+	}
+}
+
+bool CBakeScheduler::Step(IBakeBackend& backend)
+{
+	if (m_bCancelled || IsDone())
+		return false;
+
+	const SPlannedItem& planned = m_items[m_nNextItem];
+	const SBakeWorkItem& item = planned.item;
+	if (m_nNextItem == planned.nPassFirstItem)
+	{
+		backend.BeginPass(item.ePass, item.nBounce);
+		m_nPassBudget = -1;
+		m_nPassRays = 0;
+		m_nPassMaxRays = 0;
+		m_nRaysSinceCount = 0;
+		m_nActiveVertices = m_nEndVertex - m_nFirstVertex;
+	}
+	else if (planned.nBudgetRays > 0 && item.nFirstVertex == m_nFirstVertex && IsOverRayBudget(backend, planned))
+	{
+		// the rest of the pass is left out
+		const int nPassEndItem = planned.nPassFirstItem + planned.nPassNumItems;
+		for (; m_nNextItem < nPassEndItem; ++m_nNextItem)
+			m_doneCost += m_items[m_nNextItem].cost;
+
+		backend.EndPass(item.ePass, item.nBounce);
+		return !m_bCancelled && !IsDone();
+	}
+
+	backend.Run(item);
+	m_doneCost += planned.cost;
+	++m_nNextItem;
+
+	if (m_nNextItem == planned.nPassFirstItem + planned.nPassNumItems)
+		backend.EndPass(item.ePass, item.nBounce);
+
+	return !m_bCancelled && !IsDone();
+}
+
+bool CBakeScheduler::IsOverRayBudget(IBakeBackend& backend, const SPlannedItem& planned)
+{
+	// upper bound of the rays traced so far, the count is only read back once the next batch could go over the budget
+	const int nLastBatchRays = m_items[m_nNextItem - 1].nBatchRays;
+	m_nRaysSinceCount += nLastBatchRays;
+	m_nPassMaxRays += (int64_t)nLastBatchRays * m_nActiveVertices;
+	if (m_nPassBudget >= 0 && m_nPassMaxRays + (int64_t)planned.nBatchRays * m_nActiveVertices <= m_nPassBudget)
+		return false;
+
+	// only converged vertices drop out, so the average over the batches since the last count is an upper bound of the
+	// vertices still tracing. Nothing converges in the first batch, its vertices set the budget.
+	const int64_t nPassRays = backend.GetPassRays();
+	m_nActiveVertices = (nPassRays - m_nPassRays + m_nRaysSinceCount - 1) / m_nRaysSinceCount;
+	if (m_nPassBudget < 0)
+		m_nPassBudget = m_nActiveVertices * planned.nBudgetRays;
+
+	m_nPassRays = nPassRays;
+	m_nPassMaxRays = nPassRays;
+	m_nRaysSinceCount = 0;
+	return m_nActiveVertices == 0 || nPassRays + (int64_t)planned.nBatchRays * m_nActiveVertices > m_nPassBudget;
+}
+
+void CBakeScheduler::Run(IBakeBackend& backend)
+{
+	while (Step(backend))
+		;
+}
+
+float CBakeScheduler::GetProgress() const
+{
+	if (m_totalCost <= 0.0)
+		return IsDone() ? 1.0f : 0.0f;
+
+	return (float)(m_doneCost / m_totalCost);
+}
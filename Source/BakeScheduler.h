@@ -0,0 +1,200 @@
+#pragma once
+
+// Splits a bake into small work items so it can run progressively. The vertex passes go over tiles of vertices and the
+// ray passes (sky/emissive and every indirect bounce) are also split into ray batches, every batch is an evenly spread
+// subset of the hemisphere (see GetBatchRayIndex). All tiles of a batch run before the next batch, so the whole level
+// converges together. The ray passes keep a running mean per vertex (SVertexSampleStats), so the accumulation is a
+// usable preview after every batch and the adaptive bake can stop converged vertices early.
+// The scheduler only decides the order, a backend (the compute shaders of the plugin, or CCpuBakeBackend) runs the items.
+// Between items the caller can update a preview, report progress or cancel.
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "BakeTypes.h"
+
+enum EBakePass
+{
+	EBakePass_SmoothNormals,
+	EBakePass_WeldVertices, // BuildVertexWelds with the final normals, runs on the CPU for both backends
+	EBakePass_Sun,
+	EBakePass_Direct,
+	EBakePass_SkyEmissive,
+	EBakePass_Indirect,
+};
+
+static constexpr int kNumBakePasses = EBakePass_Indirect + 1;
+
+struct SBakeWorkItem
+{
+	EBakePass ePass;
+	int       nBounce;      // indirect bounce, 0 for the other passes
+	int       nFirstVertex;
+	int       nNumVertices;
+	int       nRayOffset;   // ray batch of the item, plus nRayStride times the ray set (see GetBatchRaySet)
+	int       nRayStride;   // number of ray batches of the pass, 1 for the passes without hemisphere rays
+};
+
+// The rays of a pass are split into blocks of nRayStride consecutive rays, a batch takes one ray of every block and
+// shifts by one ray per block. GenRay spreads consecutive rays in elevation and picks the azimuth from the low bits of
+// the ray index, so taking every n-th ray would only cover a wedge of the hemisphere while this covers all of it.
+// Mirrored in Baking.hlsli.
+inline int GetBatchRayIndex(int nBlock, int nRayOffset, int nRayStride)
+{
+	return nBlock * nRayStride + (nRayOffset + nBlock) % nRayStride;
+}
+
+// number of rays of a batch, only the last block can be partial
+inline int GetBatchRayCount(int nNumRays, int nRayOffset, int nRayStride)
+{
+	const int nFullBlocks = nNumRays / nRayStride;
+	return nFullBlocks + (((nRayOffset + nFullBlocks) % nRayStride < nNumRays % nRayStride) ? 1 : 0);
+}
+
+// An adaptive pass traces the rays again for the vertices that haven't converged, set n > 0 shifts the ray pattern (see
+// GenRay) so it doesn't repeat the same rays. Mirrored in Baking.hlsli.
+inline int GetBatchRaySet(int nRayOffset, int nRayStride)
+{
+	return nRayOffset / nRayStride;
+}
+
+// The adaptive bake traces up to kAdaptiveMaxRayScale sets of the selected rays for noisy vertices. The selected rays
+// times the traced vertices are the budget of a pass: converged vertices stop and leave their share to the noisy ones, the
+// pass ends before a batch that could go over the budget.
+static constexpr int   kAdaptiveMaxRayScale = 4;
+static constexpr float kDefaultAdaptiveThreshold = 0.004f;
+
+// largest batch of an adaptive bake that doesn't ask for batches, it needs several to estimate the variance. The batches
+// are made smaller for small ray counts so kAdaptiveMinBatches of them fit in the rays a vertex traces before it can stop.
+static constexpr int kDefaultAdaptiveBatchRays = 16;
+
+// z value of the 95% confidence interval, the absolute error that's always good enough (for dark vertices) and the
+// batches needed before the variance between them is worth anything
+static constexpr float kAdaptiveConfidence = 1.96f;
+static constexpr float kAdaptiveTolerance = 0.001f;
+static constexpr int   kAdaptiveMinBatches = 4;
+
+// turns on the adaptive bake for the ray counts in levelInfo, threshold is the relative error a vertex stops at
+void EnableAdaptiveRays(SLevelInfo& levelInfo, float threshold);
+
+// rays per vertex traced by a ray pass, for the average rays per vertex of the adaptive bake
+struct SRayPassStats
+{
+	int64_t nRays = 0;
+	int64_t nVertices = 0; // vertices that traced rays, counted again for every bounce
+
+	void Add(const SVertexSampleStats* paStats, int nNumVertices);
+	float GetAverageRays() const { return nVertices > 0 ? (float)nRays / (float)nVertices : 0.0f; }
+};
+
+// Rays traced by a pass and the adjoins they crossed, summed per range of vertices and then per pass (see CountRay)
+struct STraceCounters
+{
+	int64_t nRays = 0;
+	int64_t nAdjoinHops = 0;
+	int64_t nMaxRecursionRays = 0; // rays cut off by kMaxRecursion
+
+	STraceCounters& operator+=(const STraceCounters& other)
+	{
+		nRays += other.nRays;
+		nAdjoinHops += other.nAdjoinHops;
+		nMaxRecursionRays += other.nMaxRecursionRays;
+		return *this;
+	}
+
+	STraceCounters& operator-=(const STraceCounters& other)
+	{
+		nRays -= other.nRays;
+		nAdjoinHops -= other.nAdjoinHops;
+		nMaxRecursionRays -= other.nMaxRecursionRays;
+		return *this;
+	}
+
+	float GetAverageHops() const { return nRays > 0 ? (float)nAdjoinHops / (float)nRays : 0.0f; }
+};
+
+class IBakeBackend
+{
+public:
+	virtual ~IBakeBackend() = default;
+
+	// called before the first and after the last item of a pass (every indirect bounce is a pass)
+	virtual void BeginPass(EBakePass ePass, int nBounce) = 0;
+	virtual void Run(const SBakeWorkItem& item) = 0;
+	virtual void EndPass(EBakePass ePass, int nBounce) = 0;
+
+	// rays traced so far by the ray pass in progress (the sum of SVertexSampleStats::nRays), read by the adaptive bake
+	// near the budget of the pass
+	virtual int64_t GetPassRays() = 0;
+};
+
+struct SBakeScheduleSettings
+{
+	int nTileVertices = 0; // vertices per work item, 0 for all vertices in one item
+	int nBatchRays = 0;    // rays per vertex in a batch, 0 for all rays in one batch (kDefaultAdaptiveBatchRays if adaptive)
+	bool bWeldVertices = true; // trace the vertices shared by several surfaces once
+
+	// vertices of the light passes, an end of 0 for all of them (a worker of a distributed bake only runs its share)
+	int nFirstVertex = 0;
+	int nEndVertex = 0;
+};
+
+class CBakeScheduler
+{
+public:
+	// plans the passes enabled in levelInfo.nBakeFlags in the order of CCpuBaker::Bake,
+	// smoothing is planned for a normalSmoothCos below 1 and welding after it
+	void Begin(const SLevelInfo& levelInfo, int nIndirectBounces, const SBakeScheduleSettings& settings);
+
+	// runs the next work item, returns false once the bake is done or cancelled
+	bool Step(IBakeBackend& backend);
+
+	// runs the remaining work items
+	void Run(IBakeBackend& backend);
+
+	// can be called from any thread, the bake stops before the next work item
+	void Cancel() { m_bCancelled = true; }
+
+	bool IsCancelled() const { return m_bCancelled; }
+	bool IsDone() const { return m_nNextItem >= (int)m_items.size(); }
+
+	// estimated fraction of the work done, weighted by the rays traced per item (all rays for an adaptive bake, the batches
+	// a pass leaves out for its budget count as done)
+	float GetProgress() const;
+
+	int GetNumItems() const { return (int)m_items.size(); }
+
+private:
+	struct SPlannedItem
+	{
+		SBakeWorkItem item;
+		double        cost;
+		int           nPassFirstItem;
+		int           nPassNumItems;
+		int           nBatchRays;  // rays per vertex of the item's batch
+		int           nBudgetRays; // selected rays per vertex of an adaptive ray pass, 0 without a budget
+	};
+
+	void AddPass(EBakePass ePass, int nBounce, int nNumRays, double costPerVertex);
+	bool IsOverRayBudget(IBakeBackend& backend, const SPlannedItem& planned);
+
+	std::vector<SPlannedItem> m_items;
+	int                       m_nNextItem = 0;
+	int                       m_nTotalVertices = 0;
+	int                       m_nFirstVertex = 0; // range of the light passes
+	int                       m_nEndVertex = 0;
+	int                       m_nTileVertices = 0;
+	int                       m_nBatchRays = 0;
+	double                    m_totalCost = 0.0;
+	double                    m_doneCost = 0.0;
+	bool                      m_bAdaptive = false;
+
+	// ray budget of the adaptive pass in progress, see IsOverRayBudget
+	int64_t                   m_nPassBudget = -1; // unknown until the first batch is counted
+	int64_t                   m_nPassRays = 0;    // rays traced at the last count
+	int64_t                   m_nPassMaxRays = 0; // upper bound of the rays traced since
+	int                       m_nRaysSinceCount = 0; // rays per vertex of the batches since the last count
+	int64_t                   m_nActiveVertices = 0; // vertices still tracing at the last count
+	std::atomic<bool>         m_bCancelled = false;
+};
@@ -4,44 +4,109 @@
 
 groupshared float4 g_sharedAcc[RAYS_PER_GROUP];
 
+bool IsEmissiveOnPlane(SSurface surface, float3 pos)
+{
+	return surface.nAdjoinSector < 0 && (surface.nFlags & ESurface_IsVisible) && surface.emissive.w > 0.0 && IsOnSurfacePlane(surface.normal, pos);
+}
+
+// True if an emissive surface of the vertex sector, or of a sector behind one of its adjoins through the vertex, has the
+// vertex on its plane. The emissive samples skip those surfaces, the hemisphere rays have to gather them.
+bool IsNextToEmissiveSurface(SVertexData vertexData)
+{
+	const SSector sector = aSectors[vertexData.nSectorIndex];
+	for (uint nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const SSurface surface = aSurfaces[nSurfaceIndex];
+		if (IsEmissiveOnPlane(surface, vertexData.vertex))
+			return true;
+		if (surface.nAdjoinSector < 0 || !IsOnSurfacePlane(surface.normal, vertexData.vertex))
+			continue;
+
+		const SSector adjoinSector = aSectors[surface.nAdjoinSector];
+		for (uint nAdjoinSurface = adjoinSector.nFirstSurface; nAdjoinSurface < adjoinSector.nFirstSurface + adjoinSector.nNumSurfaces; ++nAdjoinSurface)
+		{
+			if (IsEmissiveOnPlane(aSurfaces[nAdjoinSurface], vertexData.vertex))
+				return true;
+		}
+	}
+	return false;
+}
+
 [numthreads(RAYS_PER_GROUP, 1, 1)]
 void main(int3 dispatchThreadID : SV_DispatchThreadID,
 		  int3 groupThreadID    : SV_GroupThreadID,
 		  int3 groupID          : SV_GroupID)
 {
 	SVertexData vertexData;
-	if (!GetVertexData(vertexData, groupID.x))
+	if (!GetVertexData(vertexData, g_levelInfo.nFirstVertex + groupID.x))
+		return;
+
+	// the adaptive bake is done with this vertex for the pass
+	if (IsSampleConverged(aSampleStats[vertexData.nVertexIndex], aVertexAccumulation[vertexData.nVertexIndex]))
 		return;
 
 	const float3x3 frame = GenerateTangentFrame(vertexData.normal);
 
-	// each thread processes g_levelInfo.nSkyEmissiveRays / RAYS_PER_GROUP rays
+	// with emissive surfaces to sample every ray also samples an emissive point, the hemisphere rays only gather the sky and
+	// the emissive surfaces whose plane goes through the vertex (see GenEmissiveSample)
+	const bool bEmissiveSamples = (g_levelInfo.nBakeFlags & ELightBake_Emissive) && g_levelInfo.nNumEmissiveSurfaces > 0;
+	const bool bHemisphereRays = (g_levelInfo.nBakeFlags & ELightBake_Sky) || !bEmissiveSamples || IsNextToEmissiveSurface(vertexData);
+
+	// each thread processes every RAYS_PER_GROUP-th ray of the batch, one ray per block of nRayStride rays
+	const int nRayStride = max(g_levelInfo.nRayStride, 1);
+	const int nRaySet = GetBatchRaySet();
 	float4 localAcc = float4(0,0,0,0);
-	for(int nRayIndex = groupThreadID.x; nRayIndex < g_levelInfo.nSkyEmissiveRays; nRayIndex += RAYS_PER_GROUP)
+	for(int nBlock = groupThreadID.x; nBlock * nRayStride < g_levelInfo.nSkyEmissiveRays; nBlock += RAYS_PER_GROUP)
 	{
-		float3 rayDir = GenRay(nRayIndex, g_levelInfo.nSkyEmissiveRays);
-		rayDir = mul(rayDir, frame);
+		const int nRayIndex = GetBatchRayIndex(nBlock);
+		if (nRayIndex >= g_levelInfo.nSkyEmissiveRays)
+			continue;
 
-		const float3 rayTarget = kSkyDistance * rayDir + vertexData.vertex;
+		if (bHemisphereRays)
+		{
+			float3 rayDir = GenRay(nRayIndex, g_levelInfo.nSkyEmissiveRays, nRaySet);
+			rayDir = mul(rayDir, frame);
 
-		SRayPayload payload = (SRayPayload)0;
-		payload.attenuation = float4(1,1,1,1);
+			const float3 rayTarget = kSkyDistance * rayDir + vertexData.vertex;
 
-		bool bRayHit = TraceRay(payload, vertexData.nSectorIndex, vertexData.vertex + rayDir * kRayBias, rayTarget);
-		if(bRayHit)
-		{
-			float4 color = float4(0,0,0,0);
-			uint hitFlags = aSurfaces[payload.nHitSurfaceIndex].nFlags;
-			if((g_levelInfo.nBakeFlags & ELightBake_Sky) && (hitFlags & ESurface_IsSky))
+			SRayPayload payload = (SRayPayload)0;
+			payload.attenuation = float4(1,1,1,1);
+
+			bool bRayHit = TraceRay(payload, vertexData.nSectorIndex, vertexData.vertex + rayDir * kRayBias, rayTarget);
+			if(bRayHit)
 			{
-				color = aLights[g_levelInfo.nSkyLightIndex].color;
+				float4 color = float4(0,0,0,0);
+				const SSurface hitSurface = aSurfaces[payload.nHitSurfaceIndex];
+				if((g_levelInfo.nBakeFlags & ELightBake_Sky) && (hitSurface.nFlags & ESurface_IsSky))
+				{
+					color = aLights[g_levelInfo.nSkyLightIndex].color;
+				}
+				else if((g_levelInfo.nBakeFlags & ELightBake_Emissive) && (hitSurface.nFlags & ESurface_IsVisible)
+					&& (!bEmissiveSamples || IsOnSurfacePlane(hitSurface.normal, vertexData.vertex)))
+				{
+					color = hitSurface.emissive;
+				}
+
+				localAcc += color * payload.attenuation;
 			}
-			else if((g_levelInfo.nBakeFlags & ELightBake_Emissive) && (hitFlags & ESurface_IsVisible))
+		}
+
+		// shadow ray to a point on an emissive surface, the light counts if nothing else is in the way
+		float3 emissivePoint;
+		int nEmissiveSurface;
+		float4 emissiveColor;
+		if (bEmissiveSamples && GenEmissiveSample(vertexData, nRayIndex, g_levelInfo.nSkyEmissiveRays, nRaySet, emissivePoint, nEmissiveSurface, emissiveColor))
+		{
+			const float3 rayDir = normalize(emissivePoint - vertexData.vertex);
+
+			SRayPayload payload = (SRayPayload)0;
+			payload.attenuation = float4(1,1,1,1);
+
+			if (TraceRay(payload, vertexData.nSectorIndex, vertexData.vertex + rayDir * kRayBias, emissivePoint - rayDir * kRayBias)
+				&& payload.nHitSurfaceIndex == nEmissiveSurface)
 			{
-				color = aSurfaces[payload.nHitSurfaceIndex].emissive;
+				localAcc += emissiveColor * payload.attenuation;
 			}
-
-			localAcc += color * payload.attenuation;
 		}
 	}
 
@@ -60,8 +125,14 @@ void main(int3 dispatchThreadID : SV_DispatchThreadID,
 	// only thread 0 writes final result for this vertex
 	if(groupThreadID.x == 0)
 	{
-		float4 result = g_sharedAcc[0] / (float)g_levelInfo.nSkyEmissiveRays;
+		// running mean of the pass over the batches so far
+		SVertexSampleStats stats = aSampleStats[vertexData.nVertexIndex];
+		const float4 prevMean = stats.mean;
+		AddSampleBatch(stats, g_sharedAcc[0], GetBatchRayCount(g_levelInfo.nSkyEmissiveRays));
+		aSampleStats[vertexData.nVertexIndex] = stats;
+
+		// replaces the estimate of the previous batches
 		float4 prevResult = aVertexAccumulation[vertexData.nVertexIndex];
-		aVertexAccumulation[vertexData.nVertexIndex] = prevResult + result;
+		aVertexAccumulation[vertexData.nVertexIndex] = prevResult + (stats.mean - prevMean);
 	}
 }
@@ -4,7 +4,7 @@
 void main(int3 dispatchThreadID : SV_DispatchThreadID)
 {
 	SVertexData vertexData;
-	if (!GetVertexData(vertexData, dispatchThreadID.x))
+	if (!GetVertexData(vertexData, g_levelInfo.nFirstVertex + dispatchThreadID.x))
 		return;
 
 	float3 sunPos = aLights[g_levelInfo.nSunLightIndex].position.xyz;
@@ -0,0 +1,203 @@
+#pragma once
+
+// Portable definitions shared between the plugin, the CPU baker and the shaders (see Baking.hlsli)
+
+#include <cstdint>
+
+#include "Gamma.h"
+#include "float3.h"
+#include "float4.h"
+
+// GPU mirrored structs
+struct SSector
+{
+	uint32_t nFirstSurface;
+	uint32_t nNumSurfaces;
+	uint32_t nLayerIndex;
+	uint32_t nBvhRoot; // see SBvhNode
+	float4   center;
+};
+
+struct SSurface
+{
+	float4    albedo;
+	float4    emissive;
+	float4    normal; // w is the plane distance, dot(normal, first vertex)
+	uint32_t  nFirstVertex;
+	uint32_t  nNumVertices;
+	int32_t   nAdjoinSector;
+	uint32_t  nFlags;
+};
+
+struct SVertex
+{
+	uint32_t  nSectorIndex;
+	uint32_t  nSurfaceIndex;
+	uint32_t  nLocalSurfaceIndex;
+	uint32_t  nLocalVertexIndex;
+	float4    position;
+};
+
+// Compact layout of the CPU tracer (see CompactLayout.h). The hot part is what the traversal reads for every tested
+// surface, the cold part is only read for surfaces that are hit. Both mirror the tail and the head of SSurface.
+struct SSurfaceHot
+{
+	float4    normal; // w is the plane distance
+	uint32_t  nFirstVertex;
+	uint32_t  nNumVertices;
+	int32_t   nAdjoinSector;
+	uint32_t  nFlags;
+};
+
+struct SSurfaceCold
+{
+	float4    albedo;
+	float4    emissive;
+};
+
+// Surface vertex position quantized to 16 bits relative to the center of its sector (see SBakeScene::sectorQuantization)
+struct SVertexCompact
+{
+	int16_t   x, y, z;
+	uint16_t  nSectorIndex;
+};
+
+// Per sector surface BVH, children of an inner node are stored next to each other
+struct SBvhNode
+{
+	float3    boxMin;
+	uint32_t  nFirst; // leaf: first entry in the bvh surface list, inner: left child (the right one follows)
+	float3    boxMax;
+	uint32_t  nCount; // leaf: number of surfaces, inner: 0
+};
+
+// Slot of the vertex hash used for smoothing (see VertexHash.h), empty slots have no vertices
+struct SVertexHashCell
+{
+	int32_t   x, y, z; // quantized position
+	uint32_t  nFirst;  // first entry in the vertex hash list
+	uint32_t  nCount;
+};
+
+struct SLight
+{
+	uint32_t  nFlags;
+	int32_t   nSectorIndex;
+	int32_t   nLayerIndex;
+	float     range;
+	float4    position;
+	float4    color;
+};
+
+// Emissive surface sampled by the sky/emissive pass, see BuildEmissiveSurfaces
+struct SEmissiveSurface
+{
+	uint32_t  nSurfaceIndex;
+	uint32_t  nFirstTriangle; // first entry of the surface in the triangle area CDF (the fan around its first vertex)
+	float     powerCdf;       // emissive power (emissive.w * area) of this and the previous surfaces over the total
+	float     inversePdf;     // 1 / the chance density of a sampled point on the surface, total power over emissive.w
+};
+
+// Light bake configuration
+enum ELightBakeFlags
+{
+	ELightBake_Lights             =   0x1,
+	ELightBake_Sun                =   0x2,
+	ELightBake_Sky                =   0x4,
+	ELightBake_Emissive           =   0x8,
+	ELightBake_Indirect           =  0x10,
+	ELightBake_Selected           =  0x20,
+	ELightBake_VisibleLayers      =  0x40,
+	ELightBake_GammaCorrect       =  0x80,
+	ELightBake_ExtraLightEmissive = 0x100,
+	ELightBake_ToneMap            = 0x200,
+	ELightBake_PhysicalFalloff    = 0x400,
+	ELightBake_Adaptive           = 0x800, // stop the ray passes of converged vertices early
+
+	ELightBake_Direct = ELightBake_Lights | ELightBake_Sun | ELightBake_Sky | ELightBake_Emissive
+};
+
+// Gpu surface flags
+enum ESurfaceFlags
+{
+	ESurface_IsSky         = 0x1,
+	ESurface_IsVisible     = 0x2,
+	ESurface_IsTranslucent = 0x4,
+};
+
+// Engine/editor sector flags
+enum ESectorFlags
+{
+	// SED specific
+	ESector_NoAmbientLightRGB = 0x20000000,
+	ESector_NoAmbientLight    = 0x40000000
+};
+
+// Engine/editor adjoin flags
+enum EAdjoinFlags
+{
+	EAdjoin_Visible     =        0x1,
+	EAdjoin_BlocksLight = 0x80000000,
+};
+
+// Engine/editor face flags
+enum EFaceFlags
+{
+	EFace_Translucent = 0x2,
+};
+
+// Engine/editor sky surface flags
+enum ESkyFlags
+{
+	ESky_Horizon = 0x200,
+	ESky_Ceiling = 0x400,
+};
+
+// Baker specific light flags
+enum ELightFlags
+{
+	ELight_NotBlocked = 0x1,
+	ELight_Sun        = 0x2,
+	ELight_Sky        = 0x4,
+	ELight_Anchor     = 0x8,
+};
+
+// be careful of constant buffer padding here
+struct SLevelInfo
+{
+	int32_t nSunLightIndex;
+	int32_t nSkyLightIndex;
+	int32_t nAnchorLightIndex;
+	int32_t nNumEmissiveSurfaces; // 0 gathers the emissive light with the sky rays
+
+	int32_t nTotalSectors;
+	int32_t nTotalSurfaces;
+	int32_t nTotalVertices;
+	int32_t nTotalLights;
+
+	uint32_t nBakeFlags;
+	int32_t  nSkyEmissiveRays;
+	int32_t  nIndirectRays;
+	float    normalSmoothCos;
+
+	// work item of the progressive bake, only set in the constant buffer of a dispatch (see CBakeScheduler)
+	int32_t  nFirstVertex;
+	int32_t  nEndVertex;
+	int32_t  nRayOffset;
+	int32_t  nRayStride;
+
+	// adaptive ray count, a vertex stops once the 95% confidence interval of its luminance is within the threshold (relative)
+	float    adaptiveThreshold;
+	int32_t  nMinAdaptiveRays;
+	int32_t  _padding3[2];
+};
+
+// Running estimate of a vertex in a ray pass (sky/emissive or an indirect bounce), updated after every ray batch
+struct SVertexSampleStats
+{
+	float4  mean;     // light of the pass so far
+	float   lumSum;   // sum and sum of squares of the batch mean luminance, for the variance between batches
+	float   lumSqSum;
+	int32_t nRays;    // rays traced so far
+	int32_t nBatches;
+};
@@ -10,6 +10,7 @@ static const uint ELightBake_GammaCorrect       =  0x80;
 static const uint ELightBake_ExtraLightEmissive = 0x100;
 static const uint ELightBake_ToneMap            = 0x200;
 static const uint ELightBake_PhysicalFalloff    = 0x400;
+static const uint ELightBake_Adaptive           = 0x800;
 
 // must match ESurfaceFlags
 static const uint ESurface_IsSky         = 0x1;
@@ -33,6 +34,12 @@ static const float kRayBias = -1e-4;
 // maximum number of adjoins to cross for a given ray (puts an upper bound on recursions for safety)
 static const int kMaxRecursion = 256; // should be more than enough?
 
+// must match kBvhStackSize, the sector bvhs are built balanced so this is plenty
+static const int kBvhStackSize = 32;
+
+// must match kBvhEmptyRoot, nFirst of the root of a sector without traceable surfaces
+static const uint kBvhEmptyRoot = 0xFFFFFFFF;
+
 // Ray payload, filled on hit
 struct SRayPayload
 {
@@ -48,7 +55,7 @@ struct SSector
 	uint   nFirstSurface;
 	uint   nNumSurfaces;
 	int    nLayerIndex;
-	uint   _padding;
+	uint   nBvhRoot;
 	float4 center;
 };
 
@@ -56,7 +63,7 @@ struct SSurface
 {
 	float4 albedo;
 	float4 emissive;
-	float4 normal;
+	float4 normal; // w is the plane distance
 	uint   nFirstVertex;
 	uint   nNumVertices;
 	int    nAdjoinSector;
@@ -71,6 +78,21 @@ struct SVertex
 	float4 position;
 };
 
+struct SBvhNode
+{
+	float3 boxMin;
+	uint   nFirst; // leaf: first entry in aBvhSurfaces, inner: left child (the right one follows)
+	float3 boxMax;
+	uint   nCount; // leaf: number of surfaces, inner: 0
+};
+
+struct SVertexHashCell
+{
+	int3 cell;
+	uint nFirst;
+	uint nCount;
+};
+
 struct SLight
 {
 	uint   nFlags;
@@ -81,12 +103,20 @@ struct SLight
 	float4 color;
 };
 
+struct SEmissiveSurface
+{
+	uint  nSurfaceIndex;
+	uint  nFirstTriangle; // first entry in aEmissiveTriangleCdf
+	float powerCdf;
+	float inversePdf;
+};
+
 struct SLevelInfo
 {
 	int  nSunLightIndex;
 	int  nSkyLightIndex;
 	int  nAnchorLightIndex;
-	int _padding;
+	int  nNumEmissiveSurfaces;
 
 	int nTotalSectors;
 	int nTotalSurfaces;
@@ -98,7 +128,24 @@ struct SLevelInfo
 	int  nIndirectRays;
 	float normalSmoothCos;
 
-	int4 _padding2;
+	// work item of the progressive bake, see CBakeScheduler
+	int nFirstVertex;
+	int nEndVertex;
+	int nRayOffset; // ray batch of the dispatch, see GetBatchRayIndex
+	int nRayStride;
+
+	float adaptiveThreshold;
+	int   nMinAdaptiveRays;
+	int2  _padding3;
+};
+
+struct SVertexSampleStats
+{
+	float4 mean;
+	float  lumSum;
+	float  lumSqSum;
+	int    nRays;
+	int    nBatches;
 };
 
 cbuffer CBLevelInfo : register( b0 )
@@ -126,9 +173,82 @@ StructuredBuffer<SVertex>  aVertices      : register(t4);
 StructuredBuffer<SLight>   aLights        : register(t5);
 StructuredBuffer<int4>     aVertexNormals : register(t6);
 StructuredBuffer<float4>   aVertexColors  : register(t7);
+StructuredBuffer<float4>   aEdgePlanes    : register(t8);
+StructuredBuffer<SBvhNode> aBvhNodes      : register(t9);
+Buffer<uint>               aBvhSurfaces   : register(t10);
+Buffer<uint>               aVertexWelds   : register(t11);
+Buffer<uint>               aSectorLightOffsets : register(t12); // see BuildSectorLightLists
+Buffer<uint>               aSectorLights       : register(t13);
+StructuredBuffer<SEmissiveSurface> aEmissiveSurfaces : register(t16); // see BuildEmissiveSurfaces
+Buffer<float>              aEmissiveTriangleCdf : register(t17);
 
 RWStructuredBuffer<float4> aVertexColorsWrite  : register(u0);
 RWStructuredBuffer<float4> aVertexAccumulation : register(u1);
+RWStructuredBuffer<SVertexSampleStats> aSampleStats : register(u2);
+
+// z value of the 95% confidence interval, the absolute error that's always good enough (for dark vertices) and the
+// batches needed before the variance between them is worth anything
+static const float kAdaptiveConfidence = 1.96;
+static const float kAdaptiveTolerance = 0.001;
+static const int   kAdaptiveMinBatches = 4;
+
+// Ray of a batch, see GetBatchRayIndex in BakeScheduler.h
+int GetBatchRayIndex(int nBlock)
+{
+	const int nRayStride = max(g_levelInfo.nRayStride, 1);
+	return nBlock * nRayStride + (g_levelInfo.nRayOffset + nBlock) % nRayStride;
+}
+
+int GetBatchRayCount(int nNumRays)
+{
+	const int nRayStride = max(g_levelInfo.nRayStride, 1);
+	const int nFullBlocks = nNumRays / nRayStride;
+	return nFullBlocks + (((g_levelInfo.nRayOffset + nFullBlocks) % nRayStride < nNumRays % nRayStride) ? 1 : 0);
+}
+
+// Ray set of an adaptive pass, see GetBatchRaySet in BakeScheduler.h
+int GetBatchRaySet()
+{
+	return g_levelInfo.nRayOffset / max(g_levelInfo.nRayStride, 1);
+}
+
+float GetSampleLuminance(float4 color)
+{
+	// w is the mono light value
+	return max(dot(color.rgb, float3(0.2126, 0.7152, 0.0722)), color.w);
+}
+
+// True once the adaptive bake can stop tracing a vertex for the current pass, vertexLight is its accumulated light so far
+// (the earlier passes and the current one)
+bool IsSampleConverged(SVertexSampleStats stats, float4 vertexLight)
+{
+	if (!(g_levelInfo.nBakeFlags & ELightBake_Adaptive) || stats.nBatches < kAdaptiveMinBatches || stats.nRays < g_levelInfo.nMinAdaptiveRays)
+		return false;
+
+	// variance of the batch means, the error of the pass mean shrinks with the number of batches
+	const float nBatches = (float)stats.nBatches;
+	const float meanLum = stats.lumSum / nBatches;
+	const float variance = max(stats.lumSqSum / nBatches - meanLum * meanLum, 0.0) * nBatches / (nBatches - 1.0);
+	const float error = kAdaptiveConfidence * sqrt(variance / nBatches);
+
+	// the error shows against all the light of the vertex, a pass that adds little to a bright vertex is done sooner
+	return error <= g_levelInfo.adaptiveThreshold * GetSampleLuminance(vertexLight) + kAdaptiveTolerance;
+}
+
+// Adds the summed light of a batch of rays to the running mean, with a single batch this is batchSum / nBatchRays
+void AddSampleBatch(inout SVertexSampleStats stats, float4 batchSum, int nBatchRays)
+{
+	if (nBatchRays <= 0)
+		return;
+
+	stats.mean += (batchSum - stats.mean * (float)nBatchRays) / (float)(stats.nRays + nBatchRays);
+
+	const float lum = GetSampleLuminance(batchSum / (float)nBatchRays);
+	stats.lumSum += lum;
+	stats.lumSqSum += lum * lum;
+	stats.nRays += nBatchRays;
+	stats.nBatches += 1;
+}
 
 // Test if a sector is in the sector bitmask
 bool IsSectorVisible(int nSectorIndex)
@@ -162,7 +282,10 @@ bool GetVertexData(out SVertexData vertexData, int nVertexIndex)
 	vertexData.vertex = aVertices[vertexData.nVertexIndex].position.xyz;
 	vertexData.normal = normalize((float3)aVertexNormals[vertexData.nVertexIndex].xyz);
 
+	// welded vertices get the light of the vertex traced in their place
 	return (vertexData.nVertexIndex < g_levelInfo.nTotalVertices)
+		&& (vertexData.nVertexIndex < g_levelInfo.nEndVertex)
+		&& (aVertexWelds[vertexData.nVertexIndex] == (uint)vertexData.nVertexIndex)
 		&& IsSectorVisible(vertexData.nSectorIndex)
 		&& IsLayerVisible(vertexData.nLayerIndex)
 		&& IsSurfaceVisible(vertexData.nSurfaceIndex);
@@ -177,8 +300,8 @@ float3x3 GenerateTangentFrame(float3 normal)
 	return float3x3(tangent, binormal, normal);
 }
 
-// Generate a cosine weighted ray using a hammersley sequence
-float3 GenRay(int N, int M)
+// Van der Corput radical inverse of N, the second coordinate of the hammersley points
+float RadicalInverse(int N)
 {
 	uint bits = N;
 	bits = (bits << 16u) | (bits >> 16u);
@@ -186,8 +309,21 @@ float3 GenRay(int N, int M)
 	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
 	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
 	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
-	float v = (float)bits * 2.3283064365386963e-10f; // / 0x100000000
-	float u = (float)N / (float)M;
+	return (float)bits * 2.3283064365386963e-10f; // / 0x100000000
+}
+
+// Offset of ray set n of an adaptive pass, see GetRaySetShift in CpuTracer.cpp
+float2 GetRaySetShift(int nRaySet)
+{
+	return frac((float)nRaySet * float2(0.7548777, 0.5698403));
+}
+
+// Generate a cosine weighted ray using a hammersley sequence, shifted for the ray set (see GenRay in CpuTracer.h)
+float3 GenRay(int N, int M, int nRaySet)
+{
+	const float2 shift = GetRaySetShift(nRaySet);
+	float v = frac(RadicalInverse(N) + shift.y);
+	float u = ((float)N + shift.x) / (float)M;
 
 	u = lerp(0.0001, 1.0, u);
 	const float phi = v * 2.0f * 3.141592f;
@@ -196,6 +332,84 @@ float3 GenRay(int N, int M)
 	return float3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
 }
 
+// True if the point lies on the plane (w is the plane distance), must match kEmissivePlaneEpsilon
+bool IsOnSurfacePlane(float4 plane, float3 pos)
+{
+	return abs(dot(plane.xyz, pos) - plane.w) < 1e-3;
+}
+
+// Emissive light sample N of M of a vertex, see GenEmissiveSample in CpuTracer.h
+// picks the surface by its power, the fan triangle by its area and a point in it, color is the light the vertex gets if
+// the ray to the point ends on nSurfaceIndex
+bool GenEmissiveSample(SVertexData vertexData, int N, int M, int nRaySet, out float3 pos, out int nSurfaceIndex, out float4 color)
+{
+	static const float kOneBelowOne = 0.99999994;
+
+	// per vertex offset of the sample points (Cranley-Patterson rotation), plus the offset of the ray set
+	uint hash = (uint)vertexData.nVertexIndex * 0x9E3779B9u;
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	const float2 shift = GetRaySetShift(nRaySet);
+	float u = min(frac(((float)N + 0.5) / (float)M + (float)(hash & 0xFFFFu) * (1.0 / 65536.0) + shift.x), kOneBelowOne);
+	float v = min(frac(RadicalInverse(N) + (float)(hash >> 16) * (1.0 / 65536.0) + shift.y), kOneBelowOne);
+
+	// the surface by its power (first power CDF entry above u), u is stretched over its part of the CDF
+	int nLow = 0;
+	int nHigh = g_levelInfo.nNumEmissiveSurfaces - 1;
+	while (nLow < nHigh)
+	{
+		const int nMid = (nLow + nHigh) / 2;
+		if (u < aEmissiveSurfaces[nMid].powerCdf)
+			nHigh = nMid;
+		else
+			nLow = nMid + 1;
+	}
+	const SEmissiveSurface emissive = aEmissiveSurfaces[nLow];
+	const float powerLower = nLow > 0 ? aEmissiveSurfaces[nLow - 1].powerCdf : 0.0;
+	u = min((u - powerLower) / max(emissive.powerCdf - powerLower, 1e-12), kOneBelowOne);
+
+	// the triangle by its area, then uniform within it
+	const SSurface surface = aSurfaces[emissive.nSurfaceIndex];
+	nLow = 0;
+	nHigh = (int)surface.nNumVertices - 3;
+	while (nLow < nHigh)
+	{
+		const int nMid = (nLow + nHigh) / 2;
+		if (u < aEmissiveTriangleCdf[emissive.nFirstTriangle + nMid])
+			nHigh = nMid;
+		else
+			nLow = nMid + 1;
+	}
+	const float areaLower = nLow > 0 ? aEmissiveTriangleCdf[emissive.nFirstTriangle + nLow - 1] : 0.0;
+	u = min((u - areaLower) / max(aEmissiveTriangleCdf[emissive.nFirstTriangle + nLow] - areaLower, 1e-12), kOneBelowOne);
+
+	const float su = sqrt(u);
+	pos = aVertices[surface.nFirstVertex].position.xyz * (1.0 - su)
+		+ aVertices[surface.nFirstVertex + nLow + 1].position.xyz * (su * (1.0 - v))
+		+ aVertices[surface.nFirstVertex + nLow + 2].position.xyz * (su * v);
+	nSurfaceIndex = (int)emissive.nSurfaceIndex;
+	color = float4(0,0,0,0);
+
+	// the surfaces through the vertex are left to the hemisphere rays
+	if (IsOnSurfacePlane(surface.normal, vertexData.vertex))
+		return false;
+
+	const float3 toPoint = pos - vertexData.vertex;
+	const float distSqr = dot(toPoint, toPoint);
+	if (distSqr <= 0.0)
+		return false;
+
+	const float3 rayDir = toPoint * rsqrt(distSqr);
+	const float cosVertex = dot(vertexData.normal, rayDir);
+	const float cosSurface = -dot(surface.normal.xyz, rayDir);
+	if (cosVertex <= 0.0 || cosSurface <= 0.0)
+		return false;
+
+	color = surface.emissive * (cosVertex * cosSurface * emissive.inversePdf / (3.141592 * max(distSqr, 0.001)));
+	return true;
+}
+
 // Shoddy interpolation of vertex color over a surface, but has better properties than triangle interpolation
 float4 InterpolateSurfaceLight(int nSurfaceIndex, float3 pos)
 {
@@ -242,7 +456,7 @@ float4 InterpolateSurfaceLight(int nSurfaceIndex, float3 pos)
         // Weight for this vertex
         const float weight = (tanHalfPrev + tanHalfNext) / lenCurr;
 
-        vertexLight += aVertexColors[nFirstVertex + nCurrIndex] * weight;
+        vertexLight += aVertexColors[aVertexWelds[nFirstVertex + nCurrIndex]] * weight;
         totalWeight += weight;
     }
 
@@ -252,8 +466,6 @@ float4 InterpolateSurfaceLight(int nSurfaceIndex, float3 pos)
 // Test if a point is within a surfaces edges
 bool IsPointOnSurface(int nSurfaceIndex, float3 position)
 {
-	const float3 normal = aSurfaces[nSurfaceIndex].normal.xyz;
-
 	const uint nFirstVertex = aSurfaces[nSurfaceIndex].nFirstVertex;
 	const uint nNumVertices = aSurfaces[nSurfaceIndex].nNumVertices;
 
@@ -262,9 +474,8 @@ bool IsPointOnSurface(int nSurfaceIndex, float3 position)
 	[loop]
 	for (uint i = 0; i < nNumVertices; ++i)
 	{
-		const float3 vertex1 = aVertices[nFirstVertex + i].position.xyz;
-		const float3 vertex2 = aVertices[nFirstVertex + (i + 1) % nNumVertices].position.xyz;
-		const float dist = dot(cross(normal, vertex2 - vertex1), position - vertex1);
+		const float4 edgePlane = aEdgePlanes[nFirstVertex + i];
+		const float dist = dot(edgePlane.xyz, position) - edgePlane.w;
 		if (dist < -1e-3)
 		{
 			bResult = false;
@@ -287,13 +498,10 @@ bool IsSurfCrossed(int nSurfaceIndex, float3 start, float3 end, inout float3 hit
 	[branch]
 	if (nNumVertices > 0)
 	{
-		const int nFirstVertex = aSurfaces[nSurfaceIndex].nFirstVertex;
-
-		const float3 normal = aSurfaces[nSurfaceIndex].normal.xyz;
-		const float3 vertex = aVertices[nFirstVertex].position.xyz;
+		const float4 plane = aSurfaces[nSurfaceIndex].normal;
 
-		const float distToStart = dot(normal, start - vertex);
-		const float distToEnd   = dot(normal, end - vertex);
+		const float distToStart = dot(plane.xyz, start) - plane.w;
+		const float distToEnd   = dot(plane.xyz, end) - plane.w;
 
 		const bool bAllOutsidePositive = (distToStart > 0.0001 && distToEnd > 0.0001);
 		const bool bAllOutsideNegative = (distToStart < -0.0001 && distToEnd < -0.0001);
@@ -319,29 +527,80 @@ bool IsSurfCrossed(int nSurfaceIndex, float3 start, float3 end, inout float3 hit
 	return bResult;
 }
 
-// Test all the surfaces in a sector, return true if something was hit as well as hit position and surface index
+// 1/delta for IsSegmentInBox, zero components get a huge finite value so the slab test never sees 0 * inf
+float3 GetSegmentInvDelta(float3 delta)
+{
+	return (delta != 0.0) ? 1.0 / delta : 1e30;
+}
+
+// Segment [start, start + delta] against a box, invDelta comes from GetSegmentInvDelta
+bool IsSegmentInBox(float3 start, float3 invDelta, float3 boxMin, float3 boxMax)
+{
+	const float3 t0 = (boxMin - start) * invDelta;
+	const float3 t1 = (boxMax - start) * invDelta;
+	const float3 tNear = min(t0, t1);
+	const float3 tFar = max(t0, t1);
+	const float tMin = max(max(max(tNear.x, tNear.y), tNear.z), 0.0);
+	const float tMax = min(min(min(tFar.x, tFar.y), tFar.z), 1.0);
+	return tMin <= tMax;
+}
+
+// Test the surfaces of a sector through its bvh, return true if something was hit as well as hit position and surface index
+// The first crossed surface in sector order wins (adjoins first), not the closest one
 bool TraceSurfaces(int nSectorIndex, float3 start, float3 end, inout float3 hitPos, inout int nHitSurfaceIndex)
 {
-	bool bResult = false;
+	const float3 delta = end - start;
+	const float3 invDelta = GetSegmentInvDelta(delta);
 
-	const uint nFirstSurface = aSectors[nSectorIndex].nFirstSurface;
-	const uint nLastSurface  = nFirstSurface + aSectors[nSectorIndex].nNumSurfaces;
+	uint nBestSurface = 0xFFFFFFFF;
+
+	uint aStack[kBvhStackSize];
+	int nStackSize = 0;
+	aStack[nStackSize++] = aSectors[nSectorIndex].nBvhRoot;
 
 	[loop]
-	for (uint nSurfaceIndex = nFirstSurface; nSurfaceIndex < nLastSurface; ++nSurfaceIndex)
+	while (nStackSize > 0)
 	{
-		const float3 normal = aSurfaces[nSurfaceIndex].normal.xyz;
-		const float dotVal  = dot(normal, end - start);
-		if (dotVal < 0)
+		const SBvhNode node = aBvhNodes[aStack[--nStackSize]];
+
+		[branch]
+		if (IsSegmentInBox(start, invDelta, node.boxMin, node.boxMax))
 		{
-			if (IsSurfCrossed(nSurfaceIndex, start, end, hitPos))
+			[branch]
+			if (node.nCount == 0)
 			{
-				nHitSurfaceIndex = nSurfaceIndex;
-				bResult = true;
-				break;
+				// sectors without traceable surfaces have an empty root, see BuildSectorBvhs
+				if (node.nFirst != kBvhEmptyRoot)
+				{
+					aStack[nStackSize++] = node.nFirst;
+					aStack[nStackSize++] = node.nFirst + 1;
+				}
+			}
+			else
+			{
+				[loop]
+				for (uint nEntry = node.nFirst; nEntry < node.nFirst + node.nCount; ++nEntry)
+				{
+					const uint nSurfaceIndex = aBvhSurfaces[nEntry];
+					if (nSurfaceIndex >= nBestSurface)
+						break; // leaves are sorted
+
+					float3 surfaceHitPos;
+					const float dotVal = dot(aSurfaces[nSurfaceIndex].normal.xyz, delta);
+					if (dotVal < 0 && IsSurfCrossed(nSurfaceIndex, start, end, surfaceHitPos))
+					{
+						nBestSurface = nSurfaceIndex;
+						hitPos = surfaceHitPos;
+						break;
+					}
+				}
 			}
 		}
 	}
+
+	const bool bResult = nBestSurface != 0xFFFFFFFF;
+	if (bResult)
+		nHitSurfaceIndex = nBestSurface;
 	return bResult;
 }
 
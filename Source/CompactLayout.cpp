@@ -0,0 +1,73 @@
+#include "CompactLayout.h"
+
+#include <algorithm>
+#include <cmath>
+
+static_assert(sizeof(SSurfaceHot) == 32 && sizeof(SSurfaceCold) == 32 && sizeof(SVertexCompact) == 8, "compact layout sizes");
+
+// quantization steps from the sector center to its farthest vertex
+static constexpr float kQuantizationSteps = 32767.0f;
+
+bool BuildCompactLayout(SBakeScene& scene)
+{
+	scene.surfaceHot.clear();
+	scene.surfaceCold.clear();
+	scene.vertexCompact.clear();
+	scene.sectorQuantization.clear();
+	if (scene.sectors.size() > kMaxCompactSectors)
+		return false;
+
+	scene.surfaceHot.resize(scene.surfaces.size());
+	scene.surfaceCold.resize(scene.surfaces.size());
+	for (size_t nSurfaceIndex = 0; nSurfaceIndex < scene.surfaces.size(); ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		scene.surfaceHot[nSurfaceIndex] = { surface.normal, surface.nFirstVertex, surface.nNumVertices, surface.nAdjoinSector, surface.nFlags };
+		scene.surfaceCold[nSurfaceIndex] = { surface.albedo, surface.emissive };
+	}
+
+	// the farthest vertex of every sector sets its step size
+	std::vector<float> sectorExtents(scene.sectors.size(), 0.0f);
+	for (const SVertex& vertex : scene.vertices)
+	{
+		const float4& center = scene.sectors[vertex.nSectorIndex].center;
+		const float extent = std::max(std::max(fabsf(vertex.position.x - center.x), fabsf(vertex.position.y - center.y)), fabsf(vertex.position.z - center.z));
+		sectorExtents[vertex.nSectorIndex] = std::max(sectorExtents[vertex.nSectorIndex], extent);
+	}
+
+	scene.sectorQuantization.resize(scene.sectors.size());
+	for (size_t nSectorIndex = 0; nSectorIndex < scene.sectors.size(); ++nSectorIndex)
+	{
+		const float4& center = scene.sectors[nSectorIndex].center;
+		const float step = sectorExtents[nSectorIndex] > 0.0f ? sectorExtents[nSectorIndex] / kQuantizationSteps : 1.0f;
+		scene.sectorQuantization[nSectorIndex] = { center.x, center.y, center.z, step };
+	}
+
+	auto quantize = [](float value, float center, float step)
+	{
+		return (int16_t)std::clamp(lroundf((value - center) / step), -32767l, 32767l);
+	};
+
+	scene.vertexCompact.resize(scene.vertices.size());
+	for (size_t nVertexIndex = 0; nVertexIndex < scene.vertices.size(); ++nVertexIndex)
+	{
+		const SVertex& vertex = scene.vertices[nVertexIndex];
+		const float4& quantization = scene.sectorQuantization[vertex.nSectorIndex];
+		SVertexCompact& compact = scene.vertexCompact[nVertexIndex];
+		compact.x = quantize(vertex.position.x, quantization.x, quantization.w);
+		compact.y = quantize(vertex.position.y, quantization.y, quantization.w);
+		compact.z = quantize(vertex.position.z, quantization.z, quantization.w);
+		compact.nSectorIndex = (uint16_t)vertex.nSectorIndex;
+	}
+	return true;
+}
+
+size_t GetTraceLayoutBytes(const SBakeScene& scene, bool bCompact)
+{
+	if (bCompact)
+	{
+		return scene.surfaceHot.size() * sizeof(SSurfaceHot) + scene.surfaceCold.size() * sizeof(SSurfaceCold)
+			+ scene.vertexCompact.size() * sizeof(SVertexCompact) + scene.sectorQuantization.size() * sizeof(float4);
+	}
+	return scene.surfaces.size() * sizeof(SSurface) + scene.vertices.size() * sizeof(SVertex);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Compact layout of the scene for the CPU tracer. The traversal only needs the plane, vertex range, adjoin and flags of a
+// surface (SSurfaceHot, 32 bytes instead of the 64 of SSurface), albedo and emissive are only read for the surfaces that
+// get hit (SSurfaceCold). The vertex positions used for the surface light interpolation are quantized to 16 bits around
+// their sector center (SVertexCompact, 8 bytes instead of 32). The hit tests still use the full precision edge planes,
+// only the interpolation weights change a little, so a compact bake isn't bit identical to a full one.
+
+#include "BakeScene.h"
+
+// sector indices of a compact vertex are 16 bits
+static constexpr int kMaxCompactSectors = 0x10000;
+
+// Fills the compact arrays of the scene from its surfaces, vertices and sectors, false (and empty arrays) if the level has
+// too many sectors. Run again after changing the geometry.
+bool BuildCompactLayout(SBakeScene& scene);
+
+// bytes of the arrays the tracer reads per surface and vertex, full or compact
+size_t GetTraceLayoutBytes(const SBakeScene& scene, bool bCompact);
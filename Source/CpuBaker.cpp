@@ -0,0 +1,636 @@
+#include "CpuBaker.h"
+#include "BakeProfile.h"
+#include "CpuTracer.h"
+#include "JobSystem.h"
+#include "SceneBuilder.h"
+#include "SectorVisibility.h"
+
+#include <algorithm>
+
+// vertices per range for cheap single ray passes and for the expensive many ray passes
+static constexpr int kCheapPassGrainSize = 256;
+static constexpr int kRayPassGrainSize = 16;
+
+// matches the integer precision the GPU uses for the atomic normal accumulation
+static constexpr float kNormalScale = 1024.0f;
+
+// Hemisphere rays of the work item's batch in the blocks nFirstBlock, nFirstBlock + 1, ... (up to kRayPacketSize of them)
+// of a vertex, the same rays the shaders generate one per thread (see GetBatchRayIndex)
+static void GenHemispherePacket(SRayPacket& packet, const SVertexData& vertexData, const STangentFrame& frame, const SBakeWorkItem& item, int nFirstBlock, int nNumRays)
+{
+	const int nRaySet = GetBatchRaySet(item.nRayOffset, item.nRayStride);
+	packet.nCount = 0;
+	for (int nBlock = nFirstBlock; nBlock < nFirstBlock + kRayPacketSize; ++nBlock)
+	{
+		const int nRayIndex = GetBatchRayIndex(nBlock, item.nRayOffset, item.nRayStride);
+		if (nRayIndex >= nNumRays)
+			break;
+
+		const float3 rayDir = TransformRay(GenRay(nRayIndex, nNumRays, nRaySet), frame);
+		const float3 rayTarget = kSkyDistance * rayDir + vertexData.vertex;
+		packet.Set(packet.nCount++, vertexData.vertex + rayDir * kRayBias, rayTarget);
+	}
+}
+
+// Shadow rays of the emissive samples in the same blocks, only for the samples that can light the vertex from a sector it
+// can see. A lane gets the light in paColors if its ray ends on the surface in paSurfaceIndices.
+static void GenEmissivePacket(SRayPacket& packet, int* paSurfaceIndices, float4* paColors, const SBakeScene& scene, const SVertexData& vertexData,
+	const uint32_t* paVisibleSectors, const SBakeWorkItem& item, int nFirstBlock, int nNumRays)
+{
+	const int nRaySet = GetBatchRaySet(item.nRayOffset, item.nRayStride);
+	packet.nCount = 0;
+	for (int nBlock = nFirstBlock; nBlock < nFirstBlock + kRayPacketSize; ++nBlock)
+	{
+		const int nRayIndex = GetBatchRayIndex(nBlock, item.nRayOffset, item.nRayStride);
+		if (nRayIndex >= nNumRays)
+			break;
+
+		float3 point;
+		int nSurfaceIndex;
+		float4 color;
+		if (!GenEmissiveSample(scene, vertexData, nRayIndex, nNumRays, nRaySet, point, nSurfaceIndex, color))
+			continue;
+
+		if (!TestMaskBit(paVisibleSectors, scene.vertices[scene.surfaces[nSurfaceIndex].nFirstVertex].nSectorIndex))
+			continue;
+
+		const float3 rayDir = normalize(point - vertexData.vertex);
+		paSurfaceIndices[packet.nCount] = nSurfaceIndex;
+		paColors[packet.nCount] = color;
+		packet.Set(packet.nCount++, vertexData.vertex + rayDir * kRayBias, point - rayDir * kRayBias);
+	}
+}
+
+// True if an emissive surface of the vertex sector, or of a sector behind one of its adjoins through the vertex, has the
+// vertex on its plane. The emissive samples skip those surfaces, the hemisphere rays have to gather them.
+static bool IsNextToEmissiveSurface(const SBakeScene& scene, const SVertexData& vertexData)
+{
+	const SSector& sector = scene.sectors[vertexData.nSectorIndex];
+	for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		if (!IsOnSurfacePlane(surface.normal, vertexData.vertex))
+			continue;
+
+		if (surface.nAdjoinSector < 0)
+		{
+			if ((surface.nFlags & ESurface_IsVisible) && surface.emissive.w > 0.0f)
+				return true;
+			continue;
+		}
+
+		const SSector& adjoinSector = scene.sectors[surface.nAdjoinSector];
+		for (uint32_t nAdjoinSurface = adjoinSector.nFirstSurface; nAdjoinSurface < adjoinSector.nFirstSurface + adjoinSector.nNumSurfaces; ++nAdjoinSurface)
+		{
+			const SSurface& other = scene.surfaces[nAdjoinSurface];
+			if (other.nAdjoinSector < 0 && (other.nFlags & ESurface_IsVisible) && other.emissive.w > 0.0f && IsOnSurfacePlane(other.normal, vertexData.vertex))
+				return true;
+		}
+	}
+	return false;
+}
+
+bool ComputeDirectLight(const CCpuTracer& tracer, const SLight& light, const SVertexData& vertexData, uint32_t nBakeFlags, float4& color,
+	STraceCounters* pCounters)
+{
+	const int nLightSectorIndex = light.nSectorIndex;
+	if (nLightSectorIndex < 0 || (light.nFlags & ELight_Sun) || (light.nFlags & ELight_Sky)) // invalid sector or a sun/sky light
+		return false;
+
+	if (!tracer.IsSectorVisible(nLightSectorIndex))
+		return false;
+
+	if (!tracer.IsLayerVisible(light.nLayerIndex))
+		return false;
+
+	const float3 lightDir = ToFloat3(light.position) - vertexData.vertex;
+	const float ndotl = dot(lightDir, vertexData.normal);
+	if (ndotl <= 0.0f)
+		return false;
+
+	const float rangeSqr = light.range * light.range;
+	const float dist2 = dot(lightDir, lightDir);
+	if (dist2 >= rangeSqr)
+		return false;
+
+	const float dist = sqrtf(dist2);
+	const float3 lightVec = lightDir / dist;
+
+	SRayPayload payload;
+	if (!(light.nFlags & ELight_NotBlocked))
+	{
+		if (nLightSectorIndex != vertexData.nSectorIndex)
+		{
+			const bool bRayHit = tracer.TraceRay(payload, vertexData.nSectorIndex, vertexData.vertex + lightDir * kRayBias, ToFloat3(light.position));
+			if (pCounters)
+				CountRay(*pCounters, payload);
+			if (bRayHit)
+				return false;
+		}
+	}
+
+	color = light.color * payload.attenuation;
+
+	const float atten = GetLightFalloff(light, dist2, nBakeFlags);
+	if (nBakeFlags & ELightBake_PhysicalFalloff)
+		color *= atten * std::clamp(dot(lightVec, vertexData.normal), 0.0f, 1.0f);
+	else
+		color *= atten;
+
+	return true;
+}
+
+float GetLightFalloff(const SLight& light, float dist2, uint32_t nBakeFlags)
+{
+	const float dist = sqrtf(dist2);
+	if (nBakeFlags & ELightBake_PhysicalFalloff) // new hotness hybrid with inverse square falloff
+	{
+		float atten = 1.0f / std::max(dist2, 0.001f);
+		float fade = std::clamp(1.0f - dist / light.range, 0.0f, 1.0f);
+		fade *= fade;
+		atten *= fade;
+		return atten;
+	}
+	else // old'n'busted linear falloff
+	{
+		float atten = (light.range - dist) / light.range;
+		atten *= atten;
+		return atten;
+	}
+}
+
+CCpuBaker::CCpuBaker(CJobSystem* pJobSystem)
+	: m_pJobSystem(pJobSystem)
+{
+}
+
+void CCpuBaker::Bake(SBakeScene& scene, int nIndirectBounces, std::vector<float4>& accumulation, const SBakeScheduleSettings& settings)
+{
+	BeginBake(scene, accumulation);
+
+	// without the weld pass every vertex is traced
+	if (!settings.bWeldVertices)
+	{
+		scene.vertexWelds.clear();
+		m_nNumTracedVertices = scene.levelInfo.nTotalVertices;
+	}
+
+	// one work item per pass by default
+	CBakeScheduler scheduler;
+	scheduler.Begin(scene.levelInfo, nIndirectBounces, settings);
+
+	CCpuBakeBackend backend(*this, scene, accumulation);
+	scheduler.Run(backend);
+}
+
+void CCpuBaker::BakeDirectPasses(SBakeScene& scene, std::vector<float4>& accumulation)
+{
+	BeginBake(scene, accumulation);
+
+	SLevelInfo levelInfo = scene.levelInfo;
+	levelInfo.nBakeFlags &= ~ELightBake_Indirect;
+
+	CBakeScheduler scheduler;
+	scheduler.Begin(levelInfo, 0, SBakeScheduleSettings());
+
+	CCpuBakeBackend backend(*this, scene, accumulation);
+	scheduler.Run(backend);
+}
+
+void CCpuBaker::BakeIndirect(SBakeScene& scene, int nIndirectBounces, std::vector<float4>& accumulation)
+{
+	// only the bounces, the normals are already smoothed
+	SLevelInfo levelInfo = scene.levelInfo;
+	levelInfo.nBakeFlags &= ELightBake_Indirect | ELightBake_Adaptive;
+	levelInfo.normalSmoothCos = 1.0f;
+
+	CBakeScheduler scheduler;
+	scheduler.Begin(levelInfo, nIndirectBounces, SBakeScheduleSettings());
+
+	CCpuBakeBackend backend(*this, scene, accumulation);
+	scheduler.Run(backend);
+}
+
+void CCpuBaker::BeginBake(const SBakeScene& scene, std::vector<float4>& accumulation)
+{
+	accumulation.assign(scene.levelInfo.nTotalVertices, float4(0,0,0,0));
+	m_colorLastResult.assign(scene.levelInfo.nTotalVertices, float4(0,0,0,0));
+	ResetRayStats();
+}
+
+void CCpuBaker::ResetRayStats()
+{
+	m_skyEmissiveRayStats = SRayPassStats();
+	m_indirectRayStats = SRayPassStats();
+
+	std::lock_guard<std::mutex> lock(m_traceCounterMutex);
+	for (STraceCounters& counters : m_traceCounters)
+		counters = STraceCounters();
+}
+
+STraceCounters CCpuBaker::GetTraceCounters(EBakePass ePass) const
+{
+	std::lock_guard<std::mutex> lock(m_traceCounterMutex);
+	return m_traceCounters[ePass];
+}
+
+void CCpuBaker::AddTraceCounters(EBakePass ePass, const STraceCounters& counters)
+{
+	std::lock_guard<std::mutex> lock(m_traceCounterMutex);
+	m_traceCounters[ePass] += counters;
+}
+
+void CCpuBaker::BeginRayPass(const SBakeScene& scene)
+{
+	const SVertexSampleStats emptyStats = { float4(0,0,0,0), 0.0f, 0.0f, 0, 0 };
+	m_sampleStats.assign(scene.levelInfo.nTotalVertices, emptyStats);
+}
+
+int64_t CCpuBaker::GetRayPassRays() const
+{
+	int64_t nRays = 0;
+	for (const SVertexSampleStats& stats : m_sampleStats)
+		nRays += stats.nRays;
+	return nRays;
+}
+
+void CCpuBaker::EndRayPass(EBakePass ePass)
+{
+	SRayPassStats& stats = (ePass == EBakePass_Indirect) ? m_indirectRayStats : m_skyEmissiveRayStats;
+	stats.Add(m_sampleStats.data(), (int)m_sampleStats.size());
+}
+
+// number of times the smoothing of a vertex in nSectorIndex adds a vertex of nOtherSector, once per adjoin into it
+static int GetSmoothAdjoinCount(const SBakeScene& scene, uint32_t nSectorIndex, uint32_t nOtherSector)
+{
+	const SSector& sector = scene.sectors[nSectorIndex];
+	int nCount = 0;
+	for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+		nCount += scene.surfaces[nSurfaceIndex].nAdjoinSector == (int32_t)nOtherSector;
+	return nCount;
+}
+
+void CCpuBaker::ComputeSmoothNormals(SBakeScene& scene)
+{
+	const float normalSmoothCos = scene.levelInfo.normalSmoothCos;
+	const std::vector<SSurface>& surfaces = scene.surfaces;
+	const std::vector<SVertex>& vertices = scene.vertices;
+	std::vector<int4>& normals = scene.normals;
+
+	BuildVertexHash(scene, m_vertexHash);
+
+	// Every vertex adds the normals of the vertices in range in its own sector and in the sectors it adjoins (once per
+	// adjoin). A vertex only writes its own normal so they can run in parallel, the integer sums don't depend on the order.
+	m_pJobSystem->ParallelFor((int)vertices.size(), kCheapPassGrainSize, [&](int nBegin, int nEnd)
+	{
+		for (int nVertexIndex0 = nBegin; nVertexIndex0 < nEnd; ++nVertexIndex0)
+		{
+			const SVertex& vertex0 = vertices[nVertexIndex0];
+			const float3 position0 = ToFloat3(vertex0.position);
+			const float3 normal0 = ToFloat3(surfaces[vertex0.nSurfaceIndex].normal);
+			const int32_t x = GetVertexHashCoord(position0.x);
+			const int32_t y = GetVertexHashCoord(position0.y);
+			const int32_t z = GetVertexHashCoord(position0.z);
+
+			int4 sum = { 0, 0, 0, 0 };
+			for (int32_t nCellZ = z - 1; nCellZ <= z + 1; ++nCellZ)
+			{
+				for (int32_t nCellY = y - 1; nCellY <= y + 1; ++nCellY)
+				{
+					for (int32_t nCellX = x - 1; nCellX <= x + 1; ++nCellX)
+					{
+						const SVertexHashCell* pCell = FindVertexHashCell(m_vertexHash, nCellX, nCellY, nCellZ);
+						if (!pCell)
+							continue;
+
+						for (uint32_t nEntry = pCell->nFirst; nEntry < pCell->nFirst + pCell->nCount; ++nEntry)
+						{
+							const uint32_t nVertexIndex1 = m_vertexHash.vertices[nEntry];
+							const SVertex& vertex1 = vertices[nVertexIndex1];
+							const int nCount = (vertex1.nSectorIndex == vertex0.nSectorIndex) ? (nVertexIndex1 != (uint32_t)nVertexIndex0)
+								: GetSmoothAdjoinCount(scene, vertex0.nSectorIndex, vertex1.nSectorIndex);
+							if (nCount == 0)
+								continue;
+
+							const float3 diff = ToFloat3(vertex1.position) - position0;
+							const float3 normal1 = ToFloat3(surfaces[vertex1.nSurfaceIndex].normal);
+							if (dot(diff, diff) < kSmoothDistanceSqr && dot(normal0, normal1) > normalSmoothCos)
+							{
+								sum.x += nCount * int(normal1.x * kNormalScale);
+								sum.y += nCount * int(normal1.y * kNormalScale);
+								sum.z += nCount * int(normal1.z * kNormalScale);
+							}
+						}
+					}
+				}
+			}
+
+			normals[nVertexIndex0].x += sum.x;
+			normals[nVertexIndex0].y += sum.y;
+			normals[nVertexIndex0].z += sum.z;
+		}
+	});
+}
+
+void CCpuBaker::WeldVertices(SBakeScene& scene)
+{
+	m_nNumTracedVertices = BuildVertexWelds(scene);
+}
+
+void CCpuBaker::BakeSun(const SBakeScene& scene, std::vector<float4>& accumulation, const SBakeWorkItem& item)
+{
+	const CCpuTracer tracer(scene, m_colorLastResult.data());
+	const SLevelInfo& levelInfo = scene.levelInfo;
+
+	float3 sunPos = ToFloat3(scene.lights[levelInfo.nSunLightIndex].position);
+	if (levelInfo.nAnchorLightIndex >= 0)
+		sunPos -= ToFloat3(scene.lights[levelInfo.nAnchorLightIndex].position);
+
+	const float3 rayDir = normalize(sunPos);
+	const float4 sunColor = scene.lights[levelInfo.nSunLightIndex].color;
+
+	m_pJobSystem->ParallelFor(item.nNumVertices, kCheapPassGrainSize, [&](int nBegin, int nEnd)
+	{
+		STraceCounters counters;
+		for (int nVertexIndex = item.nFirstVertex + nBegin; nVertexIndex < item.nFirstVertex + nEnd; ++nVertexIndex)
+		{
+			SVertexData vertexData;
+			if (!tracer.GetVertexData(vertexData, nVertexIndex))
+				continue;
+
+			const float ndotl = dot(vertexData.normal, rayDir);
+			if (ndotl <= 0)
+				continue;
+
+			const float3 rayTarget = kSkyDistance * rayDir + vertexData.vertex;
+
+			float4 color = { 0,0,0,0 };
+			SRayPayload payload;
+			const bool bRayHit = tracer.TraceRay(payload, vertexData.nSectorIndex, vertexData.vertex + rayDir * kRayBias, rayTarget);
+			CountRay(counters, payload);
+			if (bRayHit && (tracer.GetSurfaceHot(payload.nHitSurfaceIndex).nFlags & ESurface_IsSky))
+				color = ndotl * payload.attenuation * sunColor;
+
+			// sun is the first pass so don't bother reading the previous result
+			accumulation[nVertexIndex] = color;
+		}
+		AddTraceCounters(EBakePass_Sun, counters);
+	});
+}
+
+void CCpuBaker::BakeDirect(const SBakeScene& scene, std::vector<float4>& accumulation, const SBakeWorkItem& item)
+{
+	const CCpuTracer tracer(scene, m_colorLastResult.data());
+	const SLevelInfo& levelInfo = scene.levelInfo;
+
+	// without the light lists every vertex goes over all lights
+	const bool bLightLists = scene.sectorLightOffsets.size() == scene.sectors.size() + 1;
+
+	m_pJobSystem->ParallelFor(item.nNumVertices, kRayPassGrainSize, [&](int nBegin, int nEnd)
+	{
+		STraceCounters counters;
+		for (int nVertexIndex = item.nFirstVertex + nBegin; nVertexIndex < item.nFirstVertex + nEnd; ++nVertexIndex)
+		{
+			SVertexData vertexData;
+			if (!tracer.GetVertexData(vertexData, nVertexIndex))
+				continue;
+
+			const uint32_t nFirstEntry = bLightLists ? scene.sectorLightOffsets[vertexData.nSectorIndex] : 0;
+			const uint32_t nEndEntry = bLightLists ? scene.sectorLightOffsets[vertexData.nSectorIndex + 1] : (uint32_t)levelInfo.nTotalLights;
+
+			float4 localAcc = { 0,0,0,0 };
+			for (uint32_t nEntry = nFirstEntry; nEntry < nEndEntry; ++nEntry)
+			{
+				const uint32_t nLightIndex = bLightLists ? scene.sectorLights[nEntry] : nEntry;
+
+				float4 color;
+				if (ComputeDirectLight(tracer, scene.lights[nLightIndex], vertexData, levelInfo.nBakeFlags, color, &counters))
+					localAcc += color;
+			}
+
+			accumulation[nVertexIndex] += localAcc;
+		}
+		AddTraceCounters(EBakePass_Direct, counters);
+	});
+}
+
+void CCpuBaker::BakeSkyEmissive(const SBakeScene& scene, std::vector<float4>& accumulation, const SBakeWorkItem& item)
+{
+	const CCpuTracer tracer(scene, m_colorLastResult.data());
+	const SLevelInfo& levelInfo = scene.levelInfo;
+	const int nNumRays = levelInfo.nSkyEmissiveRays;
+
+	// with emissive surfaces to sample every ray also samples an emissive point, the hemisphere rays only gather the sky and
+	// the emissive surfaces whose plane goes through the vertex (see GenEmissiveSample)
+	const bool bEmissiveSamples = (levelInfo.nBakeFlags & ELightBake_Emissive) && !scene.emissiveSurfaces.empty();
+
+	m_pJobSystem->ParallelFor(item.nNumVertices, kRayPassGrainSize, [&](int nBegin, int nEnd)
+	{
+		STraceCounters counters;
+		std::vector<uint32_t> visibleSectors(GetMaskBucketCount((int)scene.sectors.size()));
+		for (int nVertexIndex = item.nFirstVertex + nBegin; nVertexIndex < item.nFirstVertex + nEnd; ++nVertexIndex)
+		{
+			SVertexData vertexData;
+			if (!tracer.GetVertexData(vertexData, nVertexIndex))
+				continue;
+
+			// the adaptive bake is done with this vertex for the pass
+			SVertexSampleStats& stats = m_sampleStats[nVertexIndex];
+			if (IsSampleConverged(stats, accumulation[nVertexIndex], levelInfo))
+				continue;
+
+			const STangentFrame frame = GenerateTangentFrame(vertexData.normal);
+			const bool bNextToEmissive = bEmissiveSamples && IsNextToEmissiveSurface(scene, vertexData);
+			const bool bHemisphereRays = (levelInfo.nBakeFlags & ELightBake_Sky) || !bEmissiveSamples || bNextToEmissive;
+			if (bEmissiveSamples)
+			{
+				std::fill(visibleSectors.begin(), visibleSectors.end(), 0u);
+				AddVisibleSectors(scene, vertexData.nSectorIndex, visibleSectors.data());
+			}
+
+			float4 localAcc = { 0,0,0,0 };
+			for (int nFirstBlock = 0; nFirstBlock * item.nRayStride < nNumRays; nFirstBlock += kRayPacketSize)
+			{
+				SRayPacket packet;
+				SRayPayload aPayloads[kRayPacketSize];
+				if (bHemisphereRays)
+				{
+					GenHemispherePacket(packet, vertexData, frame, item, nFirstBlock, nNumRays);
+
+					const int nHitMask = tracer.TraceRayPacket(aPayloads, vertexData.nSectorIndex, packet);
+					for (int nLane = 0; nLane < packet.nCount; ++nLane)
+					{
+						const SRayPayload& payload = aPayloads[nLane];
+						const bool bRayHit = (nHitMask & (1 << nLane)) != 0;
+						CountRay(counters, payload);
+						if (!bRayHit)
+							continue;
+
+						float4 color = { 0,0,0,0 };
+						const uint32_t hitFlags = tracer.GetSurfaceHot(payload.nHitSurfaceIndex).nFlags;
+						if ((levelInfo.nBakeFlags & ELightBake_Sky) && (hitFlags & ESurface_IsSky))
+							color = scene.lights[levelInfo.nSkyLightIndex].color;
+						else if ((levelInfo.nBakeFlags & ELightBake_Emissive) && (hitFlags & ESurface_IsVisible)
+							&& (!bEmissiveSamples || IsOnSurfacePlane(tracer.GetSurfaceHot(payload.nHitSurfaceIndex).normal, vertexData.vertex)))
+							color = tracer.GetSurfaceCold(payload.nHitSurfaceIndex).emissive;
+
+						localAcc += color * payload.attenuation;
+					}
+				}
+
+				if (bEmissiveSamples)
+				{
+					int anSurfaceIndices[kRayPacketSize];
+					float4 aColors[kRayPacketSize];
+					GenEmissivePacket(packet, anSurfaceIndices, aColors, scene, vertexData, visibleSectors.data(), item, nFirstBlock, nNumRays);
+
+					const int nHitMask = tracer.TraceRayPacket(aPayloads, vertexData.nSectorIndex, packet);
+					for (int nLane = 0; nLane < packet.nCount; ++nLane)
+					{
+						const SRayPayload& payload = aPayloads[nLane];
+						CountRay(counters, payload);
+						if ((nHitMask & (1 << nLane)) && payload.nHitSurfaceIndex == anSurfaceIndices[nLane])
+							localAcc += aColors[nLane] * payload.attenuation;
+					}
+				}
+			}
+
+			// running mean of the pass over the batches so far, replaces the estimate of the previous batches
+			const float4 prevMean = stats.mean;
+			AddSampleBatch(stats, localAcc, GetBatchRayCount(nNumRays, item.nRayOffset, item.nRayStride));
+			accumulation[nVertexIndex] += stats.mean - prevMean;
+		}
+		AddTraceCounters(EBakePass_SkyEmissive, counters);
+	});
+}
+
+void CCpuBaker::BeginIndirectBounce(const std::vector<float4>& accumulation, int nBounce)
+{
+	// Copy the direct light result for the first bounce
+	if (nBounce == 0)
+		m_colorLastResult = accumulation;
+
+	// clear the buffer for the next bounce accumulation
+	m_colorCurrResult.assign(accumulation.size(), float4(0,0,0,0));
+}
+
+void CCpuBaker::EndIndirectBounce()
+{
+	std::swap(m_colorLastResult, m_colorCurrResult);
+}
+
+void CCpuBaker::BakeIndirect(const SBakeScene& scene, std::vector<float4>& accumulation, const SBakeWorkItem& item)
+{
+	const SLevelInfo& levelInfo = scene.levelInfo;
+	const int nNumRays = levelInfo.nIndirectRays;
+
+	const CCpuTracer tracer(scene, m_colorLastResult.data());
+	m_pJobSystem->ParallelFor(item.nNumVertices, kRayPassGrainSize, [&](int nBegin, int nEnd)
+	{
+		STraceCounters counters;
+		for (int nVertexIndex = item.nFirstVertex + nBegin; nVertexIndex < item.nFirstVertex + nEnd; ++nVertexIndex)
+		{
+			SVertexData vertexData;
+			if (!tracer.GetVertexData(vertexData, nVertexIndex))
+				continue;
+
+			// the adaptive bake is done with this vertex for the pass
+			SVertexSampleStats& stats = m_sampleStats[nVertexIndex];
+			if (IsSampleConverged(stats, accumulation[nVertexIndex], levelInfo))
+				continue;
+
+			const STangentFrame frame = GenerateTangentFrame(vertexData.normal);
+
+			float4 localAcc = { 0,0,0,0 };
+			for (int nFirstBlock = 0; nFirstBlock * item.nRayStride < nNumRays; nFirstBlock += kRayPacketSize)
+			{
+				SRayPacket packet;
+				GenHemispherePacket(packet, vertexData, frame, item, nFirstBlock, nNumRays);
+
+				SRayPayload aPayloads[kRayPacketSize];
+				const int nHitMask = tracer.TraceRayPacket(aPayloads, vertexData.nSectorIndex, packet);
+				for (int nLane = 0; nLane < packet.nCount; ++nLane)
+				{
+					const SRayPayload& payload = aPayloads[nLane];
+					const bool bRayHit = (nHitMask & (1 << nLane)) != 0;
+					CountRay(counters, payload);
+					if (bRayHit && (tracer.GetSurfaceHot(payload.nHitSurfaceIndex).nFlags & ESurface_IsVisible))
+					{
+						const float4 surfaceLight = tracer.InterpolateSurfaceLight(payload.nHitSurfaceIndex, payload.hitPos);
+
+						float4 color = tracer.GetSurfaceCold(payload.nHitSurfaceIndex).albedo * surfaceLight;
+						color = color * payload.attenuation + payload.reflection;
+
+						localAcc += color * payload.attenuation;
+					}
+				}
+			}
+
+			// running mean of the bounce over the batches so far
+			const float4 prevMean = stats.mean;
+			AddSampleBatch(stats, localAcc, GetBatchRayCount(nNumRays, item.nRayOffset, item.nRayStride));
+
+			// store for next bounce
+			m_colorCurrResult[nVertexIndex] = stats.mean;
+
+			// accumulate this bounce, replacing the estimate of the previous batches
+			accumulation[nVertexIndex] += stats.mean - prevMean;
+		}
+		AddTraceCounters(EBakePass_Indirect, counters);
+	});
+}
+
+CCpuBakeBackend::CCpuBakeBackend(CCpuBaker& baker, SBakeScene& scene, std::vector<float4>& accumulation)
+	: m_baker(baker)
+	, m_scene(scene)
+	, m_accumulation(accumulation)
+{
+}
+
+void CCpuBakeBackend::BeginPass(EBakePass ePass, int nBounce)
+{
+	CScopedBakeTimer timer(m_baker.GetProfile(), ePass, nBounce);
+	m_passStartCounters = m_baker.GetTraceCounters(ePass);
+
+	if (ePass == EBakePass_Indirect)
+		m_baker.BeginIndirectBounce(m_accumulation, nBounce);
+
+	if (ePass == EBakePass_SkyEmissive || ePass == EBakePass_Indirect)
+		m_baker.BeginRayPass(m_scene);
+}
+
+void CCpuBakeBackend::Run(const SBakeWorkItem& item)
+{
+	CScopedBakeTimer timer(m_baker.GetProfile(), item.ePass, item.nBounce);
+	switch (item.ePass)
+	{
+	case EBakePass_SmoothNormals: m_baker.ComputeSmoothNormals(m_scene); break;
+	case EBakePass_WeldVertices:  m_baker.WeldVertices(m_scene); break;
+	case EBakePass_Sun:           m_baker.BakeSun(m_scene, m_accumulation, item); break;
+	case EBakePass_Direct:        m_baker.BakeDirect(m_scene, m_accumulation, item); break;
+	case EBakePass_SkyEmissive:   m_baker.BakeSkyEmissive(m_scene, m_accumulation, item); break;
+	case EBakePass_Indirect:      m_baker.BakeIndirect(m_scene, m_accumulation, item); break;
+	}
+}
+
+void CCpuBakeBackend::EndPass(EBakePass ePass, int nBounce)
+{
+	CScopedBakeTimer timer(m_baker.GetProfile(), ePass, nBounce);
+	if (SBakeProfile* pProfile = m_baker.GetProfile())
+	{
+		SBakeStageProfile& stage = pProfile->GetPass(ePass, nBounce);
+		stage.counters += m_baker.GetTraceCounters(ePass);
+		stage.counters -= m_passStartCounters;
+		stage.bCountedHops = true;
+	}
+
+	// the light passes only wrote the traced vertices
+	if (ePass != EBakePass_SmoothNormals && ePass != EBakePass_WeldVertices)
+		ScatterWeldedVertices(m_scene, m_accumulation);
+
+	if (ePass == EBakePass_SkyEmissive || ePass == EBakePass_Indirect)
+		m_baker.EndRayPass(ePass);
+
+	if (ePass == EBakePass_Indirect)
+		m_baker.EndIndirectBounce();
+}
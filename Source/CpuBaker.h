@@ -0,0 +1,121 @@
+#pragma once
+
+// CPU implementation of the bake passes, mirrors the compute shaders dispatched by CLightBakerDlg so it
+// produces the same results on machines without a (usable) GPU
+
+#include <mutex>
+#include <vector>
+
+#include "BakeScene.h"
+#include "BakeScheduler.h"
+#include "VertexHash.h"
+
+class CCpuTracer;
+class CJobSystem;
+struct SBakeProfile;
+struct SVertexData;
+
+// Light of a single point light at a vertex, the body of the light loop in BakeDirect (BakeDirect.hlsl)
+// returns false if the light doesn't reach the vertex, sun and sky lights are never direct lights
+// the shadow ray is added to pCounters if there is one
+bool ComputeDirectLight(const CCpuTracer& tracer, const SLight& light, const SVertexData& vertexData, uint32_t nBakeFlags, float4& color,
+	STraceCounters* pCounters = nullptr);
+
+// distance falloff of a point light at dist2 (squared), without the cosine of the physical falloff
+float GetLightFalloff(const SLight& light, float dist2, uint32_t nBakeFlags);
+
+class CCpuBaker
+{
+public:
+	explicit CCpuBaker(CJobSystem* pJobSystem);
+
+	// runs every pass enabled in scene.levelInfo.nBakeFlags, the result is the accumulated light per vertex
+	void Bake(SBakeScene& scene, int nIndirectBounces, std::vector<float4>& accumulation, const SBakeScheduleSettings& settings = SBakeScheduleSettings());
+
+	// everything up to the indirect bounces (smooth normals, sun, lights, sky and emissive), indirect light starts from this
+	void BakeDirectPasses(SBakeScene& scene, std::vector<float4>& accumulation);
+
+	// the indirect bounces on top of the direct light in accumulation
+	void BakeIndirect(SBakeScene& scene, int nIndirectBounces, std::vector<float4>& accumulation);
+
+	// clears accumulation and the pass results before the first work item of a bake
+	void BeginBake(const SBakeScene& scene, std::vector<float4>& accumulation);
+
+	// work items of the individual passes (see CBakeScheduler), equivalent to the shaders of the same name
+	void ComputeSmoothNormals(SBakeScene& scene);
+	void WeldVertices(SBakeScene& scene);
+	void BakeSun(const SBakeScene& scene, std::vector<float4>& accumulation, const SBakeWorkItem& item);
+	void BakeDirect(const SBakeScene& scene, std::vector<float4>& accumulation, const SBakeWorkItem& item);
+	void BakeSkyEmissive(const SBakeScene& scene, std::vector<float4>& accumulation, const SBakeWorkItem& item);
+	void BakeIndirect(const SBakeScene& scene, std::vector<float4>& accumulation, const SBakeWorkItem& item);
+
+	// the first bounce starts from the direct light in accumulation, every bounce starts from the result of the last one
+	void BeginIndirectBounce(const std::vector<float4>& accumulation, int nBounce);
+	void EndIndirectBounce();
+
+	// what the next bounce reads, the result of the last bounce after EndIndirectBounce. A distributed bake replaces it
+	// with the gathered result of every worker before the next bounce (see DistributedBake.h)
+	std::vector<float4>& GetBounceColors() { return m_colorLastResult; }
+
+	// the sky/emissive pass and every indirect bounce start with fresh sample stats, the rays traced are added up at the end
+	void BeginRayPass(const SBakeScene& scene);
+	void EndRayPass(EBakePass ePass);
+	int64_t GetRayPassRays() const; // rays traced by the ray pass in progress
+
+	// rays per vertex of the ray passes since the last BeginBake (or ResetRayStats)
+	void ResetRayStats();
+	const SRayPassStats& GetSkyEmissiveRayStats() const { return m_skyEmissiveRayStats; }
+	const SRayPassStats& GetIndirectRayStats() const { return m_indirectRayStats; }
+
+	// rays of a pass since the last BeginBake (or ResetRayStats), the indirect pass sums up every bounce
+	STraceCounters GetTraceCounters(EBakePass ePass) const;
+
+	// vertices traced by the passes after the last WeldVertices
+	int GetNumTracedVertices() const { return m_nNumTracedVertices; }
+
+	// the passes run through a CCpuBakeBackend add their time and rays to the profile, null to stop profiling
+	void SetProfile(SBakeProfile* pProfile) { m_pProfile = pProfile; }
+	SBakeProfile* GetProfile() const { return m_pProfile; }
+
+private:
+	CJobSystem*   m_pJobSystem;
+	SBakeProfile* m_pProfile = nullptr;
+
+	// the previous pass result (aVertexColors), all zero for the direct passes
+	std::vector<float4> m_colorLastResult;
+	std::vector<float4> m_colorCurrResult;
+
+	// running estimate per vertex of the ray pass in progress (aSampleStats)
+	std::vector<SVertexSampleStats> m_sampleStats;
+
+	SRayPassStats m_skyEmissiveRayStats;
+	SRayPassStats m_indirectRayStats;
+
+	// added once per range of vertices
+	void AddTraceCounters(EBakePass ePass, const STraceCounters& counters);
+	mutable std::mutex m_traceCounterMutex;
+	STraceCounters     m_traceCounters[kNumBakePasses];
+
+	int m_nNumTracedVertices = 0;
+
+	// kept between bakes for its allocations
+	SVertexHash m_vertexHash;
+};
+
+// Runs the work items of a CBakeScheduler on the CPU
+class CCpuBakeBackend : public IBakeBackend
+{
+public:
+	CCpuBakeBackend(CCpuBaker& baker, SBakeScene& scene, std::vector<float4>& accumulation);
+
+	void BeginPass(EBakePass ePass, int nBounce) override;
+	void Run(const SBakeWorkItem& item) override;
+	void EndPass(EBakePass ePass, int nBounce) override;
+	int64_t GetPassRays() override { return m_baker.GetRayPassRays(); }
+
+private:
+	CCpuBaker&           m_baker;
+	SBakeScene&          m_scene;
+	std::vector<float4>& m_accumulation;
+	STraceCounters       m_passStartCounters; // of the profiled pass in progress
+};
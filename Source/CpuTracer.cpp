@@ -0,0 +1,677 @@
+#include "CpuTracer.h"
+#include "SectorBvh.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+
+// the tracer reads the full surfaces through the compact structs
+static_assert(offsetof(SSurface, albedo) == offsetof(SSurfaceCold, albedo) && offsetof(SSurface, emissive) == offsetof(SSurfaceCold, emissive), "SSurfaceCold has to mirror the head of SSurface");
+static_assert(offsetof(SSurface, normal) == sizeof(SSurfaceCold) && sizeof(SSurface) == sizeof(SSurfaceCold) + sizeof(SSurfaceHot), "SSurfaceHot has to mirror the tail of SSurface");
+static_assert(offsetof(SSurface, nFlags) - offsetof(SSurface, normal) == offsetof(SSurfaceHot, nFlags), "SSurfaceHot has to mirror the tail of SSurface");
+
+STangentFrame GenerateTangentFrame(const float3& normal)
+{
+	const float3 up = fabsf(normal.z) < 0.999f ? float3(0,0,1) : float3(1,0,0);
+	const float3 tangent = normalize(cross(up, normal));
+	const float3 binormal = cross(normal, tangent);
+	return { tangent, binormal, normal };
+}
+
+// van der Corput radical inverse, the second coordinate of the hammersley sequence
+static float RadicalInverse(int N)
+{
+	uint32_t bits = (uint32_t)N;
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return (float)bits * 2.3283064365386963e-10f; // / 0x100000000
+}
+
+// largest float below 1, keeps the sample numbers in [0,1)
+static constexpr float kOneBelowOne = 0.99999994f;
+
+// offset of ray set n of an adaptive pass, the points of the R2 sequence are spread evenly for any number of sets
+static void GetRaySetShift(int nRaySet, float& shiftU, float& shiftV)
+{
+	shiftU = (float)nRaySet * 0.7548777f;
+	shiftV = (float)nRaySet * 0.5698403f;
+	shiftU -= floorf(shiftU);
+	shiftV -= floorf(shiftV);
+}
+
+float3 GenRay(int N, int M, int nRaySet)
+{
+	float shiftU, shiftV;
+	GetRaySetShift(nRaySet, shiftU, shiftV);
+	float v = RadicalInverse(N) + shiftV;
+	float u = ((float)N + shiftU) / (float)M;
+	v -= floorf(v);
+
+	u = 0.0001f + (1.0f - 0.0001f) * u;
+	const float phi = v * 2.0f * 3.141592f;
+	const float cosTheta = sqrtf(1.0f - u);
+	const float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+	return float3(cosf(phi) * sinTheta, sinf(phi) * sinTheta, cosTheta);
+}
+
+float3 GenSphereRay(int N, int M)
+{
+	const float phi = RadicalInverse(N) * 2.0f * 3.141592f;
+	const float cosTheta = 1.0f - 2.0f * ((float)N + 0.5f) / (float)M;
+	const float sinTheta = sqrtf(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+	return float3(cosf(phi) * sinTheta, sinf(phi) * sinTheta, cosTheta);
+}
+
+bool GenEmissiveSample(const SBakeScene& scene, const SVertexData& vertexData, int N, int M, int nRaySet, float3& point, int& nSurfaceIndex, float4& color)
+{
+	// per vertex offset of the sample points (Cranley-Patterson rotation), neighbouring vertices don't see the same points
+	uint32_t hash = (uint32_t)vertexData.nVertexIndex * 0x9E3779B9u;
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	float shiftU, shiftV;
+	GetRaySetShift(nRaySet, shiftU, shiftV);
+	float u = ((float)N + 0.5f) / (float)M + (float)(hash & 0xFFFFu) * (1.0f / 65536.0f) + shiftU;
+	float v = RadicalInverse(N) + (float)(hash >> 16) * (1.0f / 65536.0f) + shiftV;
+	u = std::min(u - floorf(u), kOneBelowOne);
+	v = std::min(v - floorf(v), kOneBelowOne);
+
+	// the surface by its power, u is stretched over the surface's part of the CDF for the next choice
+	const SEmissiveSurface* paEmissive = scene.emissiveSurfaces.data();
+	const int nNumEmissive = (int)scene.emissiveSurfaces.size();
+	const SEmissiveSurface* pEmissive = std::upper_bound(paEmissive, paEmissive + nNumEmissive - 1, u,
+		[](float value, const SEmissiveSurface& emissive) { return value < emissive.powerCdf; });
+	const float powerLower = pEmissive > paEmissive ? pEmissive[-1].powerCdf : 0.0f;
+	u = std::min((u - powerLower) / std::max(pEmissive->powerCdf - powerLower, 1e-12f), kOneBelowOne);
+
+	// the triangle by its area, then uniform within it
+	const SSurface& surface = scene.surfaces[pEmissive->nSurfaceIndex];
+	const float* paTriangleCdf = &scene.emissiveTriangleCdf[pEmissive->nFirstTriangle];
+	const uint32_t nTriangle = (uint32_t)(std::upper_bound(paTriangleCdf, paTriangleCdf + surface.nNumVertices - 3, u) - paTriangleCdf);
+	const float areaLower = nTriangle > 0 ? paTriangleCdf[nTriangle - 1] : 0.0f;
+	u = std::min((u - areaLower) / std::max(paTriangleCdf[nTriangle] - areaLower, 1e-12f), kOneBelowOne);
+
+	const float su = sqrtf(u);
+	const SVertex* paVertices = &scene.vertices[surface.nFirstVertex];
+	point = ToFloat3(paVertices[0].position) * (1.0f - su) + ToFloat3(paVertices[nTriangle + 1].position) * (su * (1.0f - v))
+		+ ToFloat3(paVertices[nTriangle + 2].position) * (su * v);
+	nSurfaceIndex = (int)pEmissive->nSurfaceIndex;
+	if (IsOnSurfacePlane(surface.normal, vertexData.vertex))
+		return false;
+
+	const float3 toPoint = point - vertexData.vertex;
+	const float distSqr = dot(toPoint, toPoint);
+	if (distSqr <= 0.0f)
+		return false;
+
+	const float3 rayDir = toPoint / sqrtf(distSqr);
+	const float cosVertex = dot(vertexData.normal, rayDir);
+	const float cosSurface = -dot(ToFloat3(surface.normal), rayDir);
+	if (cosVertex <= 0.0f || cosSurface <= 0.0f)
+		return false;
+
+	// the hemisphere rays average the light, which is the cosine weighted integral over pi, same clamp as the point lights
+	color = surface.emissive * (cosVertex * cosSurface * pEmissive->inversePdf / (3.141592f * std::max(distSqr, 0.001f)));
+	return true;
+}
+
+bool IsOnSurfacePlane(const float4& plane, const float3& point)
+{
+	return fabsf(dot(ToFloat3(plane), point) - plane.w) < kEmissivePlaneEpsilon;
+}
+
+float GetSampleLuminance(const float4& color)
+{
+	const float lum = color.x * 0.2126f + color.y * 0.7152f + color.z * 0.0722f;
+	return lum > color.w ? lum : color.w;
+}
+
+bool IsSampleConverged(const SVertexSampleStats& stats, const float4& vertexLight, const SLevelInfo& levelInfo)
+{
+	if (!(levelInfo.nBakeFlags & ELightBake_Adaptive) || stats.nBatches < kAdaptiveMinBatches || stats.nRays < levelInfo.nMinAdaptiveRays)
+		return false;
+
+	// variance of the batch means, the error of the pass mean shrinks with the number of batches
+	const float nBatches = (float)stats.nBatches;
+	const float meanLum = stats.lumSum / nBatches;
+	const float variance = std::max(stats.lumSqSum / nBatches - meanLum * meanLum, 0.0f) * nBatches / (nBatches - 1.0f);
+	const float error = kAdaptiveConfidence * sqrtf(variance / nBatches);
+
+	// the error shows against all the light of the vertex, a pass that adds little to a bright vertex is done sooner
+	return error <= levelInfo.adaptiveThreshold * GetSampleLuminance(vertexLight) + kAdaptiveTolerance;
+}
+
+void AddSampleBatch(SVertexSampleStats& stats, const float4& batchSum, int nBatchRays)
+{
+	if (nBatchRays <= 0)
+		return;
+
+	stats.mean += (batchSum - stats.mean * (float)nBatchRays) / (float)(stats.nRays + nBatchRays);
+
+	const float lum = GetSampleLuminance(batchSum / (float)nBatchRays);
+	stats.lumSum += lum;
+	stats.lumSqSum += lum * lum;
+	stats.nRays += nBatchRays;
+	stats.nBatches += 1;
+}
+
+CCpuTracer::CCpuTracer(const SBakeScene& scene, const float4* paVertexColors)
+	: m_scene(scene)
+	, m_paVertexColors(paVertexColors)
+{
+	if (!scene.surfaceHot.empty())
+	{
+		m_pSurfaceHot = (const uint8_t*)scene.surfaceHot.data();
+		m_pSurfaceCold = (const uint8_t*)scene.surfaceCold.data();
+		m_nSurfaceStride = sizeof(SSurfaceHot);
+		m_paVertexCompact = scene.vertexCompact.data();
+	}
+	else
+	{
+		m_pSurfaceHot = (const uint8_t*)scene.surfaces.data() + offsetof(SSurface, normal);
+		m_pSurfaceCold = (const uint8_t*)scene.surfaces.data();
+		m_nSurfaceStride = sizeof(SSurface);
+		m_paVertexCompact = nullptr;
+	}
+}
+
+bool CCpuTracer::IsSectorVisible(int nSectorIndex) const
+{
+	return TestMaskBit(m_scene.sectorMasks.data(), nSectorIndex);
+}
+
+bool CCpuTracer::IsLayerVisible(int nLayerIndex) const
+{
+	return TestMaskBit(m_scene.layerMasks.data(), nLayerIndex);
+}
+
+bool CCpuTracer::IsSurfaceVisible(int nSurfaceIndex) const
+{
+	return (GetSurfaceHot(nSurfaceIndex).nFlags & ESurface_IsVisible) != 0;
+}
+
+bool CCpuTracer::GetVertexData(SVertexData& vertexData, int nVertexIndex) const
+{
+	if (nVertexIndex >= m_scene.levelInfo.nTotalVertices)
+		return false;
+
+	// welded vertices get the light of the vertex traced in their place
+	if (!m_scene.vertexWelds.empty() && m_scene.vertexWelds[nVertexIndex] != (uint32_t)nVertexIndex)
+		return false;
+
+	const SVertex& vertex = m_scene.vertices[nVertexIndex];
+	const int4& normal = m_scene.normals[nVertexIndex];
+
+	vertexData.nVertexIndex = nVertexIndex;
+	vertexData.nSectorIndex = vertex.nSectorIndex;
+	vertexData.nLayerIndex = m_scene.sectors[vertexData.nSectorIndex].nLayerIndex;
+	vertexData.nSurfaceIndex = vertex.nSurfaceIndex;
+	vertexData.vertex = ToFloat3(vertex.position);
+	vertexData.normal = normalize(float3((float)normal.x, (float)normal.y, (float)normal.z));
+
+	return IsSectorVisible(vertexData.nSectorIndex)
+		&& IsLayerVisible(vertexData.nLayerIndex)
+		&& IsSurfaceVisible(vertexData.nSurfaceIndex);
+}
+
+float4 CCpuTracer::InterpolateSurfaceLight(int nSurfaceIndex, const float3& pos) const
+{
+	const SSurfaceHot& surface = GetSurfaceHot(nSurfaceIndex);
+	if (m_paVertexCompact)
+	{
+		// the vertices of a surface share the sector and its quantization
+		const SVertexCompact* paVertices = m_paVertexCompact + surface.nFirstVertex;
+		const float4& quantization = surface.nNumVertices > 0 ? m_scene.sectorQuantization[paVertices[0].nSectorIndex] : float4(0,0,0,0);
+		return InterpolateSurfaceLight(surface, pos, [&](uint32_t nIndex)
+		{
+			return float3(quantization.x + paVertices[nIndex].x * quantization.w, quantization.y + paVertices[nIndex].y * quantization.w,
+				quantization.z + paVertices[nIndex].z * quantization.w);
+		});
+	}
+
+	const SVertex* paVertices = m_scene.vertices.data() + surface.nFirstVertex;
+	return InterpolateSurfaceLight(surface, pos, [&](uint32_t nIndex) { return ToFloat3(paVertices[nIndex].position); });
+}
+
+template <typename TGetVertex>
+float4 CCpuTracer::InterpolateSurfaceLight(const SSurfaceHot& surface, const float3& pos, TGetVertex getVertex) const
+{
+	const uint32_t nFirstVertex = surface.nFirstVertex;
+	const uint32_t nNumVertices = surface.nNumVertices;
+	if (nNumVertices == 0)
+		return float4(0,0,0,0);
+
+	float4 vertexLight = { 0,0,0,0 };
+	float totalWeight = 0.0f;
+
+	// Vectors from pos to the vertices and their lengths, every vertex is the next, current and previous one in turn
+	auto getDirection = [&](uint32_t nIndex, float& len)
+	{
+		const float3 w = getVertex(nIndex) - pos;
+		len = length(w) + 1e-6f;
+		return w / len;
+	};
+
+	float lenPrev, lenCurr;
+	float3 wPrev = getDirection(nNumVertices - 1, lenPrev);
+	float3 wCurr = getDirection(0, lenCurr);
+
+	for (uint32_t nVertexIndex = 0; nVertexIndex < nNumVertices; ++nVertexIndex)
+	{
+		float lenNext;
+		const float3 wNext = getDirection((nVertexIndex + 1) % nNumVertices, lenNext);
+
+		// Compute tan(theta/2) for previous and next angles
+		const float sinThetaPrev = length(cross(wCurr, wPrev));
+		const float cosThetaPrev = dot(wCurr, wPrev);
+		const float tanHalfPrev = sinThetaPrev / (1.0f + cosThetaPrev + 1e-6f);
+
+		const float sinThetaNext = length(cross(wNext, wCurr));
+		const float cosThetaNext = dot(wNext, wCurr);
+		const float tanHalfNext = sinThetaNext / (1.0f + cosThetaNext + 1e-6f);
+
+		// Weight for this vertex
+		const float weight = (tanHalfPrev + tanHalfNext) / lenCurr;
+
+		const uint32_t nColorIndex = m_scene.vertexWelds.empty() ? nFirstVertex + nVertexIndex : m_scene.vertexWelds[nFirstVertex + nVertexIndex];
+		vertexLight += m_paVertexColors[nColorIndex] * weight;
+		totalWeight += weight;
+
+		wPrev = wCurr;
+		wCurr = wNext;
+		lenCurr = lenNext;
+	}
+
+	return totalWeight < 1e-6f ? float4(0,0,0,0) : vertexLight / totalWeight;
+}
+
+bool CCpuTracer::IsPointOnSurface(int nSurfaceIndex, const float3& position) const
+{
+	const SSurfaceHot& surface = GetSurfaceHot(nSurfaceIndex);
+	const float4* paEdgePlanes = &m_scene.edgePlanes[surface.nFirstVertex];
+
+	for (uint32_t i = 0; i < surface.nNumVertices; ++i)
+	{
+		const float4& edgePlane = paEdgePlanes[i];
+		const float dist = edgePlane.x * position.x + edgePlane.y * position.y + edgePlane.z * position.z - edgePlane.w;
+		if (dist < -1e-3f)
+			return false;
+	}
+
+	return true;
+}
+
+bool CCpuTracer::IsSurfCrossed(int nSurfaceIndex, const float3& start, const float3& end, float3& hitPos) const
+{
+	// initialize out parameter
+	hitPos = float3(0,0,0);
+
+	const SSurfaceHot& surface = GetSurfaceHot(nSurfaceIndex);
+	if (surface.nNumVertices == 0)
+		return false;
+
+	const float3 normal = ToFloat3(surface.normal);
+
+	const float distToStart = dot(normal, start) - surface.normal.w;
+	const float distToEnd   = dot(normal, end) - surface.normal.w;
+
+	const bool bAllOutsidePositive = (distToStart > 0.0001f && distToEnd > 0.0001f);
+	const bool bAllOutsideNegative = (distToStart < -0.0001f && distToEnd < -0.0001f);
+	const bool bBothOnPlane        = (fabsf(distToStart) <= 0.0001f && fabsf(distToEnd) <= 0.0001f);
+
+	if (bAllOutsidePositive || bAllOutsideNegative)
+		return false;
+
+	if (bBothOnPlane)
+	{
+		hitPos = start;
+		return true;
+	}
+
+	const float s = distToStart / (distToStart - distToEnd);
+	hitPos = start + s * (end - start);
+	return IsPointOnSurface(nSurfaceIndex, hitPos);
+}
+
+bool CCpuTracer::TraceSurfaces(int nSectorIndex, const float3& start, const float3& end, float3& hitPos, int& nHitSurfaceIndex) const
+{
+	const float3 delta = end - start;
+	const float3 invDelta = GetSegmentInvDelta(delta);
+
+	// the first crossed surface in sector order wins (adjoins first), not the closest one
+	uint32_t nBestSurface = UINT32_MAX;
+
+	uint32_t aStack[kBvhStackSize];
+	int nStackSize = 0;
+	aStack[nStackSize++] = m_scene.sectors[nSectorIndex].nBvhRoot;
+	while (nStackSize > 0)
+	{
+		const SBvhNode& node = m_scene.bvhNodes[aStack[--nStackSize]];
+		if (!IsSegmentInBox(start, invDelta, node.boxMin, node.boxMax))
+			continue;
+
+		if (node.nCount == 0)
+		{
+			if (node.nFirst != kBvhEmptyRoot)
+			{
+				aStack[nStackSize++] = node.nFirst;
+				aStack[nStackSize++] = node.nFirst + 1;
+			}
+			continue;
+		}
+
+		for (uint32_t nEntry = node.nFirst; nEntry < node.nFirst + node.nCount; ++nEntry)
+		{
+			const uint32_t nSurfaceIndex = m_scene.bvhSurfaces[nEntry];
+			if (nSurfaceIndex >= nBestSurface)
+				break; // leaves are sorted
+
+			const float dotVal = dot(ToFloat3(GetSurfaceHot(nSurfaceIndex).normal), delta);
+			float3 surfaceHitPos;
+			if (dotVal < 0 && IsSurfCrossed(nSurfaceIndex, start, end, surfaceHitPos))
+			{
+				nBestSurface = nSurfaceIndex;
+				hitPos = surfaceHitPos;
+				break;
+			}
+		}
+	}
+
+	if (nBestSurface == UINT32_MAX)
+		return false;
+
+	nHitSurfaceIndex = (int)nBestSurface;
+	return true;
+}
+
+bool CCpuTracer::TraceRay(SRayPayload& payload, int nSectorIndex, const float3& start, const float3& end) const
+{
+	int nRecurseLevel   = 0;
+	int nCurrentSector  = nSectorIndex;
+	int nPreviousSector = -1;
+
+	payload.nHitSurfaceIndex = -1;
+	payload.hitPos = start;
+	payload.attenuation = float4(1,1,1,1);
+	payload.nAdjoinHops = 0;
+
+	while (nCurrentSector >= 0 && nCurrentSector != nPreviousSector && nRecurseLevel < kMaxRecursion)
+	{
+		float3 hitPos = start;
+		int nHitSurfaceIndex = -1;
+		TraceSurfaces(nCurrentSector, start, end, hitPos, nHitSurfaceIndex);
+
+		// didn't hit anything
+		if (nHitSurfaceIndex < 0)
+			return false;
+
+		// we hit something
+		payload.nHitSurfaceIndex = nHitSurfaceIndex;
+		payload.hitPos = hitPos;
+
+		// move to next sector (if available)
+		nPreviousSector = nCurrentSector;
+		nCurrentSector = GetSurfaceHot(nHitSurfaceIndex).nAdjoinSector;
+		if (nCurrentSector >= 0)
+		{
+			AddAdjoinContribution(payload, nHitSurfaceIndex, hitPos);
+			++nRecurseLevel;
+			++payload.nAdjoinHops;
+		}
+	}
+
+	return payload.nHitSurfaceIndex >= 0;
+}
+
+void CCpuTracer::AddAdjoinContribution(SRayPayload& payload, int nHitSurfaceIndex, const float3& hitPos) const
+{
+	// add transparent contributions
+	const uint32_t nSurfaceFlags = GetSurfaceHot(nHitSurfaceIndex).nFlags;
+	if (nSurfaceFlags & ESurface_IsVisible)
+	{
+		const SSurfaceCold& hitSurface = GetSurfaceCold(nHitSurfaceIndex);
+		float4 albedo = hitSurface.albedo;
+		float4 emissive = hitSurface.emissive;
+		if (nSurfaceFlags & ESurface_IsTranslucent)
+		{
+			albedo *= kSurfaceAlpha;
+			emissive *= kSurfaceAlpha;
+		}
+
+		const float4 surfaceLight = InterpolateSurfaceLight(nHitSurfaceIndex, hitPos);
+		payload.reflection += (albedo * surfaceLight + emissive) * payload.attenuation;
+
+		if (nSurfaceFlags & ESurface_IsTranslucent)
+			payload.attenuation *= albedo + (1.0f - kSurfaceAlpha);
+	}
+}
+
+// Same operations in the same order as TraceSurfaces/IsSurfCrossed so every lane gets bit identical results
+int CCpuTracer::TraceSurfacesPacket(int nSectorIndex, const SRayPacket& packet, int nLaneMask, float3* paHitPos, int* paHitSurfaceIndex) const
+{
+	const vfloat startX = Load(packet.startX), startY = Load(packet.startY), startZ = Load(packet.startZ);
+	const vfloat endX = Load(packet.endX), endY = Load(packet.endY), endZ = Load(packet.endZ);
+	const vfloat deltaX = endX - startX, deltaY = endY - startY, deltaZ = endZ - startZ;
+
+	// GetSegmentInvDelta
+	const vfloat zero = Broadcast(0.0f);
+	const vfloat one = Broadcast(1.0f);
+	const vfloat huge = Broadcast(1e30f);
+	const vfloat invDeltaX = Select((deltaX < zero) | (deltaX > zero), one / deltaX, huge);
+	const vfloat invDeltaY = Select((deltaY < zero) | (deltaY > zero), one / deltaY, huge);
+	const vfloat invDeltaZ = Select((deltaZ < zero) | (deltaZ > zero), one / deltaZ, huge);
+
+	const vfloat planeEpsilon = Broadcast(0.0001f);
+	const vfloat negPlaneEpsilon = Broadcast(-0.0001f);
+	const vfloat edgeEpsilon = Broadcast(-1e-3f);
+
+	// lowest crossed surface per lane, INT32_MAX = none
+	int32_t aBestSurface[kRayPacketSize];
+	for (int nLane = 0; nLane < kRayPacketSize; ++nLane)
+		aBestSurface[nLane] = INT32_MAX;
+	vint bestSurface = BroadcastInt(INT32_MAX);
+	int nHitMask = 0;
+
+	// every stack entry keeps the lanes that entered its parent, so a lane only sees the nodes it would visit on its own
+	uint32_t aStack[kBvhStackSize];
+	int aStackMask[kBvhStackSize];
+	int nStackSize = 0;
+	aStack[nStackSize] = m_scene.sectors[nSectorIndex].nBvhRoot;
+	aStackMask[nStackSize++] = nLaneMask;
+	while (nStackSize > 0)
+	{
+		--nStackSize;
+		const SBvhNode& node = m_scene.bvhNodes[aStack[nStackSize]];
+
+		// IsSegmentInBox
+		const vfloat tx0 = (Broadcast(node.boxMin.x) - startX) * invDeltaX, tx1 = (Broadcast(node.boxMax.x) - startX) * invDeltaX;
+		const vfloat ty0 = (Broadcast(node.boxMin.y) - startY) * invDeltaY, ty1 = (Broadcast(node.boxMax.y) - startY) * invDeltaY;
+		const vfloat tz0 = (Broadcast(node.boxMin.z) - startZ) * invDeltaZ, tz1 = (Broadcast(node.boxMax.z) - startZ) * invDeltaZ;
+		const vfloat tMin = Max(Max(Max(Min(tx0, tx1), Min(ty0, ty1)), Min(tz0, tz1)), zero);
+		const vfloat tMax = Min(Min(Min(Max(tx0, tx1), Max(ty0, ty1)), Max(tz0, tz1)), one);
+		const int nNodeMask = GetMask(tMin <= tMax) & aStackMask[nStackSize];
+		if (!nNodeMask)
+			continue;
+
+		if (node.nCount == 0)
+		{
+			if (node.nFirst != kBvhEmptyRoot)
+			{
+				aStack[nStackSize] = node.nFirst;
+				aStackMask[nStackSize++] = nNodeMask;
+				aStack[nStackSize] = node.nFirst + 1;
+				aStackMask[nStackSize++] = nNodeMask;
+			}
+			continue;
+		}
+
+		const vfloat nodeMask = MaskFromBits(nNodeMask);
+		for (uint32_t nEntry = node.nFirst; nEntry < node.nFirst + node.nCount; ++nEntry)
+		{
+			const uint32_t nSurfaceIndex = m_scene.bvhSurfaces[nEntry];
+
+			// leaves are sorted, lanes drop out once they have a lower hit
+			const vfloat liveMask = nodeMask & (bestSurface > BroadcastInt((int32_t)nSurfaceIndex));
+			if (!GetMask(liveMask))
+				break;
+
+			const SSurfaceHot& surface = GetSurfaceHot(nSurfaceIndex);
+			const vfloat normalX = Broadcast(surface.normal.x), normalY = Broadcast(surface.normal.y), normalZ = Broadcast(surface.normal.z);
+			const vfloat dotVal = normalX * deltaX + normalY * deltaY + normalZ * deltaZ;
+
+			const vfloat planeDist = Broadcast(surface.normal.w);
+			const vfloat distToStart = (normalX * startX + normalY * startY + normalZ * startZ) - planeDist;
+			const vfloat distToEnd = (normalX * endX + normalY * endY + normalZ * endZ) - planeDist;
+
+			const vfloat allOutside = ((distToStart > planeEpsilon) & (distToEnd > planeEpsilon)) | ((distToStart < negPlaneEpsilon) & (distToEnd < negPlaneEpsilon));
+			const vfloat crossMask = AndNot(liveMask & (dotVal < zero), allOutside);
+			if (!GetMask(crossMask))
+				continue;
+
+			const vfloat bothOnPlane = (Abs(distToStart) <= planeEpsilon) & (Abs(distToEnd) <= planeEpsilon);
+
+			const vfloat s = distToStart / (distToStart - distToEnd);
+			const vfloat hitX = startX + (endX - startX) * s;
+			const vfloat hitY = startY + (endY - startY) * s;
+			const vfloat hitZ = startZ + (endZ - startZ) * s;
+
+			// IsPointOnSurface
+			vfloat insideMask = AndNot(crossMask, bothOnPlane);
+			const float4* paEdgePlanes = &m_scene.edgePlanes[surface.nFirstVertex];
+			for (uint32_t i = 0; i < surface.nNumVertices && GetMask(insideMask); ++i)
+			{
+				const float4& edgePlane = paEdgePlanes[i];
+				const vfloat dist = Broadcast(edgePlane.x) * hitX + Broadcast(edgePlane.y) * hitY + Broadcast(edgePlane.z) * hitZ - Broadcast(edgePlane.w);
+				insideMask = AndNot(insideMask, dist < edgeEpsilon);
+			}
+
+			const int nOnPlaneMask = GetMask(crossMask & bothOnPlane);
+			const int nSurfaceHitMask = nOnPlaneMask | GetMask(insideMask);
+			if (!nSurfaceHitMask)
+				continue;
+
+			float aHitX[kRayPacketSize], aHitY[kRayPacketSize], aHitZ[kRayPacketSize];
+			Store(aHitX, hitX);
+			Store(aHitY, hitY);
+			Store(aHitZ, hitZ);
+			for (int nLane = 0; nLane < kRayPacketSize; ++nLane)
+			{
+				const int nLaneBit = 1 << nLane;
+				if (!(nSurfaceHitMask & nLaneBit))
+					continue;
+
+				aBestSurface[nLane] = (int32_t)nSurfaceIndex;
+				if (nOnPlaneMask & nLaneBit)
+					paHitPos[nLane] = { packet.startX[nLane], packet.startY[nLane], packet.startZ[nLane] };
+				else
+					paHitPos[nLane] = { aHitX[nLane], aHitY[nLane], aHitZ[nLane] };
+			}
+			bestSurface = LoadInt(aBestSurface);
+			nHitMask |= nSurfaceHitMask;
+		}
+	}
+
+	for (int nLane = 0; nLane < kRayPacketSize; ++nLane)
+	{
+		if (nHitMask & (1 << nLane))
+			paHitSurfaceIndex[nLane] = aBestSurface[nLane];
+	}
+	return nHitMask;
+}
+
+int CCpuTracer::TraceRayPacket(SRayPayload* paPayloads, int nSectorIndex, const SRayPacket& packet) const
+{
+	int aCurrentSector[kRayPacketSize];
+	int aPreviousSector[kRayPacketSize];
+	int aRecurseLevel[kRayPacketSize];
+
+	for (int nLane = 0; nLane < packet.nCount; ++nLane)
+	{
+		SRayPayload& payload = paPayloads[nLane];
+		payload.nHitSurfaceIndex = -1;
+		payload.hitPos = { packet.startX[nLane], packet.startY[nLane], packet.startZ[nLane] };
+		payload.attenuation = float4(1,1,1,1);
+		payload.nAdjoinHops = 0;
+
+		aCurrentSector[nLane] = nSectorIndex;
+		aPreviousSector[nLane] = -1;
+		aRecurseLevel[nLane] = 0;
+	}
+
+	int nActiveMask = nSectorIndex >= 0 ? (1 << packet.nCount) - 1 : 0;
+	int nResultMask = 0;
+	while (nActiveMask)
+	{
+		// trace all lanes that are in the same sector as the first active one
+		int nCurrentSector = -1;
+		int nGroupMask = 0;
+		for (int nLane = 0; nLane < packet.nCount; ++nLane)
+		{
+			if (!(nActiveMask & (1 << nLane)))
+				continue;
+
+			if (nCurrentSector < 0)
+				nCurrentSector = aCurrentSector[nLane];
+			if (aCurrentSector[nLane] == nCurrentSector)
+				nGroupMask |= 1 << nLane;
+		}
+
+		float3 aHitPos[kRayPacketSize];
+		int aHitSurfaceIndex[kRayPacketSize];
+		int nHitMask = 0;
+		if (std::popcount((unsigned)nGroupMask) >= kMinPacketLanes)
+		{
+			nHitMask = TraceSurfacesPacket(nCurrentSector, packet, nGroupMask, aHitPos, aHitSurfaceIndex);
+		}
+		else
+		{
+			// too few lanes left in this sector for the packet to pay off, same hits one ray at a time
+			for (int nLane = 0; nLane < packet.nCount; ++nLane)
+			{
+				if (!(nGroupMask & (1 << nLane)))
+					continue;
+
+				const float3 start = { packet.startX[nLane], packet.startY[nLane], packet.startZ[nLane] };
+				const float3 end = { packet.endX[nLane], packet.endY[nLane], packet.endZ[nLane] };
+				if (TraceSurfaces(nCurrentSector, start, end, aHitPos[nLane], aHitSurfaceIndex[nLane]))
+					nHitMask |= 1 << nLane;
+			}
+		}
+
+		// didn't hit anything
+		nActiveMask &= ~(nGroupMask & ~nHitMask);
+
+		for (int nLane = 0; nLane < packet.nCount; ++nLane)
+		{
+			const int nLaneBit = 1 << nLane;
+			if (!(nGroupMask & nHitMask & nLaneBit))
+				continue;
+
+			// we hit something
+			SRayPayload& payload = paPayloads[nLane];
+			payload.nHitSurfaceIndex = aHitSurfaceIndex[nLane];
+			payload.hitPos = aHitPos[nLane];
+
+			// move to next sector (if available)
+			aPreviousSector[nLane] = aCurrentSector[nLane];
+			aCurrentSector[nLane] = GetSurfaceHot(payload.nHitSurfaceIndex).nAdjoinSector;
+			if (aCurrentSector[nLane] >= 0)
+			{
+				AddAdjoinContribution(payload, payload.nHitSurfaceIndex, payload.hitPos);
+				++aRecurseLevel[nLane];
+				++payload.nAdjoinHops;
+			}
+
+			if (aCurrentSector[nLane] < 0 || aCurrentSector[nLane] == aPreviousSector[nLane] || aRecurseLevel[nLane] >= kMaxRecursion)
+			{
+				nActiveMask &= ~nLaneBit;
+				nResultMask |= nLaneBit;
+			}
+		}
+	}
+
+	return nResultMask;
+}
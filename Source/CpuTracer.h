@@ -0,0 +1,175 @@
+#pragma once
+
+// C++ port of the tracing functions in Baking.hlsli, any change to the shader side must be mirrored here (and vice versa)
+
+#include "BakeScene.h"
+#include "BakeScheduler.h"
+#include "SimdFloat.h"
+
+static constexpr float kSkyDistance = 512.0f;
+
+// standard JK alpha value
+static constexpr float kSurfaceAlpha = 90.0f / 255.0f;
+
+// bias the ray along the ray dir to avoid self intersection or stuff like that
+static constexpr float kRayBias = -1e-4f;
+
+// maximum number of adjoins to cross for a given ray (puts an upper bound on recursions for safety)
+static constexpr int kMaxRecursion = 256;
+
+// Ray payload, filled on hit
+struct SRayPayload
+{
+	float4 attenuation = { 1,1,1,1 };
+	float4 reflection = { 0,0,0,0 };
+	float3 hitPos = { 0,0,0 };
+	int    nHitSurfaceIndex = -1;
+	int    nAdjoinHops = 0; // adjoins crossed, kMaxRecursion if the ray was cut off
+};
+
+inline void CountRay(STraceCounters& counters, const SRayPayload& payload)
+{
+	++counters.nRays;
+	counters.nAdjoinHops += payload.nAdjoinHops;
+	counters.nMaxRecursionRays += payload.nAdjoinHops >= kMaxRecursion;
+}
+
+// Rays traced together by TraceRayPacket, one SIMD lane each (structure of arrays), lanes past nCount are ignored
+static constexpr int kRayPacketSize = kSimdWidth;
+
+// lanes of a packet that end up in different sectors are traced per sector, groups smaller than this go one ray at a time
+static constexpr int kMinPacketLanes = kRayPacketSize / 2;
+
+struct SRayPacket
+{
+	int   nCount = 0;
+	float startX[kRayPacketSize], startY[kRayPacketSize], startZ[kRayPacketSize];
+	float endX[kRayPacketSize], endY[kRayPacketSize], endZ[kRayPacketSize];
+
+	void Set(int nLane, const float3& start, const float3& end)
+	{
+		startX[nLane] = start.x; startY[nLane] = start.y; startZ[nLane] = start.z;
+		endX[nLane] = end.x; endY[nLane] = end.y; endZ[nLane] = end.z;
+	}
+};
+
+struct SVertexData
+{
+	int nVertexIndex;
+	int nSectorIndex;
+	int nLayerIndex;
+	int nSurfaceIndex;
+
+	float3 vertex;
+	float3 normal;
+};
+
+// Rows of the float3x3(tangent, binormal, normal) matrix used by the shaders
+struct STangentFrame
+{
+	float3 tangent;
+	float3 binormal;
+	float3 normal;
+};
+
+inline float3 ToFloat3(const float4& v)
+{
+	return { v.x, v.y, v.z };
+}
+
+// Generates an arbitrary tangent frame around a normal
+STangentFrame GenerateTangentFrame(const float3& normal);
+
+// Generate a cosine weighted ray using a hammersley sequence, ray set n > 0 of an adaptive pass shifts the sequence
+// (Cranley-Patterson rotation by the R2 sequence) so its rays stay spread as evenly but fall between the earlier ones
+float3 GenRay(int N, int M, int nRaySet = 0);
+
+// Generate a ray uniformly distributed over the whole sphere using a hammersley sequence (CPU only, for the probes)
+float3 GenSphereRay(int N, int M);
+
+// Emissive light sample N of M of a vertex (see BuildEmissiveSurfaces): a hammersley point, shifted by a hash of the vertex,
+// picks the surface by its power, the fan triangle by its area and a point in it. color is the emissive light of the point
+// over its chance with the cosines at both ends and the distance falloff, the vertex gets it if the ray to the point ends
+// on nSurfaceIndex. False if the point faces away from the vertex or the vertex from it, or if the surface's plane goes
+// through the vertex: the vertices are polygon corners and the hemisphere rays going out of the corner hit the surfaces
+// next to it right away, those stay with the hemisphere rays (see IsOnSurfacePlane).
+bool GenEmissiveSample(const SBakeScene& scene, const SVertexData& vertexData, int N, int M, int nRaySet, float3& point, int& nSurfaceIndex, float4& color);
+
+// distance of a vertex to a surface plane under which the surface is next to the vertex
+static constexpr float kEmissivePlaneEpsilon = 1e-3f;
+
+// True if the point lies on the plane (w is the plane distance)
+bool IsOnSurfacePlane(const float4& plane, const float3& point);
+
+// Luminance the adaptive bake estimates the variance of, w is the mono light value
+float GetSampleLuminance(const float4& color);
+
+// True once the adaptive bake can stop tracing a vertex for the current pass, vertexLight is its accumulated light so far
+// (the earlier passes and the current one)
+bool IsSampleConverged(const SVertexSampleStats& stats, const float4& vertexLight, const SLevelInfo& levelInfo);
+
+// Adds the summed light of a batch of rays to the running mean, with a single batch this is batchSum / nBatchRays
+void AddSampleBatch(SVertexSampleStats& stats, const float4& batchSum, int nBatchRays);
+
+// Equivalent of mul(rayDir, frame) in the shaders
+inline float3 TransformRay(const float3& rayDir, const STangentFrame& frame)
+{
+	return frame.tangent * rayDir.x + frame.binormal * rayDir.y + frame.normal * rayDir.z;
+}
+
+class CCpuTracer
+{
+public:
+	// paVertexColors is the equivalent of aVertexColors (t7), the previous pass result used for surface light interpolation
+	// traces the compact layout of the scene if it has one (see BuildCompactLayout)
+	CCpuTracer(const SBakeScene& scene, const float4* paVertexColors);
+
+	// surface fields from the compact layout or the full surfaces
+	const SSurfaceHot& GetSurfaceHot(int nSurfaceIndex) const { return *(const SSurfaceHot*)(m_pSurfaceHot + nSurfaceIndex * m_nSurfaceStride); }
+	const SSurfaceCold& GetSurfaceCold(int nSurfaceIndex) const { return *(const SSurfaceCold*)(m_pSurfaceCold + nSurfaceIndex * m_nSurfaceStride); }
+
+	bool IsSectorVisible(int nSectorIndex) const;
+	bool IsLayerVisible(int nLayerIndex) const;
+	bool IsSurfaceVisible(int nSurfaceIndex) const;
+
+	// Fetch the data for this vertex, return false if we should ignore the vertex
+	bool GetVertexData(SVertexData& vertexData, int nVertexIndex) const;
+
+	// Shoddy interpolation of vertex color over a surface, but has better properties than triangle interpolation
+	float4 InterpolateSurfaceLight(int nSurfaceIndex, const float3& pos) const;
+
+	// Test if a point is within a surfaces edges, uses the precomputed edge planes
+	bool IsPointOnSurface(int nSurfaceIndex, const float3& position) const;
+
+	// Test if a segment/line/ray crossed a surface
+	bool IsSurfCrossed(int nSurfaceIndex, const float3& start, const float3& end, float3& hitPos) const;
+
+	// Test the surfaces of a sector through its bvh, return true if something was hit as well as hit position and surface index
+	bool TraceSurfaces(int nSectorIndex, const float3& start, const float3& end, float3& hitPos, int& nHitSurfaceIndex) const;
+
+	bool TraceRay(SRayPayload& payload, int nSectorIndex, const float3& start, const float3& end) const;
+
+	// TraceSurfaces for the lanes in nLaneMask at once, returns the mask of lanes that hit something
+	int TraceSurfacesPacket(int nSectorIndex, const SRayPacket& packet, int nLaneMask, float3* paHitPos, int* paHitSurfaceIndex) const;
+
+	// TraceRay for a packet of rays starting in the same sector (e.g. the hemisphere rays of one vertex), same results as tracing
+	// them one by one. Lanes split up as they cross different adjoins, returns the mask of lanes TraceRay would return true for
+	int TraceRayPacket(SRayPayload* paPayloads, int nSectorIndex, const SRayPacket& packet) const;
+
+private:
+	// transparent contribution of a crossed adjoin surface
+	void AddAdjoinContribution(SRayPayload& payload, int nHitSurfaceIndex, const float3& hitPos) const;
+
+	// InterpolateSurfaceLight over the vertex positions of the full or the compact layout
+	template <typename TGetVertex>
+	float4 InterpolateSurfaceLight(const SSurfaceHot& surface, const float3& pos, TGetVertex getVertex) const;
+
+	const SBakeScene&     m_scene;
+	const float4*         m_paVertexColors;
+
+	// the surface arrays seen through a stride, the compact ones or the matching parts of SSurface
+	const uint8_t*        m_pSurfaceHot;
+	const uint8_t*        m_pSurfaceCold;
+	size_t                m_nSurfaceStride;
+	const SVertexCompact* m_paVertexCompact; // null without a compact layout
+};
@@ -0,0 +1,399 @@
+#include "DistributedBake.h"
+#include "CompactLayout.h"
+#include "CpuBaker.h"
+#include "SceneBuilder.h"
+#include "SceneFile.h"
+
+#include <algorithm>
+#include <sstream>
+
+// guards the allocation of a payload against a broken stream
+static constexpr uint64_t kMaxDistributedMessageSize = 1ull << 36;
+
+struct SDistributedHeader
+{
+	uint32_t nType;
+	uint32_t _padding0;
+	uint64_t nSize; // bytes of the payload after the header
+};
+
+struct SDistributedHello
+{
+	uint32_t nMagic;
+	uint32_t nVersion;
+};
+
+struct SDistributedJob
+{
+	int32_t nFirstVertex;
+	int32_t nEndVertex;
+	int32_t nBatchRays;
+	int32_t bCompactLayout; // the worker traces the compact layout of the scene (see CompactLayout.h)
+};
+
+struct SDistributedBounce
+{
+	int32_t nBounce;
+	int32_t _padding0;
+};
+
+struct SDistributedResult
+{
+	int32_t       nBounce; // -1 after the direct passes
+	int32_t       nFirstVertex;
+	int32_t       nNumVertices;
+	int32_t       _padding0;
+	SRayPassStats skyEmissiveRayStats; // of the worker since the job started
+	SRayPassStats indirectRayStats;
+};
+
+static bool SendHeader(CSocket& socket, EDistributedMessage eType, uint64_t nSize)
+{
+	const SDistributedHeader header = { (uint32_t)eType, 0, nSize };
+	return socket.Send(&header, sizeof(header));
+}
+
+static bool ReceiveHeader(CSocket& socket, SDistributedHeader& header)
+{
+	return socket.Receive(&header, sizeof(header)) && header.nSize <= kMaxDistributedMessageSize;
+}
+
+// Runs the light passes of a work range, like CCpuBakeBackend without scattering the welded vertices (the coordinator
+// scatters after gathering). An indirect bounce reads the colors gathered from every worker.
+class CWorkerBakeBackend : public IBakeBackend
+{
+public:
+	CWorkerBakeBackend(CCpuBaker& baker, SBakeScene& scene, std::vector<float4>& accumulation, const std::vector<float4>& bounceColors)
+		: m_baker(baker)
+		, m_scene(scene)
+		, m_accumulation(accumulation)
+		, m_bounceColors(bounceColors)
+	{
+	}
+
+	void BeginPass(EBakePass ePass, int nBounce) override
+	{
+		if (ePass == EBakePass_Indirect)
+		{
+			m_baker.BeginIndirectBounce(m_accumulation, nBounce);
+			m_baker.GetBounceColors() = m_bounceColors;
+		}
+
+		if (ePass == EBakePass_SkyEmissive || ePass == EBakePass_Indirect)
+			m_baker.BeginRayPass(m_scene);
+	}
+
+	void Run(const SBakeWorkItem& item) override
+	{
+		switch (item.ePass)
+		{
+		case EBakePass_Sun:         m_baker.BakeSun(m_scene, m_accumulation, item); break;
+		case EBakePass_Direct:      m_baker.BakeDirect(m_scene, m_accumulation, item); break;
+		case EBakePass_SkyEmissive: m_baker.BakeSkyEmissive(m_scene, m_accumulation, item); break;
+		case EBakePass_Indirect:    m_baker.BakeIndirect(m_scene, m_accumulation, item); break;
+		default: break;
+		}
+	}
+
+	void EndPass(EBakePass ePass, int /*nBounce*/) override
+	{
+		if (ePass == EBakePass_SkyEmissive || ePass == EBakePass_Indirect)
+			m_baker.EndRayPass(ePass);
+
+		if (ePass == EBakePass_Indirect)
+			m_baker.EndIndirectBounce();
+	}
+
+	int64_t GetPassRays() override { return m_baker.GetRayPassRays(); }
+
+private:
+	CCpuBaker&                 m_baker;
+	SBakeScene&                m_scene;
+	std::vector<float4>&       m_accumulation;
+	const std::vector<float4>& m_bounceColors;
+};
+
+// the accumulation of the range, and the bounce result of the range after a bounce
+static bool SendResult(CSocket& socket, int nBounce, const SDistributedJob& job, const CCpuBaker& baker, const std::vector<float4>& accumulation,
+	const std::vector<float4>* pBounceColors)
+{
+	SDistributedResult result = {};
+	result.nBounce = nBounce;
+	result.nFirstVertex = job.nFirstVertex;
+	result.nNumVertices = job.nEndVertex - job.nFirstVertex;
+	result.skyEmissiveRayStats = baker.GetSkyEmissiveRayStats();
+	result.indirectRayStats = baker.GetIndirectRayStats();
+
+	const uint64_t nRangeSize = (uint64_t)result.nNumVertices * sizeof(float4);
+	return SendHeader(socket, EDistributedMessage_Result, sizeof(result) + nRangeSize * (pBounceColors ? 2 : 1))
+		&& socket.Send(&result, sizeof(result))
+		&& socket.Send(accumulation.data() + job.nFirstVertex, nRangeSize)
+		&& (!pBounceColors || socket.Send(pBounceColors->data() + job.nFirstVertex, nRangeSize));
+}
+
+static bool ReceiveResult(CSocket& socket, int nBounce, int nFirstVertex, int nEndVertex, std::vector<float4>& accumulation,
+	std::vector<float4>* pBounceColors, SDistributedResult& result)
+{
+	const uint64_t nRangeSize = (uint64_t)(nEndVertex - nFirstVertex) * sizeof(float4);
+
+	SDistributedHeader header;
+	if (!ReceiveHeader(socket, header) || header.nType != EDistributedMessage_Result
+		|| header.nSize != sizeof(result) + nRangeSize * (pBounceColors ? 2 : 1))
+		return false;
+
+	if (!socket.Receive(&result, sizeof(result)) || result.nBounce != nBounce || result.nFirstVertex != nFirstVertex
+		|| result.nNumVertices != nEndVertex - nFirstVertex)
+		return false;
+
+	return socket.Receive(accumulation.data() + nFirstVertex, nRangeSize)
+		&& (!pBounceColors || socket.Receive(pBounceColors->data() + nFirstVertex, nRangeSize));
+}
+
+bool CBakeCoordinator::Start(const std::string& sAddress, int nNumWorkers, std::string& sError)
+{
+	Stop();
+	if (!m_listener.Listen(sAddress, sError))
+		return false;
+
+	while ((int)m_workers.size() < nNumWorkers)
+	{
+		CSocket worker;
+		if (!m_listener.Accept(worker, sError))
+			return false;
+
+		// a worker of another build would read the structs wrong, turn it away
+		SDistributedHeader header;
+		SDistributedHello hello = {};
+		if (!ReceiveHeader(worker, header) || header.nType != EDistributedMessage_Hello || header.nSize != sizeof(hello)
+			|| !worker.Receive(&hello, sizeof(hello)) || hello.nMagic != kDistributedMagic || hello.nVersion != kDistributedVersion)
+			continue;
+
+		m_workers.push_back(std::move(worker));
+	}
+
+	// everyone is in, later connections are refused
+	m_listener.Close();
+	return true;
+}
+
+void CBakeCoordinator::Stop()
+{
+	for (CSocket& worker : m_workers)
+		SendHeader(worker, EDistributedMessage_Done, 0);
+
+	m_workers.clear();
+	m_listener.Close();
+}
+
+bool CBakeCoordinator::Bake(SBakeScene& scene, int nIndirectBounces, std::vector<float4>& accumulation, std::string& sError)
+{
+	const int nTotalVertices = scene.levelInfo.nTotalVertices;
+	accumulation.assign(nTotalVertices, float4(0,0,0,0));
+	m_skyEmissiveRayStats = SRayPassStats();
+	m_indirectRayStats = SRayPassStats();
+	if (nTotalVertices <= 0)
+		return true;
+
+	if (m_workers.empty())
+	{
+		sError = "No workers connected";
+		return false;
+	}
+
+	std::ostringstream sceneStream;
+	WriteSceneFile(sceneStream, scene);
+	const std::string sSceneData = sceneStream.str();
+
+	// the workers build the same welds from the scene, the coordinator scatters with them after every gather
+	BuildVertexWelds(scene);
+
+	// contiguous ranges keep the sectors of a worker together
+	const int nNumWorkers = std::min((int)m_workers.size(), nTotalVertices);
+	std::vector<SDistributedJob> jobs(nNumWorkers);
+	for (int nWorker = 0; nWorker < nNumWorkers; ++nWorker)
+	{
+		SDistributedJob& job = jobs[nWorker];
+		job = {};
+		job.nFirstVertex = (int)((int64_t)nTotalVertices * nWorker / nNumWorkers);
+		job.nEndVertex = (int)((int64_t)nTotalVertices * (nWorker + 1) / nNumWorkers);
+		job.nBatchRays = SBakeScheduleSettings().nBatchRays;
+		job.bCompactLayout = !scene.surfaceHot.empty();
+
+		CSocket& worker = m_workers[nWorker];
+		if (!SendHeader(worker, EDistributedMessage_Job, sizeof(job) + sSceneData.size()) || !worker.Send(&job, sizeof(job))
+			|| !worker.Send(sSceneData.data(), sSceneData.size()))
+		{
+			sError = "Lost the connection to a worker";
+			return false;
+		}
+	}
+
+	std::vector<SDistributedResult> results(nNumWorkers);
+	for (int nWorker = 0; nWorker < nNumWorkers; ++nWorker)
+	{
+		if (!ReceiveResult(m_workers[nWorker], -1, jobs[nWorker].nFirstVertex, jobs[nWorker].nEndVertex, accumulation, nullptr, results[nWorker]))
+		{
+			sError = "Lost the connection to a worker";
+			return false;
+		}
+	}
+	ScatterWeldedVertices(scene, accumulation);
+
+	if (scene.levelInfo.nBakeFlags & ELightBake_Indirect)
+	{
+		// the first bounce reads the direct light, every later one the result of the bounce before
+		std::vector<float4> bounceColors = accumulation;
+		std::vector<float4> nextColors;
+		for (int nBounce = 0; nBounce < nIndirectBounces; ++nBounce)
+		{
+			const SDistributedBounce bounce = { nBounce, 0 };
+			const uint64_t nColorsSize = bounceColors.size() * sizeof(float4);
+			for (int nWorker = 0; nWorker < nNumWorkers; ++nWorker)
+			{
+				CSocket& worker = m_workers[nWorker];
+				if (!SendHeader(worker, EDistributedMessage_Bounce, sizeof(bounce) + nColorsSize) || !worker.Send(&bounce, sizeof(bounce))
+					|| !worker.Send(bounceColors.data(), nColorsSize))
+				{
+					sError = "Lost the connection to a worker";
+					return false;
+				}
+			}
+
+			// the barrier, all ranges of the bounce are in before the next one is sent out
+			nextColors.assign(nTotalVertices, float4(0,0,0,0));
+			for (int nWorker = 0; nWorker < nNumWorkers; ++nWorker)
+			{
+				if (!ReceiveResult(m_workers[nWorker], nBounce, jobs[nWorker].nFirstVertex, jobs[nWorker].nEndVertex, accumulation, &nextColors, results[nWorker]))
+				{
+					sError = "Lost the connection to a worker";
+					return false;
+				}
+			}
+			ScatterWeldedVertices(scene, accumulation);
+			bounceColors.swap(nextColors);
+		}
+	}
+
+	for (const SDistributedResult& result : results)
+	{
+		m_skyEmissiveRayStats.nRays += result.skyEmissiveRayStats.nRays;
+		m_skyEmissiveRayStats.nVertices += result.skyEmissiveRayStats.nVertices;
+		m_indirectRayStats.nRays += result.indirectRayStats.nRays;
+		m_indirectRayStats.nVertices += result.indirectRayStats.nVertices;
+	}
+	return true;
+}
+
+bool RunBakeWorker(const std::string& sAddress, CJobSystem* pJobSystem, std::string& sError)
+{
+	CSocket socket;
+	if (!socket.Connect(sAddress, kWorkerConnectTimeoutMs, sError))
+		return false;
+
+	const SDistributedHello hello = { kDistributedMagic, kDistributedVersion };
+	if (!SendHeader(socket, EDistributedMessage_Hello, sizeof(hello)) || !socket.Send(&hello, sizeof(hello)))
+	{
+		sError = "Lost the connection to the coordinator";
+		return false;
+	}
+
+	CCpuBaker baker(pJobSystem);
+	SBakeScene scene;
+	SDistributedJob job = {};
+	std::vector<float4> accumulation;
+	std::vector<float4> bounceColors;
+	std::vector<char> sceneData;
+	for (;;)
+	{
+		SDistributedHeader header;
+		if (!ReceiveHeader(socket, header))
+		{
+			sError = "Lost the connection to the coordinator";
+			return false;
+		}
+
+		if (header.nType == EDistributedMessage_Done)
+			return true;
+
+		if (header.nType == EDistributedMessage_Job && header.nSize >= sizeof(job))
+		{
+			sceneData.resize((size_t)(header.nSize - sizeof(job)));
+			if (!socket.Receive(&job, sizeof(job)) || !socket.Receive(sceneData.data(), sceneData.size()))
+			{
+				sError = "Lost the connection to the coordinator";
+				return false;
+			}
+
+			if (!ReadSceneFile(sceneData.data(), sceneData.size(), scene, sError))
+				return false;
+			if (job.bCompactLayout)
+				BuildCompactLayout(scene);
+
+			// the same welds as the coordinator, then the direct passes of the range
+			baker.BeginBake(scene, accumulation);
+			baker.WeldVertices(scene);
+			bounceColors.clear();
+
+			SLevelInfo levelInfo = scene.levelInfo;
+			levelInfo.nBakeFlags &= ~ELightBake_Indirect;
+			levelInfo.normalSmoothCos = 1.0f;
+
+			SBakeScheduleSettings settings;
+			settings.nBatchRays = job.nBatchRays;
+			settings.bWeldVertices = false;
+			settings.nFirstVertex = job.nFirstVertex;
+			settings.nEndVertex = job.nEndVertex;
+
+			CBakeScheduler scheduler;
+			scheduler.Begin(levelInfo, 0, settings);
+			CWorkerBakeBackend backend(baker, scene, accumulation, bounceColors);
+			scheduler.Run(backend);
+
+			if (!SendResult(socket, -1, job, baker, accumulation, nullptr))
+			{
+				sError = "Lost the connection to the coordinator";
+				return false;
+			}
+		}
+		else if (header.nType == EDistributedMessage_Bounce && header.nSize == sizeof(SDistributedBounce) + accumulation.size() * sizeof(float4))
+		{
+			SDistributedBounce bounce;
+			bounceColors.resize(accumulation.size());
+			if (!socket.Receive(&bounce, sizeof(bounce)) || !socket.Receive(bounceColors.data(), bounceColors.size() * sizeof(float4)))
+			{
+				sError = "Lost the connection to the coordinator";
+				return false;
+			}
+
+			// the first bounce starts from the gathered direct light, the coordinator scattered the welded vertices
+			if (bounce.nBounce == 0)
+				accumulation = bounceColors;
+
+			SLevelInfo levelInfo = scene.levelInfo;
+			levelInfo.nBakeFlags &= ELightBake_Indirect | ELightBake_Adaptive;
+			levelInfo.normalSmoothCos = 1.0f;
+
+			SBakeScheduleSettings settings;
+			settings.nBatchRays = job.nBatchRays;
+			settings.bWeldVertices = false;
+			settings.nFirstVertex = job.nFirstVertex;
+			settings.nEndVertex = job.nEndVertex;
+
+			CBakeScheduler scheduler;
+			scheduler.Begin(levelInfo, 1, settings);
+			CWorkerBakeBackend backend(baker, scene, accumulation, bounceColors);
+			scheduler.Run(backend);
+
+			if (!SendResult(socket, bounce.nBounce, job, baker, accumulation, &baker.GetBounceColors()))
+			{
+				sError = "Lost the connection to the coordinator";
+				return false;
+			}
+		}
+		else
+		{
+			sError = "Unexpected message from the coordinator";
+			return false;
+		}
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+// Distributed bake over sockets for the headless baker.
+// A coordinator (lightbake --listen) splits the vertices of a level into one contiguous range per worker process
+// (lightbake --worker), sends every worker the scene as a scene file (see SceneFile.h) and gathers the accumulated light
+// of the ranges. The direct passes only write their own vertices and need no synchronization. Every indirect bounce
+// reads the previous bounce at all vertices, so the coordinator gathers each bounce and sends it to every worker before
+// the next one starts, one barrier per bounce. The result is the same as a local CCpuBaker::Bake.
+// Messages carry the structs in their native layout, the coordinator and the workers have to run the same build.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BakeScene.h"
+#include "BakeScheduler.h"
+#include "Socket.h"
+
+class CJobSystem;
+
+static constexpr uint32_t kDistributedMagic = 0x4244424Cu; // "LBDB"
+static constexpr uint32_t kDistributedVersion = 2;
+
+// how long a worker keeps trying to reach the coordinator
+static constexpr int kWorkerConnectTimeoutMs = 30000;
+
+enum EDistributedMessage : uint32_t
+{
+	EDistributedMessage_Hello,  // worker to coordinator after connecting, magic and version
+	EDistributedMessage_Job,    // vertex range and the scene file
+	EDistributedMessage_Bounce, // the colors the next indirect bounce reads
+	EDistributedMessage_Result, // accumulation of the range after the direct passes or a bounce, and the bounce result
+	EDistributedMessage_Done,   // no more jobs, the worker exits
+};
+
+class CBakeCoordinator
+{
+public:
+	// listens on sAddress and waits until nNumWorkers workers connected
+	bool Start(const std::string& sAddress, int nNumWorkers, std::string& sError);
+
+	// sends Done to the workers and closes the connections
+	void Stop();
+
+	// Bakes the scene on the workers, the result is the accumulated light per vertex like CCpuBaker::Bake.
+	// scene.normals have to be smoothed already (levelInfo.normalSmoothCos 1), the welds are built here.
+	// Fails if a worker drops out, the level has to be baked again then.
+	bool Bake(SBakeScene& scene, int nIndirectBounces, std::vector<float4>& accumulation, std::string& sError);
+
+	int GetNumWorkers() const { return (int)m_workers.size(); }
+
+	// rays per vertex of the last Bake, summed over the workers
+	const SRayPassStats& GetSkyEmissiveRayStats() const { return m_skyEmissiveRayStats; }
+	const SRayPassStats& GetIndirectRayStats() const { return m_indirectRayStats; }
+
+private:
+	CSocket              m_listener;
+	std::vector<CSocket> m_workers;
+	SRayPassStats        m_skyEmissiveRayStats;
+	SRayPassStats        m_indirectRayStats;
+};
+
+// connects to the coordinator on sAddress and bakes its jobs until it sends Done, false if the connection failed
+bool RunBakeWorker(const std::string& sAddress, CJobSystem* pJobSystem, std::string& sError);
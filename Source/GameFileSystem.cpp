@@ -0,0 +1,147 @@
+#include "GameFileSystem.h"
+#include "AssetIndex.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+	// GOB 2.0 container layout (JK/MotS)
+	struct SGobHeader
+	{
+		char     magic[4]; // "GOB "
+		uint32_t nVersion;
+		uint32_t nIndexOffset;
+	};
+
+	struct SGobEntry
+	{
+		uint32_t nOffset;
+		uint32_t nSize;
+		char     sName[128];
+	};
+
+	std::string NormalizeName(std::string sName)
+	{
+		std::replace(sName.begin(), sName.end(), '\\', '/');
+		std::transform(sName.begin(), sName.end(), sName.begin(), [](unsigned char c) { return (char)tolower(c); });
+		return sName;
+	}
+}
+
+bool CGameFileSystem::AddSearchPath(const std::string& sPath, std::string& sError)
+{
+	std::error_code ec;
+	if (std::filesystem::is_directory(sPath, ec))
+		return AddDirectory(sPath, sError);
+
+	if (std::filesystem::is_regular_file(sPath, ec))
+		return AddContainer(sPath, sError);
+
+	sError = "Search path '" + sPath + "' doesn't exist";
+	return false;
+}
+
+bool CGameFileSystem::AddDirectory(const std::string& sPath, std::string& sError)
+{
+	std::error_code ec;
+	for (std::filesystem::recursive_directory_iterator it(sPath, ec), end; !ec && it != end; it.increment(ec))
+	{
+		if (!it->is_regular_file(ec))
+			continue;
+
+		const std::string sRelative = NormalizeName(std::filesystem::relative(it->path(), sPath, ec).generic_string());
+		const int64_t nModifiedTime = (int64_t)it->last_write_time(ec).time_since_epoch().count();
+		m_files.emplace(sRelative, SFileEntry{ -1, 0, (uint64_t)it->file_size(ec), nModifiedTime, it->path().string() });
+	}
+
+	if (ec)
+	{
+		sError = "Failed to list '" + sPath + "': " + ec.message();
+		return false;
+	}
+	return true;
+}
+
+bool CGameFileSystem::AddContainer(const std::string& sPath, std::string& sError)
+{
+	std::ifstream file(sPath, std::ios::binary);
+
+	SGobHeader header;
+	if (!file.read((char*)&header, sizeof(SGobHeader)) || memcmp(header.magic, "GOB ", 4) != 0)
+	{
+		sError = "'" + sPath + "' is not a GOB file";
+		return false;
+	}
+
+	uint32_t nNumEntries = 0;
+	file.seekg(header.nIndexOffset);
+	if (!file.read((char*)&nNumEntries, sizeof(uint32_t)))
+	{
+		sError = "Failed to read the index of '" + sPath + "'";
+		return false;
+	}
+
+	std::error_code ec;
+	const int64_t nModifiedTime = (int64_t)std::filesystem::last_write_time(sPath, ec).time_since_epoch().count();
+
+	const int nContainer = (int)m_containers.size();
+	m_containers.push_back(sPath);
+
+	for (uint32_t i = 0; i < nNumEntries; ++i)
+	{
+		SGobEntry entry;
+		if (!file.read((char*)&entry, sizeof(SGobEntry)))
+		{
+			sError = "Truncated index in '" + sPath + "'";
+			return false;
+		}
+		entry.sName[sizeof(entry.sName) - 1] = '\0';
+		m_files.emplace(NormalizeName(entry.sName), SFileEntry{ nContainer, entry.nOffset, entry.nSize, nModifiedTime, std::string() });
+	}
+	return true;
+}
+
+const CGameFileSystem::SFileEntry* CGameFileSystem::FindEntry(const std::string& sName) const
+{
+	static const char* const kSearchDirs[] = { "", "mat/", "3do/mat/", "misc/cmp/" };
+
+	const std::string sNormalized = NormalizeName(sName);
+	for (const char* sDir : kSearchDirs)
+	{
+		auto it = m_files.find(sDir + sNormalized);
+		if (it != m_files.end())
+			return &it->second;
+	}
+	return nullptr;
+}
+
+bool CGameFileSystem::ReadGameFile(const std::string& sName, std::vector<uint8_t>& data) const
+{
+	const SFileEntry* pEntry = FindEntry(sName);
+	return pEntry && ReadEntry(*pEntry, data);
+}
+
+bool CGameFileSystem::GetFileStamp(const std::string& sName, uint64_t& nStamp) const
+{
+	const SFileEntry* pEntry = FindEntry(sName);
+	if (!pEntry)
+		return false;
+
+	nStamp = MakeAssetStamp(pEntry->nSize, pEntry->nModifiedTime, pEntry->nOffset);
+	return true;
+}
+
+bool CGameFileSystem::ReadEntry(const SFileEntry& entry, std::vector<uint8_t>& data) const
+{
+	std::ifstream file(entry.nContainer < 0 ? entry.sPath : m_containers[entry.nContainer], std::ios::binary);
+	if (!file)
+		return false;
+
+	data.resize(entry.nSize);
+	file.seekg(entry.nOffset);
+	return (bool)file.read((char*)data.data(), data.size());
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// Game file lookup for the headless baker, the equivalent of JED's OpenGameFile
+// Search paths are either directories (a project or extracted game resource directory) or GOB containers,
+// lookups are case insensitive and the first search path that has a file wins.
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class CGameFileSystem
+{
+public:
+	// adds a directory or .gob to the search paths
+	bool AddSearchPath(const std::string& sPath, std::string& sError);
+
+	// reads a game file, bare names are also searched for in the standard mat/ and misc/cmp/ directories
+	// safe to call from multiple threads once all search paths are added
+	bool ReadGameFile(const std::string& sName, std::vector<uint8_t>& data) const;
+
+	// stamp of the file for the asset index (see MakeAssetStamp), false if there is no such file
+	bool GetFileStamp(const std::string& sName, uint64_t& nStamp) const;
+
+private:
+	struct SFileEntry
+	{
+		int      nContainer; // -1 for loose files
+		uint64_t nOffset;
+		uint64_t nSize;
+		int64_t  nModifiedTime; // of the loose file or the container
+		std::string sPath;   // loose file path
+	};
+
+	bool AddDirectory(const std::string& sPath, std::string& sError);
+	bool AddContainer(const std::string& sPath, std::string& sError);
+
+	const SFileEntry* FindEntry(const std::string& sName) const;
+	bool ReadEntry(const SFileEntry& entry, std::vector<uint8_t>& data) const;
+
+	// lowercase, forward slashed relative path to file
+	std::unordered_map<std::string, SFileEntry> m_files;
+	std::vector<std::string> m_containers;
+};
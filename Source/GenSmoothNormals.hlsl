@@ -1,93 +1,91 @@
 #include "Baking.hlsli"
 
+// vertex hash built on the CPU, see VertexHash.h
+StructuredBuffer<SVertexHashCell> aVertexHashCells    : register(t14);
+Buffer<uint>                      aVertexHashVertices : register(t15);
+
 RWStructuredBuffer<int4> aNormalsWrite : register(u0);
 
-// Smooth contribution between two vertices
-void SmoothPair(uint nVertexIndex0, uint nVertexIndex1)
-{
-    const float3 vertex0 = aVertices[nVertexIndex0].position.xyz;
-    const float3 vertex1 = aVertices[nVertexIndex1].position.xyz;
+// must match kSmoothDistanceSqr and kVertexHashCellSize
+static const float kSmoothDistanceSqr = 1e-5;
+static const float kVertexHashCellSize = 0.01;
 
-    const float3 normal0 = aSurfaces[aVertices[nVertexIndex0].nSurfaceIndex].normal.xyz;
-    const float3 normal1 = aSurfaces[aVertices[nVertexIndex1].nSurfaceIndex].normal.xyz;
+// must match GetVertexHashSize
+uint GetVertexHashMask()
+{
+    uint nSize = 1;
+    while (nSize < 2u * (uint)g_levelInfo.nTotalVertices)
+        nSize <<= 1;
+    return nSize - 1;
+}
 
-    const float3 diff = vertex1 - vertex0;
-    if (dot(diff, diff) < 1e-5 && dot(normal0, normal1) > g_levelInfo.normalSmoothCos)
+// slot of the cell or -1 if it has no vertices, must match GetVertexHashSlot
+int FindVertexHashCell(int3 cell, uint nMask)
+{
+    const uint3 ucell = (uint3)cell;
+    uint nSlot = ((ucell.x * 73856093u) ^ (ucell.y * 19349663u) ^ (ucell.z * 83492791u)) & nMask;
+    while (aVertexHashCells[nSlot].nCount > 0)
     {
-        int old;
-        InterlockedAdd(aNormalsWrite[nVertexIndex0].x, int(normal1.x * 1024.0), old);
-        InterlockedAdd(aNormalsWrite[nVertexIndex0].y, int(normal1.y * 1024.0), old);
-        InterlockedAdd(aNormalsWrite[nVertexIndex0].z, int(normal1.z * 1024.0), old);
-        InterlockedAdd(aNormalsWrite[nVertexIndex1].x, int(normal0.x * 1024.0), old);
-        InterlockedAdd(aNormalsWrite[nVertexIndex1].y, int(normal0.y * 1024.0), old);
-        InterlockedAdd(aNormalsWrite[nVertexIndex1].z, int(normal0.z * 1024.0), old);
+        if (all(aVertexHashCells[nSlot].cell == cell))
+            return (int)nSlot;
+        nSlot = (nSlot + 1) & nMask;
     }
+    return -1;
 }
 
-// Smooth contribution from neighbor vertex only
-void SmoothAdjoin(uint nVertexIndex0, uint nVertexIndex1)
+// a vertex adds the vertices of an adjoined sector once per adjoin into it
+int GetAdjoinCount(uint nSectorIndex, uint nOtherSector)
 {
-    const float3 vertex0 = aVertices[nVertexIndex0].position.xyz;
-    const float3 vertex1 = aVertices[nVertexIndex1].position.xyz;
-
-    const float3 normal0 = aSurfaces[aVertices[nVertexIndex0].nSurfaceIndex].normal.xyz;
-    const float3 normal1 = aSurfaces[aVertices[nVertexIndex1].nSurfaceIndex].normal.xyz;
+    const uint nFirstSurface = aSectors[nSectorIndex].nFirstSurface;
+    const uint nLastSurface = nFirstSurface + aSectors[nSectorIndex].nNumSurfaces;
 
-    const float3 diff = vertex1 - vertex0;
-    if (dot(diff, diff) < 1e-5 && dot(normal0, normal1) > g_levelInfo.normalSmoothCos)
-    {
-        int old;
-        InterlockedAdd(aNormalsWrite[nVertexIndex0].x, int(normal1.x * 1024.0), old);
-        InterlockedAdd(aNormalsWrite[nVertexIndex0].y, int(normal1.y * 1024.0), old);
-        InterlockedAdd(aNormalsWrite[nVertexIndex0].z, int(normal1.z * 1024.0), old);
-    }
+    int nCount = 0;
+    for (uint nSurfaceIndex = nFirstSurface; nSurfaceIndex < nLastSurface; ++nSurfaceIndex)
+        nCount += (aSurfaces[nSurfaceIndex].nAdjoinSector == (int)nOtherSector) ? 1 : 0;
+    return nCount;
 }
 
+// One thread per vertex, adds the normals of the vertices in range in its sector and the sectors it adjoins.
+// Every thread only writes its own normal so there are no atomics.
 [numthreads(256, 1, 1)]
 void main(uint3 dispatchThreadID : SV_DispatchThreadID)
 {
-    const int nSectorIndex = dispatchThreadID.x;
-    if (nSectorIndex >= g_levelInfo.nTotalSectors) return;
+    const uint nVertexIndex0 = dispatchThreadID.x;
+    if (nVertexIndex0 >= (uint)g_levelInfo.nTotalVertices) return;
 
-    const uint nFirstSurface0 = aSectors[nSectorIndex].nFirstSurface;
-    const uint nLastSurface0 = nFirstSurface0 + aSectors[nSectorIndex].nNumSurfaces;
+    const SVertex vertex0 = aVertices[nVertexIndex0];
+    const float3 normal0 = aSurfaces[vertex0.nSurfaceIndex].normal.xyz;
+    const int3 cell = (int3)floor(vertex0.position.xyz * (1.0 / kVertexHashCellSize));
+    const uint nMask = GetVertexHashMask();
 
-    // Compare within sector
-    for (uint nSurfaceIndex0 = nFirstSurface0; nSurfaceIndex0 < nLastSurface0; ++nSurfaceIndex0)
+    int3 sum = int3(0,0,0);
+    for (int z = -1; z <= 1; ++z)
     {
-        const uint nFirstVertex0 = aSurfaces[nSurfaceIndex0].nFirstVertex;
-        const uint nLastVertex0 = nFirstVertex0 + aSurfaces[nSurfaceIndex0].nNumVertices;
-
-        for (uint nVertexIndex0 = nFirstVertex0; nVertexIndex0 < nLastVertex0; ++nVertexIndex0)
+        for (int y = -1; y <= 1; ++y)
         {
-            for (uint nSurfaceIndex1 = nSurfaceIndex0; nSurfaceIndex1 < nLastSurface0; ++nSurfaceIndex1)
-            {
-                const uint nFirstVertex1 = aSurfaces[nSurfaceIndex1].nFirstVertex;
-                const uint nLastVertex1 = nFirstVertex1 + aSurfaces[nSurfaceIndex1].nNumVertices;
-
-                const uint nStart = (nSurfaceIndex0 == nSurfaceIndex1) ? nVertexIndex0 + 1 : nFirstVertex1;
-                for (uint nVertexIndex1 = nStart; nVertexIndex1 < nLastVertex1; ++nVertexIndex1)
-                    SmoothPair(nVertexIndex0, nVertexIndex1);
-            }
-
-            // Compare with adjoined sector
-            for (nSurfaceIndex1 = nFirstSurface0; nSurfaceIndex1 < nLastSurface0; ++nSurfaceIndex1)
+            for (int x = -1; x <= 1; ++x)
             {
-                int nAdjoinSector = aSurfaces[nSurfaceIndex1].nAdjoinSector;
-                if (nAdjoinSector < 0) continue;
-
-                const uint nFirstSurface1 = aSectors[nAdjoinSector].nFirstSurface;
-                const uint nLastSurface1 = nFirstSurface1 + aSectors[nAdjoinSector].nNumSurfaces;
+                const int nSlot = FindVertexHashCell(cell + int3(x, y, z), nMask);
+                if (nSlot < 0) continue;
 
-                for (uint nSurfaceIndex1Adj = nFirstSurface1; nSurfaceIndex1Adj < nLastSurface1; ++nSurfaceIndex1Adj)
+                const uint nFirst = aVertexHashCells[nSlot].nFirst;
+                const uint nLast = nFirst + aVertexHashCells[nSlot].nCount;
+                for (uint nEntry = nFirst; nEntry < nLast; ++nEntry)
                 {
-                    const uint nFirstVertex1 = aSurfaces[nSurfaceIndex1Adj].nFirstVertex;
-                    const uint nLastVertex1 = nFirstVertex1 + aSurfaces[nSurfaceIndex1Adj].nNumVertices;
-
-                    for (uint nVertexIndex1 = nFirstVertex1; nVertexIndex1 < nLastVertex1; ++nVertexIndex1)
-                        SmoothAdjoin(nVertexIndex0, nVertexIndex1);
+                    const uint nVertexIndex1 = aVertexHashVertices[nEntry];
+                    const SVertex vertex1 = aVertices[nVertexIndex1];
+                    const int nCount = (vertex1.nSectorIndex == vertex0.nSectorIndex) ? ((nVertexIndex1 != nVertexIndex0) ? 1 : 0)
+                        : GetAdjoinCount(vertex0.nSectorIndex, vertex1.nSectorIndex);
+                    if (nCount == 0) continue;
+
+                    const float3 diff = vertex1.position.xyz - vertex0.position.xyz;
+                    const float3 normal1 = aSurfaces[vertex1.nSurfaceIndex].normal.xyz;
+                    if (dot(diff, diff) < kSmoothDistanceSqr && dot(normal0, normal1) > g_levelInfo.normalSmoothCos)
+                        sum += nCount * int3(normal1 * 1024.0);
                 }
             }
         }
     }
+
+    aNormalsWrite[nVertexIndex0].xyz += sum;
 }
@@ -2,6 +2,7 @@
 #include "framework.h"
 
 #include "GpuBuffer.h"
+#include "SceneResidency.h"
 
 // todo: move it out of the constructor is probably a good idea
 CGpuBuffer::CGpuBuffer()
@@ -10,6 +11,8 @@ CGpuBuffer::CGpuBuffer()
 	, m_pBuffer(nullptr)
 	, m_pShaderView(nullptr)
 	, m_pUnorderedView(nullptr)
+	, m_nCapacity(0)
+	, m_nStride(0)
 {
 	memset(&mapped, 0, sizeof(mapped));
 }
@@ -43,6 +46,9 @@ bool CGpuBuffer::Create(ID3D11Device* pDevice, ID3D11DeviceContext* pDeviceConte
 	if (!m_pBuffer)
 		return false;
 
+	m_nCapacity = numElements;
+	m_nStride = stride;
+
 	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
 	ZeroMemory(&srvDesc, sizeof(srvDesc));
 	//srvDesc.Buffer.FirstElement = 0;
@@ -100,6 +106,34 @@ void CGpuBuffer::Release()
 	if (m_pUnorderedView)
 		m_pUnorderedView->Release();
 	m_pUnorderedView = NULL;
+
+	m_nCapacity = 0;
+}
+
+bool CGpuBuffer::Reserve(ID3D11Device* pDevice, ID3D11DeviceContext* pDeviceContext, int numElements, int stride, DXGI_FORMAT format, int writeable, int readable, D3D11_RESOURCE_MISC_FLAG miscFlags)
+{
+	if (m_pBuffer && m_pDevice == pDevice && m_nStride == stride && numElements <= m_nCapacity)
+		return false;
+
+	const int capacity = (m_pBuffer && m_nStride == stride) ? (int)GrowCapacity(m_nCapacity, numElements) : numElements;
+	Release();
+	Create(pDevice, pDeviceContext, capacity, stride, format, writeable, readable, miscFlags);
+	return true;
+}
+
+void CGpuBuffer::UpdateRange(const void* pData, int firstElement, int numElements)
+{
+	if (!m_pBuffer || numElements <= 0)
+		return;
+
+	D3D11_BOX box;
+	box.left = firstElement * m_nStride;
+	box.right = (firstElement + numElements) * m_nStride;
+	box.top = 0;
+	box.bottom = 1;
+	box.front = 0;
+	box.back = 1;
+	m_pDeviceContext->UpdateSubresource(m_pBuffer, 0, &box, pData, 0, 0);
 }
 
 void* CGpuBuffer::Map(D3D11_MAP mapping)
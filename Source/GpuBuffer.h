@@ -9,6 +9,15 @@ public:
 	bool Create(ID3D11Device* pDevice, ID3D11DeviceContext* pDeviceContext, int numElements, int stride, DXGI_FORMAT format, int writeable, int readable, D3D11_RESOURCE_MISC_FLAG miscFlags);
 	void Release();
 
+	// keeps the buffer if it already holds numElements, otherwise recreates it with geometric growth (see GrowCapacity)
+	// returns true if the buffer was (re)created, its content is undefined then
+	bool Reserve(ID3D11Device* pDevice, ID3D11DeviceContext* pDeviceContext, int numElements, int stride, DXGI_FORMAT format, int writeable, int readable, D3D11_RESOURCE_MISC_FLAG miscFlags);
+
+	// copies numElements elements to firstElement, the buffer has to be at least that large
+	void UpdateRange(const void* pData, int firstElement, int numElements);
+
+	int GetCapacity() const { return m_nCapacity; }
+
 	void* Map(D3D11_MAP mapping);
 	void Unmap();
 
@@ -31,6 +40,8 @@ private:
 
 	ID3D11Device* m_pDevice;
 	ID3D11DeviceContext* m_pDeviceContext;
+	int                        m_nCapacity; // elements
+	int                        m_nStride;
 	D3D11_MAPPED_SUBRESOURCE   mapped;
 };
 
@@ -0,0 +1,45 @@
+#pragma once
+
+// 64 bit hash for detecting changes between bakes (light cache, scene residency), FNV-1a like but 8 bytes per step
+// so hashing a whole level stays well below the cost of uploading it
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static constexpr uint64_t kHashSeed = 0xCBF29CE484222325ull;
+
+inline uint64_t HashBytes(uint64_t nHash, const void* pData, size_t nSize)
+{
+	const uint8_t* pBytes = (const uint8_t*)pData;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= nSize; i += sizeof(uint64_t))
+	{
+		uint64_t nWord;
+		memcpy(&nWord, pBytes + i, sizeof(nWord));
+		nHash = (nHash ^ nWord) * 0x9E3779B97F4A7C15ull;
+		nHash ^= nHash >> 29;
+	}
+	for (; i < nSize; ++i)
+	{
+		nHash ^= pBytes[i];
+		nHash *= 0x100000001B3ull;
+	}
+	return nHash;
+}
+
+// hashes a range of trivially copyable values including its length
+template <typename T>
+inline uint64_t HashRange(uint64_t nHash, const T* paValues, size_t nCount)
+{
+	const uint64_t nCount64 = nCount;
+	nHash = HashBytes(nHash, &nCount64, sizeof(nCount64));
+	return HashBytes(nHash, paValues, nCount * sizeof(T));
+}
+
+template <typename T>
+inline uint64_t HashVector(uint64_t nHash, const std::vector<T>& values)
+{
+	return HashRange(nHash, values.data(), values.size());
+}
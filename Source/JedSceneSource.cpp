@@ -0,0 +1,312 @@
+#include "pch.h"
+#include "framework.h"
+#include "Light Baker.h"
+#include "JedSceneSource.h"
+
+#include <algorithm>
+#include <atlconv.h>
+#include <filesystem>
+
+CJedSceneSource::CJedSceneSource(IJED* pJed)
+	: m_pJed(pJed)
+	, m_pJedLevel(nullptr)
+	, m_pLastJedLevel(nullptr)
+	, m_pProfile(nullptr)
+	, m_nContainerTime(0)
+{
+}
+
+bool CJedSceneSource::SetLevel(IJEDLevel* pJedLevel)
+{
+	m_pJedLevel = pJedLevel;
+	const bool bChanged = m_pLastJedLevel != m_pJedLevel;
+	if (bChanged)
+	{
+		// clear resource caches on any level changes so we can reload mising mats, the asset index keeps that cheap
+		m_materialColorCache.clear();
+		m_colormapCache.clear();
+	}
+	m_pLastJedLevel = m_pJedLevel;
+	return bChanged;
+}
+
+void CJedSceneSource::PreloadMasterCMP()
+{
+	tlevelheader levelHeader;
+	memset(&levelHeader, 0, sizeof(tlevelheader));
+	m_pJedLevel->GetLevelHeader(&levelHeader, lh_all);
+	if (levelHeader.mastercmp && levelHeader.mastercmp[0] != '\0')
+		LoadMissing(EAsset_Colormap, { levelHeader.mastercmp }, nullptr);
+}
+
+int CJedSceneSource::GetNumSectors()
+{
+	return m_pJedLevel->NSectors();
+}
+
+int CJedSceneSource::GetNumLayers()
+{
+	return m_pJedLevel->NLayers();
+}
+
+int CJedSceneSource::GetNumLights()
+{
+	return m_pJedLevel->NLights();
+}
+
+void CJedSceneSource::GetSector(int nSectorIndex, SSceneSector& sector)
+{
+	tjedsectorrec sectorRec;
+	memset(&sectorRec, 0, sizeof(tjedsectorrec));
+	m_pJedLevel->GetSector(nSectorIndex, &sectorRec, s_flags | s_cmp | s_layer);
+
+	sector.nFlags = sectorRec.flags;
+	sector.nLayer = sectorRec.layer;
+
+	// the colormap and the material fill colors are set by ResolveAssets
+	if ((int)m_sectorColormaps.size() <= nSectorIndex)
+	{
+		m_sectorColormaps.resize(nSectorIndex + 1, -1);
+		m_surfaceMaterials.resize(nSectorIndex + 1);
+	}
+	m_sectorColormaps[nSectorIndex] = AddPendingName(sectorRec.colormap);
+
+	// fetch every sector vertex once rather than once per surface using it
+	const int nNumVertices = m_pJedLevel->SectorNVertices(nSectorIndex);
+	sector.vertices.resize(nNumVertices);
+	for (int nVertexIndex = 0; nVertexIndex < nNumVertices; ++nVertexIndex)
+	{
+		tjedvector vertex;
+		m_pJedLevel->SectorGetVertex(nSectorIndex, nVertexIndex, &vertex.v.s1.x, &vertex.v.s1.y, &vertex.v.s1.z);
+		sector.vertices[nVertexIndex] = { (float)vertex.v.s1.x, (float)vertex.v.s1.y, (float)vertex.v.s1.z };
+	}
+
+	const int nNumSurfaces = m_pJedLevel->SectorNSurfaces(nSectorIndex);
+	sector.surfaces.resize(nNumSurfaces);
+	m_surfaceMaterials[nSectorIndex].resize(nNumSurfaces);
+	for (int nSurfaceIndex = 0; nSurfaceIndex < nNumSurfaces; ++nSurfaceIndex)
+	{
+		tjedsurfacerec surfaceRec;
+		memset(&surfaceRec, 0, sizeof(tjedsurfacerec));
+		m_pJedLevel->GetSurface(nSectorIndex, nSurfaceIndex, &surfaceRec, sf_adjoin | sf_adjoinflags | sf_SurfFlags | sf_FaceFlags | sf_Material | sf_geo | sf_ExtraLight);
+
+		tjedvector normal;
+		m_pJedLevel->GetSurfaceNormal(nSectorIndex, nSurfaceIndex, &normal);
+
+		SSceneSurface& surface = sector.surfaces[nSurfaceIndex];
+		surface.nAdjoinSector = surfaceRec.adjoinsc;
+		surface.nAdjoinFlags = surfaceRec.adjoinflags;
+		surface.nSurfFlags = surfaceRec.surfflags;
+		surface.nFaceFlags = surfaceRec.faceflags;
+		surface.nGeo = surfaceRec.geo;
+		surface.bHasMaterial = surfaceRec.material != nullptr;
+		m_surfaceMaterials[nSectorIndex][nSurfaceIndex] = AddPendingName(surfaceRec.material);
+		surface.extraLight = (float)surfaceRec.extralight;
+		surface.normal = { (float)normal.v.s1.x, (float)normal.v.s1.y, (float)normal.v.s1.z };
+
+		const int nNumSurfaceVertices = m_pJedLevel->SurfaceNVertices(nSectorIndex, nSurfaceIndex);
+		surface.nFirstIndex = (uint32_t)sector.indices.size();
+		surface.nNumIndices = nNumSurfaceVertices;
+		for (int nVertexIndex = 0; nVertexIndex < nNumSurfaceVertices; ++nVertexIndex)
+			sector.indices.push_back(m_pJedLevel->SurfaceGetVertexNum(nSectorIndex, nSurfaceIndex, nVertexIndex));
+	}
+}
+
+void CJedSceneSource::GetLight(int nLightIndex, SSceneLight& light)
+{
+	tjedlightrec lightRec;
+	memset(&lightRec, 0, sizeof(tjedlightrec));
+	m_pJedLevel->GetLight(nLightIndex, &lightRec, lt_all);
+
+	light.position = { (float)lightRec.x, (float)lightRec.y, (float)lightRec.z };
+	light.intensity = (float)lightRec.intensity;
+	light.range = (float)lightRec.range;
+	light.color = { lightRec.r, lightRec.g, lightRec.b };
+	light.rgbIntensity = lightRec.rgbintensity;
+	light.nFlags = lightRec.flags;
+	light.nLayer = lightRec.layer;
+	light.nSectorIndex = m_pJed->FindSectorForXYZ(lightRec.x, lightRec.y, lightRec.z);
+}
+
+bool CJedSceneSource::ReadGameFile(const wchar_t* sFileName, std::vector<uint8_t>& data) const
+{
+	int nFileHandle = m_pJed->OpenGameFile((char*)sFileName);
+	if (nFileHandle < 0)
+		return false;
+
+	const long nFileSize = m_pJed->GetFileSize(nFileHandle);
+	data.resize(nFileSize > 0 ? nFileSize : 0);
+	const bool bRead = data.empty() || m_pJed->ReadFile(nFileHandle, data.data(), (long)data.size()) == (int)data.size();
+	m_pJed->CloseFile(nFileHandle);
+
+	if (!bRead)
+		PrintMessage(m_pJed, msg_error, "Failed to read file '%ls'.", sFileName);
+
+	return bRead;
+}
+
+int CJedSceneSource::AddPendingName(const wchar_t* sFileName)
+{
+	if (!sFileName || sFileName[0] == '\0')
+		return -1;
+
+	auto it = m_pendingIds.emplace(sFileName, (int)m_pendingNames.size());
+	if (it.second)
+		m_pendingNames.push_back(sFileName);
+	return it.first->second;
+}
+
+void CJedSceneSource::ResolveAssets(SSceneSnapshot& snapshot, CJobSystem* pJobSystem)
+{
+	const int nNumSectors = std::min((int)snapshot.sectors.size(), (int)m_sectorColormaps.size());
+
+	std::vector<bool> used(m_pendingNames.size(), false);
+	std::vector<std::wstring> names;
+	for (int nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		const int nColormap = m_sectorColormaps[nSectorIndex];
+		if (nColormap >= 0 && !used[nColormap])
+		{
+			used[nColormap] = true;
+			names.push_back(m_pendingNames[nColormap]);
+		}
+	}
+	LoadMissing(EAsset_Colormap, names, pJobSystem);
+
+	// materials are only looked at in sectors with a colormap
+	used.assign(m_pendingNames.size(), false);
+	names.clear();
+	for (int nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		const int nColormap = m_sectorColormaps[nSectorIndex];
+		SSceneSector& sector = snapshot.sectors[nSectorIndex];
+		sector.pColormap = (nColormap >= 0) ? m_colormapCache[m_pendingNames[nColormap]].get() : nullptr;
+		if (!sector.pColormap)
+			continue;
+
+		for (int nMaterial : m_surfaceMaterials[nSectorIndex])
+		{
+			if (nMaterial >= 0 && !used[nMaterial])
+			{
+				used[nMaterial] = true;
+				names.push_back(m_pendingNames[nMaterial]);
+			}
+		}
+	}
+	LoadMissing(EAsset_Material, names, pJobSystem);
+
+	for (int nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		SSceneSector& sector = snapshot.sectors[nSectorIndex];
+		for (size_t nSurfaceIndex = 0; nSurfaceIndex < sector.surfaces.size(); ++nSurfaceIndex)
+		{
+			const int nMaterial = m_surfaceMaterials[nSectorIndex][nSurfaceIndex];
+			SSceneSurface& surface = sector.surfaces[nSurfaceIndex];
+			surface.pMaterial = (sector.pColormap && nMaterial >= 0) ? m_materialColorCache[m_pendingNames[nMaterial]].get() : nullptr;
+			surface.nFillColor = surface.pMaterial ? surface.pMaterial->nFillColor : 0;
+		}
+	}
+
+	m_pendingIds.clear();
+	m_pendingNames.clear();
+}
+
+void CJedSceneSource::UpdateAssetIndexPath()
+{
+	const char* sProjectDir = m_pJed->GetJEDString(js_ProjectDir);
+	const std::string sPath = (sProjectDir && *sProjectDir) ? (std::filesystem::path(sProjectDir) / "assets.lbindex").string() : std::string();
+	if (sPath == m_sAssetIndexPath)
+		return;
+
+	m_sAssetIndexPath = sPath;
+
+	// files from the game containers are stamped with the newest container, they only change when the game is patched
+	m_nContainerTime = 0;
+	const char* sGameDir = m_pJed->GetJEDString(js_GameDir);
+	std::error_code ec;
+	for (std::filesystem::recursive_directory_iterator it(sGameDir ? sGameDir : "", ec), end; !ec && it != end; it.increment(ec))
+	{
+		const std::filesystem::path extension = it->path().extension();
+		if (extension == ".gob" || extension == ".GOB" || extension == ".goo" || extension == ".GOO")
+			m_nContainerTime = std::max(m_nContainerTime, (int64_t)it->last_write_time(ec).time_since_epoch().count());
+	}
+
+	std::string sError;
+	if (!m_sAssetIndexPath.empty() && !m_assetIndex.Load(m_sAssetIndexPath, sError))
+		PrintMessage(m_pJed, msg_warning, "%s '%s', rebuilding it.", sError.c_str(), m_sAssetIndexPath.c_str());
+}
+
+uint64_t CJedSceneSource::GetGameFileStamp(const std::wstring& sFileName) const
+{
+	const int nFileHandle = m_pJed->OpenGameFile((char*)sFileName.c_str());
+	if (nFileHandle < 0)
+		return 0;
+
+	const long nFileSize = m_pJed->GetFileSize(nFileHandle);
+	m_pJed->CloseFile(nFileHandle);
+
+	// JED looks in the project directory before the game containers, loose files there have their own time
+	int64_t nModifiedTime = m_nContainerTime;
+	const char* sProjectDir = m_pJed->GetJEDString(js_ProjectDir);
+	if (sProjectDir && *sProjectDir)
+	{
+		static const wchar_t* const kSearchDirs[] = { L"", L"mat", L"3do\\mat", L"misc\\cmp" };
+		for (const wchar_t* sDir : kSearchDirs)
+		{
+			std::error_code ec;
+			const auto time = std::filesystem::last_write_time(std::filesystem::path(sProjectDir) / sDir / sFileName, ec);
+			if (!ec)
+			{
+				nModifiedTime = (int64_t)time.time_since_epoch().count();
+				break;
+			}
+		}
+	}
+	return MakeAssetStamp((uint64_t)nFileSize, nModifiedTime, 0);
+}
+
+void CJedSceneSource::LoadMissing(EAssetType eType, const std::vector<std::wstring>& names, CJobSystem* pJobSystem)
+{
+	std::vector<std::wstring> missing;
+	for (const std::wstring& sName : names)
+	{
+		const bool bCached = (eType == EAsset_Colormap) ? m_colormapCache.count(sName) != 0 : m_materialColorCache.count(sName) != 0;
+		if (!bCached)
+			missing.push_back(sName);
+	}
+	if (missing.empty())
+		return;
+
+	CScopedBakeTimer timer(m_pProfile, EBakeStage_Materials);
+	UpdateAssetIndexPath();
+
+	std::vector<SAssetLoad> loads(missing.size());
+	for (size_t i = 0; i < missing.size(); ++i)
+	{
+		loads[i].eType = eType;
+		loads[i].sName = (const char*)CW2A(missing[i].c_str(), CP_UTF8);
+		loads[i].nStamp = GetGameFileStamp(missing[i]);
+	}
+
+	// JED's files are read on this thread
+	LoadAssets(loads, m_sAssetIndexPath.empty() ? nullptr : &m_assetIndex, pJobSystem, [this](const std::string& sName, std::vector<uint8_t>& data)
+	{
+		return ReadGameFile(CA2W(sName.c_str(), CP_UTF8), data);
+	}, false);
+
+	// missing files get a blank value too, to avoid console spam and slowdowns
+	for (size_t i = 0; i < loads.size(); ++i)
+	{
+		if (loads[i].sError)
+			PrintMessage(m_pJed, msg_error, "%s in '%ls'.", loads[i].sError, missing[i].c_str());
+
+		if (eType == EAsset_Colormap)
+			m_colormapCache[missing[i]] = std::move(loads[i].pColormap);
+		else
+			m_materialColorCache[missing[i]] = loads[i].bLoaded ? std::make_unique<SMaterialColor>(loads[i].material) : nullptr;
+	}
+
+	std::string sError;
+	if (m_assetIndex.IsDirty() && !m_assetIndex.Save(m_sAssetIndexPath, sError))
+		PrintMessage(m_pJed, msg_warning, "%s '%s'.", sError.c_str(), m_sAssetIndexPath.c_str());
+}
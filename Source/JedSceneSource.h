@@ -0,0 +1,79 @@
+#pragma once
+
+// Scene source reading the level currently open in JED, also owns the colormap/material caches of the plugin
+// GetSector only notes the colormaps and materials of the sectors, ResolveAssets loads the ones that aren't cached in one
+// go once the snapshot is taken and fills them in. JED's files can only be read from the main thread, they are read
+// there whole and parsed on the job system. The parsed files are kept in assets.lbindex in the project directory.
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "AssetIndex.h"
+#include "SceneBuilder.h"
+
+struct IJED;
+struct IJEDLevel;
+struct SBakeProfile;
+class CJobSystem;
+
+class CJedSceneSource
+	: public ISceneSource
+{
+public:
+	explicit CJedSceneSource(IJED* pJed);
+
+	// clears the resource caches when the level changed so we can reload missing mats, true if it changed
+	bool SetLevel(IJEDLevel* pJedLevel);
+
+	// fetches the level header and preloads the master cmp if there is one
+	void PreloadMasterCMP();
+
+	// files that aren't cached yet are loaded in the materials stage of the profile, null to stop profiling
+	void SetProfile(SBakeProfile* pProfile) { m_pProfile = pProfile; }
+
+	// loads the colormaps and materials the sectors of the snapshot use and sets their colormaps and fill colors
+	void ResolveAssets(SSceneSnapshot& snapshot, CJobSystem* pJobSystem);
+
+	int  GetNumSectors() override;
+	int  GetNumLayers() override;
+	int  GetNumLights() override;
+	void GetSector(int nSectorIndex, SSceneSector& sector) override;
+	void GetLight(int nLightIndex, SSceneLight& light) override;
+
+private:
+	// reads a whole game file (from the project or the game containers) into memory
+	bool       ReadGameFile(const wchar_t* sFileName, std::vector<uint8_t>& data) const;
+
+	// stamp of a game file for the asset index, 0 if it doesn't exist
+	uint64_t   GetGameFileStamp(const std::wstring& sFileName) const;
+
+	// loads the files that aren't cached yet and adds them to the cache
+	void       LoadMissing(EAssetType eType, const std::vector<std::wstring>& names, CJobSystem* pJobSystem);
+
+	// loads the index of the project directory if it isn't loaded yet
+	void       UpdateAssetIndexPath();
+
+	// id of a name noted by GetSector
+	int        AddPendingName(const wchar_t* sFileName);
+
+	IJED*      m_pJed;
+	IJEDLevel* m_pJedLevel;
+	IJEDLevel* m_pLastJedLevel;
+	SBakeProfile* m_pProfile;
+
+	// Resource caching, null when missing/broken
+	std::unordered_map<std::wstring, std::unique_ptr<SColormap>>      m_colormapCache;
+	std::unordered_map<std::wstring, std::unique_ptr<SMaterialColor>> m_materialColorCache;
+
+	// parsed files of the project, kept between sessions
+	CAssetIndex m_assetIndex;
+	std::string m_sAssetIndexPath;
+	int64_t     m_nContainerTime; // newest modification time of the game containers, stamps the files in them
+
+	// names noted by GetSector for ResolveAssets, -1 for none
+	std::unordered_map<std::wstring, int> m_pendingIds;
+	std::vector<std::wstring>             m_pendingNames;
+	std::vector<int>                      m_sectorColormaps;  // per sector
+	std::vector<std::vector<int>>         m_surfaceMaterials; // per surface of every sector
+};
@@ -0,0 +1,564 @@
+#include "JklLevel.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "BakeScene.h"
+
+namespace
+{
+	struct SToken
+	{
+		size_t nOffset;
+		size_t nLength;
+	};
+
+	// splits a line on whitespace, keeping the offsets so values can be replaced in place
+	void Tokenize(const std::string& sLine, std::vector<SToken>& tokens)
+	{
+		tokens.clear();
+		size_t i = 0;
+		while (i < sLine.size())
+		{
+			while (i < sLine.size() && isspace((unsigned char)sLine[i]))
+				++i;
+			if (i >= sLine.size())
+				break;
+
+			const size_t nStart = i;
+			while (i < sLine.size() && !isspace((unsigned char)sLine[i]))
+				++i;
+			tokens.push_back({ nStart, i - nStart });
+		}
+	}
+
+	bool IsComment(const std::string& sLine)
+	{
+		for (char c : sLine)
+		{
+			if (!isspace((unsigned char)c))
+				return c == '#';
+		}
+		return true; // empty
+	}
+
+	bool EqualsNoCase(const char* sA, const char* sB)
+	{
+		for (; *sA && *sB; ++sA, ++sB)
+		{
+			if (tolower((unsigned char)*sA) != tolower((unsigned char)*sB))
+				return false;
+		}
+		return *sA == *sB;
+	}
+
+	// walks the data lines of the document, skipping comments and blank lines
+	class CLineReader
+	{
+	public:
+		explicit CLineReader(const std::vector<std::string>& lines)
+			: m_lines(lines)
+		{
+		}
+
+		bool Next()
+		{
+			while (m_nNextLine < (int)m_lines.size())
+			{
+				m_nLine = m_nNextLine++;
+				if (IsComment(m_lines[m_nLine]))
+					continue;
+
+				Tokenize(m_lines[m_nLine], m_tokens);
+				return true;
+			}
+			return false;
+		}
+
+		// peek at the next data line without consuming it
+		bool PeekIsRecord() const
+		{
+			for (int nLine = m_nNextLine; nLine < (int)m_lines.size(); ++nLine)
+			{
+				if (IsComment(m_lines[nLine]))
+					continue;
+
+				const std::string& sLine = m_lines[nLine];
+				const size_t nFirst = sLine.find_first_not_of(" \t");
+				const size_t nColon = sLine.find(':', nFirst);
+				const size_t nSpace = sLine.find_first_of(" \t", nFirst);
+				return nColon != std::string::npos && nColon < nSpace && isdigit((unsigned char)sLine[nFirst]);
+			}
+			return false;
+		}
+
+		int         Line() const                  { return m_nLine; }
+		size_t      Count() const                 { return m_tokens.size(); }
+		std::string Str(size_t i) const           { return i < m_tokens.size() ? m_lines[m_nLine].substr(m_tokens[i].nOffset, m_tokens[i].nLength) : std::string(); }
+		int         Int(size_t i) const           { return (int)strtol(Str(i).c_str(), nullptr, 0); }
+		uint32_t    Hex(size_t i) const           { return (uint32_t)strtoul(Str(i).c_str(), nullptr, 0); }
+		float       Float(size_t i) const         { return strtof(Str(i).c_str(), nullptr); }
+		bool        Is(size_t i, const char* s) const { return EqualsNoCase(Str(i).c_str(), s); }
+		const SToken& Token(size_t i) const       { return m_tokens[i]; }
+
+	private:
+		const std::vector<std::string>& m_lines;
+		std::vector<SToken> m_tokens;
+		int m_nLine = -1;
+		int m_nNextLine = 0;
+	};
+
+	void FormatFloat(std::string& sOut, float value)
+	{
+		char sValue[32];
+		snprintf(sValue, sizeof(sValue), "%.4f", value);
+		sOut += sValue;
+	}
+}
+
+bool CJklLevel::Load(const char* sPath, std::string& sError)
+{
+	std::ifstream file(sPath, std::ios::binary);
+	if (!file)
+	{
+		sError = "Failed to open file";
+		return false;
+	}
+
+	std::stringstream contents;
+	contents << file.rdbuf();
+	const std::string sText = contents.str();
+
+	m_lines.clear();
+	m_bCRLF = false;
+
+	size_t nStart = 0;
+	while (nStart < sText.size())
+	{
+		size_t nEnd = sText.find('\n', nStart);
+		if (nEnd == std::string::npos)
+			nEnd = sText.size();
+
+		std::string sLine = sText.substr(nStart, nEnd - nStart);
+		if (!sLine.empty() && sLine.back() == '\r')
+		{
+			sLine.pop_back();
+			m_bCRLF = true;
+		}
+		m_lines.push_back(std::move(sLine));
+		nStart = nEnd + 1;
+	}
+
+	return Parse(sError);
+}
+
+bool CJklLevel::Parse(std::string& sError)
+{
+	m_materials.clear();
+	m_colormaps.clear();
+	m_vertices.clear();
+	m_adjoins.clear();
+	m_surfaces.clear();
+	m_sectors.clear();
+	m_lights.clear();
+	m_nIntensityChannels = 1;
+
+	bool bFoundChannels = false;
+	std::string sSection;
+	SJklSector* pSector = nullptr;
+
+	CLineReader reader(m_lines);
+	while (reader.Next())
+	{
+		if (reader.Is(0, "SECTION:"))
+		{
+			sSection = reader.Str(1);
+			pSector = nullptr;
+			continue;
+		}
+
+		if (EqualsNoCase(sSection.c_str(), "GEORESOURCE"))
+		{
+			if (reader.Is(0, "World") && reader.Is(1, "Colormaps"))
+			{
+				const int nCount = reader.Int(2);
+				for (int i = 0; i < nCount && reader.Next(); ++i)
+					m_colormaps.push_back(reader.Str(1));
+			}
+			else if (reader.Is(0, "World") && reader.Is(1, "vertices"))
+			{
+				const int nCount = reader.Int(2);
+				m_vertices.reserve(nCount);
+				for (int i = 0; i < nCount && reader.Next(); ++i)
+					m_vertices.push_back({ reader.Float(1), reader.Float(2), reader.Float(3) });
+			}
+			else if (reader.Is(0, "World") && reader.Is(1, "adjoins"))
+			{
+				const int nCount = reader.Int(2);
+				m_adjoins.reserve(nCount);
+				for (int i = 0; i < nCount && reader.Next(); ++i)
+				{
+					SJklAdjoin adjoin;
+					adjoin.nFlags = reader.Hex(1);
+					adjoin.nMirror = reader.Int(2);
+					m_adjoins.push_back(adjoin);
+				}
+			}
+			else if (reader.Is(0, "World") && reader.Is(1, "surfaces"))
+			{
+				const int nCount = reader.Int(2);
+				m_surfaces.reserve(nCount);
+				for (int i = 0; i < nCount && reader.Next(); ++i)
+				{
+					// num: mat surfflags faceflags geo light tex adjoin extralight nverts v,t... intensities...
+					if (reader.Count() < 10)
+					{
+						sError = "Malformed surface on line " + std::to_string(reader.Line() + 1);
+						return false;
+					}
+
+					SJklSurface surface;
+					surface.nMaterial = reader.Int(1);
+					surface.nSurfFlags = reader.Hex(2);
+					surface.nFaceFlags = reader.Hex(3);
+					surface.nGeo = reader.Int(4);
+					surface.nAdjoin = reader.Int(7);
+					surface.extraLight = reader.Float(8);
+					surface.nLine = reader.Line();
+
+					// the vertex count is right before the first "vertex,texvertex" pair
+					size_t nFirstPair = 9;
+					while (nFirstPair < reader.Count() && reader.Str(nFirstPair).find(',') == std::string::npos)
+						++nFirstPair;
+
+					const int nNumVertices = nFirstPair < reader.Count() ? reader.Int(nFirstPair - 1) : 0;
+					if (nFirstPair + nNumVertices > reader.Count())
+					{
+						sError = "Malformed surface vertices on line " + std::to_string(reader.Line() + 1);
+						return false;
+					}
+
+					for (int v = 0; v < nNumVertices; ++v)
+						surface.vertices.push_back(reader.Int(nFirstPair + v));
+
+					const size_t nFirstIntensity = nFirstPair + nNumVertices;
+					const SToken& lastPair = reader.Token(nFirstIntensity - 1);
+					const std::string& sLine = m_lines[surface.nLine];
+					surface.nIntensityOffset = lastPair.nOffset + lastPair.nLength;
+
+					// the whitespace around the intensities is written back as it was, the pair separator without any
+					surface.separator = lastPair.nOffset > 0 ? sLine[lastPair.nOffset - 1] : '\t';
+					surface.sIntensityLead.assign(1, surface.separator);
+					if (nFirstIntensity < reader.Count())
+					{
+						surface.sIntensityLead = sLine.substr(surface.nIntensityOffset, reader.Token(nFirstIntensity).nOffset - surface.nIntensityOffset);
+						if (nFirstIntensity + 1 < reader.Count())
+							surface.separator = sLine[reader.Token(nFirstIntensity + 1).nOffset - 1];
+					}
+
+					for (size_t t = nFirstIntensity; t < reader.Count(); ++t)
+						surface.intensities.push_back(reader.Float(t));
+
+					if (!bFoundChannels && nNumVertices > 0 && !surface.intensities.empty())
+					{
+						m_nIntensityChannels = (surface.intensities.size() >= 4u * nNumVertices) ? 4 : 1;
+						bFoundChannels = true;
+					}
+					m_surfaces.push_back(std::move(surface));
+				}
+
+				// the surface normals follow the surfaces
+				for (int i = 0; i < nCount && reader.PeekIsRecord() && reader.Next(); ++i)
+					m_surfaces[i].normal = { reader.Float(1), reader.Float(2), reader.Float(3) };
+			}
+		}
+		else if (EqualsNoCase(sSection.c_str(), "MATERIALS"))
+		{
+			if (reader.Is(0, "World") && reader.Is(1, "materials"))
+			{
+				const int nCount = reader.Int(2);
+				for (int i = 0; i < nCount && reader.PeekIsRecord() && reader.Next(); ++i)
+					m_materials.push_back(reader.Str(1));
+			}
+		}
+		else if (EqualsNoCase(sSection.c_str(), "SECTORS"))
+		{
+			if (reader.Is(0, "SECTOR"))
+			{
+				const int nSectorIndex = reader.Int(1);
+				if (nSectorIndex < 0)
+				{
+					sError = "Bad sector index on line " + std::to_string(reader.Line() + 1);
+					return false;
+				}
+				if ((int)m_sectors.size() <= nSectorIndex)
+					m_sectors.resize(nSectorIndex + 1);
+				pSector = &m_sectors[nSectorIndex];
+			}
+			else if (!pSector)
+			{
+				continue;
+			}
+			else if (reader.Is(0, "FLAGS"))
+			{
+				pSector->nFlags = reader.Hex(1);
+			}
+			else if (reader.Is(0, "AMBIENT") && reader.Is(1, "LIGHT") && reader.Count() > 2)
+			{
+				pSector->ambient = reader.Float(2);
+				pSector->nAmbientLine = reader.Line();
+				pSector->nAmbientOffset = reader.Token(2).nOffset;
+				pSector->nAmbientLength = reader.Token(2).nLength;
+			}
+			else if (reader.Is(0, "COLORMAP"))
+			{
+				pSector->nColormap = reader.Int(1);
+			}
+			else if (reader.Is(0, "LAYER"))
+			{
+				pSector->nLayer = reader.Int(1);
+			}
+			else if (reader.Is(0, "VERTICES"))
+			{
+				const int nCount = reader.Int(1);
+				for (int i = 0; i < nCount && reader.Next(); ++i)
+					pSector->vertices.push_back(reader.Int(1));
+			}
+			else if (reader.Is(0, "SURFACES"))
+			{
+				pSector->nFirstSurface = reader.Int(1);
+				pSector->nNumSurfaces = reader.Int(2);
+			}
+		}
+		else if (EqualsNoCase(sSection.c_str(), "LIGHTS"))
+		{
+			if (reader.Is(0, "World") && reader.Is(1, "lights"))
+			{
+				const int nCount = reader.Int(2);
+				for (int i = 0; i < nCount && reader.PeekIsRecord() && reader.Next(); ++i)
+				{
+					SJklLight light;
+					light.position = { reader.Float(1), reader.Float(2), reader.Float(3) };
+					light.intensity = reader.Float(4);
+					light.range = reader.Float(5);
+					light.rgbIntensity = light.intensity;
+					light.rgbRange = light.range;
+					if (reader.Count() > 8)
+						light.color = { reader.Float(6), reader.Float(7), reader.Float(8) };
+					if (reader.Count() > 9)
+						light.rgbIntensity = reader.Float(9);
+					if (reader.Count() > 10)
+						light.rgbRange = reader.Float(10);
+					if (reader.Count() > 11)
+						light.nFlags = reader.Hex(11);
+					if (reader.Count() > 12)
+						light.nLayer = reader.Int(12);
+					m_lights.push_back(light);
+				}
+			}
+		}
+	}
+
+	// validate the cross references so the baker never has to
+	m_surfaceSectors.assign(m_surfaces.size(), -1);
+	for (int nSectorIndex = 0; nSectorIndex < (int)m_sectors.size(); ++nSectorIndex)
+	{
+		const SJklSector& sector = m_sectors[nSectorIndex];
+		if (sector.nFirstSurface < 0 || sector.nNumSurfaces < 0 || sector.nFirstSurface + sector.nNumSurfaces > (int)m_surfaces.size())
+		{
+			sError = "Sector " + std::to_string(nSectorIndex) + " references missing surfaces";
+			return false;
+		}
+
+		for (int nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+			m_surfaceSectors[nSurfaceIndex] = nSectorIndex;
+
+		for (int nVertex : sector.vertices)
+		{
+			if (nVertex < 0 || nVertex >= (int)m_vertices.size())
+			{
+				sError = "Sector " + std::to_string(nSectorIndex) + " references a missing vertex";
+				return false;
+			}
+		}
+	}
+
+	m_adjoinSurfaces.assign(m_adjoins.size(), -1);
+	for (int nSurfaceIndex = 0; nSurfaceIndex < (int)m_surfaces.size(); ++nSurfaceIndex)
+	{
+		const SJklSurface& surface = m_surfaces[nSurfaceIndex];
+		if (surface.nAdjoin >= (int)m_adjoins.size())
+		{
+			sError = "Surface " + std::to_string(nSurfaceIndex) + " references a missing adjoin";
+			return false;
+		}
+		if (surface.nAdjoin >= 0)
+			m_adjoinSurfaces[surface.nAdjoin] = nSurfaceIndex;
+
+		for (int nVertex : surface.vertices)
+		{
+			if (nVertex < 0 || nVertex >= (int)m_vertices.size())
+			{
+				sError = "Surface " + std::to_string(nSurfaceIndex) + " references a missing vertex";
+				return false;
+			}
+		}
+
+		// some tools don't write the normals, fall back to the polygon normal (Newell's method)
+		if (dot(surface.normal, surface.normal) < 1e-6f && surface.vertices.size() >= 3)
+		{
+			float3 normal = { 0,0,0 };
+			for (size_t v = 0; v < surface.vertices.size(); ++v)
+			{
+				const float3& curr = m_vertices[surface.vertices[v]];
+				const float3& next = m_vertices[surface.vertices[(v + 1) % surface.vertices.size()]];
+				normal.x += (curr.y - next.y) * (curr.z + next.z);
+				normal.y += (curr.z - next.z) * (curr.x + next.x);
+				normal.z += (curr.x - next.x) * (curr.y + next.y);
+			}
+			m_surfaces[nSurfaceIndex].normal = dot(normal, normal) > 0.0f ? normalize(normal) : normal;
+		}
+
+		// pad missing intensities so writing back never goes out of bounds
+		m_surfaces[nSurfaceIndex].intensities.resize(surface.vertices.size() * m_nIntensityChannels, 0.0f);
+	}
+
+	if (m_sectors.empty() || m_surfaces.empty() || m_vertices.empty())
+	{
+		sError = "No geometry found";
+		return false;
+	}
+
+	m_dirtySurfaces.assign(m_surfaces.size(), false);
+	m_dirtySectors.assign(m_sectors.size(), false);
+	return true;
+}
+
+bool CJklLevel::Save(const char* sPath, std::string& sError) const
+{
+	std::vector<std::string> lines = m_lines;
+
+	for (size_t nSurfaceIndex = 0; nSurfaceIndex < m_surfaces.size(); ++nSurfaceIndex)
+	{
+		if (!m_dirtySurfaces[nSurfaceIndex])
+			continue;
+
+		const SJklSurface& surface = m_surfaces[nSurfaceIndex];
+		std::string& sLine = lines[surface.nLine];
+		sLine.resize(surface.nIntensityOffset);
+		for (size_t nIntensity = 0; nIntensity < surface.intensities.size(); ++nIntensity)
+		{
+			if (nIntensity == 0)
+				sLine += surface.sIntensityLead;
+			else
+				sLine += surface.separator;
+			FormatFloat(sLine, surface.intensities[nIntensity]);
+		}
+	}
+
+	for (size_t nSectorIndex = 0; nSectorIndex < m_sectors.size(); ++nSectorIndex)
+	{
+		const SJklSector& sector = m_sectors[nSectorIndex];
+		if (!m_dirtySectors[nSectorIndex] || sector.nAmbientLine < 0)
+			continue;
+
+		std::string sValue;
+		FormatFloat(sValue, sector.ambient);
+
+		std::string& sLine = lines[sector.nAmbientLine];
+		sLine.replace(sector.nAmbientOffset, sector.nAmbientLength, sValue);
+	}
+
+	std::ofstream file(sPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		sError = "Failed to open file for writing";
+		return false;
+	}
+
+	const char* sLineEnd = m_bCRLF ? "\r\n" : "\n";
+	for (const std::string& sLine : lines)
+		file << sLine << sLineEnd;
+
+	if (!file)
+	{
+		sError = "Failed to write file";
+		return false;
+	}
+	return true;
+}
+
+int CJklLevel::GetAdjoinSector(int nSurfaceIndex) const
+{
+	const int nAdjoin = m_surfaces[nSurfaceIndex].nAdjoin;
+	if (nAdjoin < 0)
+		return -1;
+
+	const int nMirror = m_adjoins[nAdjoin].nMirror;
+	if (nMirror < 0 || nMirror >= (int)m_adjoinSurfaces.size() || m_adjoinSurfaces[nMirror] < 0)
+		return -1;
+
+	return m_surfaceSectors[m_adjoinSurfaces[nMirror]];
+}
+
+int CJklLevel::FindSectorForPoint(const float3& point) const
+{
+	for (int nSectorIndex = 0; nSectorIndex < (int)m_sectors.size(); ++nSectorIndex)
+	{
+		const SJklSector& sector = m_sectors[nSectorIndex];
+		if (!sector.nNumSurfaces)
+			continue;
+
+		// sectors are convex and surface normals face inwards
+		bool bInside = true;
+		for (int nSurfaceIndex = sector.nFirstSurface; bInside && nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+		{
+			const SJklSurface& surface = m_surfaces[nSurfaceIndex];
+			if (!surface.vertices.empty())
+				bInside = dot(surface.normal, point - m_vertices[surface.vertices[0]]) >= 0.0f;
+		}
+
+		if (bInside)
+			return nSectorIndex;
+	}
+	return -1;
+}
+
+float4 CJklLevel::GetVertexLight(int nSurfaceIndex, int nVertexIndex) const
+{
+	const float* pValues = &m_surfaces[nSurfaceIndex].intensities[nVertexIndex * m_nIntensityChannels];
+	if (m_nIntensityChannels == 4)
+		return float4(pValues[1], pValues[2], pValues[3], pValues[0]);
+
+	return float4(pValues[0], pValues[0], pValues[0], pValues[0]);
+}
+
+void CJklLevel::SetVertexLight(int nSurfaceIndex, int nVertexIndex, const float4& light)
+{
+	// only the channels the level stores are compared, unchanged values keep the surface line as it is
+	if (IsSameStoredLight(GetVertexLight(nSurfaceIndex, nVertexIndex), m_nIntensityChannels == 4 ? light : float4(light.w, light.w, light.w, light.w)))
+		return;
+
+	float* pValues = &m_surfaces[nSurfaceIndex].intensities[nVertexIndex * m_nIntensityChannels];
+	pValues[0] = light.w;
+	if (m_nIntensityChannels == 4)
+	{
+		pValues[1] = light.x;
+		pValues[2] = light.y;
+		pValues[3] = light.z;
+	}
+	m_dirtySurfaces[nSurfaceIndex] = true;
+}
+
+void CJklLevel::SetSectorAmbient(int nSectorIndex, float ambient)
+{
+	if (IsSameStoredLight(m_sectors[nSectorIndex].ambient, ambient))
+		return;
+
+	m_sectors[nSectorIndex].ambient = ambient;
+	m_dirtySectors[nSectorIndex] = true;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+// Minimal JKL level reader/writer for the headless baker
+// Only the parts the bake needs are parsed (colormaps, vertices, adjoins, surfaces, materials, sectors and lights),
+// everything else is kept verbatim so saving only touches the vertex intensities and sector ambient lines.
+//
+// JK stores one intensity per surface vertex, MotS stores 4 (intensity r g b), the format is detected from the file.
+// Lights aren't part of the engine format, they're read from an optional section written alongside the level:
+//
+//   SECTION: LIGHTS
+//   World lights <count>
+//   #num: x y z intensity range [r g b rgbintensity rgbrange flags layer]
+//
+// the optional fields follow tjedlightrec and default to a white light with no flags on layer 0.
+
+#include <string>
+#include <vector>
+
+#include "BakeTypes.h"
+
+struct SJklAdjoin
+{
+	uint32_t nFlags = 0;
+	int      nMirror = -1;
+};
+
+struct SJklSurface
+{
+	int         nMaterial = -1;
+	uint32_t    nSurfFlags = 0;
+	uint32_t    nFaceFlags = 0;
+	int         nGeo = 0;
+	int         nAdjoin = -1;
+	float       extraLight = 0.0f;
+	float3      normal = { 0,0,0 };
+	std::vector<int>   vertices;    // world vertex indices
+	std::vector<float> intensities; // GetIntensityChannels() values per vertex
+
+	// location of the intensities in the document, for writing them back
+	int         nLine = -1;
+	size_t      nIntensityOffset = 0;
+	std::string sIntensityLead = "\t"; // whitespace between the vertex list and the first intensity
+	char        separator = '\t';      // between the intensities
+};
+
+struct SJklSector
+{
+	uint32_t nFlags = 0;
+	float    ambient = 0.0f;
+	int      nColormap = 0;
+	int      nLayer = 0;
+	int      nFirstSurface = 0;
+	int      nNumSurfaces = 0;
+	std::vector<int> vertices; // world vertex indices
+
+	// location of the ambient light value in the document, for writing it back
+	int    nAmbientLine = -1;
+	size_t nAmbientOffset = 0;
+	size_t nAmbientLength = 0;
+};
+
+struct SJklLight
+{
+	float3   position = { 0,0,0 };
+	float    intensity = 0.0f;
+	float    range = 0.0f;
+	float3   color = { 1,1,1 };
+	float    rgbIntensity = 0.0f;
+	float    rgbRange = 0.0f;
+	uint32_t nFlags = 0;
+	int      nLayer = 0;
+};
+
+class CJklLevel
+{
+public:
+	bool Load(const char* sPath, std::string& sError);
+	bool Save(const char* sPath, std::string& sError) const;
+
+	const std::vector<std::string>& GetMaterials() const { return m_materials; }
+	const std::vector<std::string>& GetColormaps() const { return m_colormaps; }
+	const std::vector<float3>&      GetVertices() const  { return m_vertices; }
+	const std::vector<SJklAdjoin>&  GetAdjoins() const   { return m_adjoins; }
+	const std::vector<SJklSurface>& GetSurfaces() const  { return m_surfaces; }
+	const std::vector<SJklSector>&  GetSectors() const   { return m_sectors; }
+	const std::vector<SJklLight>&   GetLights() const    { return m_lights; }
+
+	// 1 for JK levels, 4 for MotS levels
+	int GetIntensityChannels() const { return m_nIntensityChannels; }
+
+	// sector the surface adjoins to, -1 if it isn't an adjoin
+	int GetAdjoinSector(int nSurfaceIndex) const;
+
+	// first sector containing the point, -1 if none does
+	int FindSectorForPoint(const float3& point) const;
+
+	// light is (r, g, b, intensity) like SurfaceSetVertexLight, only the intensity is stored for JK levels
+	// setting a value that is stored the same (see IsSameStoredLight) leaves the level untouched
+	float4 GetVertexLight(int nSurfaceIndex, int nVertexIndex) const;
+	void   SetVertexLight(int nSurfaceIndex, int nVertexIndex, const float4& light);
+
+	void SetSectorAmbient(int nSectorIndex, float ambient);
+
+private:
+	bool Parse(std::string& sError);
+
+	// the document, split in lines without line endings
+	std::vector<std::string> m_lines;
+	bool                     m_bCRLF = false;
+
+	std::vector<std::string> m_materials;
+	std::vector<std::string> m_colormaps;
+	std::vector<float3>      m_vertices;
+	std::vector<SJklAdjoin>  m_adjoins;
+	std::vector<SJklSurface> m_surfaces;
+	std::vector<SJklSector>  m_sectors;
+	std::vector<SJklLight>   m_lights;
+
+	// surface that owns each adjoin and sector that owns each surface
+	std::vector<int> m_adjoinSurfaces;
+	std::vector<int> m_surfaceSectors;
+
+	// what needs to be written back on save
+	std::vector<bool> m_dirtySurfaces;
+	std::vector<bool> m_dirtySectors;
+
+	int m_nIntensityChannels = 1;
+};
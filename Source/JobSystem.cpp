@@ -0,0 +1,172 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// queue index of the current thread, external threads use the shared queue
+static thread_local int t_nQueueIndex = -1;
+static thread_local const CJobSystem* t_pOwner = nullptr;
+
+CJobSystem::CJobSystem(int nNumThreads)
+	: m_nQueuedTasks(0)
+	, m_bQuit(false)
+{
+	if (nNumThreads <= 0)
+		nNumThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	m_queues.reserve(nNumThreads + 1);
+	for (int i = 0; i < nNumThreads + 1; ++i)
+		m_queues.emplace_back(new SWorkQueue());
+
+	m_workers.reserve(nNumThreads);
+	for (int i = 0; i < nNumThreads; ++i)
+		m_workers.emplace_back(&CJobSystem::WorkerLoop, this, i);
+}
+
+CJobSystem::~CJobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_bQuit = true;
+	}
+	m_sleepCondition.notify_all();
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void CJobSystem::ParallelFor(int nCount, int nGrainSize, const RangeFunc& func)
+{
+	if (nCount <= 0)
+		return;
+
+	nGrainSize = std::max(1, nGrainSize);
+
+	// not worth waking anyone up
+	if (nCount <= nGrainSize)
+	{
+		func(0, nCount);
+		return;
+	}
+
+	SJobGroup group;
+	group.pFunc = &func;
+	group.nGrainSize = nGrainSize;
+	group.nRemaining = nCount;
+
+	const int nQueueIndex = (t_pOwner == this) ? t_nQueueIndex : GetExternalQueueIndex();
+
+	// seed every worker with an even slice, the rest is balanced by splitting and stealing
+	const int nNumSlices = std::min((int)m_queues.size(), (nCount + nGrainSize - 1) / nGrainSize);
+	for (int nSlice = 0; nSlice < nNumSlices; ++nSlice)
+	{
+		const int nBegin = (int)((int64_t)nCount * nSlice / nNumSlices);
+		const int nEnd = (int)((int64_t)nCount * (nSlice + 1) / nNumSlices);
+		Push((nQueueIndex + nSlice) % (int)m_queues.size(), { &group, nBegin, nEnd });
+	}
+	WakeWorkers();
+
+	// help out until our group is done, we may end up running tasks from other groups which is fine
+	while (group.nRemaining.load(std::memory_order_acquire) > 0)
+	{
+		SRangeTask task;
+		if (Pop(nQueueIndex, task) || Steal(nQueueIndex, task))
+			Execute(nQueueIndex, task);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void CJobSystem::WorkerLoop(int nQueueIndex)
+{
+	t_nQueueIndex = nQueueIndex;
+	t_pOwner = this;
+
+	while (true)
+	{
+		SRangeTask task;
+		if (Pop(nQueueIndex, task) || Steal(nQueueIndex, task))
+		{
+			Execute(nQueueIndex, task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_sleepCondition.wait(lock, [this] { return m_bQuit || m_nQueuedTasks > 0; });
+		if (m_bQuit)
+			break;
+	}
+}
+
+void CJobSystem::Push(int nQueueIndex, const SRangeTask& task)
+{
+	SWorkQueue& queue = *m_queues[nQueueIndex];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+	++m_nQueuedTasks;
+}
+
+void CJobSystem::WakeWorkers()
+{
+	// taking the lock makes sure a worker can't miss the notification between its check and its wait
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+	}
+	m_sleepCondition.notify_all();
+}
+
+bool CJobSystem::Pop(int nQueueIndex, SRangeTask& task)
+{
+	// own work is taken LIFO for locality
+	SWorkQueue& queue = *m_queues[nQueueIndex];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty())
+		return false;
+
+	task = queue.tasks.back();
+	queue.tasks.pop_back();
+	--m_nQueuedTasks;
+	return true;
+}
+
+bool CJobSystem::Steal(int nQueueIndex, SRangeTask& task)
+{
+	// stolen work is taken FIFO, the oldest tasks are the biggest ranges
+	const int nNumQueues = (int)m_queues.size();
+	for (int nOffset = 1; nOffset < nNumQueues; ++nOffset)
+	{
+		SWorkQueue& queue = *m_queues[(nQueueIndex + nOffset) % nNumQueues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		task = queue.tasks.front();
+		queue.tasks.pop_front();
+		--m_nQueuedTasks;
+		return true;
+	}
+	return false;
+}
+
+void CJobSystem::Execute(int nQueueIndex, SRangeTask task)
+{
+	SJobGroup* pGroup = task.pGroup;
+
+	// split off the upper half while the range is too big so others have something to steal
+	bool bPushed = false;
+	while (task.nEnd - task.nBegin > pGroup->nGrainSize)
+	{
+		const int nMid = task.nBegin + (task.nEnd - task.nBegin) / 2;
+		Push(nQueueIndex, { pGroup, nMid, task.nEnd });
+		task.nEnd = nMid;
+		bPushed = true;
+	}
+	if (bPushed)
+		WakeWorkers();
+
+	(*pGroup->pFunc)(task.nBegin, task.nEnd);
+
+	pGroup->nRemaining.fetch_sub(task.nEnd - task.nBegin, std::memory_order_release);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work stealing thread pool for range based parallel loops.
+// Every worker owns a deque of ranges, it splits its own work in halves (pushing the upper half back)
+// and idle workers steal the oldest (largest) ranges from the front of other queues.
+// ParallelFor can be called from any thread, including from inside another ParallelFor, the calling thread helps until its loop is done.
+class CJobSystem
+{
+public:
+	typedef std::function<void(int nBegin, int nEnd)> RangeFunc;
+
+	// nNumThreads <= 0 uses all hardware threads
+	explicit CJobSystem(int nNumThreads = 0);
+	~CJobSystem();
+
+	CJobSystem(const CJobSystem&) = delete;
+	CJobSystem& operator=(const CJobSystem&) = delete;
+
+	int GetNumThreads() const { return (int)m_workers.size(); }
+
+	// runs func over [0, nCount) in ranges of at most nGrainSize and blocks until all ranges completed
+	void ParallelFor(int nCount, int nGrainSize, const RangeFunc& func);
+
+private:
+	struct SJobGroup
+	{
+		const RangeFunc*  pFunc = nullptr;
+		int               nGrainSize = 1;
+		std::atomic<int>  nRemaining{ 0 }; // number of items not yet processed
+	};
+
+	struct SRangeTask
+	{
+		SJobGroup* pGroup;
+		int        nBegin;
+		int        nEnd;
+	};
+
+	struct SWorkQueue
+	{
+		std::mutex             mutex;
+		std::deque<SRangeTask> tasks;
+	};
+
+	void WorkerLoop(int nQueueIndex);
+	void Push(int nQueueIndex, const SRangeTask& task);
+	void WakeWorkers();
+	bool Pop(int nQueueIndex, SRangeTask& task);
+	bool Steal(int nQueueIndex, SRangeTask& task);
+	void Execute(int nQueueIndex, SRangeTask task);
+
+	// one queue per worker plus a shared queue for external threads
+	int GetExternalQueueIndex() const { return (int)m_workers.size(); }
+
+	std::vector<std::thread>                 m_workers;
+	std::vector<std::unique_ptr<SWorkQueue>> m_queues;
+
+	std::mutex              m_sleepMutex;
+	std::condition_variable m_sleepCondition;
+	std::atomic<int>        m_nQueuedTasks;
+	std::atomic<bool>       m_bQuit;
+};
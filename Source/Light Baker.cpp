@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "framework.h"
 #include "Light Baker.h"
+#include "CpuBaker.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -18,33 +19,15 @@ static constexpr const wchar_t* ksRaysPerVertex[] = { _T("256"), _T("512"), _T("
 static constexpr int kRaysPerVertex[] = { 256, 512, 1024 };
 static constexpr int kDefRaysPerVertexIdx = 2;
 
-float3 SColormap::GetColor(uint32_t nIndex, int nLightLevel) const
-{
-	if (nLightLevel >= 0)
-		nIndex = nLightLevels[nLightLevel * 256 + nIndex];
-
-	float3 fillColor;
-	fillColor.x = (float)colors[nIndex].r / 255.0f;
-	fillColor.y = (float)colors[nIndex].g / 255.0f;
-	fillColor.z = (float)colors[nIndex].b / 255.0f;
-	return fillColor;
-}
-
-template <typename... Args>
-void PrintMessage(IJED* pJed, uint32_t nType, const char* sFmt, Args&&... args)
-{
-	char msg[256];
-	sprintf_s(msg, 256, sFmt, std::forward<Args>(args)...);
-	pJed->PanMessage(nType, msg);
-}
+// progressive bake: vertices per work item and rays per vertex of a batch (a whole thread group on the GPU)
+static constexpr int kGpuTileVertices = 16384;
+static constexpr int kCpuTileVertices = 4096;
+static constexpr int kGpuBatchRays = 256;
+static constexpr int kCpuBatchRays = 64;
 
-// Test if a sector is in the sector bitmask
-static bool TestMaskBit(const uint32_t* paMasks, int nIndex)
-{
-	const uint32_t nBucketIndex = nIndex / 32u;
-	const uint32_t nBucketPlace = nIndex % 32u;
-	return (paMasks[nBucketIndex] & (1u << nBucketPlace));
-}
+// level preview while baking, and the resolution of the progress bar
+static constexpr int kPreviewIntervalMs = 1000;
+static constexpr int kProgressRange = 1000;
 
 CLightBakerApp theApp;
 static CLightBakerDlg* g_pLightBaker = nullptr;
@@ -78,7 +61,7 @@ CLightBakerDlg::CLightBakerDlg(IJED* pJed, CWnd* pParent)
 	: CDialogEx(IDD_LIGHTBAKER_DLG, pParent)
 	, m_pJed(pJed)
 	, m_pJedLevel(nullptr)
-	, m_pLastJedLevel(nullptr)
+	, m_sceneSource(pJed)
 	, m_pDeviceD3D(nullptr)
 	, m_pDeviceContextD3D(nullptr)
 	, m_pBakeSunShader(nullptr)
@@ -87,6 +70,12 @@ CLightBakerDlg::CLightBakerDlg(IJED* pJed, CWnd* pParent)
 	, m_pBakeIndirectShader(nullptr)
 	, m_pGenNormalsShader(nullptr)
 	, m_pLevelInfoConstants(nullptr)
+	, m_pBakeQuery(nullptr)
+	, m_apTimestampQueries{ nullptr, nullptr }
+	, m_pTimestampDisjointQuery(nullptr)
+	, m_bTimestampPending(false)
+	, m_pReadBuffer(nullptr)
+	, m_pWriteBuffer(nullptr)
 	, m_bBakePointLights(TRUE)
 	, m_bBakeSunLight(TRUE)
 	, m_bBakeSkyLight(TRUE)
@@ -96,12 +85,14 @@ CLightBakerDlg::CLightBakerDlg(IJED* pJed, CWnd* pParent)
 	, m_bExtraLightEmissive(FALSE)
 	, m_bPhysicalFalloff(TRUE)
 	, m_bToneMap(FALSE)
+	, m_bAdaptiveRays(FALSE)
+	, m_bProbeAmbient(FALSE)
 	, m_nSkyEmissiveRayCount(kRaysPerVertex[kDefRaysPerVertexIdx])
 	, m_nIndirectRayCount(kRaysPerVertex[kDefRaysPerVertexIdx])
 	, m_nIndirectBounces(kDefIndirectBounces)
-	, m_nSunLightIndex(-1)
-	, m_nSkyLightIndex(-1)
-	, m_nAnchorLightIndex(-1)
+	, m_eProfiledPass(EBakePass_SmoothNormals)
+	, m_nProfiledBounce(0)
+	, m_bBaking(false)
 	, m_nBakeFlags(0)
 	, m_nNumSectors(0)
 	, m_nNumQueuedSectors(0)
@@ -115,6 +106,13 @@ CLightBakerDlg::CLightBakerDlg(IJED* pJed, CWnd* pParent)
 
 CLightBakerDlg::~CLightBakerDlg()
 {
+	ReleaseDeviceD3D();
+}
+
+void CLightBakerDlg::ReleaseDeviceD3D()
+{
+	FreeBuffers();
+
 	if (m_pBakeSunShader)
 		m_pBakeSunShader->Release();
 	m_pBakeSunShader = nullptr;
@@ -123,9 +121,9 @@ CLightBakerDlg::~CLightBakerDlg()
 		m_pBakeDirectShader->Release();
 	m_pBakeDirectShader = nullptr;
 
-	if (m_pBakeIndirectShader)
-		m_pBakeIndirectShader->Release();
-	m_pBakeIndirectShader = nullptr;
+	if (m_pBakeSkyEmissiveShader)
+		m_pBakeSkyEmissiveShader->Release();
+	m_pBakeSkyEmissiveShader = nullptr;
 
 	if (m_pBakeIndirectShader)
 		m_pBakeIndirectShader->Release();
@@ -139,6 +137,12 @@ CLightBakerDlg::~CLightBakerDlg()
 		m_pLevelInfoConstants->Release();
 	m_pLevelInfoConstants = nullptr;
 
+	if (m_pBakeQuery)
+		m_pBakeQuery->Release();
+	m_pBakeQuery = nullptr;
+
+	ReleaseTimestampQueries();
+
 	if (m_pDeviceContextD3D)
 		m_pDeviceContextD3D->Release();
 	m_pDeviceContextD3D = nullptr;
@@ -161,48 +165,89 @@ bool CLightBakerDlg::CreateDeviceD3D()
 	if (FAILED(hr))
 	{
 		PrintMessage(m_pJed, msg_error, "Failed to create D3D11 device.");
+		ReleaseDeviceD3D();
 		return false;
 	}
 
 	if (!CreateComputeShader(m_pDeviceD3D, &m_pBakeSunShader, IDR_BAKE_SUN_CSO))
 	{
 		PrintMessage(m_pJed, msg_error, "Failed to compile sun shader.");
+		ReleaseDeviceD3D();
 		return false;
 	}
 
 	if (!CreateComputeShader(m_pDeviceD3D, &m_pBakeDirectShader, IDR_BAKE_DIRECT_CSO))
 	{
 		PrintMessage(m_pJed, msg_error, "Failed to compile light shader.");
+		ReleaseDeviceD3D();
 		return false;
 	}
 
 	if (!CreateComputeShader(m_pDeviceD3D, &m_pBakeSkyEmissiveShader, IDR_BAKE_SKY_EMISSIVE_CSO))
 	{
 		PrintMessage(m_pJed, msg_error, "Failed to compile sky/emissive shader.");
+		ReleaseDeviceD3D();
 		return false;
 	}
 
 	if (!CreateComputeShader(m_pDeviceD3D, &m_pBakeIndirectShader, IDR_BAKE_INDIRECT_CSO))
 	{
 		PrintMessage(m_pJed, msg_error, "Failed to compile indirect shader.");
+		ReleaseDeviceD3D();
 		return false;
 	}
 
 	if (!CreateComputeShader(m_pDeviceD3D, &m_pGenNormalsShader, IDR_GEN_SMOOTH_NORMALS_CSO))
 	{
 		PrintMessage(m_pJed, msg_error, "Failed to compile vertex normals generation shader.");
+		ReleaseDeviceD3D();
 		return false;
 	}
 
 	if(!CreateConstantBuffer(m_pDeviceD3D, &m_pLevelInfoConstants, sizeof(SLevelInfo)))
 	{
 		PrintMessage(m_pJed, msg_error, "Failed to created constant buffer.");
+		ReleaseDeviceD3D();
+		return false;
+	}
+
+	D3D11_QUERY_DESC queryDesc = { D3D11_QUERY_EVENT, 0 };
+	if (FAILED(m_pDeviceD3D->CreateQuery(&queryDesc, &m_pBakeQuery)))
+	{
+		PrintMessage(m_pJed, msg_error, "Failed to create event query.");
+		ReleaseDeviceD3D();
 		return false;
 	}
 
+	// the bake works without GPU times, the profile only has the wall clock times then
+	D3D11_QUERY_DESC timestampDesc = { D3D11_QUERY_TIMESTAMP, 0 };
+	D3D11_QUERY_DESC disjointDesc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+	if (FAILED(m_pDeviceD3D->CreateQuery(&timestampDesc, &m_apTimestampQueries[0]))
+		|| FAILED(m_pDeviceD3D->CreateQuery(&timestampDesc, &m_apTimestampQueries[1]))
+		|| FAILED(m_pDeviceD3D->CreateQuery(&disjointDesc, &m_pTimestampDisjointQuery)))
+	{
+		PrintMessage(m_pJed, msg_warning, "Failed to create timestamp queries, the bake profile has no GPU times.");
+		ReleaseTimestampQueries();
+	}
+
 	return true;
 }
 
+void CLightBakerDlg::ReleaseTimestampQueries()
+{
+	for (ID3D11Query*& pQuery : m_apTimestampQueries)
+	{
+		if (pQuery)
+			pQuery->Release();
+		pQuery = nullptr;
+	}
+
+	if (m_pTimestampDisjointQuery)
+		m_pTimestampDisjointQuery->Release();
+	m_pTimestampDisjointQuery = nullptr;
+	m_bTimestampPending = false;
+}
+
 void CLightBakerDlg::DoDataExchange(CDataExchange* pDX)
 {
 	CDialogEx::DoDataExchange(pDX);
@@ -215,6 +260,8 @@ void CLightBakerDlg::DoDataExchange(CDataExchange* pDX)
 	DDX_Check(pDX, IDC_CHECK_EXTRA_LIGHT_EMISSIVE, m_bExtraLightEmissive);
 	DDX_Check(pDX, IDC_CHECK_PHYSICAL_FALLOFF, m_bPhysicalFalloff);
 	DDX_Check(pDX, IDC_CHECK_TONE_MAP, m_bToneMap);
+	DDX_Check(pDX, IDC_CHECK_ADAPTIVE_RAYS, m_bAdaptiveRays);
+	DDX_Check(pDX, IDC_CHECK_PROBE_AMBIENT, m_bProbeAmbient);
 
 	DDX_Text(pDX, IDC_BOUNCES_EDIT, m_nIndirectBounces);
 
@@ -223,6 +270,7 @@ void CLightBakerDlg::DoDataExchange(CDataExchange* pDX)
 	DDV_MinMaxInt(pDX, m_nNormalSmoothingAngle, kMinNormalSmoothAngle, kMaxNormalSmoothAngle);
 	DDX_Control(pDX, IDC_COMBO_RAYS, m_skyEmissionRayCombo);
 	DDX_Control(pDX, IDC_COMBO_INDIRECT_RAYS, m_indirectRaysCombo);
+	DDX_Control(pDX, IDC_BAKE_PROGRESS, m_bakeProgress);
 }
 
 BOOL CLightBakerDlg::OnInitDialog()
@@ -260,6 +308,8 @@ BOOL CLightBakerDlg::OnInitDialog()
 		pNormalSmoothSpin->SetPos(m_nNormalSmoothingAngle);
 	}
 
+	m_bakeProgress.SetRange32(0, kProgressRange);
+
 	return TRUE;
 }
 
@@ -267,28 +317,43 @@ BEGIN_MESSAGE_MAP(CLightBakerDlg, CDialogEx)
 	ON_BN_CLICKED(IDC_BUTTON_BAKE_ALL, &CLightBakerDlg::OnBnClickedBakeAll)
 	ON_BN_CLICKED(IDC_BUTTON_BAKE_SEL, &CLightBakerDlg::OnBnClickedBakeSelected)
 	ON_BN_CLICKED(IDC_BUTTON_BAKE_LAYERS, &CLightBakerDlg::OnBnClickedBakeVisibleLayers)
+	ON_BN_CLICKED(IDC_BUTTON_CANCEL_BAKE, &CLightBakerDlg::OnBnClickedCancelBake)
 	ON_CBN_SELCHANGE(IDC_COMBO_RAYS, &CLightBakerDlg::OnCbnSelchangeComboRays)
 	ON_CBN_SELCHANGE(IDC_COMBO_INDIRECT_RAYS, &CLightBakerDlg::OnCbnSelchangeComboIndirectRays)
 END_MESSAGE_MAP()
 
 afx_msg void CLightBakerDlg::OnBnClickedBakeAll()
 {
+	if (m_bBaking)
+		return;
+
 	UpdateData(TRUE);
 	BakeLighting(0);
 }
 
 afx_msg void CLightBakerDlg::OnBnClickedBakeSelected()
 {
+	if (m_bBaking)
+		return;
+
 	UpdateData(TRUE);
 	BakeLighting(ELightBake_Selected);
 }
 
 afx_msg void CLightBakerDlg::OnBnClickedBakeVisibleLayers()
 {
+	if (m_bBaking)
+		return;
+
 	UpdateData(TRUE);
 	BakeLighting(ELightBake_VisibleLayers);
 }
 
+afx_msg void CLightBakerDlg::OnBnClickedCancelBake()
+{
+	m_bakeScheduler.Cancel();
+}
+
 afx_msg void CLightBakerDlg::OnCbnSelchangeComboRays()
 {
 	int sel = m_skyEmissionRayCombo.GetCurSel();
@@ -307,45 +372,6 @@ afx_msg void CLightBakerDlg::OnCbnSelchangeComboIndirectRays()
 	}
 }
 
-bool CLightBakerDlg::QuerySurfaceVisible(int nSectorIndex, int nSurfaceIndex) const
-{
-	tjedsurfacerec surface;
-	memset(&surface, 0, sizeof(tjedsurfacerec));
-	m_pJedLevel->GetSurface(nSectorIndex, nSurfaceIndex, &surface, sf_Material | sf_adjoin | sf_adjoinflags | sf_geo | sf_SurfFlags | sf_FaceFlags);
-
-	// ignore geo mode 0 (not visible) and surfaces with no material
-	if (surface.geo == 0 || !surface.material)
-		return false;
-
-	// ignore adjoins that block
-	if (surface.adjoinsc >= 0 && !(surface.adjoinflags & EAdjoin_Visible))
-		return false;
-
-	// ignore skies
-	if((surface.surfflags & ESky_Horizon) != 0 || (surface.surfflags & ESky_Ceiling) != 0)
-		return false;
-
-	return true;
-}
-
-float3 CLightBakerDlg::QuerySurfaceNormal(int nSectorIndex, int nSurfaceIndex) const
-{
-	tjedvector dnormal;
-	m_pJedLevel->GetSurfaceNormal(nSectorIndex, nSurfaceIndex, &dnormal);
-	return { (float)dnormal.v.s1.x, (float)dnormal.v.s1.y, (float)dnormal.v.s1.z };
-}
-
-float3 CLightBakerDlg::QuerySurfaceVertex(int nSectorIndex, int nSurfaceIndex, int nVertexIndex) const
-{
-	// Get sector vertex index from surface vertex index
-	int nVertex = m_pJedLevel->SurfaceGetVertexNum(nSectorIndex, nSurfaceIndex, nVertexIndex);
-
-	tjedvector vertex;
-	m_pJedLevel->SectorGetVertex(nSectorIndex, nVertex, &vertex.v.s1.x, &vertex.v.s1.y, &vertex.v.s1.z);
-
-	return { (float)vertex.v.s1.x, (float)vertex.v.s1.y, (float)vertex.v.s1.z };
-}
-
 bool CLightBakerDlg::BakeLighting(uint32_t nInitBakeFlags)
 {
 	m_nBakeFlags = nInitBakeFlags;
@@ -358,20 +384,14 @@ bool CLightBakerDlg::BakeLighting(uint32_t nInitBakeFlags)
 	m_nBakeFlags |= m_bExtraLightEmissive ? ELightBake_ExtraLightEmissive : 0;
 	m_nBakeFlags |= m_bPhysicalFalloff ? ELightBake_PhysicalFalloff : 0;
 	m_nBakeFlags |= m_bToneMap ? ELightBake_ToneMap : 0;
+	m_nBakeFlags |= m_bAdaptiveRays ? ELightBake_Adaptive : 0;
 	
 	m_pJedLevel = m_pJed->GetLevel();
 	if (!m_pJedLevel)
 		return false;
 
-	if (m_pLastJedLevel != m_pJedLevel)
-	{
-		// clear resource caches on any level changes so we can reload mising mats
-		m_materialColorCache.clear();
-		m_colormapCache.clear();
-	}
-	m_pLastJedLevel = m_pJedLevel;
-
-	m_nNumLayers = m_pJedLevel->NLayers();
+	if (m_sceneSource.SetLevel(m_pJedLevel))
+		m_levelVertexLight.clear();
 
 	m_nNumSectors = m_pJedLevel->NSectors();
 	m_nNumQueuedSectors = (m_nBakeFlags & ELightBake_Selected) ? m_pJed->GetNMultiselected(MM_SC) : m_nNumSectors;
@@ -392,35 +412,45 @@ bool CLightBakerDlg::BakeLighting(uint32_t nInitBakeFlags)
 
 	const auto startTime = std::chrono::high_resolution_clock::now();
 
-	// we need to know how many vertices we have in total in the level
-	m_nTotalSurfaces = 0;
-	m_nTotalVertices = 0;
-	for (int nSectorIndex = 0; nSectorIndex < m_nNumSectors; ++nSectorIndex)
+	// the profile is named after the level file without its directory
+	const char* sLevelFile = m_pJed->GetJEDString(js_LevelFile);
+	const std::string sLevelPath = sLevelFile ? sLevelFile : "";
+	m_profile.Clear();
+	m_profile.sLevel = sLevelPath.substr(sLevelPath.find_last_of("\\/") + 1);
+	m_sceneSource.SetProfile(&m_profile);
+
 	{
-		const int nNumSurfaces = m_pJedLevel->SectorNSurfaces(nSectorIndex);
-		m_nTotalSurfaces += nNumSurfaces;
-		for (int nSurfaceIndex = 0; nSurfaceIndex < nNumSurfaces; ++nSurfaceIndex)
-		{
-			const int nNumVertices = m_pJedLevel->SurfaceNVertices(nSectorIndex, nSurfaceIndex);
-			m_nTotalVertices += nNumVertices;
-		}
+		CScopedBakeTimer timer(&m_profile, EBakeStage_Extract);
+
+		// preload the master colormap up front
+		m_sceneSource.PreloadMasterCMP();
+
+		// read the whole level in one pass, this also gives us the totals
+		TakeSceneSnapshot(m_sceneSource, m_snapshot);
+
+		// then the colormaps and materials it uses, parsed on the CPU baker's threads
+		if (!m_pJobSystem)
+			m_pJobSystem.reset(new CJobSystem());
+		m_sceneSource.ResolveAssets(m_snapshot, m_pJobSystem.get());
 	}
+	m_nNumLayers = m_snapshot.nNumLayers;
+	m_nTotalSurfaces = m_snapshot.nTotalSurfaces;
+	m_nTotalVertices = m_snapshot.nTotalVertices;
 	PrintMessage(m_pJed, msg_info, "%u Vertices in Level queued for baking.", m_nTotalVertices);
 
-	// preload the master colormap up front
-	PreloadMasterCMP();
-
-	AllocateBuffers();
-	BuildSelectionBitmask();
-	BuildLayerBitmask();
-	BuildLights();
-	BuildGeometry();
+	{
+		CScopedBakeTimer timer(&m_profile, EBakeStage_BuildScene);
+		m_scene.Clear();
+		BuildSelectionBitmask();
+		BuildLayerBitmask();
+		BuildBakeScene(m_snapshot, m_nBakeFlags, m_scene);
+	}
 
 	// remove flags if no sun/sky were found
-	if (m_nSunLightIndex < 0)
+	if (m_scene.levelInfo.nSunLightIndex < 0)
 		m_nBakeFlags &= ~ELightBake_Sun;
 
-	if (m_nSkyLightIndex < 0)
+	if (m_scene.levelInfo.nSkyLightIndex < 0)
 		m_nBakeFlags &= ~ELightBake_Sky;
 
 	if (!m_nNumLights)
@@ -429,36 +459,114 @@ bool CLightBakerDlg::BakeLighting(uint32_t nInitBakeFlags)
 	// only update level info after updating the bake flags because we write them
 	UpdateLevelInfo();
 
-	// generate smooth normals
-	if (m_nNormalSmoothingAngle > 0)
-		ComputeSmoothNormals();
+	// the dialog keeps handling messages between work items, only the cancel button stays usable
+	m_bBaking = true;
+	EnableBakeControls(true);
+
+	// an unchanged level takes the result from its cache file, when only point lights changed since the last bake
+	// we can start from its direct light
+	bool bFinished;
+	uint64_t nSceneHash, nResultHash;
+	std::string sCacheFile;
+	bool bCached;
+	{
+		CScopedBakeTimer timer(&m_profile, EBakeStage_CacheFile);
+		nSceneHash = CLightCache::HashScene(m_scene);
+		nResultHash = HashBakeResult(m_scene, m_nIndirectBounces, GetScheduleSettings());
+		sCacheFile = GetBakeCacheFile();
+		bCached = !sCacheFile.empty() && LoadBakeCacheFile(sCacheFile, nResultHash, nSceneHash);
+	}
+	if (bCached)
+	{
+		PrintMessage(m_pJed, msg_info, "Level unchanged since the bake in %s, nothing traced.", sCacheFile.c_str());
+		m_skyEmissiveRayStats = SRayPassStats();
+		m_indirectRayStats = SRayPassStats();
+		bFinished = true;
+	}
+	else if (m_lightCache.CanUpdate(nSceneHash))
+	{
+		bFinished = RebakeChangedLights();
+	}
+	else
+	{
+		if (m_pDeviceD3D)
+			bFinished = BakeLightingGpu();
+		else
+			bFinished = BakeLightingCpu();
+
+		// a cancelled bake has no complete direct light
+		if (bFinished)
+			m_lightCache.Store(nSceneHash, m_scene, m_directLight);
+		else
+			m_lightCache.Clear();
+	}
 
-	if (m_nBakeFlags & ELightBake_Direct)
-		BakeDirectLighting();
+	if (bFinished && m_bProbeAmbient)
+		TraceProbes();
 
-	// - N Bounce passes (ping pong for readback between bounces, atomic add)
-	if (m_nBakeFlags & ELightBake_Indirect)
-		BakeIndirectLighting();
-	
-	m_pDeviceContextD3D->Flush();
+	if (bFinished)
+		ApplyToLevel(m_vertexColors);
 
-	DownloadAndApplyToLevel();
-	FreeBuffers();
+	if (bFinished && !bCached && !sCacheFile.empty())
+	{
+		CScopedBakeTimer timer(&m_profile, EBakeStage_CacheFile);
+		SBakeCacheResult result;
+		result.nResultHash = nResultHash;
+		result.levelInfo = m_scene.levelInfo;
+		result.nIndirectBounces = m_nIndirectBounces;
+		result.vertexColors = m_vertexColors;
+
+		std::string sError;
+		if (!SaveBakeCache(sCacheFile, result, m_lightCache, sError))
+			PrintMessage(m_pJed, msg_warning, "%s '%s'.", sError.c_str(), sCacheFile.c_str());
+	}
+
+	m_scene.Clear();
+	m_vertexColors.clear();
+	m_directLight.clear();
+	m_probes = SSectorProbes();
+
+	m_bBaking = false;
+	EnableBakeControls(false);
+	m_sceneSource.SetProfile(nullptr);
 
 	const auto endTime = std::chrono::high_resolution_clock::now();
 	const std::chrono::duration<float> deltaTime = endTime - startTime;
+	m_profile.totalSeconds = deltaTime.count();
+
+	if (!bFinished)
+	{
+		PrintMessage(m_pJed, msg_info, "Cancelled light bake after %g seconds, the level keeps the last preview.", deltaTime.count());
+		return false;
+	}
+
+	if (m_nBakeFlags & ELightBake_Adaptive)
+	{
+		if (m_skyEmissiveRayStats.nVertices > 0)
+			PrintMessage(m_pJed, msg_info, "Sky and emissive light: %.1f rays per vertex on average.", m_skyEmissiveRayStats.GetAverageRays());
+		if (m_indirectRayStats.nVertices > 0)
+			PrintMessage(m_pJed, msg_info, "Indirect light: %.1f rays per vertex and bounce on average.", m_indirectRayStats.GetAverageRays());
+	}
 
+	ReportProfile();
 	PrintMessage(m_pJed, msg_info, "Finished light bake in %g seconds.", deltaTime.count());
 
 	return true;
 }
 
-void CLightBakerDlg::PreloadMasterCMP()
+void CLightBakerDlg::ReportProfile()
 {
-	tlevelheader levelHeader;
-	memset(&levelHeader, 0, sizeof(tlevelheader));
-	m_pJedLevel->GetLevelHeader(&levelHeader, lh_all);
-	LoadColormap(levelHeader.mastercmp);
+	for (const SBakeStageProfile& stage : m_profile.stages)
+		PrintMessage(m_pJed, msg_info, "  %s", FormatBakeStage(stage).c_str());
+
+	const char* sLevelFile = m_pJed->GetJEDString(js_LevelFile);
+	if (!sLevelFile || !*sLevelFile)
+		return;
+
+	std::string sError;
+	const std::string sProfileFile = GetBakeProfilePath(sLevelFile);
+	if (!SaveBakeProfiles(sProfileFile, { m_profile }, sError))
+		PrintMessage(m_pJed, msg_warning, "%s '%s'.", sError.c_str(), sProfileFile.c_str());
 }
 
 bool CLightBakerDlg::LoadEmbeddedShader(UINT resourceID, const void** data, DWORD* size) const
@@ -476,241 +584,512 @@ bool CLightBakerDlg::LoadEmbeddedShader(UINT resourceID, const void** data, DWOR
 	return (*data && *size);
 }
 
-void CLightBakerDlg::AllocateBuffers()
+bool CLightBakerDlg::BakeLightingGpu()
 {
-	// todo: move the creation of the buffer data out of the constructor and check for failures
-	m_selectionBitmaskBuffer.Create(m_pDeviceD3D, m_pDeviceContextD3D, (m_nNumSectors + 31) / 32, sizeof(uint32_t), DXGI_FORMAT_R32_UINT, 0, 1, (D3D11_RESOURCE_MISC_FLAG)0);
-	m_layerBitmaskBuffer    .Create(m_pDeviceD3D, m_pDeviceContextD3D, (m_nNumLayers + 31) / 32, sizeof(uint32_t), DXGI_FORMAT_R32_UINT, 0, 1, (D3D11_RESOURCE_MISC_FLAG)0);
-	m_sectorBuffer          .Create(m_pDeviceD3D, m_pDeviceContextD3D, m_nNumSectors,             sizeof(SSector), DXGI_FORMAT_UNKNOWN, 0, 1, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
-	m_surfaceBuffer         .Create(m_pDeviceD3D, m_pDeviceContextD3D, m_nTotalSurfaces,          sizeof(SSurface), DXGI_FORMAT_UNKNOWN, 0, 1, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
-	m_vertexBuffer          .Create(m_pDeviceD3D, m_pDeviceContextD3D, m_nTotalVertices,          sizeof(SVertex), DXGI_FORMAT_UNKNOWN, 0, 1, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
-	m_normalBuffer          .Create(m_pDeviceD3D, m_pDeviceContextD3D, m_nTotalVertices,          sizeof(float4), DXGI_FORMAT_UNKNOWN, 1, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
-	m_lightBuffer           .Create(m_pDeviceD3D, m_pDeviceContextD3D, m_nNumLights,              sizeof(SLight), DXGI_FORMAT_UNKNOWN, 0, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
-	m_colorLastResultBuffer .Create(m_pDeviceD3D, m_pDeviceContextD3D, m_nTotalVertices,          sizeof(float4), DXGI_FORMAT_UNKNOWN, 1, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
-	m_colorCurrResultBuffer .Create(m_pDeviceD3D, m_pDeviceContextD3D, m_nTotalVertices,          sizeof(float4), DXGI_FORMAT_UNKNOWN, 1, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
-	m_accumulationBuffer    .Create(m_pDeviceD3D, m_pDeviceContextD3D, m_nTotalVertices,          sizeof(float4), DXGI_FORMAT_UNKNOWN, 1, 1, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	{
+		CScopedBakeTimer timer(&m_profile, EBakeStage_Upload);
+		AllocateBuffers();
+		UploadScene();
+	}
 
-	// clear the color buffers before we render anything to them
-	m_colorLastResultBuffer.ClearUAV();
-	m_colorCurrResultBuffer.ClearUAV();
-	m_accumulationBuffer.ClearUAV();
+	if (!RunBakeSchedule(m_scene.levelInfo))
+		return false;
+
+	DownloadResults();
+
+	// without indirect light the whole result is direct light
+	if (!(m_nBakeFlags & ELightBake_Indirect))
+		m_directLight = m_vertexColors;
+
+	return true;
 }
 
-void CLightBakerDlg::FreeBuffers()
+bool CLightBakerDlg::BakeLightingCpu()
 {
-	m_selectionBitmaskBuffer.Release();
-	m_layerBitmaskBuffer.Release();
-	m_sectorBuffer.Release();
-	m_surfaceBuffer.Release();
-	m_vertexBuffer.Release();
-	m_lightBuffer.Release();
-	m_normalBuffer.Release();
-	m_colorLastResultBuffer.Release();
-	m_colorCurrResultBuffer.Release();
-	m_accumulationBuffer.Release();
+	CreateCpuBaker();
+
+	PrintMessage(m_pJed, msg_info, "Baking on the CPU with %d threads.", m_pJobSystem->GetNumThreads());
+
+	m_pCpuBaker->BeginBake(m_scene, m_vertexColors);
+	if (!RunBakeSchedule(m_scene.levelInfo))
+		return false;
+
+	if (!(m_nBakeFlags & ELightBake_Indirect))
+		m_directLight = m_vertexColors;
+
+	return true;
 }
 
-void CLightBakerDlg::BuildSelectionBitmask()
+bool CLightBakerDlg::RebakeChangedLights()
 {
-	CGpuBufferMapping<uint32_t> selectionMask(&m_selectionBitmaskBuffer, D3D11_MAP_WRITE);
-	if (!selectionMask)
+	CreateCpuBaker();
+
+	// the changed lights are traced on the CPU, usually only a few sectors worth of vertices
+	SLightCacheStats stats;
 	{
-		PrintMessage(m_pJed, msg_error, "Failed to map selection bitmask buffer for upload.");
-		return;
+		CScopedBakeTimer timer(&m_profile, EBakeStage_ChangedLights);
+		m_lightCache.Update(m_scene, m_pJobSystem.get(), stats);
 	}
+	m_vertexColors = m_lightCache.GetDirectLight();
+	m_directLight = m_vertexColors;
 
-	memset(selectionMask.RawData(), 0, sizeof(uint32_t) * ((m_nNumSectors + 31) / 32));
-	for (int nQueuedSectorIndex = 0; nQueuedSectorIndex < m_nNumQueuedSectors; ++nQueuedSectorIndex)
+	PrintMessage(m_pJed, msg_info, "Rebaked %d changed lights (%d vertices traced).", stats.nChangedLights, stats.nTracedVertices);
+
+	// every bounce depends on all lights, those are always redone
+	if (!(m_nBakeFlags & ELightBake_Indirect))
+		return true;
+
+	// only the bounces, the cached normals are already smoothed
+	SLevelInfo levelInfo = m_scene.levelInfo;
+	levelInfo.nBakeFlags &= ELightBake_Indirect | ELightBake_Adaptive;
+	levelInfo.normalSmoothCos = 1.0f;
+
+	if (m_pDeviceD3D)
 	{
-		const int nSectorIndex = (m_nBakeFlags & ELightBake_Selected) ? m_pJed->GetSelectedSC(nQueuedSectorIndex) : nQueuedSectorIndex;
-		const uint32_t nBucketIndex = nSectorIndex / 32;
-		const uint32_t nBucketPlace = nSectorIndex % 32;
-		selectionMask[nBucketIndex] |= 1u << nBucketPlace;
+		{
+			CScopedBakeTimer timer(&m_profile, EBakeStage_Upload);
+			AllocateBuffers();
+			UploadScene();
+			UploadAccumulation();
+
+			// UploadScene starts from the unsmoothed normals, the bounces and the welds use the cached ones
+			m_normalBuffer.UpdateRange(m_scene.normals.data(), 0, (int)m_scene.normals.size());
+		}
+
+		if (!RunBakeSchedule(levelInfo))
+			return false;
+
+		DownloadResults();
+		return true;
 	}
+
+	return RunBakeSchedule(levelInfo);
 }
 
-void CLightBakerDlg::BuildLayerBitmask()
+void CLightBakerDlg::CreateCpuBaker()
 {
-	CGpuBufferMapping<uint32_t> layerMask(&m_layerBitmaskBuffer, D3D11_MAP_WRITE);
-	memset(layerMask.RawData(), 0, sizeof(uint32_t) * ((m_nNumLayers + 31) / 32));
-	for (int nLayerIndex = 0; nLayerIndex < m_nNumLayers; ++nLayerIndex)
+	if (!m_pJobSystem)
+		m_pJobSystem.reset(new CJobSystem());
+
+	if (!m_pCpuBaker)
 	{
-		if (!(m_nBakeFlags & ELightBake_VisibleLayers) || m_pJed->IsLayerVisible(nLayerIndex))
+		m_pCpuBaker.reset(new CCpuBaker(m_pJobSystem.get()));
+		m_pCpuBackend.reset(new CCpuBakeBackend(*m_pCpuBaker, m_scene, m_vertexColors));
+
+		// the CPU passes time themselves
+		m_pCpuBaker->SetProfile(&m_profile);
+	}
+}
+
+std::string CLightBakerDlg::GetBakeCacheFile() const
+{
+	const char* sLevelFile = m_pJed->GetJEDString(js_LevelFile);
+	if (!sLevelFile || !*sLevelFile)
+		return std::string();
+
+	return GetBakeCachePath(sLevelFile);
+}
+
+bool CLightBakerDlg::LoadBakeCacheFile(const std::string& sPath, uint64_t nResultHash, uint64_t nSceneHash)
+{
+	if (GetFileAttributesA(sPath.c_str()) == INVALID_FILE_ATTRIBUTES)
+		return false;
+
+	SBakeCacheResult cached;
+	CLightCache lightCache;
+	std::string sError;
+	if (!LoadBakeCache(sPath, cached, lightCache, sError))
+	{
+		PrintMessage(m_pJed, msg_warning, "%s '%s', baking without it.", sError.c_str(), sPath.c_str());
+		return false;
+	}
+
+	if (cached.nResultHash == nResultHash && cached.vertexColors.size() == m_scene.vertices.size())
+	{
+		m_vertexColors = std::move(cached.vertexColors);
+		return true;
+	}
+
+	// a light cache in memory is at least as recent as the file
+	if (!m_lightCache.CanUpdate(nSceneHash) && lightCache.CanUpdate(nSceneHash))
+		m_lightCache = std::move(lightCache);
+
+	return false;
+}
+
+SBakeScheduleSettings CLightBakerDlg::GetScheduleSettings() const
+{
+	SBakeScheduleSettings settings;
+	settings.nTileVertices = m_pDeviceD3D ? kGpuTileVertices : kCpuTileVertices;
+	settings.nBatchRays = m_pDeviceD3D ? kGpuBatchRays : kCpuBatchRays;
+	return settings;
+}
+
+bool CLightBakerDlg::RunBakeSchedule(const SLevelInfo& levelInfo)
+{
+	m_bakeScheduler.Begin(levelInfo, m_nIndirectBounces, GetScheduleSettings());
+
+	m_skyEmissiveRayStats = SRayPassStats();
+	m_indirectRayStats = SRayPassStats();
+	if (!m_pDeviceD3D)
+		m_pCpuBaker->ResetRayStats();
+
+	m_bakeProgress.SetPos(0);
+
+	auto lastPreviewTime = std::chrono::high_resolution_clock::now();
+	while (m_bakeScheduler.Step(*this))
+	{
+		// short work items keep the dialog responsive (and the GPU away from the driver timeout)
+		if (m_pDeviceD3D)
 		{
-			const uint32_t nBucketIndex = nLayerIndex / 32;
-			const uint32_t nBucketPlace = nLayerIndex % 32;
-			layerMask[nBucketIndex] |= 1u << nBucketPlace;
+			// the wait is part of the pass on the wall clock
+			{
+				CScopedBakeTimer timer(&m_profile, m_eProfiledPass, m_nProfiledBounce);
+				WaitForGpu();
+			}
+			ReadGpuTimestamps();
+		}
+		else
+		{
+			PumpMessages();
+		}
+
+		m_bakeProgress.SetPos((int)(m_bakeScheduler.GetProgress() * kProgressRange));
+
+		const auto currTime = std::chrono::high_resolution_clock::now();
+		if (std::chrono::duration_cast<std::chrono::milliseconds>(currTime - lastPreviewTime).count() >= kPreviewIntervalMs)
+		{
+			UpdatePreview();
+			lastPreviewTime = std::chrono::high_resolution_clock::now();
 		}
 	}
+
+	if (!m_pDeviceD3D)
+	{
+		m_skyEmissiveRayStats = m_pCpuBaker->GetSkyEmissiveRayStats();
+		m_indirectRayStats = m_pCpuBaker->GetIndirectRayStats();
+	}
+
+	m_bakeProgress.SetPos(m_bakeScheduler.IsCancelled() ? 0 : kProgressRange);
+	return !m_bakeScheduler.IsCancelled();
 }
 
-void CLightBakerDlg::BuildLights()
+void CLightBakerDlg::BeginPass(EBakePass ePass, int nBounce)
 {
-	CGpuBufferMapping<SLight> lights(&m_lightBuffer, D3D11_MAP_WRITE);
-
-	// build lights
-	m_nSunLightIndex = -1;
-	m_nSkyLightIndex = -1;
-	m_nAnchorLightIndex = -1;
-	for (int nLightIndex = 0; nLightIndex < m_nNumLights; ++nLightIndex)
-	{
-		tjedlightrec light;
-		memset(&light, 0, sizeof(tjedlightrec));
-		m_pJedLevel->GetLight(nLightIndex, &light, lt_all);
-		
-		if (m_nBakeFlags & ELightBake_GammaCorrect)
+	if (!m_pDeviceD3D)
+	{
+		if (ePass == EBakePass_Indirect && nBounce == 0)
+			m_directLight = m_vertexColors;
+
+		m_pCpuBackend->BeginPass(ePass, nBounce);
+		return;
+	}
+
+	CScopedBakeTimer timer(&m_profile, ePass, nBounce);
+
+	// every ray pass starts a new running mean per vertex
+	if (ePass == EBakePass_SkyEmissive || ePass == EBakePass_Indirect)
+		m_sampleStatsBuffer.ClearUAV();
+
+	if (ePass == EBakePass_Indirect)
+	{
+		if (nBounce == 0)
 		{
-			light.r = ToLinear(light.r);
-			light.g = ToLinear(light.g);
-			light.b = ToLinear(light.b);
+			// keep the direct light for the light cache
+			DownloadResults();
+			m_directLight = m_vertexColors;
+
+			// Copy the direct light result for the first bounce
+			m_pReadBuffer = &m_colorLastResultBuffer;
+			m_pWriteBuffer = &m_colorCurrResultBuffer;
+			m_pDeviceContextD3D->CopyResource(m_pReadBuffer->GetBuffer(), m_accumulationBuffer.GetBuffer());
 		}
 
-		SLight* pLight = &lights[nLightIndex];
-		pLight->nSectorIndex = m_pJed->FindSectorForXYZ(light.x, light.y, light.z);
-		pLight->nFlags = light.flags;
-		pLight->range = (float)light.range;
-		pLight->nLayerIndex = light.layer;
-		pLight->color = { (float)(light.r * light.rgbintensity), (float)(light.g * light.rgbintensity), (float)(light.b * light.rgbintensity), (float)light.intensity };
-		pLight->position = { (float)light.x, (float)light.y, (float)light.z, 1.0f };
-
-		if (light.flags & ELight_Sun) // todo: more than 1?
-			m_nSunLightIndex = nLightIndex;
-		else if (light.flags & ELight_Sky)
-			m_nSkyLightIndex = nLightIndex;
-		else if (light.flags & ELight_Anchor)
-			m_nAnchorLightIndex = nLightIndex;
+		// clear the buffer for the next bounce, vertices outside the bake stay black
+		m_pWriteBuffer->ClearUAV();
 	}
 }
 
-void CLightBakerDlg::BuildGeometry()
+void CLightBakerDlg::Run(const SBakeWorkItem& item)
 {
-	CGpuBufferMapping<SSector> sectors(&m_sectorBuffer, D3D11_MAP_WRITE);
-	CGpuBufferMapping<SSurface> surfaces(&m_surfaceBuffer, D3D11_MAP_WRITE);
-	CGpuBufferMapping<SVertex> vertices(&m_vertexBuffer, D3D11_MAP_WRITE);
-	CGpuBufferMapping<int4> normals(&m_normalBuffer, D3D11_MAP_WRITE);
+	m_eProfiledPass = item.ePass;
+	m_nProfiledBounce = item.nBounce;
 
-	if (!sectors || !surfaces || !vertices || !normals)
+	if (item.ePass == EBakePass_WeldVertices)
 	{
-		PrintMessage(m_pJed, msg_error, "Failed to map geometry buffers for upload.");
+		CScopedBakeTimer timer(&m_profile, item.ePass, item.nBounce);
+		WeldVertices();
 		return;
 	}
 
-	uint32_t nSurfaceOffset = 0;
-	uint32_t nVertexOffset = 0;
-	for (int nSectorIndex = 0; nSectorIndex < m_nNumSectors; ++nSectorIndex)
+	if (!m_pDeviceD3D)
 	{
-		const int nNumSurfaces = m_pJedLevel->SectorNSurfaces(nSectorIndex);
+		m_pCpuBackend->Run(item);
+		return;
+	}
 
-		tjedsectorrec sector;
-		memset(&sector, 0, sizeof(tjedsectorrec));
-		m_pJedLevel->GetSector(nSectorIndex, &sector, s_all);
-		SColormap* pColormap = LoadColormap(sector.colormap);
-		
-		tjedbox box;
-		m_pJed->FindBBox(nSectorIndex, &box);
-
-		SSector* pSector = &sectors[nSectorIndex];
-		pSector->nFirstSurface = nSurfaceOffset;
-		pSector->nNumSurfaces = nNumSurfaces;
-		pSector->nLayerIndex = sector.layer;
-		pSector->center.x = float(box.x1 + box.x2) * 0.5f;
-		pSector->center.y = float(box.y1 + box.y2) * 0.5f;
-		pSector->center.z = float(box.z1 + box.z2) * 0.5f;
-
-		uint32_t nSurfaceBase = nSurfaceOffset;
-		uint32_t nAdjoinCursor = nSurfaceBase;              // grows forward
-		uint32_t nSolidCursor = nSurfaceBase + nNumSurfaces - 1; // grows backward
-		for (int nSurfaceIndex = 0; nSurfaceIndex < nNumSurfaces; ++nSurfaceIndex)
-		{
-			tjedsurfacerec surface;
-			memset(&surface, 0, sizeof(tjedsurfacerec));
-			m_pJedLevel->GetSurface(nSectorIndex, nSurfaceIndex, &surface, sf_all);
-
-			const int nAdjoinSector = (surface.adjoinflags & EAdjoin_BlocksLight) ? -1 : surface.adjoinsc;
-			const bool bHasAdjoin = (nAdjoinSector >= 0);
-			uint32_t nDstIndex = bHasAdjoin ? nAdjoinCursor++ : nSolidCursor--;
-			
-			const int nNumVertices = m_pJedLevel->SurfaceNVertices(nSectorIndex, nSurfaceIndex);
-
-			SSurface* pSurface = &surfaces[nDstIndex];
-			pSurface->nFirstVertex = nVertexOffset;
-			pSurface->nNumVertices = nNumVertices;
-
-			float3 albedo = { 0.5f,0.5f,0.5f };
-			float3 emissive = { 0,0,0 };
-			if (pColormap)
-			{
-				int emissiveLightLevel = 0;
+	CScopedBakeTimer timer(&m_profile, item.ePass, item.nBounce);
 
-				// use the light level so we can gracefully go back to 0 and still use regular emissives
-				if (m_nBakeFlags & ELightBake_ExtraLightEmissive)
-					emissiveLightLevel = int(std::min(std::max((float)surface.extralight, 0.0f), 1.0f) * 63.0f);
+	// the work item only goes into the constant buffer, m_scene.levelInfo keeps the whole level
+	SLevelInfo levelInfo = m_scene.levelInfo;
+	levelInfo.nFirstVertex = item.nFirstVertex;
+	levelInfo.nEndVertex   = item.nFirstVertex + item.nNumVertices;
+	levelInfo.nRayOffset   = item.nRayOffset;
+	levelInfo.nRayStride   = item.nRayStride;
+	m_pDeviceContextD3D->UpdateSubresource(m_pLevelInfoConstants, 0, nullptr, &levelInfo, 0, 0);
 
-				uint32_t nFillColor = LoadMaterialFillColor(surface.material, pColormap);
-				albedo = pColormap->GetColor(nFillColor, -1);
-				emissive = pColormap->GetColor(nFillColor, emissiveLightLevel);
-				if (m_nBakeFlags & ELightBake_GammaCorrect)
-				{
-					albedo = ToLinear(albedo);
-					emissive = ToLinear(emissive);
-				}
+	// read back by ReadGpuTimestamps once the item is done
+	if (m_pTimestampDisjointQuery)
+	{
+		m_pDeviceContextD3D->Begin(m_pTimestampDisjointQuery);
+		m_pDeviceContextD3D->End(m_apTimestampQueries[0]);
+	}
 
-				// allow the extra light to increase the intensity
-				if (m_nBakeFlags & ELightBake_ExtraLightEmissive)
-				{
-					emissive.x = std::max(emissive.x, (float)surface.extralight * emissive.x);
-					emissive.y = std::max(emissive.y, (float)surface.extralight * emissive.y);
-					emissive.z = std::max(emissive.z, (float)surface.extralight * emissive.z);
-				}
-			}
-			pSurface->albedo.x = albedo.x;
-			pSurface->albedo.y = albedo.y;
-			pSurface->albedo.z = albedo.z;
-			pSurface->albedo.w = (albedo.x + albedo.y + albedo.z) / 3.0f;
-
-			pSurface->emissive.x = emissive.x;
-			pSurface->emissive.y = emissive.y;
-			pSurface->emissive.z = emissive.z;
-			pSurface->emissive.w = (emissive.x + emissive.y + emissive.z) / 3.0f;
-
-			float3 normal = QuerySurfaceNormal(nSectorIndex, nSurfaceIndex);
-			pSurface->normal.x = normal.x;
-			pSurface->normal.y = normal.y;
-			pSurface->normal.z = normal.z;
-
-			// if a surface is set to block light, then ignore the adjoin value
-			pSurface->nAdjoinSector = nAdjoinSector;
-			pSurface->nFlags = QuerySurfaceVisible(nSectorIndex, nSurfaceIndex) ? ESurface_IsVisible : 0;
-			if (((surface.surfflags & ESky_Horizon) != 0) || ((surface.surfflags & ESky_Ceiling) != 0))
-				pSurface->nFlags |= ESurface_IsSky;
-			if (surface.faceflags & EFace_Translucent)
-				pSurface->nFlags |= ESurface_IsTranslucent;
-
-			for (int nVertexIndex = 0; nVertexIndex < nNumVertices; ++nVertexIndex)
-			{
-				float3 vertex = QuerySurfaceVertex(nSectorIndex, nSurfaceIndex, nVertexIndex);
-
-				SVertex* pVertex = &vertices[nVertexOffset];
-				pVertex->position.x = vertex.x;
-				pVertex->position.y = vertex.y;
-				pVertex->position.z = vertex.z;
-				pVertex->nSectorIndex = nSectorIndex;
-				pVertex->nSurfaceIndex = nDstIndex;
-				pVertex->nLocalSurfaceIndex = nSurfaceIndex;
-				pVertex->nLocalVertexIndex = nVertexIndex;
-
-				int4* pNormal = &normals[nVertexOffset++];
-				pNormal->x = (int)(normal.x * 1024.0);
-				pNormal->y = (int)(normal.y * 1024.0);
-				pNormal->z = (int)(normal.z * 1024.0);
-				pNormal->w = 1;
-			}
-			nSurfaceOffset = nAdjoinCursor + (nNumSurfaces - (nSolidCursor - nSurfaceBase + 1));
-			//++nSurfaceOffset;
+	// Passes are in order:
+	// - Sun (replaces vertex data, no atomics)
+	// - Direct lights (atomic add)
+	// - Sky and emissive (atomic add)
+	// - N Bounce passes (ping pong for readback between bounces, atomic add)
+	switch (item.ePass)
+	{
+	case EBakePass_SmoothNormals:
+		ComputeSmoothNormals();
+		break;
+	case EBakePass_WeldVertices:
+		break;
+	case EBakePass_Sun:
+		DispatchBakePass((item.nNumVertices + 255) / 256, 1, m_pBakeSunShader, &m_colorLastResultBuffer, &m_colorCurrResultBuffer);
+		break;
+	case EBakePass_Direct:
+		DispatchBakePass(item.nNumVertices, 1, m_pBakeDirectShader, &m_colorLastResultBuffer, &m_colorCurrResultBuffer);
+		break;
+	case EBakePass_SkyEmissive:
+		DispatchBakePass(item.nNumVertices, 1, m_pBakeSkyEmissiveShader, &m_colorLastResultBuffer, &m_colorCurrResultBuffer);
+		break;
+	case EBakePass_Indirect:
+		DispatchBakePass(item.nNumVertices, 1, m_pBakeIndirectShader, m_pReadBuffer, m_pWriteBuffer);
+		break;
+	}
+
+	if (m_pTimestampDisjointQuery)
+	{
+		m_pDeviceContextD3D->End(m_apTimestampQueries[1]);
+		m_pDeviceContextD3D->End(m_pTimestampDisjointQuery);
+		m_bTimestampPending = true;
+	}
+}
+
+void CLightBakerDlg::EndPass(EBakePass ePass, int nBounce)
+{
+	if (!m_pDeviceD3D)
+	{
+		m_pCpuBackend->EndPass(ePass, nBounce);
+		return;
+	}
+
+	CScopedBakeTimer timer(&m_profile, ePass, nBounce);
+
+	// the light cache traces with the smoothed normals
+	if (ePass == EBakePass_SmoothNormals)
+		DownloadNormals();
+
+	// the shaders only count the rays of the ray passes, through the sample stats
+	if (ePass == EBakePass_SkyEmissive || ePass == EBakePass_Indirect)
+	{
+		SRayPassStats& stats = (ePass == EBakePass_Indirect) ? m_indirectRayStats : m_skyEmissiveRayStats;
+		const int64_t nRays = stats.nRays;
+		DownloadSampleStats(stats);
+		m_profile.GetPass(ePass, nBounce).counters.nRays += stats.nRays - nRays;
+	}
+
+	if (ePass == EBakePass_Indirect)
+		std::swap(m_pReadBuffer, m_pWriteBuffer);
+}
+
+void CLightBakerDlg::WaitForGpu()
+{
+	m_pDeviceContextD3D->End(m_pBakeQuery);
+	m_pDeviceContextD3D->Flush();
+
+	BOOL bDone = FALSE;
+	while (m_pDeviceContextD3D->GetData(m_pBakeQuery, &bDone, sizeof(bDone), 0) == S_FALSE)
+	{
+		PumpMessages();
+		Sleep(1);
+	}
+	PumpMessages();
+}
+
+void CLightBakerDlg::ReadGpuTimestamps()
+{
+	if (!m_bTimestampPending)
+		return;
+	m_bTimestampPending = false;
+
+	// the item is done after WaitForGpu, the queries around it only have to reach the CPU
+	auto getData = [this](ID3D11Query* pQuery, void* pData, UINT nSize)
+	{
+		HRESULT hr;
+		while ((hr = m_pDeviceContextD3D->GetData(pQuery, pData, nSize, 0)) == S_FALSE)
+			Sleep(0);
+		return hr == S_OK;
+	};
+
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+	UINT64 anTimestamps[2];
+	if (!getData(m_pTimestampDisjointQuery, &disjoint, sizeof(disjoint))
+		|| !getData(m_apTimestampQueries[0], &anTimestamps[0], sizeof(UINT64))
+		|| !getData(m_apTimestampQueries[1], &anTimestamps[1], sizeof(UINT64)))
+	{
+		return;
+	}
+
+	// the GPU clock changed in between, the timestamps can't be compared
+	if (disjoint.Disjoint || disjoint.Frequency == 0)
+		return;
+
+	m_profile.GetPass(m_eProfiledPass, m_nProfiledBounce).AddGpuSeconds((double)(anTimestamps[1] - anTimestamps[0]) / (double)disjoint.Frequency);
+}
+
+void CLightBakerDlg::PumpMessages()
+{
+	MSG msg;
+	while (::PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+	{
+		// hand the quit back to the main loop and stop baking
+		if (msg.message == WM_QUIT)
+		{
+			::PostQuitMessage((int)msg.wParam);
+			m_bakeScheduler.Cancel();
+			return;
+		}
+
+		if (!IsDialogMessage(&msg))
+		{
+			::TranslateMessage(&msg);
+			::DispatchMessage(&msg);
 		}
 	}
 }
 
+void CLightBakerDlg::UpdatePreview()
+{
+	// on the CPU m_vertexColors is the accumulation itself, the ray passes keep it at their mean so far
+	if (m_pDeviceD3D)
+		DownloadResults();
+	else
+		ScatterWeldedVertices(m_scene, m_vertexColors);
+
+	ApplyToLevel(m_vertexColors);
+}
+
+void CLightBakerDlg::EnableBakeControls(bool bBaking)
+{
+	const UINT anBakeButtons[] = { IDC_BUTTON_BAKE_ALL, IDC_BUTTON_BAKE_SEL, IDC_BUTTON_BAKE_LAYERS };
+	for (UINT nID : anBakeButtons)
+	{
+		if (CWnd* pButton = GetDlgItem(nID))
+			pButton->EnableWindow(!bBaking);
+	}
+
+	if (CWnd* pCancelButton = GetDlgItem(IDC_BUTTON_CANCEL_BAKE))
+		pCancelButton->EnableWindow(bBaking);
+}
+
+void CLightBakerDlg::ReserveSceneBuffer(CGpuBuffer& buffer, ESceneBuffer eBuffer, DXGI_FORMAT format, D3D11_RESOURCE_MISC_FLAG miscFlags)
+{
+	// empty buffers can't be created, keep at least one element around
+	const int nCount = (int)GetSceneBufferCount(m_scene, eBuffer);
+	if (buffer.Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nCount > 0 ? nCount : 1, GetSceneBufferStride(eBuffer), format, 0, 0, miscFlags))
+		m_sceneResidency.InvalidateBuffer(eBuffer);
+}
+
+void CLightBakerDlg::AllocateBuffers()
+{
+	// buffers are kept between bakes and only grow, the scene buffers are tracked by m_sceneResidency
+	const int nNumLights = m_scene.lights.empty() ? 1 : (int)m_scene.lights.size();
+	const int nNumVertices = m_nTotalVertices > 0 ? m_nTotalVertices : 1;
+	const int nNumSectorLights = m_scene.sectorLights.empty() ? 1 : (int)m_scene.sectorLights.size();
+	const int nNumEmissiveSurfaces = m_scene.emissiveSurfaces.empty() ? 1 : (int)m_scene.emissiveSurfaces.size();
+	const int nNumEmissiveTriangles = m_scene.emissiveTriangleCdf.empty() ? 1 : (int)m_scene.emissiveTriangleCdf.size();
+	m_selectionBitmaskBuffer.Reserve(m_pDeviceD3D, m_pDeviceContextD3D, GetMaskBucketCount(m_nNumSectors), sizeof(uint32_t), DXGI_FORMAT_R32_UINT, 0, 1, (D3D11_RESOURCE_MISC_FLAG)0);
+	m_layerBitmaskBuffer    .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, GetMaskBucketCount(m_nNumLayers),  sizeof(uint32_t), DXGI_FORMAT_R32_UINT, 0, 1, (D3D11_RESOURCE_MISC_FLAG)0);
+	m_lightBuffer           .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumLights,                         sizeof(SLight), DXGI_FORMAT_UNKNOWN, 0, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	m_sectorLightOffsetBuffer.Reserve(m_pDeviceD3D, m_pDeviceContextD3D, m_nNumSectors + 1,                 sizeof(uint32_t), DXGI_FORMAT_R32_UINT, 0, 0, (D3D11_RESOURCE_MISC_FLAG)0);
+	m_sectorLightBuffer     .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumSectorLights,                   sizeof(uint32_t), DXGI_FORMAT_R32_UINT, 0, 0, (D3D11_RESOURCE_MISC_FLAG)0);
+	m_emissiveSurfaceBuffer .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumEmissiveSurfaces,               sizeof(SEmissiveSurface), DXGI_FORMAT_UNKNOWN, 0, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	m_emissiveTriangleCdfBuffer.Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumEmissiveTriangles,           sizeof(float), DXGI_FORMAT_R32_FLOAT, 0, 0, (D3D11_RESOURCE_MISC_FLAG)0);
+	m_normalBuffer          .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumVertices,                       sizeof(int4), DXGI_FORMAT_UNKNOWN, 1, 1, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	m_colorLastResultBuffer .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumVertices,                       sizeof(float4), DXGI_FORMAT_UNKNOWN, 1, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	m_colorCurrResultBuffer .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumVertices,                       sizeof(float4), DXGI_FORMAT_UNKNOWN, 1, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	m_accumulationBuffer    .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumVertices,                       sizeof(float4), DXGI_FORMAT_UNKNOWN, 1, 1, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	m_sampleStatsBuffer     .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumVertices,                       sizeof(SVertexSampleStats), DXGI_FORMAT_UNKNOWN, 1, 1, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	m_vertexWeldBuffer      .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumVertices,                       sizeof(uint32_t), DXGI_FORMAT_R32_UINT, 0, 0, (D3D11_RESOURCE_MISC_FLAG)0);
+	m_vertexHashCellBuffer  .Reserve(m_pDeviceD3D, m_pDeviceContextD3D, GetVertexHashSize(nNumVertices),    sizeof(SVertexHashCell), DXGI_FORMAT_UNKNOWN, 0, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	m_vertexHashVertexBuffer.Reserve(m_pDeviceD3D, m_pDeviceContextD3D, nNumVertices,                       sizeof(uint32_t), DXGI_FORMAT_R32_UINT, 0, 0, (D3D11_RESOURCE_MISC_FLAG)0);
+
+	ReserveSceneBuffer(m_sectorBuffer,      ESceneBuffer_Sectors,     DXGI_FORMAT_UNKNOWN,  D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	ReserveSceneBuffer(m_surfaceBuffer,     ESceneBuffer_Surfaces,    DXGI_FORMAT_UNKNOWN,  D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	ReserveSceneBuffer(m_vertexBuffer,      ESceneBuffer_Vertices,    DXGI_FORMAT_UNKNOWN,  D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	ReserveSceneBuffer(m_rawNormalBuffer,   ESceneBuffer_Normals,     DXGI_FORMAT_UNKNOWN,  D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	ReserveSceneBuffer(m_edgePlaneBuffer,   ESceneBuffer_EdgePlanes,  DXGI_FORMAT_UNKNOWN,  D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	ReserveSceneBuffer(m_bvhNodeBuffer,     ESceneBuffer_BvhNodes,    DXGI_FORMAT_UNKNOWN,  D3D11_RESOURCE_MISC_BUFFER_STRUCTURED);
+	ReserveSceneBuffer(m_bvhSurfaceBuffer,  ESceneBuffer_BvhSurfaces, DXGI_FORMAT_R32_UINT, (D3D11_RESOURCE_MISC_FLAG)0);
+
+	// clear the color buffers before we render anything to them
+	m_colorLastResultBuffer.ClearUAV();
+	m_colorCurrResultBuffer.ClearUAV();
+	m_accumulationBuffer.ClearUAV();
+}
+
+void CLightBakerDlg::FreeBuffers()
+{
+	m_selectionBitmaskBuffer.Release();
+	m_layerBitmaskBuffer.Release();
+	m_sectorBuffer.Release();
+	m_surfaceBuffer.Release();
+	m_vertexBuffer.Release();
+	m_lightBuffer.Release();
+	m_rawNormalBuffer.Release();
+	m_normalBuffer.Release();
+	m_colorLastResultBuffer.Release();
+	m_colorCurrResultBuffer.Release();
+	m_accumulationBuffer.Release();
+	m_sampleStatsBuffer.Release();
+	m_vertexWeldBuffer.Release();
+	m_sectorLightOffsetBuffer.Release();
+	m_sectorLightBuffer.Release();
+	m_emissiveSurfaceBuffer.Release();
+	m_emissiveTriangleCdfBuffer.Release();
+	m_vertexHashCellBuffer.Release();
+	m_vertexHashVertexBuffer.Release();
+	m_edgePlaneBuffer.Release();
+	m_bvhNodeBuffer.Release();
+	m_bvhSurfaceBuffer.Release();
+
+	m_sceneResidency.Invalidate();
+}
+
+void CLightBakerDlg::BuildSelectionBitmask()
+{
+	m_scene.sectorMasks.assign(GetMaskBucketCount(m_nNumSectors), 0);
+	for (int nQueuedSectorIndex = 0; nQueuedSectorIndex < m_nNumQueuedSectors; ++nQueuedSectorIndex)
+	{
+		const int nSectorIndex = (m_nBakeFlags & ELightBake_Selected) ? m_pJed->GetSelectedSC(nQueuedSectorIndex) : nQueuedSectorIndex;
+		SetMaskBit(m_scene.sectorMasks.data(), nSectorIndex);
+	}
+}
+
+void CLightBakerDlg::BuildLayerBitmask()
+{
+	m_scene.layerMasks.assign(GetMaskBucketCount(m_nNumLayers), 0);
+	for (int nLayerIndex = 0; nLayerIndex < m_nNumLayers; ++nLayerIndex)
+	{
+		if (!(m_nBakeFlags & ELightBake_VisibleLayers) || m_pJed->IsLayerVisible(nLayerIndex))
+			SetMaskBit(m_scene.layerMasks.data(), nLayerIndex);
+	}
+}
+
 int CLightBakerDlg::CreateComputeShader(ID3D11Device* pDevice, ID3D11ComputeShader** pShader, UINT resourceID) const
 {
 	const void* shaderData = nullptr;
@@ -740,20 +1119,60 @@ int CLightBakerDlg::CreateConstantBuffer(ID3D11Device* pDevice, ID3D11Buffer** p
 
 void CLightBakerDlg::UpdateLevelInfo()
 {
-	// run the bake
-	SLevelInfo levelInfo;
-	levelInfo.nTotalSectors     = m_nNumSectors;
-	levelInfo.nTotalSurfaces    = m_nTotalSurfaces;
-	levelInfo.nTotalVertices    = m_nTotalVertices;
-	levelInfo.nTotalLights      = m_nNumLights;
-	levelInfo.nBakeFlags        = m_nBakeFlags;
-	levelInfo.nSkyEmissiveRays  = m_nSkyEmissiveRayCount;
-	levelInfo.nIndirectRays     = m_nIndirectRayCount;
-	levelInfo.nSunLightIndex    = m_nSunLightIndex;
-	levelInfo.nSkyLightIndex    = m_nSkyLightIndex;
-	levelInfo.nAnchorLightIndex = m_nAnchorLightIndex;
-	levelInfo.normalSmoothCos   = cosf((float)m_nNormalSmoothingAngle * (3.141592f / 180.0f));
-	m_pDeviceContextD3D->UpdateSubresource(m_pLevelInfoConstants, 0, nullptr, &levelInfo, 0, 0);
+	// totals and light indices were filled by BuildBakeScene
+	SLevelInfo& levelInfo = m_scene.levelInfo;
+	levelInfo.nBakeFlags       = m_nBakeFlags;
+	levelInfo.nSkyEmissiveRays = m_nSkyEmissiveRayCount;
+	levelInfo.nIndirectRays    = m_nIndirectRayCount;
+	levelInfo.normalSmoothCos  = cosf((float)m_nNormalSmoothingAngle * (3.141592f / 180.0f));
+
+	// the selected ray counts become the budget of the passes, noisy vertices get the rays the converged ones leave
+	if (m_nBakeFlags & ELightBake_Adaptive)
+		EnableAdaptiveRays(levelInfo, kDefaultAdaptiveThreshold);
+	if (m_pDeviceContextD3D)
+		m_pDeviceContextD3D->UpdateSubresource(m_pLevelInfoConstants, 0, nullptr, &levelInfo, 0, 0);
+}
+
+void CLightBakerDlg::UploadScene()
+{
+	m_selectionBitmaskBuffer.UpdateRange(m_scene.sectorMasks.data(), 0, (int)m_scene.sectorMasks.size());
+	m_layerBitmaskBuffer.UpdateRange(m_scene.layerMasks.data(), 0, (int)m_scene.layerMasks.size());
+	m_lightBuffer.UpdateRange(m_scene.lights.data(), 0, (int)m_scene.lights.size());
+	m_sectorLightOffsetBuffer.UpdateRange(m_scene.sectorLightOffsets.data(), 0, (int)m_scene.sectorLightOffsets.size());
+	m_sectorLightBuffer.UpdateRange(m_scene.sectorLights.data(), 0, (int)m_scene.sectorLights.size());
+	m_emissiveSurfaceBuffer.UpdateRange(m_scene.emissiveSurfaces.data(), 0, (int)m_scene.emissiveSurfaces.size());
+	m_emissiveTriangleCdfBuffer.UpdateRange(m_scene.emissiveTriangleCdf.data(), 0, (int)m_scene.emissiveTriangleCdf.size());
+
+	// only the sectors that changed since the last bake
+	std::vector<SSceneRange> aUploads[ESceneBuffer_Count];
+	m_sceneResidency.Update(m_scene, aUploads);
+
+	CGpuBuffer* apSceneBuffers[ESceneBuffer_Count] =
+	{
+		&m_sectorBuffer,
+		&m_surfaceBuffer,
+		&m_vertexBuffer,
+		&m_rawNormalBuffer,
+		&m_edgePlaneBuffer,
+		&m_bvhNodeBuffer,
+		&m_bvhSurfaceBuffer
+	};
+
+	for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+	{
+		const uint8_t* pData = (const uint8_t*)GetSceneBufferData(m_scene, (ESceneBuffer)nBuffer);
+		const uint32_t nStride = GetSceneBufferStride((ESceneBuffer)nBuffer);
+		for (const SSceneRange& range : aUploads[nBuffer])
+			apSceneBuffers[nBuffer]->UpdateRange(pData + (size_t)range.nFirst * nStride, range.nFirst, range.nCount);
+	}
+
+	if (m_sceneResidency.GetNumDirtySectors() < m_nNumSectors)
+		PrintMessage(m_pJed, msg_info, "Uploaded %d of %d sectors.", m_sceneResidency.GetNumDirtySectors(), m_nNumSectors);
+
+	// the smoothing pass writes into m_normalBuffer, start from the unsmoothed normals every bake
+	D3D11_BOX box = { 0, 0, 0, (UINT)(m_nTotalVertices * sizeof(int4)), 1, 1 };
+	if (m_nTotalVertices > 0)
+		m_pDeviceContextD3D->CopySubresourceRegion(m_normalBuffer.GetBuffer(), 0, 0, 0, 0, m_rawNormalBuffer.GetBuffer(), 0, &box);
 }
 
 void CLightBakerDlg::DispatchBakePass(int nDispatchX, int nDispatchY, ID3D11ComputeShader* pShader, CGpuBuffer* pReadBuffer, CGpuBuffer* pWriteBuffer)
@@ -767,71 +1186,52 @@ void CLightBakerDlg::DispatchBakePass(int nDispatchX, int nDispatchY, ID3D11Comp
 		m_vertexBuffer.GetSRV(),
 		m_lightBuffer.GetSRV(),
 		m_normalBuffer.GetSRV(),
-		pReadBuffer->GetSRV()
+		pReadBuffer->GetSRV(),
+		m_edgePlaneBuffer.GetSRV(),
+		m_bvhNodeBuffer.GetSRV(),
+		m_bvhSurfaceBuffer.GetSRV(),
+		m_vertexWeldBuffer.GetSRV(),
+		m_sectorLightOffsetBuffer.GetSRV(),
+		m_sectorLightBuffer.GetSRV(),
+		nullptr, // t14 and t15 are the vertex hash of GenSmoothNormals
+		nullptr,
+		m_emissiveSurfaceBuffer.GetSRV(),
+		m_emissiveTriangleCdfBuffer.GetSRV()
 	};
 	
 	ID3D11UnorderedAccessView* apUnorderedResources[] =
 	{
 		pWriteBuffer->GetUAV(),
-		m_accumulationBuffer.GetUAV()
+		m_accumulationBuffer.GetUAV(),
+		m_sampleStatsBuffer.GetUAV()
 	};
 
 	ID3D11Buffer* apConstantBuffers[] = { m_pLevelInfoConstants };
 
 	m_pDeviceContextD3D->CSSetShader(pShader, nullptr, 0);
 	m_pDeviceContextD3D->CSSetConstantBuffers(0, 1, apConstantBuffers);
-	m_pDeviceContextD3D->CSSetShaderResources(0, 8, apShaderResources);
-	m_pDeviceContextD3D->CSSetUnorderedAccessViews(0, 2, apUnorderedResources, 0);
+	m_pDeviceContextD3D->CSSetShaderResources(0, _countof(apShaderResources), apShaderResources);
+	m_pDeviceContextD3D->CSSetUnorderedAccessViews(0, _countof(apUnorderedResources), apUnorderedResources, 0);
 	m_pDeviceContextD3D->Dispatch(nDispatchX, nDispatchY, 1);
 
 	ID3D11Buffer* nullBuf[] = { nullptr };
-	ID3D11ShaderResourceView* nullSRV[] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
-	ID3D11UnorderedAccessView* nullUAV[] = { nullptr, nullptr };
+	ID3D11ShaderResourceView* nullSRV[_countof(apShaderResources)] = {};
+	ID3D11UnorderedAccessView* nullUAV[_countof(apUnorderedResources)] = {};
 
 	m_pDeviceContextD3D->CSSetConstantBuffers(0, 1, nullBuf);
-	m_pDeviceContextD3D->CSSetShaderResources(0, 8, nullSRV);
-	m_pDeviceContextD3D->CSSetUnorderedAccessViews(0, 2, nullUAV, 0);
+	m_pDeviceContextD3D->CSSetShaderResources(0, _countof(nullSRV), nullSRV);
+	m_pDeviceContextD3D->CSSetUnorderedAccessViews(0, _countof(nullUAV), nullUAV, 0);
 	
 	m_pDeviceContextD3D->Flush();
 }
 
-void CLightBakerDlg::BakeDirectLighting()
-{
-	// Passes are in order:
-	// - Sun (replaces vertex data, no atomics)
-	// - Direct lights (atomic add)
-	// - Sky and emissive (atomic add)
-	if (m_nBakeFlags & ELightBake_Sun)
-		DispatchBakePass((m_nTotalVertices + 255) / 256, 1, m_pBakeSunShader, &m_colorLastResultBuffer, &m_colorCurrResultBuffer);
-	
-	if (m_nBakeFlags & ELightBake_Lights)
-		DispatchBakePass(m_nTotalVertices, 1, m_pBakeDirectShader, &m_colorLastResultBuffer, &m_colorCurrResultBuffer);
-	
-	if ((m_nBakeFlags & ELightBake_Sky) || (m_nBakeFlags & ELightBake_Emissive))
-		DispatchBakePass(m_nTotalVertices, 1, m_pBakeSkyEmissiveShader, &m_colorLastResultBuffer, &m_colorCurrResultBuffer);
-}
-
-void CLightBakerDlg::BakeIndirectLighting()
-{
-	CGpuBuffer* pReadBuffer = &m_colorLastResultBuffer;
-	CGpuBuffer* pWriteBuffer = &m_colorCurrResultBuffer;
-
-	// Copy the direct light result for the first bounce
-	m_pDeviceContextD3D->CopyResource(pReadBuffer->GetBuffer(), m_accumulationBuffer.GetBuffer());
-
-	for (int nBounce = 0; nBounce < m_nIndirectBounces; ++nBounce)
-	{
-		// clear the buffer for the next bounce accumulation
-		pWriteBuffer->ClearUAV();
-
-		DispatchBakePass(m_nTotalVertices, 1, m_pBakeIndirectShader, pReadBuffer, pWriteBuffer);
-
-		std::swap(pReadBuffer, pWriteBuffer);
-	}
-}
-
 void CLightBakerDlg::ComputeSmoothNormals()
 {
+	// the shader looks up the coincident vertices of every vertex in the hash
+	BuildVertexHash(m_scene, m_vertexHash);
+	m_vertexHashCellBuffer.UpdateRange(m_vertexHash.cells.data(), 0, (int)m_vertexHash.cells.size());
+	m_vertexHashVertexBuffer.UpdateRange(m_vertexHash.vertices.data(), 0, (int)m_vertexHash.vertices.size());
+
 	ID3D11ShaderResourceView* apShaderResources[] =
 	{
 		m_selectionBitmaskBuffer.GetSRV(),
@@ -841,6 +1241,12 @@ void CLightBakerDlg::ComputeSmoothNormals()
 		m_vertexBuffer.GetSRV(),
 	};
 
+	ID3D11ShaderResourceView* apHashResources[] =
+	{
+		m_vertexHashCellBuffer.GetSRV(),
+		m_vertexHashVertexBuffer.GetSRV()
+	};
+
 	ID3D11UnorderedAccessView* apUnorderedResources[] =
 	{
 		m_normalBuffer.GetUAV()
@@ -851,8 +1257,9 @@ void CLightBakerDlg::ComputeSmoothNormals()
 	m_pDeviceContextD3D->CSSetShader(m_pGenNormalsShader, nullptr, 0);
 	m_pDeviceContextD3D->CSSetConstantBuffers(0, 1, apConstantBuffers);
 	m_pDeviceContextD3D->CSSetShaderResources(0, 5, apShaderResources);
+	m_pDeviceContextD3D->CSSetShaderResources(14, 2, apHashResources);
 	m_pDeviceContextD3D->CSSetUnorderedAccessViews(0, 1, apUnorderedResources, 0);
-	m_pDeviceContextD3D->Dispatch((m_nNumSectors + 255)/256, 1, 1);//(m_nTotalVertices + 15) / 16, (m_nTotalVertices + 15) / 16, 1);
+	m_pDeviceContextD3D->Dispatch((m_nTotalVertices + 255) / 256, 1, 1);
 
 	ID3D11Buffer* nullBuf[] = { nullptr };
 	ID3D11ShaderResourceView* nullSRV[] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
@@ -860,238 +1267,234 @@ void CLightBakerDlg::ComputeSmoothNormals()
 
 	m_pDeviceContextD3D->CSSetConstantBuffers(0, 1, nullBuf);
 	m_pDeviceContextD3D->CSSetShaderResources(0, 5, nullSRV);
+	m_pDeviceContextD3D->CSSetShaderResources(14, 2, nullSRV);
 	m_pDeviceContextD3D->CSSetUnorderedAccessViews(0, 1, nullUAV, 0);
 }
 
-void CLightBakerDlg::DownloadAndApplyToLevel()
+void CLightBakerDlg::WeldVertices()
 {
-	const CGpuBufferMapping<float4> vertexData(&m_accumulationBuffer, D3D11_MAP_READ);
-	const CGpuBufferMapping<SVertex> vertices(&m_vertexBuffer, D3D11_MAP_READ);
-	const CGpuBufferMapping<SSector> sectors(&m_sectorBuffer, D3D11_MAP_READ);
-	const CGpuBufferMapping<SSurface> surfaces(&m_surfaceBuffer, D3D11_MAP_READ);
-	const CGpuBufferMapping<uint32_t> layerMask(&m_layerBitmaskBuffer, D3D11_MAP_WRITE);
-	const CGpuBufferMapping<uint32_t> sectorMask(&m_selectionBitmaskBuffer, D3D11_MAP_WRITE);
+	const int nNumTracedVertices = BuildVertexWelds(m_scene);
+	if (m_pDeviceD3D)
+		m_vertexWeldBuffer.UpdateRange(m_scene.vertexWelds.data(), 0, (int)m_scene.vertexWelds.size());
 
-	if (!vertexData || !vertices || !sectors || !surfaces || !layerMask || !sectorMask)
+	if (nNumTracedVertices < m_nTotalVertices)
+		PrintMessage(m_pJed, msg_info, "Tracing %d of %d vertices, the others share a position and normal with one of them.", nNumTracedVertices, m_nTotalVertices);
+}
+
+void CLightBakerDlg::DownloadResults()
+{
+	CScopedBakeTimer timer(&m_profile, EBakeStage_Readback);
+	const CGpuBufferMapping<float4> vertexData(&m_accumulationBuffer, D3D11_MAP_READ);
+	if (!vertexData)
 	{
-		PrintMessage(m_pJed, msg_error, "Failed to map geometry buffers for download.");
+		PrintMessage(m_pJed, msg_error, "Failed to map accumulation buffer for download.");
+		m_vertexColors.clear();
 		return;
 	}
 
-	for (int nVertexIndex = 0; nVertexIndex < m_nTotalVertices; ++nVertexIndex)
-	{
-		const uint32_t nSectorIndex = vertices[nVertexIndex].nSectorIndex;
-		const uint32_t nSurfaceIndex = vertices[nVertexIndex].nSurfaceIndex;
-		const uint32_t nLayerIndex = sectors[nSectorIndex].nLayerIndex;
-
-		// don't update vertices for surfaces if they weren't touched in the bake
-		if (!TestMaskBit(sectorMask.RawData(), nSectorIndex)
-			|| !TestMaskBit(layerMask.RawData(), nLayerIndex)
-			|| !(surfaces[nSurfaceIndex].nFlags & ESurface_IsVisible))
-		{
-			continue;
-		}
-
-		float4 color = vertexData[nVertexIndex];
-		if (m_nBakeFlags & ELightBake_ToneMap)
-		{
-			float a = 2.51f;
-			float b = 0.03f;
-			float c = 2.43f;
-			float d = 0.59f;
-			float e = 0.14f;
-			color = ((color * (a * color + b)) / (color * (c * color + d) + e));
-		}
-
-		if (m_nBakeFlags & ELightBake_GammaCorrect)
-			color = ToSRGB(color);
-
-		const uint32_t nLocalSurfaceIndex = vertices[nVertexIndex].nLocalSurfaceIndex;
-		const uint32_t nLocalVertexIndex = vertices[nVertexIndex].nLocalVertexIndex;
+	m_vertexColors.assign(vertexData.RawData(), vertexData.RawData() + m_nTotalVertices);
 
-		m_pJedLevel->SurfaceSetVertexLight(nSectorIndex, nLocalSurfaceIndex, nLocalVertexIndex, color.w, color.x, color.y, color.z);
-	}
+	// the shaders only write the traced vertices
+	ScatterWeldedVertices(m_scene, m_vertexColors);
+}
 
-	// todo: do this on gpu
-	for (int nSectorIndex = 0; nSectorIndex < m_nNumSectors; ++nSectorIndex)
+void CLightBakerDlg::DownloadNormals()
+{
+	CScopedBakeTimer timer(&m_profile, EBakeStage_Readback);
+	const CGpuBufferMapping<int4> normals(&m_normalBuffer, D3D11_MAP_READ);
+	if (!normals)
 	{
-		if (!TestMaskBit(sectorMask.RawData(), nSectorIndex))
-		{
-			continue;
-		}
-
-		// todo: might be better to actually also trace probes at the center of sectors to get better ambient
-		float4 ambientColor = { 0,0,0,0 };
-		float totalAmbient = 0.0f;
-
-		const int nNumSurfaces = m_pJedLevel->SectorNSurfaces(nSectorIndex);
-		for (int nSurfaceIndex = 0; nSurfaceIndex < nNumSurfaces; ++nSurfaceIndex)
-		{
-			const int nNumVertices = m_pJedLevel->SurfaceNVertices(nSectorIndex, nSurfaceIndex);
-			for (int nVertexIndex = 0; nVertexIndex < nNumVertices; ++nVertexIndex)
-			{
-				float r, g, b, a;
-				m_pJedLevel->SurfaceGetVertexLight(nSectorIndex, nSurfaceIndex, nVertexIndex, &a, &r, &g, &b);
-
-				ambientColor += float4(r, g, b, a);
-				totalAmbient += 1.0f;
-			}
-			m_pJedLevel->SurfaceUpdate(nSectorIndex, nSurfaceIndex, 0);
-		}
-
-		// update sector ambient if needed
-		tjedsectorrec sector;
-		memset(&sector, 0, sizeof(tjedsectorrec));
-		m_pJedLevel->GetSector(nSectorIndex, &sector, s_flags | s_ambient);
-		if (!(sector.flags & ESector_NoAmbientLightRGB) && !(sector.flags & ESector_NoAmbientLight))
-		{
-			float invTotalAmbient = totalAmbient < 1e-5f ? 0.0f : 1.0f / totalAmbient;
-			ambientColor *= invTotalAmbient;
-
-			// todo: SED has rgb ambient for Jones?
-			sector.ambient = ambientColor.w;
-			m_pJedLevel->SetSector(nSectorIndex, &sector, s_ambient);
-		}
-
-		m_pJedLevel->SectorUpdate(nSectorIndex);
+		PrintMessage(m_pJed, msg_error, "Failed to map normal buffer for download.");
+		return;
 	}
+
+	m_scene.normals.assign(normals.RawData(), normals.RawData() + m_nTotalVertices);
 }
 
-SColormap* CLightBakerDlg::LoadColormap(const wchar_t* sFileName)
+int64_t CLightBakerDlg::GetPassRays()
 {
-	if (!sFileName || sFileName[0] == '\0')
-		return nullptr;
-
-	auto it = m_colormapCache.find(sFileName);
-	if (it != m_colormapCache.end())
-		return &it->second;
+	if (!m_pDeviceD3D)
+		return m_pCpuBackend->GetPassRays();
 
-	int nFileHandle = m_pJed->OpenGameFile((char*)sFileName);
-	if (nFileHandle < 0)
-	{
-		// the file wasn't found, to avoid console spam and slowdowns, insert a blank value
-		m_colormapCache.emplace(sFileName, SColormap());
-		return nullptr;
-	}
-
-	SColormapHeader colormapHeader;
-	if (m_pJed->ReadFile(nFileHandle, &colormapHeader, sizeof(SColormapHeader)) != sizeof(SColormapHeader))
-	{
-		PrintMessage(m_pJed, msg_error, "Failed to read file '%ls'.", sFileName);
-		m_pJed->CloseFile(nFileHandle);
-		return nullptr;
-	}
+	// the shaders count the rays of the pass in progress in the sample stats
+	SRayPassStats stats;
+	DownloadSampleStats(stats);
+	return stats.nRays;
+}
 
-	if (strncmp(colormapHeader.magic, "CMP ", 4) != 0)
+void CLightBakerDlg::DownloadSampleStats(SRayPassStats& stats)
+{
+	CScopedBakeTimer timer(&m_profile, EBakeStage_Readback);
+	const CGpuBufferMapping<SVertexSampleStats> sampleStats(&m_sampleStatsBuffer, D3D11_MAP_READ);
+	if (!sampleStats)
 	{
-		PrintMessage(m_pJed, msg_error, "Bad colormap header in file '%ls'.", sFileName);
-		m_pJed->CloseFile(nFileHandle);
-		return nullptr;
+		PrintMessage(m_pJed, msg_error, "Failed to map sample stats buffer for download.");
+		return;
 	}
 
-	if (colormapHeader.nVersion < 30)
-	{
-		PrintMessage(m_pJed, msg_error, "Unsupported colormap version for '%ls'.", sFileName);
-		m_pJed->CloseFile(nFileHandle);
-		return nullptr;
-	}
+	stats.Add(sampleStats.RawData(), m_nTotalVertices);
+}
 
-	uint8_t* paColors = new uint8_t[3 * 256];
-	if (m_pJed->ReadFile(nFileHandle, paColors, (3 * 256)) != (3 * 256))
+void CLightBakerDlg::UploadAccumulation()
+{
+	CScopedBakeTimer timer(&m_profile, EBakeStage_Upload);
+	CGpuBufferMapping<float4> accumulation(&m_accumulationBuffer, D3D11_MAP_WRITE);
+	if (!accumulation || m_vertexColors.size() != (size_t)m_nTotalVertices)
 	{
-		PrintMessage(m_pJed, msg_error, "Failed to read colors from '%ls'.", sFileName);
-		m_pJed->CloseFile(nFileHandle);
-		delete[] paColors;
-		return nullptr;
+		PrintMessage(m_pJed, msg_error, "Failed to map accumulation buffer for upload.");
+		return;
 	}
 
-	uint8_t* paLightLevels = new uint8_t[64 * 256];
-	if (m_pJed->ReadFile(nFileHandle, paLightLevels, (64 * 256)) != (64 * 256))
-	{
-		PrintMessage(m_pJed, msg_error, "Failed to read light levels from '%ls'.", sFileName);
-		delete[] paColors;
-		delete[] paLightLevels;
-		m_pJed->CloseFile(nFileHandle);
-		return nullptr;
-	}
+	memcpy(accumulation.RawData(), m_vertexColors.data(), sizeof(float4) * m_vertexColors.size());
+}
 
-	SColormap& colormap = m_colormapCache[sFileName];
-	memcpy(colormap.colors, paColors, 3 * 256);
-	memcpy(colormap.nLightLevels, paLightLevels, 64 * 256);
+void CLightBakerDlg::TraceProbes()
+{
+	CScopedBakeTimer timer(&m_profile, EBakeStage_Probes);
 
-	delete[] paColors;
-	delete[] paLightLevels;
+	// the GPU bake downloaded the vertex light for the writeback already, the probes trace it on the CPU in one go
+	SProbeSettings settings;
+	STraceCounters counters;
+	PlaceSectorProbes(m_scene, settings, m_probes);
+	TraceSectorProbes(m_scene, m_vertexColors, settings, m_pJobSystem.get(), m_probes, counters);
 
-	m_pJed->CloseFile(nFileHandle);
+	SBakeStageProfile& stage = m_profile.GetStage(EBakeStage_Probes);
+	stage.counters += counters;
+	stage.bCountedHops = true;
 
-	return &colormap;
+	PrintMessage(m_pJed, msg_info, "Traced %d probes for the sector ambient.", (int)m_probes.probes.size());
 }
 
-uint32_t CLightBakerDlg::LoadMaterialFillColor(const wchar_t* sFileName, const SColormap* pColormap)
+void CLightBakerDlg::ApplyToLevel(const std::vector<float4>& colors)
 {
-	if (!sFileName || sFileName[0] == '\0')
-		return 0;
+	if (colors.size() != (size_t)m_nTotalVertices)
+		return;
 
-	auto it = m_materialColorCache.find(sFileName);
-	if (it != m_materialColorCache.end())
-		return it->second;
+	CScopedBakeTimer timer(&m_profile, EBakeStage_Writeback);
 
-	int nFileHandle = m_pJed->OpenGameFile((char*)sFileName);
-	if (nFileHandle < 0)
+	// the level can be edited while the dialog handles messages during a bake
+	if (m_pJedLevel->NSectors() != m_nNumSectors)
 	{
-		// the file wasn't found, to avoid console spam and slowdowns, insert a blank value
-		m_materialColorCache.emplace(sFileName, 0);
-		return 0;
+		PrintMessage(m_pJed, msg_warning, "The level changed during the light bake, the result wasn't applied.");
+		return;
 	}
 
-	SMaterialFileHeader materialHeader;
-	if (m_pJed->ReadFile(nFileHandle, &materialHeader, sizeof(SMaterialFileHeader)) != sizeof(SMaterialFileHeader))
-	{
-		PrintMessage(m_pJed, msg_error, "Failed to read file '%ls'.", sFileName);
-		m_pJed->CloseFile(nFileHandle);
-		return 0;
-	}
+	const std::vector<SVertex>& vertices = m_scene.vertices;
+	const std::vector<SSector>& sectors = m_scene.sectors;
+	const std::vector<SSurface>& surfaces = m_scene.surfaces;
+	const uint32_t* layerMask = m_scene.layerMasks.data();
+	const uint32_t* sectorMask = m_scene.sectorMasks.data();
 
-	if (memcmp(materialHeader.magic, "MAT ", 4u))
+	// the vertex order only holds while the level keeps its layout, the next writeback starts over without known values
+	if (m_levelVertexLight.size() != (size_t)m_nTotalVertices || m_nLevelLightSectors != m_nNumSectors || m_nLevelLightSurfaces != m_nTotalSurfaces)
 	{
-		PrintMessage(m_pJed, msg_error, "Bad material header in file '%ls'.", sFileName);
-		m_pJed->CloseFile(nFileHandle);
-		return 0;
+		m_levelVertexLight.assign(m_nTotalVertices, float4(0, 0, 0, 0));
+		m_levelVertexLightMask.assign(GetMaskBucketCount(m_nTotalVertices), 0);
+		m_nLevelLightSectors = m_nNumSectors;
+		m_nLevelLightSurfaces = m_nTotalSurfaces;
 	}
 
-	if (materialHeader.nVersion != 0x32)
+	// the vertices of a sector follow each other in the order of its surfaces
+	std::vector<bool> dirtySurfaces;
+	int nVertexIndex = 0;
+	for (int nSectorIndex = 0; nSectorIndex < m_nNumSectors; ++nSectorIndex)
 	{
-		PrintMessage(m_pJed, msg_error, "Unsupported material version for '%ls'.", sFileName);
-		m_pJed->CloseFile(nFileHandle);
-		return 0;
-	}
+		const int nFirstVertex = nVertexIndex;
+		while (nVertexIndex < m_nTotalVertices && vertices[nVertexIndex].nSectorIndex == (uint32_t)nSectorIndex)
+			++nVertexIndex;
 
-	// read the last header (emissive signs and such start at broken, we want the cel with illumination)
-	SMaterialRecordHeader recordHeader;
-	for (uint32_t i = 0; i < materialHeader.nRecordCount; ++i)
-	{
-		if (m_pJed->ReadFile(nFileHandle, &recordHeader, sizeof(SMaterialRecordHeader)) != sizeof(SMaterialRecordHeader))
+		if (!TestMaskBit(sectorMask, nSectorIndex))
 		{
-			PrintMessage(m_pJed, msg_error, "Failed to read material record header from '%ls'.", sFileName);
-			m_pJed->CloseFile(nFileHandle);
-			return 0;
+			continue;
 		}
-		if (recordHeader.nTextureType & 8)
+
+		tjedsectorrec sector;
+		memset(&sector, 0, sizeof(tjedsectorrec));
+		m_pJedLevel->GetSector(nSectorIndex, &sector, s_flags | s_ambient);
+		const bool bAmbient = !(sector.flags & ESector_NoAmbientLightRGB) && !(sector.flags & ESector_NoAmbientLight);
+
+		// with probes the light of the vertices that weren't baked isn't needed for the ambient
+		const bool bProbeAmbient = bAmbient && m_probes.HasSectorProbes(nSectorIndex);
+		const bool bAverageAmbient = bAmbient && !bProbeAmbient;
+
+		// don't update vertices for surfaces if they weren't touched in the bake
+		const bool bLayerBaked = TestMaskBit(layerMask, sectors[nSectorIndex].nLayerIndex) != 0;
+
+		float4 ambientColor = { 0,0,0,0 };
+		float totalAmbient = 0.0f;
+
+		dirtySurfaces.assign(sectors[nSectorIndex].nNumSurfaces, false);
+		bool bSectorDirty = false;
+		for (int nSectorVertex = nFirstVertex; nSectorVertex < nVertexIndex; ++nSectorVertex)
 		{
-			SMaterialRecordHeaderExt ext;
-			if (m_pJed->ReadFile(nFileHandle, &ext, sizeof(SMaterialRecordHeaderExt)) != sizeof(SMaterialRecordHeaderExt))
+			const SVertex& vertex = vertices[nSectorVertex];
+			const bool bBaked = bLayerBaked && (surfaces[vertex.nSurfaceIndex].nFlags & ESurface_IsVisible);
+			if (!bBaked && !bAverageAmbient)
+				continue;
+
+			// baked vertices are written unless the level is known to hold the value, only the others are read
+			float4& levelLight = m_levelVertexLight[nSectorVertex];
+			const bool bKnown = TestMaskBit(m_levelVertexLightMask.data(), nSectorVertex) != 0;
+			float4 color = levelLight;
+			if (bBaked)
+			{
+				color = ResolveVertexColor(colors[nSectorVertex], m_nBakeFlags);
+				if (!bKnown || !IsSameStoredLight(color, levelLight))
+				{
+					m_pJedLevel->SurfaceSetVertexLight(nSectorIndex, vertex.nLocalSurfaceIndex, vertex.nLocalVertexIndex, color.w, color.x, color.y, color.z);
+					levelLight = color;
+					SetMaskBit(m_levelVertexLightMask.data(), nSectorVertex);
+					dirtySurfaces[vertex.nLocalSurfaceIndex] = true;
+					bSectorDirty = true;
+				}
+			}
+			else if (!bKnown)
 			{
-				PrintMessage(m_pJed, msg_error, "Failed to read material texture header from '%ls'.", sFileName);
-				m_pJed->CloseFile(nFileHandle);
-				return 0;
+				float r, g, b, a;
+				m_pJedLevel->SurfaceGetVertexLight(nSectorIndex, vertex.nLocalSurfaceIndex, vertex.nLocalVertexIndex, &a, &r, &g, &b);
+				levelLight = float4(r, g, b, a);
+				SetMaskBit(m_levelVertexLightMask.data(), nSectorVertex);
+				color = levelLight;
+			}
+
+			if (bAverageAmbient)
+			{
+				ambientColor += color;
+				totalAmbient += 1.0f;
 			}
 		}
-	}
-	m_materialColorCache.emplace(sFileName, recordHeader.nFillColor);
 
-	m_pJed->CloseFile(nFileHandle);
+		for (int nSurfaceIndex = 0; nSurfaceIndex < (int)dirtySurfaces.size(); ++nSurfaceIndex)
+		{
+			if (dirtySurfaces[nSurfaceIndex])
+				m_pJedLevel->SurfaceUpdate(nSectorIndex, nSurfaceIndex, 0);
+		}
 
-	return recordHeader.nFillColor;
+		// update sector ambient if needed
+		if (bAmbient)
+		{
+			if (bProbeAmbient)
+			{
+				ambientColor = ResolveVertexColor(m_probes.GetSectorAmbient(nSectorIndex), m_nBakeFlags);
+			}
+			else
+			{
+				float invTotalAmbient = totalAmbient < 1e-5f ? 0.0f : 1.0f / totalAmbient;
+				ambientColor *= invTotalAmbient;
+			}
+
+			// todo: SED has rgb ambient for Jones?
+			if (!IsSameStoredLight((float)sector.ambient, ambientColor.w))
+			{
+				sector.ambient = ambientColor.w;
+				m_pJedLevel->SetSector(nSectorIndex, &sector, s_ambient);
+				bSectorDirty = true;
+			}
+		}
+
+		if (bSectorDirty)
+			m_pJedLevel->SectorUpdate(nSectorIndex);
+	}
 }
 
 extern "C"
@@ -1107,10 +1510,7 @@ extern "C"
 			g_pLightBaker = new CLightBakerDlg(pJed, pJedWindow);
 			g_pLightBaker->Create(IDD_LIGHTBAKER_DLG, pJedWindow);
 			if(!g_pLightBaker->CreateDeviceD3D())
-			{
-				PrintMessage(pJed, msg_error, "Failed to initialize 3D device.");
-				return false;
-			}
+				PrintMessage(pJed, msg_warning, "Failed to initialize 3D device, baking will run on the CPU.");
 			bInit = true;
 		}
 
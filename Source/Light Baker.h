@@ -6,201 +6,33 @@
 
 #include "Resource.h"
 #include "GpuBuffer.h"
-
-// GPU mirrored structs
-struct SSector
-{
-	uint32_t nFirstSurface;
-	uint32_t nNumSurfaces;
-	uint32_t nLayerIndex;
-	uint32_t _padding;
-	float4   center;
-};
-
-struct SSurface
-{
-	float4    albedo;
-	float4    emissive;
-	float4    normal;
-	uint32_t  nFirstVertex;
-	uint32_t  nNumVertices;
-	int32_t   nAdjoinSector;
-	uint32_t  nFlags;
-};
-
-struct SVertex
-{
-	uint32_t  nSectorIndex;
-	uint32_t  nSurfaceIndex;
-	uint32_t  nLocalSurfaceIndex;
-	uint32_t  nLocalVertexIndex;
-	float4    position;
-};
-
-struct SLight
-{
-	uint32_t  nFlags;
-	int32_t   nSectorIndex;
-	int32_t   nLayerIndex;
-	float     range;
-	float4    position;
-	float4    color;
-};
-
-// Light bake configuration
-enum ELightBakeFlags
-{
-	ELightBake_Lights             =   0x1,
-	ELightBake_Sun                =   0x2,
-	ELightBake_Sky                =   0x4,
-	ELightBake_Emissive           =   0x8,
-	ELightBake_Indirect           =  0x10,
-	ELightBake_Selected           =  0x20,
-	ELightBake_VisibleLayers      =  0x40,
-	ELightBake_GammaCorrect       =  0x80,
-	ELightBake_ExtraLightEmissive = 0x100,
-	ELightBake_ToneMap            = 0x200,
-	ELightBake_PhysicalFalloff    = 0x400,
-
-	ELightBake_Direct = ELightBake_Lights | ELightBake_Sun | ELightBake_Sky | ELightBake_Emissive
-};
-
-// Gpu surface flags
-enum ESurfaceFlags
-{
-	ESurface_IsSky         = 0x1,
-	ESurface_IsVisible     = 0x2,
-	ESurface_IsTranslucent = 0x4,
-};
-
-// Engine/editor sector flags
-enum ESectorFlags
-{
-	// SED specific
-	ESector_NoAmbientLightRGB = 0x20000000,
-	ESector_NoAmbientLight    = 0x40000000
-};
-
-// Engine/editor adjoin flags
-enum EAdjoinFlags
-{
-	EAdjoin_Visible     =        0x1,
-	EAdjoin_BlocksLight = 0x80000000,
-};
-
-// Engine/editor face flags
-enum EFaceFlags
-{
-	EFace_Translucent = 0x2,
-};
-
-// Engine/editor sky surface flags
-enum ESkyFlags
-{
-	ESky_Horizon = 0x200,
-	ESky_Ceiling = 0x400,
-};
-
-// Baker specific light flags
-enum ELightFlags
-{
-	ELight_Sun    = 0x2,
-	ELight_Sky    = 0x4,
-	ELight_Anchor = 0x8,
-};
-
-// be careful of constant buffer padding here
-struct SLevelInfo
-{
-	int32_t nSunLightIndex;
-	int32_t nSkyLightIndex;
-	int32_t nAnchorLightIndex;
-	int32_t _padding0;
-
-	int32_t nTotalSectors;
-	int32_t nTotalSurfaces;
-	int32_t nTotalVertices;
-	int32_t nTotalLights;
-
-	uint32_t nBakeFlags;
-	int32_t  nSkyEmissiveRays;
-	int32_t  nIndirectRays;
-	float    normalSmoothCos;
-
-	int32_t  _padding2[4];
-};
-
-// Minimal colormap support (for reading basic color and light table)
-struct SColormapHeader
+#include "BakeScene.h"
+#include "SceneBuilder.h"
+#include "JedSceneSource.h"
+#include "JobSystem.h"
+#include "LightCache.h"
+#include "BakeCacheFile.h"
+#include "BakeProfile.h"
+#include "BakeScheduler.h"
+#include "SceneResidency.h"
+#include "SectorProbes.h"
+#include "VertexHash.h"
+
+template <typename... Args>
+void PrintMessage(IJED* pJed, uint32_t nType, const char* sFmt, Args&&... args)
 {
-	char    magic[4]; // "CMP "
-	int32_t nVersion;
-	int32_t nFlags;
-	float3  colorTint;
-	int32_t _padding[10];
-};
+	char msg[256];
+	sprintf_s(msg, 256, sFmt, std::forward<Args>(args)...);
+	pJed->PanMessage(nType, msg);
+}
 
-struct SColormap
-{
-	struct
-	{
-		uint8_t r, g, b;
-	} colors[256];
-	uint8_t nLightLevels[64 * 256];
-
-	float3 GetColor(uint32_t nIndex, int nLightLevel) const;
-};
-
-// Minimal material support (for reading material fill colors)
-struct SColorFormat
-{
-	uint32_t nColorMode = 0;
-	uint32_t nBitsPerPixel = 0;
-	uint32_t nRedBits = 0;
-	uint32_t nGreenBits = 0;
-	uint32_t nBlueBits = 0;
-	uint32_t nRedShift = 0;
-	uint32_t nGreenShift = 0;
-	uint32_t nBlueShift = 0;
-	uint32_t nRedDiff = 0;
-	uint32_t nGreenDiff = 0;
-	uint32_t nBlueDiff = 0;
-	uint32_t nAlphaBits = 0;
-	uint32_t nAlphaShift = 0;
-	uint32_t nAlphaDiff = 0;
-};
-
-struct SMaterialFileHeader
-{
-	uint8_t      magic[4];
-	uint32_t     nVersion = 0;
-	uint32_t     nType = 0;
-	uint32_t     nRecordCount = 0;
-	uint32_t     nTextureCount = 0;
-	SColorFormat colorFormat;
-};
-
-struct SMaterialRecordHeader
-{
-	uint32_t nTextureType = 0;
-	uint32_t nFillColor = 0;
-	uint32_t nUnknown1 = 0;
-	uint32_t nUnknown2 = 0;
-	uint32_t nUnknown3 = 0;
-	uint32_t nUnknown4 = 0;
-};
-
-struct SMaterialRecordHeaderExt
-{
-	uint32_t nUnknown = 0;
-	uint32_t nHeight = 0;
-	uint32_t nTransparentColor = 0;
-	uint32_t nTextureIndex = 0;
-};
+class CCpuBaker;
+class CCpuBakeBackend;
 
 // todo: this is a monolithic class atm, can probably break it up
 class CLightBakerDlg
 	: public CDialogEx
+	, private IBakeBackend
 {
 public:
 #ifdef AFX_DESIGN_TIME
@@ -211,6 +43,7 @@ public:
 	~CLightBakerDlg();
 
 	bool CreateDeviceD3D();
+	void ReleaseDeviceD3D();
 
 protected:
 	virtual void DoDataExchange(CDataExchange* pDX);
@@ -221,6 +54,7 @@ public:
 	// MFC GUI stuff
 	CComboBox m_skyEmissionRayCombo;
 	CComboBox m_indirectRaysCombo;
+	CProgressCtrl m_bakeProgress;
 
 	BOOL m_bBakePointLights;
 	BOOL m_bBakeSunLight;
@@ -231,6 +65,8 @@ public:
 	BOOL m_bExtraLightEmissive;
 	BOOL m_bPhysicalFalloff;
 	BOOL m_bToneMap;
+	BOOL m_bAdaptiveRays;
+	BOOL m_bProbeAmbient;
 
 	int m_nSkyEmissiveRayCount;
 	int m_nIndirectRayCount;
@@ -240,6 +76,7 @@ public:
 	afx_msg void OnBnClickedBakeAll();
 	afx_msg void OnBnClickedBakeSelected();
 	afx_msg void OnBnClickedBakeVisibleLayers();
+	afx_msg void OnBnClickedCancelBake();
 	afx_msg void OnCbnSelchangeComboRays();
 	afx_msg void OnCbnSelchangeComboIndirectRays();
 
@@ -247,56 +84,115 @@ private:
 	// main entry point for baking process, everything below assumes flags etc are set
 	bool BakeLighting(uint32_t nInitBakeFlags);
 
-	// Jed helpers/utils (todo: move me)
-	bool       QuerySurfaceVisible(int nSectorIndex, int nSurfaceIndex) const;
-	float3     QuerySurfaceNormal(int nSectorIndex, int nSurfaceIndex) const;
-	float3     QuerySurfaceVertex(int nSectorIndex, int nSurfaceIndex, int nVertexIndex) const;
-
-	// fetches the level header and preloads the master cmp if there is one
-	void       PreloadMasterCMP();
-
-	// attempt to load and cache a colormap, if the filename was already loaded, the cached result is returned
-	SColormap* LoadColormap(const wchar_t* sFileName);
-
-	// attempt to load and cache a material, if the filename was already loaded, the cached result is returned
-	uint32_t   LoadMaterialFillColor(const wchar_t* sFileName, const SColormap* pColormap);
+	// the timestamp queries are optional, they are released on their own if the device can't create them
+	void ReleaseTimestampQueries();
 
 	// load an embedded resource (usually shader blobs)
 	bool LoadEmbeddedShader(UINT resourceID, const void** data, DWORD* size) const;
 
-	// GPU buffer management, creates and frees various buffers
+	// GPU buffer management, the buffers live until the device is released and grow as needed
 	void AllocateBuffers();
 	void FreeBuffers();
+	void ReserveSceneBuffer(CGpuBuffer& buffer, ESceneBuffer eBuffer, DXGI_FORMAT format, D3D11_RESOURCE_MISC_FLAG miscFlags);
 
-	// builds the scene for the GPU
+	// builds the bake masks in m_scene, the rest of the scene comes from BuildBakeScene
 	void BuildSelectionBitmask();
 	void BuildLayerBitmask();
-	void BuildLights();
-	void BuildGeometry();
 
 	// helpers for shaders and buffers
 	int CreateComputeShader(ID3D11Device* pDevice, ID3D11ComputeShader** pShader, UINT resourceID) const;
 	int CreateConstantBuffer(ID3D11Device* pDevice, ID3D11Buffer** pConstantBuffer, int byteWidth) const;
 
-	// updates the level info constant buffer for all passes
+	// updates the level info (and constant buffer) for all passes
 	void UpdateLevelInfo();
 
+	// copies m_scene into the GPU buffers, only the sectors that changed since the last bake
+	void UploadScene();
+
 	// helper for dispatching a bake pass, Z is ignored since we're only doing 1d and 2d dispatches
 	void DispatchBakePass(int nDispatchX, int nDispatchY, ID3D11ComputeShader* pShader, CGpuBuffer* pReadBuffer, CGpuBuffer* pWriteBuffer);
 	
-	// baking functions that actually call DispatchBakePass
-	void BakeDirectLighting();
-	void BakeIndirectLighting();
+	// normal smoothing pass over m_vertexHash, the light passes are dispatched from Run
 	void ComputeSmoothNormals();
 
-	// downloads the results from the GPU and writes them back to the level
-	void DownloadAndApplyToLevel();
+	// welds the vertices of m_scene for both backends and uploads the weld map for the shaders
+	void WeldVertices();
+
+	// runs all bake passes on the GPU and downloads the result into m_vertexColors, false if cancelled
+	bool BakeLightingGpu();
+
+	// runs all bake passes on the CPU, used when there's no D3D11 device, false if cancelled
+	bool BakeLightingCpu();
+
+	// rebakes the point lights that changed since the last bake from m_lightCache, then redoes the indirect bounces
+	bool RebakeChangedLights();
+
+	// creates the job system and CPU baker on first use
+	void CreateCpuBaker();
+
+	// <level>.lbcache next to the level file, empty for a level that was never saved
+	std::string GetBakeCacheFile() const;
+
+	// loads the bake cache of the level, true if it holds a result with the same hash which is copied to m_vertexColors,
+	// otherwise a light cache for the same scene replaces m_lightCache
+	bool LoadBakeCacheFile(const std::string& sPath, uint64_t nResultHash, uint64_t nSceneHash);
+
+	// tile and batch size of the progressive bake on this device
+	SBakeScheduleSettings GetScheduleSettings() const;
+
+	// runs the passes of levelInfo.nBakeFlags through m_bakeScheduler, keeps the dialog responsive and updates the
+	// preview and progress between work items, returns false if the bake was cancelled
+	bool RunBakeSchedule(const SLevelInfo& levelInfo);
+
+	// IBakeBackend, dispatches the work items on the GPU or hands them to m_pCpuBackend
+	void BeginPass(EBakePass ePass, int nBounce) override;
+	void Run(const SBakeWorkItem& item) override;
+	void EndPass(EBakePass ePass, int nBounce) override;
+	int64_t GetPassRays() override;
+
+	// waits for the dispatched work items while handling window messages
+	void WaitForGpu();
+	void PumpMessages();
+
+	// adds the GPU time of the last work item to m_profile, call after WaitForGpu
+	void ReadGpuTimestamps();
+
+	// prints m_profile to the message pane and writes it next to the level
+	void ReportProfile();
+
+	// writes the result so far to the level
+	void UpdatePreview();
+
+	// bake buttons off and cancel on while baking
+	void EnableBakeControls(bool bBaking);
+
+	// downloads the accumulated light from the GPU into m_vertexColors, welded vertices get the color of their traced vertex
+	void DownloadResults();
+
+	// downloads the smoothed normals into m_scene.normals, the light cache traces with them
+	void DownloadNormals();
+
+	// adds the rays per vertex of the finished ray pass to stats
+	void DownloadSampleStats(SRayPassStats& stats);
+
+	// uploads m_vertexColors as the direct light result the indirect bounces start from
+	void UploadAccumulation();
+
+	// traces m_probes for the ambient of the finished bake on the CPU
+	void TraceProbes();
+
+	// writes the colors (m_vertexColors or a preview) back to the level, only the values that changed, and sets the
+	// sector ambient from m_probes or without probes to the average of the vertex light of the sector
+	void ApplyToLevel(const std::vector<float4>& colors);
 
 private:
 	// Jed
 	IJED*      m_pJed;
 	IJEDLevel* m_pJedLevel;
-	IJEDLevel* m_pLastJedLevel;
+
+	// Level access, also owns the colormap/material caches
+	CJedSceneSource m_sceneSource;
+	SSceneSnapshot  m_snapshot;
 
 	// D3D
 	ID3D11Device*        m_pDeviceD3D;
@@ -308,10 +204,28 @@ private:
 	CGpuBuffer m_surfaceBuffer;
 	CGpuBuffer m_vertexBuffer;
 	CGpuBuffer m_lightBuffer;
+	CGpuBuffer m_rawNormalBuffer; // as built, copied into m_normalBuffer for smoothing
 	CGpuBuffer m_normalBuffer;
 	CGpuBuffer m_colorLastResultBuffer;
 	CGpuBuffer m_colorCurrResultBuffer;
 	CGpuBuffer m_accumulationBuffer;
+	CGpuBuffer m_sampleStatsBuffer; // running mean per vertex of the ray pass in progress
+	CGpuBuffer m_vertexWeldBuffer;  // m_scene.vertexWelds
+	CGpuBuffer m_sectorLightOffsetBuffer; // m_scene.sectorLightOffsets, uploaded with the lights
+	CGpuBuffer m_sectorLightBuffer;
+	CGpuBuffer m_emissiveSurfaceBuffer;   // m_scene.emissiveSurfaces, see BuildEmissiveSurfaces
+	CGpuBuffer m_emissiveTriangleCdfBuffer;
+	CGpuBuffer m_vertexHashCellBuffer;   // m_vertexHash, uploaded by ComputeSmoothNormals
+	CGpuBuffer m_vertexHashVertexBuffer;
+	CGpuBuffer m_edgePlaneBuffer;
+	CGpuBuffer m_bvhNodeBuffer;
+	CGpuBuffer m_bvhSurfaceBuffer;
+
+	// what of m_scene the buffers above already hold
+	CSceneResidency m_sceneResidency;
+
+	// coincident vertices for the smoothing pass, built on the CPU
+	SVertexHash m_vertexHash;
 
 	ID3D11ComputeShader* m_pBakeSunShader;
 	ID3D11ComputeShader* m_pBakeDirectShader;
@@ -320,18 +234,58 @@ private:
 	ID3D11ComputeShader* m_pGenNormalsShader;
 
 	ID3D11Buffer* m_pLevelInfoConstants;
+	ID3D11Query*  m_pBakeQuery; // event after the last work item
+
+	// timestamps around the dispatch of a work item, null if the device can't take them
+	ID3D11Query* m_apTimestampQueries[2];
+	ID3D11Query* m_pTimestampDisjointQuery;
+	bool         m_bTimestampPending;
+
+	// ping pong buffers of the indirect bounces
+	CGpuBuffer* m_pReadBuffer;
+	CGpuBuffer* m_pWriteBuffer;
+
+	// CPU
+	std::unique_ptr<CJobSystem>      m_pJobSystem;
+	std::unique_ptr<CCpuBaker>       m_pCpuBaker;
+	std::unique_ptr<CCpuBakeBackend> m_pCpuBackend; // runs on m_scene and m_vertexColors
+
+	// direct light of the last bake, kept across bakes
+	CLightCache m_lightCache;
+
+	// Scene and bake result, only valid during BakeLighting
+	SBakeScene          m_scene;
+	std::vector<float4> m_vertexColors;
+	std::vector<float4> m_directLight; // result before the indirect bounces, for m_lightCache
+	SSectorProbes       m_probes;      // ambient of the final writeback, the previews average the vertex light
+
+	// light the level holds at the scene vertices, set by the writebacks so the later ones (the previews and the next
+	// bakes of the level) only write (and update the surfaces and sectors of) the values that changed. Kept until another
+	// level is opened or the sector, surface or vertex count changes.
+	std::vector<float4>   m_levelVertexLight;
+	std::vector<uint32_t> m_levelVertexLightMask; // bit per vertex, set once m_levelVertexLight holds its value
+	int                   m_nLevelLightSectors = 0;
+	int                   m_nLevelLightSurfaces = 0;
+
+	// rays per vertex of the last bake, reported for the adaptive ray count
+	SRayPassStats m_skyEmissiveRayStats;
+	SRayPassStats m_indirectRayStats;
+
+	// time of every stage of the last bake, the GPU passes are timed per work item
+	SBakeProfile m_profile;
+	EBakePass    m_eProfiledPass; // of the last work item
+	int          m_nProfiledBounce;
+
+	// Progressive bake, work items are run one at a time from BakeLighting
+	CBakeScheduler m_bakeScheduler;
+	bool           m_bBaking;
 
 	// State
-	int m_nSunLightIndex, m_nSkyLightIndex, m_nAnchorLightIndex;
 	uint32_t m_nBakeFlags;
 
 	// Resource counts, only valid during BakeLighting
 	int m_nNumSectors, m_nNumQueuedSectors, m_nNumLights, m_nNumLayers;
 	int m_nTotalSurfaces, m_nTotalVertices;
-
-	// Resource caching
-	std::unordered_map<std::wstring, SColormap> m_colormapCache;
-	std::unordered_map<std::wstring, uint32_t>  m_materialColorCache;
 };
 
 class CLightBakerApp
@@ -0,0 +1,257 @@
+#include "LightCache.h"
+#include "BakeCacheFile.h"
+#include "CpuBaker.h"
+#include "CpuTracer.h"
+#include "Hash.h"
+#include "JobSystem.h"
+#include "SceneBuilder.h"
+
+#include <algorithm>
+#include <cstring>
+
+// vertices per range when tracing one light
+static constexpr int kLightGrainSize = 64;
+
+uint64_t CLightCache::HashScene(const SBakeScene& scene)
+{
+	// the point lights are handled per light, the indirect bounces and the final color conversion are always redone
+	SLevelInfo levelInfo = scene.levelInfo;
+	levelInfo.nTotalLights = 0;
+	levelInfo.nIndirectRays = 0;
+	levelInfo.nBakeFlags &= ~(ELightBake_Indirect | ELightBake_GammaCorrect | ELightBake_ToneMap);
+
+	uint64_t nHash = kHashSeed;
+	nHash = HashBytes(nHash, &levelInfo, sizeof(levelInfo));
+	nHash = HashVector(nHash, scene.sectorMasks);
+	nHash = HashVector(nHash, scene.layerMasks);
+	nHash = HashVector(nHash, scene.sectors);
+	nHash = HashVector(nHash, scene.surfaces);
+	nHash = HashVector(nHash, scene.vertices);
+	nHash = HashVector(nHash, scene.normals);
+
+	// the sun and sky light go into the other direct passes
+	const int aLightIndices[] = { levelInfo.nSunLightIndex, levelInfo.nSkyLightIndex, levelInfo.nAnchorLightIndex };
+	for (int nLightIndex : aLightIndices)
+	{
+		if (nLightIndex >= 0)
+			nHash = HashBytes(nHash, &scene.lights[nLightIndex], sizeof(SLight));
+	}
+	return nHash;
+}
+
+void CLightCache::Clear()
+{
+	m_bValid = false;
+	m_nSceneHash = 0;
+	m_normals.clear();
+	m_directLight.clear();
+	m_zeroColors.clear();
+	m_lights.clear();
+	m_adjoinsInto.clear();
+}
+
+bool CLightCache::CanUpdate(uint64_t nSceneHash) const
+{
+	return m_bValid && m_nSceneHash == nSceneHash;
+}
+
+void CLightCache::Store(uint64_t nSceneHash, const SBakeScene& scene, const std::vector<float4>& directLight)
+{
+	Clear();
+	if (directLight.size() != scene.vertices.size())
+		return;
+
+	m_bValid = true;
+	m_nSceneHash = nSceneHash;
+	m_normals = scene.normals;
+	m_directLight = directLight;
+	m_zeroColors.assign(scene.vertices.size(), float4(0,0,0,0));
+
+	m_lights.resize(scene.lights.size());
+	for (size_t nLightIndex = 0; nLightIndex < scene.lights.size(); ++nLightIndex)
+		m_lights[nLightIndex].light = scene.lights[nLightIndex];
+
+	BuildAdjoinsInto(scene, m_adjoinsInto);
+}
+
+void CLightCache::Update(SBakeScene& scene, CJobSystem* pJobSystem, SLightCacheStats& stats)
+{
+	stats = SLightCacheStats();
+	scene.normals = m_normals;
+
+	// a cache read from a file has no adjoins yet
+	if (m_adjoinsInto.empty())
+		BuildAdjoinsInto(scene, m_adjoinsInto);
+
+	// only the traced vertices are updated, the welded ones get their color at the end
+	BuildVertexWelds(scene);
+
+	// with the light pass disabled the stored result has no light in it, only keep track of the parameters
+	const bool bBakeLights = (scene.levelInfo.nBakeFlags & ELightBake_Lights) != 0;
+
+	const size_t nNumLights = std::max(m_lights.size(), scene.lights.size());
+	for (size_t nLightIndex = 0; nLightIndex < nNumLights; ++nLightIndex)
+	{
+		const bool bOld = nLightIndex < m_lights.size();
+		const bool bNew = nLightIndex < scene.lights.size();
+		if (bOld && bNew && memcmp(&m_lights[nLightIndex].light, &scene.lights[nLightIndex], sizeof(SLight)) == 0)
+			continue;
+
+		++stats.nChangedLights;
+		if (!bBakeLights)
+			continue;
+
+		// remove the old contribution, after a full bake it has to be traced again
+		if (bOld)
+		{
+			SLightEntry& entry = m_lights[nLightIndex];
+			if (!entry.bHasContribution)
+				stats.nTracedVertices += ComputeContribution(scene, pJobSystem, entry);
+
+			for (size_t i = 0; i < entry.vertexIndices.size(); ++i)
+			{
+				// the stored total may come from the GPU, don't let rounding differences go negative
+				float4& color = m_directLight[entry.vertexIndices[i]];
+				color -= entry.contributions[i];
+				color = { std::max(color.x, 0.0f), std::max(color.y, 0.0f), std::max(color.z, 0.0f), std::max(color.w, 0.0f) };
+			}
+		}
+
+		if (bNew)
+		{
+			SLightEntry entry;
+			entry.light = scene.lights[nLightIndex];
+			stats.nTracedVertices += ComputeContribution(scene, pJobSystem, entry);
+
+			for (size_t i = 0; i < entry.vertexIndices.size(); ++i)
+				m_directLight[entry.vertexIndices[i]] += entry.contributions[i];
+
+			if (bOld)
+				m_lights[nLightIndex] = std::move(entry);
+			else
+				m_lights.push_back(std::move(entry));
+		}
+	}
+
+	m_lights.resize(scene.lights.size());
+	if (!bBakeLights)
+	{
+		for (size_t nLightIndex = 0; nLightIndex < scene.lights.size(); ++nLightIndex)
+			m_lights[nLightIndex].light = scene.lights[nLightIndex];
+	}
+
+	ScatterWeldedVertices(scene, m_directLight);
+}
+
+void CLightCache::Write(std::ostream& file) const
+{
+	WriteCacheValue(file, (uint8_t)m_bValid);
+	WriteCacheValue(file, m_nSceneHash);
+	WriteCacheVector(file, m_normals);
+	WriteCacheVector(file, m_directLight);
+
+	WriteCacheValue(file, (uint64_t)m_lights.size());
+	for (const SLightEntry& entry : m_lights)
+	{
+		WriteCacheValue(file, entry.light);
+		WriteCacheValue(file, (uint8_t)entry.bHasContribution);
+		WriteCacheVector(file, entry.vertexIndices);
+		WriteCacheVector(file, entry.contributions);
+	}
+}
+
+bool CLightCache::Read(std::istream& file)
+{
+	Clear();
+
+	uint8_t nValid = 0;
+	uint64_t nNumLights = 0;
+	if (!ReadCacheValue(file, nValid) || !ReadCacheValue(file, m_nSceneHash) || !ReadCacheVector(file, m_normals) || !ReadCacheVector(file, m_directLight)
+		|| !ReadCacheValue(file, nNumLights) || nNumLights > kMaxBakeCacheElements)
+	{
+		Clear();
+		return false;
+	}
+
+	m_lights.resize((size_t)nNumLights);
+	for (SLightEntry& entry : m_lights)
+	{
+		uint8_t nHasContribution = 0;
+		if (!ReadCacheValue(file, entry.light) || !ReadCacheValue(file, nHasContribution)
+			|| !ReadCacheVector(file, entry.vertexIndices) || !ReadCacheVector(file, entry.contributions)
+			|| entry.vertexIndices.size() != entry.contributions.size()
+			|| std::any_of(entry.vertexIndices.begin(), entry.vertexIndices.end(), [&](uint32_t nVertexIndex) { return nVertexIndex >= m_directLight.size(); }))
+		{
+			Clear();
+			return false;
+		}
+		entry.bHasContribution = nHasContribution != 0;
+	}
+
+	// the adjoins are rebuilt from the scene on the first Update
+	m_bValid = nValid != 0 && m_normals.size() == m_directLight.size();
+	m_zeroColors.assign(m_directLight.size(), float4(0,0,0,0));
+	return true;
+}
+
+// only the sectors the light can reach have lit vertices, see GatherLightSectors
+void CLightCache::GatherLightVertices(const SBakeScene& scene, const SLight& light, std::vector<uint32_t>& vertexIndices) const
+{
+	vertexIndices.clear();
+
+	std::vector<uint32_t> sectorIndices;
+	GatherLightSectors(scene, m_adjoinsInto, light, sectorIndices);
+
+	// same range test as ComputeDirectLight
+	const float3 center = ToFloat3(light.position);
+	const float rangeSqr = light.range * light.range;
+	for (uint32_t nSectorIndex : sectorIndices)
+	{
+		const SSector& sector = scene.sectors[nSectorIndex];
+		for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+		{
+			const SSurface& surface = scene.surfaces[nSurfaceIndex];
+			for (uint32_t nVertexIndex = surface.nFirstVertex; nVertexIndex < surface.nFirstVertex + surface.nNumVertices; ++nVertexIndex)
+			{
+				if (!scene.vertexWelds.empty() && scene.vertexWelds[nVertexIndex] != nVertexIndex)
+					continue;
+
+				const float3 lightDir = center - ToFloat3(scene.vertices[nVertexIndex].position);
+				if (dot(lightDir, lightDir) < rangeSqr)
+					vertexIndices.push_back(nVertexIndex);
+			}
+		}
+	}
+}
+
+int CLightCache::ComputeContribution(const SBakeScene& scene, CJobSystem* pJobSystem, SLightEntry& entry) const
+{
+	std::vector<uint32_t> candidates;
+	GatherLightVertices(scene, entry.light, candidates);
+
+	const CCpuTracer tracer(scene, m_zeroColors.data());
+	std::vector<float4> colors(candidates.size());
+	std::vector<char> lit(candidates.size(), 0);
+	pJobSystem->ParallelFor((int)candidates.size(), kLightGrainSize, [&](int nBegin, int nEnd)
+	{
+		for (int i = nBegin; i < nEnd; ++i)
+		{
+			SVertexData vertexData;
+			if (tracer.GetVertexData(vertexData, candidates[i]))
+				lit[i] = ComputeDirectLight(tracer, entry.light, vertexData, scene.levelInfo.nBakeFlags, colors[i]);
+		}
+	});
+
+	entry.vertexIndices.clear();
+	entry.contributions.clear();
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		if (!lit[i])
+			continue;
+
+		entry.vertexIndices.push_back(candidates[i]);
+		entry.contributions.push_back(colors[i]);
+	}
+	entry.bHasContribution = true;
+	return (int)candidates.size();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+// Per light cache of the direct light for incremental rebakes.
+// After a full bake the cache keeps the direct light result (everything before the indirect bounces) and the parameters
+// every light was baked with. When the next bake only differs in its point lights, Update subtracts the old contribution
+// of every changed light from the stored result and adds the new one, only tracing the vertices in range of the light
+// in the sectors it can reach.
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "BakeScene.h"
+#include "LightCulling.h"
+
+class CJobSystem;
+
+struct SLightCacheStats
+{
+	int nChangedLights = 0;
+	int nTracedVertices = 0; // for the old and new contributions of the changed lights
+};
+
+class CLightCache
+{
+public:
+	// Hash of everything the direct light depends on except the point lights, take it before baking (smoothing changes the normals)
+	static uint64_t HashScene(const SBakeScene& scene);
+
+	void Clear();
+
+	// true if the stored bake has the same scene hash, Update can be used instead of a full bake
+	bool CanUpdate(uint64_t nSceneHash) const;
+
+	// keeps the direct light of a full bake, scene.normals have to be the smoothed normals the bake used
+	void Store(uint64_t nSceneHash, const SBakeScene& scene, const std::vector<float4>& directLight);
+
+	// rebakes the point lights that changed since the last Store/Update, also sets scene.normals to the stored smoothed normals
+	void Update(SBakeScene& scene, CJobSystem* pJobSystem, SLightCacheStats& stats);
+
+	// binary state for the bake cache file, see BakeCacheFile.h. Read fails on a truncated stream and leaves the cache cleared
+	void Write(std::ostream& file) const;
+	bool Read(std::istream& file);
+
+	// direct light of the last Store/Update (sun, lights, sky and emissive)
+	const std::vector<float4>& GetDirectLight() const { return m_directLight; }
+
+private:
+	struct SLightEntry
+	{
+		SLight                light;                    // parameters the light was last baked with
+		bool                  bHasContribution = false; // a full bake only gives the sum of all lights
+		std::vector<uint32_t> vertexIndices;
+		std::vector<float4>   contributions;
+	};
+
+	// vertices that can possibly receive light from the light, see GatherLightSectors
+	void GatherLightVertices(const SBakeScene& scene, const SLight& light, std::vector<uint32_t>& vertexIndices) const;
+
+	// traces entry.light, returns the number of vertices traced
+	int ComputeContribution(const SBakeScene& scene, CJobSystem* pJobSystem, SLightEntry& entry) const;
+
+	bool                                 m_bValid = false;
+	uint64_t                             m_nSceneHash = 0;
+	std::vector<int4>                    m_normals;
+	std::vector<float4>                  m_directLight;
+	std::vector<float4>                  m_zeroColors; // aVertexColors of the direct passes
+	std::vector<SLightEntry>             m_lights;
+	std::vector<std::vector<SAdjoinRef>> m_adjoinsInto; // per sector
+};
@@ -0,0 +1,127 @@
+#include "LightCulling.h"
+#include "CpuTracer.h"
+#include "SectorVisibility.h"
+
+#include <algorithm>
+
+// slack on the light sphere for the sector and adjoin tests, those use surface bounds that the ray can graze
+static constexpr float kRangePadding = 0.01f;
+
+static float GetBoxDistanceSqr(const float3& boxMin, const float3& boxMax, const float3& point)
+{
+	const float dx = std::max(std::max(boxMin.x - point.x, point.x - boxMax.x), 0.0f);
+	const float dy = std::max(std::max(boxMin.y - point.y, point.y - boxMax.y), 0.0f);
+	const float dz = std::max(std::max(boxMin.z - point.z, point.z - boxMax.z), 0.0f);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+static bool IsSurfaceInSphere(const SBakeScene& scene, uint32_t nSurfaceIndex, const float3& center, float radius)
+{
+	const SSurface& surface = scene.surfaces[nSurfaceIndex];
+	if (surface.nNumVertices == 0)
+		return false;
+
+	float3 boxMin = ToFloat3(scene.vertices[surface.nFirstVertex].position);
+	float3 boxMax = boxMin;
+	for (uint32_t i = 1; i < surface.nNumVertices; ++i)
+	{
+		const float3 vertex = ToFloat3(scene.vertices[surface.nFirstVertex + i].position);
+		boxMin = { std::min(boxMin.x, vertex.x), std::min(boxMin.y, vertex.y), std::min(boxMin.z, vertex.z) };
+		boxMax = { std::max(boxMax.x, vertex.x), std::max(boxMax.y, vertex.y), std::max(boxMax.z, vertex.z) };
+	}
+	return GetBoxDistanceSqr(boxMin, boxMax, center) <= radius * radius;
+}
+
+void BuildAdjoinsInto(const SBakeScene& scene, std::vector<std::vector<SAdjoinRef>>& adjoinsInto)
+{
+	adjoinsInto.assign(scene.sectors.size(), std::vector<SAdjoinRef>());
+	for (uint32_t nSectorIndex = 0; nSectorIndex < (uint32_t)scene.sectors.size(); ++nSectorIndex)
+	{
+		const SSector& sector = scene.sectors[nSectorIndex];
+		for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+		{
+			const int nAdjoinSector = scene.surfaces[nSurfaceIndex].nAdjoinSector;
+			if (nAdjoinSector >= 0)
+				adjoinsInto[nAdjoinSector].push_back({ nSectorIndex, nSurfaceIndex });
+		}
+	}
+}
+
+// A vertex gets light if it's in range and either the light isn't blocked or the ray from the vertex to the light
+// gets through. That ray walks from the vertex sector through adjoins and can only end without a hit in a sector
+// that contains the light, and every adjoin it crosses is in range since the whole segment is.
+// So flooding backwards through the adjoins in range, starting at the sectors that contain the light, finds every
+// sector with lit vertices (usually the light's own sector and a few neighbours). The flood doesn't enter sectors that
+// none of the light's sectors can see (see BuildSectorVisibility), no straight line leads from those to the light.
+void GatherLightSectors(const SBakeScene& scene, const std::vector<std::vector<SAdjoinRef>>& adjoinsInto, const SLight& light, std::vector<uint32_t>& sectorIndices)
+{
+	sectorIndices.clear();
+	if (light.nSectorIndex < 0 || (light.nFlags & ELight_Sun) || (light.nFlags & ELight_Sky))
+		return;
+
+	const float3 center = ToFloat3(light.position);
+	const float radius = light.range + kRangePadding;
+
+	std::vector<char> sectorQueued(scene.sectors.size(), 0);
+	for (uint32_t nSectorIndex = 0; nSectorIndex < (uint32_t)scene.sectors.size(); ++nSectorIndex)
+	{
+		const SBvhNode& root = scene.bvhNodes[scene.sectors[nSectorIndex].nBvhRoot];
+		const float distanceSqr = GetBoxDistanceSqr(root.boxMin, root.boxMax, center);
+		const bool bSeed = (light.nFlags & ELight_NotBlocked) ? distanceSqr <= radius * radius
+			: (nSectorIndex == (uint32_t)light.nSectorIndex || distanceSqr <= kRangePadding * kRangePadding);
+		if (bSeed)
+		{
+			sectorQueued[nSectorIndex] = 1;
+			sectorIndices.push_back(nSectorIndex);
+		}
+	}
+
+	if (light.nFlags & ELight_NotBlocked)
+		return;
+
+	std::vector<uint32_t> visibleSectors(GetMaskBucketCount((int)scene.sectors.size()), 0);
+	for (uint32_t nSectorIndex : sectorIndices)
+		AddVisibleSectors(scene, nSectorIndex, visibleSectors.data());
+
+	for (size_t nQueueIndex = 0; nQueueIndex < sectorIndices.size(); ++nQueueIndex)
+	{
+		for (const SAdjoinRef& adjoin : adjoinsInto[sectorIndices[nQueueIndex]])
+		{
+			if (sectorQueued[adjoin.nSectorIndex] || !TestMaskBit(visibleSectors.data(), adjoin.nSectorIndex)
+				|| !IsSurfaceInSphere(scene, adjoin.nSurfaceIndex, center, radius))
+				continue;
+
+			sectorQueued[adjoin.nSectorIndex] = 1;
+			sectorIndices.push_back(adjoin.nSectorIndex);
+		}
+	}
+}
+
+void BuildSectorLightLists(SBakeScene& scene)
+{
+	std::vector<std::vector<SAdjoinRef>> adjoinsInto;
+	BuildAdjoinsInto(scene, adjoinsInto);
+
+	// (sector, light) pairs in light order, then grouped by sector keeping that order
+	std::vector<uint32_t> pairSectors, pairLights, sectorIndices;
+	for (uint32_t nLightIndex = 0; nLightIndex < (uint32_t)scene.lights.size(); ++nLightIndex)
+	{
+		GatherLightSectors(scene, adjoinsInto, scene.lights[nLightIndex], sectorIndices);
+		for (uint32_t nSectorIndex : sectorIndices)
+		{
+			pairSectors.push_back(nSectorIndex);
+			pairLights.push_back(nLightIndex);
+		}
+	}
+
+	scene.sectorLightOffsets.assign(scene.sectors.size() + 1, 0);
+	for (uint32_t nSectorIndex : pairSectors)
+		++scene.sectorLightOffsets[nSectorIndex + 1];
+	for (size_t nSectorIndex = 0; nSectorIndex < scene.sectors.size(); ++nSectorIndex)
+		scene.sectorLightOffsets[nSectorIndex + 1] += scene.sectorLightOffsets[nSectorIndex];
+
+	std::vector<uint32_t> sectorFill(scene.sectorLightOffsets.begin(), scene.sectorLightOffsets.end() - 1);
+	scene.sectorLights.resize(pairLights.size());
+	for (size_t nPair = 0; nPair < pairLights.size(); ++nPair)
+		scene.sectorLights[sectorFill[pairSectors[nPair]]++] = pairLights[nPair];
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// Sectors a point light can reach. The direct pass only loops over the lights of the vertex sector (see
+// BuildSectorLightLists) and the light cache only traces the vertices of the reached sectors.
+
+#include <cstdint>
+#include <vector>
+
+#include "BakeScene.h"
+
+// adjoin surface (in nSectorIndex) leading into a sector, the light walk goes through these in reverse
+struct SAdjoinRef
+{
+	uint32_t nSectorIndex;
+	uint32_t nSurfaceIndex;
+};
+
+// per sector the adjoins of the other sectors leading into it
+void BuildAdjoinsInto(const SBakeScene& scene, std::vector<std::vector<SAdjoinRef>>& adjoinsInto);
+
+// sectors that can have vertices lit by the light, empty for sun, sky and lights outside the level, see the comment in the .cpp
+void GatherLightSectors(const SBakeScene& scene, const std::vector<std::vector<SAdjoinRef>>& adjoinsInto, const SLight& light, std::vector<uint32_t>& sectorIndices);
+
+// fills scene.sectorLightOffsets and scene.sectorLights from the lights, sector bvhs and PVS, run again after changing the lights
+void BuildSectorLightLists(SBakeScene& scene);
@@ -0,0 +1,559 @@
+#include "Lightmap.h"
+#include "CpuBaker.h"
+#include "CpuTracer.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+// bisection steps that pull a padding texel onto its surface
+static constexpr int kClampSteps = 12;
+
+// distance in world units a texel keeps from the edges of its surface, the tracer's own edge test is looser and a point
+// just past the edge would start its rays behind the neighbouring wall
+static constexpr float kTexelEdgeInset = 1e-3f;
+
+int64_t SLightmapLayout::GetNumTexels() const
+{
+	int64_t nNumTexels = 0;
+	for (const SLightmapRect& rect : rects)
+		nNumTexels += (int64_t)rect.nWidth * rect.nHeight;
+	return nNumTexels;
+}
+
+// Lays a surface out in its plane, u along its longest edge. Surfaces that don't fit into nMaxSize texels get bigger texels.
+static bool LayoutSurface(const SBakeScene& scene, uint32_t nSurfaceIndex, float texelSize, int nMaxSize, SLightmapRect& rect)
+{
+	const SSurface& surface = scene.surfaces[nSurfaceIndex];
+	if (surface.nNumVertices < 3)
+		return false;
+
+	const SVertex* paVertices = &scene.vertices[surface.nFirstVertex];
+	const float3 normal = ToFloat3(surface.normal);
+
+	float3 longestEdge = { 0,0,0 };
+	float longestLengthSqr = 0.0f;
+	for (uint32_t i = 0; i < surface.nNumVertices; ++i)
+	{
+		const float3 edge = ToFloat3(paVertices[(i + 1) % surface.nNumVertices].position) - ToFloat3(paVertices[i].position);
+		const float lengthSqr = dot(edge, edge);
+		if (lengthSqr > longestLengthSqr)
+		{
+			longestEdge = edge;
+			longestLengthSqr = lengthSqr;
+		}
+	}
+
+	const float3 planeEdge = longestEdge - normal * dot(longestEdge, normal);
+	if (dot(planeEdge, planeEdge) < 1e-12f)
+		return false;
+
+	const float3 tangent = normalize(planeEdge);
+	const float3 binormal = cross(normal, tangent);
+
+	float minU = FLT_MAX, minV = FLT_MAX, maxU = -FLT_MAX, maxV = -FLT_MAX;
+	for (uint32_t i = 0; i < surface.nNumVertices; ++i)
+	{
+		const float3 position = ToFloat3(paVertices[i].position);
+		const float u = dot(position, tangent);
+		const float v = dot(position, binormal);
+		minU = std::min(minU, u);
+		maxU = std::max(maxU, u);
+		minV = std::min(minV, v);
+		maxV = std::max(maxV, v);
+	}
+
+	const int nMaxInner = nMaxSize - 2 * kLightmapPadding;
+	const float maxExtent = std::max(maxU - minU, maxV - minV);
+	if (maxExtent > texelSize * (float)nMaxInner)
+		texelSize = maxExtent / (float)nMaxInner;
+
+	rect.nSurfaceIndex = nSurfaceIndex;
+	rect.x = 0;
+	rect.y = 0;
+	rect.nWidth = std::min(std::max((int)ceilf((maxU - minU) / texelSize), 1), nMaxInner) + 2 * kLightmapPadding;
+	rect.nHeight = std::min(std::max((int)ceilf((maxV - minV) / texelSize), 1), nMaxInner) + 2 * kLightmapPadding;
+	rect.origin = tangent * (minU - kLightmapPadding * texelSize) + binormal * (minV - kLightmapPadding * texelSize) + normal * surface.normal.w;
+	rect.axisU = tangent * texelSize;
+	rect.axisV = binormal * texelSize;
+	return true;
+}
+
+// Skyline of the packed rectangles, the top edge from left to right. Every node spans up to the next one.
+struct SSkylineNode
+{
+	int x;
+	int y;
+	int nWidth;
+};
+
+// lowest place along the skyline where a rectangle of nWidth fits, the leftmost of equal ones
+static bool FindSkylinePlace(const std::vector<SSkylineNode>& skyline, int nAtlasWidth, int nWidth, size_t& nBestNode, int& nBestY)
+{
+	nBestY = INT_MAX;
+	for (size_t nNode = 0; nNode < skyline.size() && skyline[nNode].x + nWidth <= nAtlasWidth; ++nNode)
+	{
+		// the rectangle rests on the highest node under it
+		int y = 0;
+		int nRemaining = nWidth;
+		for (size_t nUnder = nNode; nRemaining > 0; ++nUnder)
+		{
+			y = std::max(y, skyline[nUnder].y);
+			nRemaining -= skyline[nUnder].nWidth;
+		}
+
+		if (y < nBestY)
+		{
+			nBestY = y;
+			nBestNode = nNode;
+		}
+	}
+	return nBestY != INT_MAX;
+}
+
+static void AddSkylineRect(std::vector<SSkylineNode>& skyline, size_t nNode, int y, int nWidth, int nHeight)
+{
+	const int x = skyline[nNode].x;
+	skyline.insert(skyline.begin() + nNode, { x, y + nHeight, nWidth });
+
+	// the nodes under the rectangle are cut off or removed
+	for (size_t nUnder = nNode + 1; nUnder < skyline.size();)
+	{
+		SSkylineNode& node = skyline[nUnder];
+		const int nCovered = x + nWidth - node.x;
+		if (nCovered <= 0)
+			break;
+
+		if (nCovered < node.nWidth)
+		{
+			node.x += nCovered;
+			node.nWidth -= nCovered;
+			break;
+		}
+		skyline.erase(skyline.begin() + nUnder);
+	}
+
+	for (size_t i = 0; i + 1 < skyline.size();)
+	{
+		if (skyline[i].y == skyline[i + 1].y)
+		{
+			skyline[i].nWidth += skyline[i + 1].nWidth;
+			skyline.erase(skyline.begin() + i + 1);
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+void BuildLightmapLayout(const SBakeScene& scene, const SLightmapSettings& settings, SLightmapLayout& layout)
+{
+	layout = SLightmapLayout();
+	layout.nWidth = std::min(std::max((settings.nWidth + kLightmapTileSize - 1) / kLightmapTileSize, 1) * kLightmapTileSize, kMaxLightmapWidth);
+
+	const float texelSize = std::max(settings.texelSize, 1e-4f);
+	for (uint32_t nSurfaceIndex = 0; nSurfaceIndex < scene.surfaces.size(); ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		if (!(surface.nFlags & ESurface_IsVisible) || surface.nNumVertices == 0)
+			continue;
+
+		const uint32_t nSectorIndex = scene.vertices[surface.nFirstVertex].nSectorIndex;
+		if (!TestMaskBit(scene.sectorMasks.data(), nSectorIndex) || !TestMaskBit(scene.layerMasks.data(), scene.sectors[nSectorIndex].nLayerIndex))
+			continue;
+
+		SLightmapRect rect;
+		if (LayoutSurface(scene, nSurfaceIndex, texelSize, layout.nWidth, rect))
+			layout.rects.push_back(rect);
+	}
+
+	// tallest first, the skyline stays flat that way
+	std::vector<uint32_t> order(layout.rects.size());
+	for (uint32_t i = 0; i < (uint32_t)order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+	{
+		const SLightmapRect& rectA = layout.rects[a];
+		const SLightmapRect& rectB = layout.rects[b];
+		return rectA.nHeight != rectB.nHeight ? rectA.nHeight > rectB.nHeight : rectA.nWidth > rectB.nWidth;
+	});
+
+	std::vector<SSkylineNode> skyline = { { 0, 0, layout.nWidth } };
+	int nUsedHeight = 0;
+	for (uint32_t nRect : order)
+	{
+		SLightmapRect& rect = layout.rects[nRect];
+
+		// every rectangle is at most as wide as the atlas, so there is always a place
+		size_t nNode = 0;
+		int y = 0;
+		FindSkylinePlace(skyline, layout.nWidth, rect.nWidth, nNode, y);
+
+		rect.x = skyline[nNode].x;
+		rect.y = y;
+		AddSkylineRect(skyline, nNode, y, rect.nWidth, rect.nHeight);
+		nUsedHeight = std::max(nUsedHeight, y + rect.nHeight);
+	}
+	layout.nHeight = (nUsedHeight + kLightmapTileSize - 1) / kLightmapTileSize * kLightmapTileSize;
+
+	// rectangles per tile, counted first
+	const int nNumTilesX = layout.GetNumTilesX();
+	const int nNumTiles = nNumTilesX * layout.GetNumTilesY();
+	layout.tileOffsets.assign(nNumTiles + 1, 0);
+	for (int nPass = 0; nPass < 2; ++nPass)
+	{
+		std::vector<uint32_t> nextEntry(layout.tileOffsets.begin(), layout.tileOffsets.end() - 1);
+		for (uint32_t nRect = 0; nRect < (uint32_t)layout.rects.size(); ++nRect)
+		{
+			const SLightmapRect& rect = layout.rects[nRect];
+			for (int nTileY = rect.y / kLightmapTileSize; nTileY <= (rect.y + rect.nHeight - 1) / kLightmapTileSize; ++nTileY)
+			{
+				for (int nTileX = rect.x / kLightmapTileSize; nTileX <= (rect.x + rect.nWidth - 1) / kLightmapTileSize; ++nTileX)
+				{
+					const int nTile = nTileY * nNumTilesX + nTileX;
+					if (nPass == 0)
+						++layout.tileOffsets[nTile + 1];
+					else
+						layout.tileRects[nextEntry[nTile]++] = nRect;
+				}
+			}
+		}
+
+		if (nPass == 0)
+		{
+			for (int nTile = 0; nTile < nNumTiles; ++nTile)
+				layout.tileOffsets[nTile + 1] += layout.tileOffsets[nTile];
+			layout.tileRects.resize(layout.tileOffsets[nNumTiles]);
+		}
+	}
+}
+
+// what every texel reads
+struct SLightmapContext
+{
+	const SBakeScene& scene;
+	const SLightmapLayout& layout;
+	const CCpuTracer& tracer;       // over the vertex light of the bake
+	const CCpuTracer& normalTracer; // over the smoothed vertex normals, interpolated like the light
+	uint32_t nBakeFlags;
+	int      nRays;
+	bool     bLightLists;
+	float3   sunDir;
+	float4   sunColor;
+	float4   skyColor;
+};
+
+// true if the point is at least kTexelEdgeInset inside every edge of the surface
+static bool IsInsideSurface(const SBakeScene& scene, const SSurface& surface, const float3& position)
+{
+	for (uint32_t i = 0; i < surface.nNumVertices; ++i)
+	{
+		const float4& edgePlane = scene.edgePlanes[surface.nFirstVertex + i];
+		const float3 edgeNormal = ToFloat3(edgePlane);
+		if (dot(edgeNormal, position) - edgePlane.w < kTexelEdgeInset * length(edgeNormal))
+			return false;
+	}
+	return true;
+}
+
+// Point on the surface for a texel. The surfaces are convex, padding texels and texels past an edge are pulled towards
+// the center of the surface until they are inside.
+static float3 ClampToSurface(const SBakeScene& scene, const SSurface& surface, const float3& center, const float3& position)
+{
+	if (IsInsideSurface(scene, surface, position))
+		return position;
+
+	float inside = 0.0f, outside = 1.0f;
+	for (int nStep = 0; nStep < kClampSteps; ++nStep)
+	{
+		const float mid = (inside + outside) * 0.5f;
+		if (IsInsideSurface(scene, surface, center + (position - center) * mid))
+			inside = mid;
+		else
+			outside = mid;
+	}
+	return center + (position - center) * inside;
+}
+
+// The passes of the vertex bake for one texel, the gather rays stand in for the sky/emissive pass and the bounces
+static float4 BakeTexel(const SLightmapContext& context, const SVertexData& texel, STraceCounters& counters)
+{
+	const CCpuTracer& tracer = context.tracer;
+	const SBakeScene& scene = context.scene;
+	const uint32_t nBakeFlags = context.nBakeFlags;
+
+	float4 color = { 0,0,0,0 };
+	if (nBakeFlags & ELightBake_Sun)
+	{
+		const float ndotl = dot(texel.normal, context.sunDir);
+		if (ndotl > 0)
+		{
+			SRayPayload payload;
+			const bool bRayHit = tracer.TraceRay(payload, texel.nSectorIndex, texel.vertex + context.sunDir * kRayBias, kSkyDistance * context.sunDir + texel.vertex);
+			CountRay(counters, payload);
+			if (bRayHit && (tracer.GetSurfaceHot(payload.nHitSurfaceIndex).nFlags & ESurface_IsSky))
+				color += ndotl * payload.attenuation * context.sunColor;
+		}
+	}
+
+	if (nBakeFlags & ELightBake_Lights)
+	{
+		const uint32_t nFirstEntry = context.bLightLists ? scene.sectorLightOffsets[texel.nSectorIndex] : 0;
+		const uint32_t nEndEntry = context.bLightLists ? scene.sectorLightOffsets[texel.nSectorIndex + 1] : (uint32_t)scene.levelInfo.nTotalLights;
+		for (uint32_t nEntry = nFirstEntry; nEntry < nEndEntry; ++nEntry)
+		{
+			const uint32_t nLightIndex = context.bLightLists ? scene.sectorLights[nEntry] : nEntry;
+
+			float4 lightColor;
+			if (ComputeDirectLight(tracer, scene.lights[nLightIndex], texel, nBakeFlags, lightColor, &counters))
+				color += lightColor;
+		}
+	}
+
+	if (!(nBakeFlags & (ELightBake_Sky | ELightBake_Emissive | ELightBake_Indirect)) || context.nRays <= 0)
+		return color;
+
+	const STangentFrame frame = GenerateTangentFrame(texel.normal);
+	float4 gather = { 0,0,0,0 };
+	for (int nFirstRay = 0; nFirstRay < context.nRays; nFirstRay += kRayPacketSize)
+	{
+		SRayPacket packet;
+		for (int nRayIndex = nFirstRay; nRayIndex < std::min(nFirstRay + kRayPacketSize, context.nRays); ++nRayIndex)
+		{
+			const float3 rayDir = TransformRay(GenRay(nRayIndex, context.nRays), frame);
+			packet.Set(packet.nCount++, texel.vertex + rayDir * kRayBias, kSkyDistance * rayDir + texel.vertex);
+		}
+
+		SRayPayload aPayloads[kRayPacketSize];
+		const int nHitMask = tracer.TraceRayPacket(aPayloads, texel.nSectorIndex, packet);
+		for (int nLane = 0; nLane < packet.nCount; ++nLane)
+		{
+			const SRayPayload& payload = aPayloads[nLane];
+			CountRay(counters, payload);
+			if (!(nHitMask & (1 << nLane)))
+				continue;
+
+			const uint32_t hitFlags = tracer.GetSurfaceHot(payload.nHitSurfaceIndex).nFlags;
+			if ((nBakeFlags & ELightBake_Sky) && (hitFlags & ESurface_IsSky))
+				gather += context.skyColor * payload.attenuation;
+			else if ((nBakeFlags & ELightBake_Emissive) && (hitFlags & ESurface_IsVisible))
+				gather += tracer.GetSurfaceCold(payload.nHitSurfaceIndex).emissive * payload.attenuation;
+
+			if ((nBakeFlags & ELightBake_Indirect) && (hitFlags & ESurface_IsVisible))
+			{
+				const float4 surfaceLight = tracer.InterpolateSurfaceLight(payload.nHitSurfaceIndex, payload.hitPos);
+				const float4 bounce = tracer.GetSurfaceCold(payload.nHitSurfaceIndex).albedo * surfaceLight * payload.attenuation + payload.reflection;
+				gather += bounce * payload.attenuation;
+			}
+		}
+	}
+
+	return color + gather / (float)context.nRays;
+}
+
+// shared exponent pixel of the .hdr, negative light is clamped
+static void ToRgbe(const float4& color, uint8_t* pRgbe)
+{
+	const float r = std::max(color.x, 0.0f), g = std::max(color.y, 0.0f), b = std::max(color.z, 0.0f);
+	const float maxValue = std::max(r, std::max(g, b));
+	if (maxValue < 1e-32f)
+	{
+		pRgbe[0] = pRgbe[1] = pRgbe[2] = pRgbe[3] = 0;
+		return;
+	}
+
+	int nExponent;
+	const float scale = frexpf(maxValue, &nExponent) * 256.0f / maxValue;
+	pRgbe[0] = (uint8_t)(r * scale);
+	pRgbe[1] = (uint8_t)(g * scale);
+	pRgbe[2] = (uint8_t)(b * scale);
+	pRgbe[3] = (uint8_t)(nExponent + 128);
+}
+
+// Traces the texels of the rectangles in a tile into its part of the band
+static void BakeTile(const SLightmapContext& context, int nTileX, int nTileY, uint8_t* pBand, STraceCounters& counters)
+{
+	const SLightmapLayout& layout = context.layout;
+	const SBakeScene& scene = context.scene;
+	const int nTile = nTileY * layout.GetNumTilesX() + nTileX;
+	const int nTileLeft = nTileX * kLightmapTileSize;
+	const int nTileTop = nTileY * kLightmapTileSize;
+
+	for (uint32_t nEntry = layout.tileOffsets[nTile]; nEntry < layout.tileOffsets[nTile + 1]; ++nEntry)
+	{
+		const SLightmapRect& rect = layout.rects[layout.tileRects[nEntry]];
+		const SSurface& surface = scene.surfaces[rect.nSurfaceIndex];
+		const float3 surfaceNormal = ToFloat3(surface.normal);
+
+		float3 center = { 0,0,0 };
+		for (uint32_t i = 0; i < surface.nNumVertices; ++i)
+			center += ToFloat3(scene.vertices[surface.nFirstVertex + i].position);
+		center *= 1.0f / (float)surface.nNumVertices;
+
+		SVertexData texel;
+		texel.nVertexIndex = -1;
+		texel.nSectorIndex = scene.vertices[surface.nFirstVertex].nSectorIndex;
+		texel.nLayerIndex = scene.sectors[texel.nSectorIndex].nLayerIndex;
+		texel.nSurfaceIndex = rect.nSurfaceIndex;
+
+		const int nBeginX = std::max(rect.x, nTileLeft), nEndX = std::min(rect.x + rect.nWidth, nTileLeft + kLightmapTileSize);
+		const int nBeginY = std::max(rect.y, nTileTop), nEndY = std::min(rect.y + rect.nHeight, nTileTop + kLightmapTileSize);
+		for (int y = nBeginY; y < nEndY; ++y)
+		{
+			for (int x = nBeginX; x < nEndX; ++x)
+			{
+				const float3 position = rect.origin + rect.axisU * ((float)(x - rect.x) + 0.5f) + rect.axisV * ((float)(y - rect.y) + 0.5f);
+				texel.vertex = ClampToSurface(scene, surface, center, position);
+
+				const float3 normal = ToFloat3(context.normalTracer.InterpolateSurfaceLight(rect.nSurfaceIndex, texel.vertex));
+				texel.normal = dot(normal, surfaceNormal) > 1e-3f ? normalize(normal) : surfaceNormal;
+
+				const float4 color = ResolveVertexColor(BakeTexel(context, texel, counters), context.nBakeFlags);
+				ToRgbe(color, pBand + ((size_t)(y - nTileTop) * layout.nWidth + x) * 4);
+			}
+		}
+	}
+}
+
+// New style run length scanline with literal runs only. Flat scanlines are valid too, but a row starting with the
+// pixel (2, 2, x) would read as a run length one.
+static void WriteHdrScanline(std::ofstream& file, const uint8_t* pPixels, int nWidth, std::vector<uint8_t>& buffer)
+{
+	buffer.clear();
+	buffer.push_back(2);
+	buffer.push_back(2);
+	buffer.push_back((uint8_t)(nWidth >> 8));
+	buffer.push_back((uint8_t)(nWidth & 0xFF));
+	for (int nChannel = 0; nChannel < 4; ++nChannel)
+	{
+		for (int x = 0; x < nWidth; x += 128)
+		{
+			const int nCount = std::min(nWidth - x, 128);
+			buffer.push_back((uint8_t)nCount);
+			for (int i = 0; i < nCount; ++i)
+				buffer.push_back(pPixels[(x + i) * 4 + nChannel]);
+		}
+	}
+	file.write((const char*)buffer.data(), buffer.size());
+}
+
+bool BakeLightmap(const SBakeScene& scene, const SLightmapLayout& layout, const std::vector<float4>& vertexColors, const SLightmapSettings& settings,
+	CJobSystem* pJobSystem, STraceCounters& counters, const std::string& sPath, std::string& sError)
+{
+	std::ofstream file(sPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		sError = "Failed to open file for writing";
+		return false;
+	}
+
+	char header[128];
+	snprintf(header, sizeof(header), "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", layout.nHeight, layout.nWidth);
+	file << header;
+
+	// the smoothed normals are interpolated over a surface like the light
+	std::vector<float4> vertexNormals(scene.normals.size());
+	for (size_t nVertexIndex = 0; nVertexIndex < scene.normals.size(); ++nVertexIndex)
+	{
+		const int4& normal = scene.normals[nVertexIndex];
+		const float3 direction = normalize(float3((float)normal.x, (float)normal.y, (float)normal.z));
+		vertexNormals[nVertexIndex] = float4(direction.x, direction.y, direction.z, 0.0f);
+	}
+
+	const CCpuTracer tracer(scene, vertexColors.data());
+	const CCpuTracer normalTracer(scene, vertexNormals.data());
+	const SLevelInfo& levelInfo = scene.levelInfo;
+
+	SLightmapContext context = { scene, layout, tracer, normalTracer, levelInfo.nBakeFlags, settings.nRays,
+		scene.sectorLightOffsets.size() == scene.sectors.size() + 1, float3(0,0,0), float4(0,0,0,0), float4(0,0,0,0) };
+	if (levelInfo.nSunLightIndex >= 0)
+	{
+		float3 sunPos = ToFloat3(scene.lights[levelInfo.nSunLightIndex].position);
+		if (levelInfo.nAnchorLightIndex >= 0)
+			sunPos -= ToFloat3(scene.lights[levelInfo.nAnchorLightIndex].position);
+		context.sunDir = normalize(sunPos);
+		context.sunColor = scene.lights[levelInfo.nSunLightIndex].color;
+	}
+	else
+	{
+		context.nBakeFlags &= ~ELightBake_Sun;
+	}
+
+	if (levelInfo.nSkyLightIndex >= 0)
+		context.skyColor = scene.lights[levelInfo.nSkyLightIndex].color;
+	else
+		context.nBakeFlags &= ~ELightBake_Sky;
+
+	// one band of tiles at a time, the tiles of a band are traced in parallel
+	std::vector<uint8_t> band((size_t)layout.nWidth * kLightmapTileSize * 4);
+	std::vector<uint8_t> scanline;
+	std::mutex counterMutex;
+	for (int nTileY = 0; nTileY < layout.GetNumTilesY() && file; ++nTileY)
+	{
+		std::fill(band.begin(), band.end(), (uint8_t)0);
+		pJobSystem->ParallelFor(layout.GetNumTilesX(), 1, [&](int nBegin, int nEnd)
+		{
+			STraceCounters tileCounters;
+			for (int nTileX = nBegin; nTileX < nEnd; ++nTileX)
+				BakeTile(context, nTileX, nTileY, band.data(), tileCounters);
+
+			std::lock_guard<std::mutex> lock(counterMutex);
+			counters += tileCounters;
+		});
+
+		for (int y = 0; y < kLightmapTileSize; ++y)
+			WriteHdrScanline(file, &band[(size_t)y * layout.nWidth * 4], layout.nWidth, scanline);
+	}
+
+	if (!file)
+	{
+		sError = "Failed to write file";
+		return false;
+	}
+	return true;
+}
+
+bool SaveLightmapTable(const std::string& sPath, const SBakeScene& scene, const SLightmapLayout& layout, std::string& sError)
+{
+	std::ofstream file(sPath, std::ios::trunc);
+	if (!file)
+	{
+		sError = "Failed to open file for writing";
+		return false;
+	}
+
+	file << "sector,surface,x,y,width,height,origin_x,origin_y,origin_z,u_x,u_y,u_z,v_x,v_y,v_z\n";
+	for (const SLightmapRect& rect : layout.rects)
+	{
+		const SVertex& vertex = scene.vertices[scene.surfaces[rect.nSurfaceIndex].nFirstVertex];
+
+		char line[512];
+		snprintf(line, sizeof(line), "%u,%u,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n", vertex.nSectorIndex, vertex.nLocalSurfaceIndex,
+			rect.x, rect.y, rect.nWidth, rect.nHeight, rect.origin.x, rect.origin.y, rect.origin.z,
+			rect.axisU.x, rect.axisU.y, rect.axisU.z, rect.axisV.x, rect.axisV.y, rect.axisV.z);
+		file << line;
+	}
+
+	if (!file)
+	{
+		sError = "Failed to write file";
+		return false;
+	}
+	return true;
+}
+
+std::string GetLightmapImagePath(const std::string& sLevelPath)
+{
+	return sLevelPath + ".lightmap.hdr";
+}
+
+std::string GetLightmapTablePath(const std::string& sLevelPath)
+{
+	return sLevelPath + ".lightmap.csv";
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// Texel light for the surfaces of a finished vertex bake (lightbake --lightmap), for flat surfaces that are too big for
+// one light value per corner.
+// Every visible surface is laid out in its plane along its longest edge and the rectangles are packed into an atlas of
+// a fixed width with a skyline packer. The texels are traced with the CPU tracer in tiles: the sun and the point lights
+// like the direct passes, and one gather of hemisphere rays that sees the sky, emissive surfaces and the light of the
+// surfaces it hits interpolated from the vertex bake. The gather reads the finished vertex light, so texels get one
+// bounce more than the vertices.
+// The atlas is written as a Radiance .hdr one band of tiles at a time, only the band is in memory, and the rectangle of
+// every surface goes to a .csv table next to it.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BakeScene.h"
+#include "BakeScheduler.h"
+
+class CJobSystem;
+
+static constexpr float kDefaultLightmapTexelSize = 0.05f;
+static constexpr int   kDefaultLightmapWidth = 2048;
+static constexpr int   kDefaultLightmapRays = 64;
+
+// texels per side of the tiles traced and written together, the atlas width is a multiple of it
+static constexpr int   kLightmapTileSize = 64;
+
+// widest atlas the .hdr scanlines can hold
+static constexpr int   kMaxLightmapWidth = 32704;
+
+// texels around every rectangle so filtering doesn't pick up the neighbours, traced at the closest point on the surface
+static constexpr int   kLightmapPadding = 1;
+
+struct SLightmapSettings
+{
+	float texelSize = kDefaultLightmapTexelSize; // world units per texel, surfaces wider than the atlas get bigger texels
+	int   nWidth = kDefaultLightmapWidth;        // rounded up to a multiple of kLightmapTileSize
+	int   nRays = kDefaultLightmapRays;          // gather rays per texel
+};
+
+// Rectangle of a surface in the atlas, padding included. Texel (x + i, y + j) is centered on
+// origin + (i + 0.5) * axisU + (j + 0.5) * axisV.
+struct SLightmapRect
+{
+	uint32_t nSurfaceIndex;
+	int      x, y;
+	int      nWidth, nHeight;
+	float3   origin;
+	float3   axisU; // one texel along x in world units
+	float3   axisV;
+};
+
+struct SLightmapLayout
+{
+	int nWidth = 0;
+	int nHeight = 0; // a multiple of kLightmapTileSize
+	std::vector<SLightmapRect> rects; // in surface order
+
+	// per tile (row major) the first entry in tileRects, one more entry at the end
+	std::vector<uint32_t> tileOffsets;
+	std::vector<uint32_t> tileRects;  // the rectangles overlapping each tile
+
+	int GetNumTilesX() const { return nWidth / kLightmapTileSize; }
+	int GetNumTilesY() const { return nHeight / kLightmapTileSize; }
+	int64_t GetNumTexels() const;    // inside the rectangles
+};
+
+// lays out and packs the visible surfaces of the visible sectors and layers
+void BuildLightmapLayout(const SBakeScene& scene, const SLightmapSettings& settings, SLightmapLayout& layout);
+
+// Traces the atlas on top of the accumulated vertex light of a bake (scene.normals smoothed) and writes it to sPath.
+// The texels are resolved like the vertex colors written to the level, the rays traced are added to counters.
+bool BakeLightmap(const SBakeScene& scene, const SLightmapLayout& layout, const std::vector<float4>& vertexColors, const SLightmapSettings& settings,
+	CJobSystem* pJobSystem, STraceCounters& counters, const std::string& sPath, std::string& sError);
+
+// The rectangles as a .csv table, one line per surface with the sector, the surface in the sector, the rectangle and
+// the origin and axes that map it to the world
+bool SaveLightmapTable(const std::string& sPath, const SBakeScene& scene, const SLightmapLayout& layout, std::string& sError);
+
+// <level>.lightmap.hdr and <level>.lightmap.csv next to the level
+std::string GetLightmapImagePath(const std::string& sLevelPath);
+std::string GetLightmapTablePath(const std::string& sLevelPath);
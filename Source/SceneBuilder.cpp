@@ -0,0 +1,314 @@
+#include "SceneBuilder.h"
+#include "CpuTracer.h"
+#include "LightCulling.h"
+#include "SectorBvh.h"
+#include "SectorVisibility.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <unordered_map>
+
+void TakeSceneSnapshot(ISceneSource& source, SSceneSnapshot& snapshot)
+{
+	snapshot.nNumLayers = source.GetNumLayers();
+	snapshot.nTotalSurfaces = 0;
+	snapshot.nTotalVertices = 0;
+
+	snapshot.sectors.resize(source.GetNumSectors());
+	for (int nSectorIndex = 0; nSectorIndex < (int)snapshot.sectors.size(); ++nSectorIndex)
+	{
+		SSceneSector& sector = snapshot.sectors[nSectorIndex];
+		sector.Clear();
+		source.GetSector(nSectorIndex, sector);
+
+		snapshot.nTotalSurfaces += (int)sector.surfaces.size();
+		snapshot.nTotalVertices += (int)sector.indices.size();
+	}
+
+	snapshot.lights.resize(source.GetNumLights());
+	for (int nLightIndex = 0; nLightIndex < (int)snapshot.lights.size(); ++nLightIndex)
+		source.GetLight(nLightIndex, snapshot.lights[nLightIndex]);
+}
+
+static void BuildLights(const SSceneSnapshot& snapshot, SBakeScene& scene)
+{
+	SLevelInfo& levelInfo = scene.levelInfo;
+	levelInfo.nSunLightIndex = -1;
+	levelInfo.nSkyLightIndex = -1;
+	levelInfo.nAnchorLightIndex = -1;
+
+	scene.lights.resize(snapshot.lights.size());
+	for (int nLightIndex = 0; nLightIndex < (int)snapshot.lights.size(); ++nLightIndex)
+	{
+		const SSceneLight& light = snapshot.lights[nLightIndex];
+
+		float3 color = light.color;
+		if (levelInfo.nBakeFlags & ELightBake_GammaCorrect)
+			color = ToLinear(color);
+
+		SLight* pLight = &scene.lights[nLightIndex];
+		pLight->nSectorIndex = light.nSectorIndex;
+		pLight->nFlags = light.nFlags;
+		pLight->range = light.range;
+		pLight->nLayerIndex = light.nLayer;
+		pLight->color = { color.x * light.rgbIntensity, color.y * light.rgbIntensity, color.z * light.rgbIntensity, light.intensity };
+		pLight->position = { light.position.x, light.position.y, light.position.z, 1.0f };
+
+		if (light.nFlags & ELight_Sun) // todo: more than 1?
+			levelInfo.nSunLightIndex = nLightIndex;
+		else if (light.nFlags & ELight_Sky)
+			levelInfo.nSkyLightIndex = nLightIndex;
+		else if (light.nFlags & ELight_Anchor)
+			levelInfo.nAnchorLightIndex = nLightIndex;
+	}
+}
+
+void BuildEmissiveSurfaces(SBakeScene& scene)
+{
+	scene.emissiveSurfaces.clear();
+	scene.emissiveTriangleCdf.clear();
+
+	float totalPower = 0.0f;
+	for (uint32_t nSurfaceIndex = 0; nSurfaceIndex < (uint32_t)scene.surfaces.size(); ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		if (!(surface.nFlags & ESurface_IsVisible) || surface.nAdjoinSector >= 0 || surface.emissive.w <= 0.0f || surface.nNumVertices < 3)
+			continue;
+
+		// running area of the triangle fan around the first vertex
+		const uint32_t nFirstTriangle = (uint32_t)scene.emissiveTriangleCdf.size();
+		const float3 origin = ToFloat3(scene.vertices[surface.nFirstVertex].position);
+		float area = 0.0f;
+		for (uint32_t nVertexIndex = 2; nVertexIndex < surface.nNumVertices; ++nVertexIndex)
+		{
+			const float3 edge0 = ToFloat3(scene.vertices[surface.nFirstVertex + nVertexIndex - 1].position) - origin;
+			const float3 edge1 = ToFloat3(scene.vertices[surface.nFirstVertex + nVertexIndex].position) - origin;
+			area += 0.5f * length(cross(edge0, edge1));
+			scene.emissiveTriangleCdf.push_back(area);
+		}
+
+		if (area <= 0.0f)
+		{
+			scene.emissiveTriangleCdf.resize(nFirstTriangle);
+			continue;
+		}
+
+		for (uint32_t nTriangle = nFirstTriangle; nTriangle < (uint32_t)scene.emissiveTriangleCdf.size(); ++nTriangle)
+			scene.emissiveTriangleCdf[nTriangle] /= area;
+		scene.emissiveTriangleCdf.back() = 1.0f;
+
+		totalPower += surface.emissive.w * area;
+		scene.emissiveSurfaces.push_back({ nSurfaceIndex, nFirstTriangle, totalPower, 0.0f });
+	}
+
+	// a point is picked with the chance of its surface (power over the total) over the surface area
+	for (SEmissiveSurface& emissiveSurface : scene.emissiveSurfaces)
+	{
+		emissiveSurface.powerCdf /= totalPower;
+		emissiveSurface.inversePdf = totalPower / scene.surfaces[emissiveSurface.nSurfaceIndex].emissive.w;
+	}
+	if (!scene.emissiveSurfaces.empty())
+		scene.emissiveSurfaces.back().powerCdf = 1.0f;
+
+	scene.levelInfo.nNumEmissiveSurfaces = (int)scene.emissiveSurfaces.size();
+}
+
+static void BuildGeometry(const SSceneSnapshot& snapshot, SBakeScene& scene)
+{
+	const uint32_t nBakeFlags = scene.levelInfo.nBakeFlags;
+
+	std::vector<SSector>& sectors = scene.sectors;
+	std::vector<SSurface>& surfaces = scene.surfaces;
+	std::vector<SVertex>& vertices = scene.vertices;
+	std::vector<int4>& normals = scene.normals;
+
+	sectors.resize(snapshot.sectors.size());
+	surfaces.resize(snapshot.nTotalSurfaces);
+	vertices.resize(snapshot.nTotalVertices);
+	normals.resize(snapshot.nTotalVertices);
+
+	uint32_t nSurfaceOffset = 0;
+	uint32_t nVertexOffset = 0;
+	for (int nSectorIndex = 0; nSectorIndex < (int)snapshot.sectors.size(); ++nSectorIndex)
+	{
+		const SSceneSector& sector = snapshot.sectors[nSectorIndex];
+		const int nNumSurfaces = (int)sector.surfaces.size();
+
+		float3 boxMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float3 boxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (const float3& vertex : sector.vertices)
+		{
+			boxMin = { std::min(boxMin.x, vertex.x), std::min(boxMin.y, vertex.y), std::min(boxMin.z, vertex.z) };
+			boxMax = { std::max(boxMax.x, vertex.x), std::max(boxMax.y, vertex.y), std::max(boxMax.z, vertex.z) };
+		}
+
+		SSector* pSector = &sectors[nSectorIndex];
+		pSector->nFirstSurface = nSurfaceOffset;
+		pSector->nNumSurfaces = nNumSurfaces;
+		pSector->nLayerIndex = sector.nLayer;
+		pSector->center = { 0,0,0,0 };
+		if (!sector.vertices.empty())
+		{
+			pSector->center.x = (boxMin.x + boxMax.x) * 0.5f;
+			pSector->center.y = (boxMin.y + boxMax.y) * 0.5f;
+			pSector->center.z = (boxMin.z + boxMax.z) * 0.5f;
+		}
+
+		uint32_t nAdjoinCursor = nSurfaceOffset;                   // grows forward
+		uint32_t nSolidCursor = nSurfaceOffset + nNumSurfaces - 1; // grows backward
+		for (int nSurfaceIndex = 0; nSurfaceIndex < nNumSurfaces; ++nSurfaceIndex)
+		{
+			const SSceneSurface& surface = sector.surfaces[nSurfaceIndex];
+
+			// if a surface is set to block light, then ignore the adjoin value
+			const int nAdjoinSector = (surface.nAdjoinFlags & EAdjoin_BlocksLight) ? -1 : surface.nAdjoinSector;
+			const bool bHasAdjoin = (nAdjoinSector >= 0);
+			const uint32_t nDstIndex = bHasAdjoin ? nAdjoinCursor++ : nSolidCursor--;
+
+			SSurface* pSurface = &surfaces[nDstIndex];
+			pSurface->nFirstVertex = nVertexOffset;
+			pSurface->nNumVertices = surface.nNumIndices;
+			ComputeSurfaceColors(*pSurface, sector.pColormap, surface.pMaterial, surface.nFillColor, surface.extraLight, nBakeFlags);
+
+			pSurface->normal.x = surface.normal.x;
+			pSurface->normal.y = surface.normal.y;
+			pSurface->normal.z = surface.normal.z;
+			pSurface->normal.w = 0.0f; // plane distance, filled by BuildSectorBvhs
+			pSurface->nAdjoinSector = nAdjoinSector;
+
+			// ignore geo mode 0 (not visible), surfaces with no material, adjoins that block and skies
+			const bool bIsSky = (surface.nSurfFlags & ESky_Horizon) || (surface.nSurfFlags & ESky_Ceiling);
+			const bool bVisible = surface.nGeo != 0 && surface.bHasMaterial
+				&& !(surface.nAdjoinSector >= 0 && !(surface.nAdjoinFlags & EAdjoin_Visible))
+				&& !bIsSky;
+
+			pSurface->nFlags = bVisible ? ESurface_IsVisible : 0;
+			if (bIsSky)
+				pSurface->nFlags |= ESurface_IsSky;
+			if (surface.nFaceFlags & EFace_Translucent)
+				pSurface->nFlags |= ESurface_IsTranslucent;
+
+			for (uint32_t nVertexIndex = 0; nVertexIndex < surface.nNumIndices; ++nVertexIndex)
+			{
+				const float3& vertex = sector.vertices[sector.indices[surface.nFirstIndex + nVertexIndex]];
+
+				SVertex* pVertex = &vertices[nVertexOffset];
+				pVertex->position.x = vertex.x;
+				pVertex->position.y = vertex.y;
+				pVertex->position.z = vertex.z;
+				pVertex->position.w = 1.0f;
+				pVertex->nSectorIndex = nSectorIndex;
+				pVertex->nSurfaceIndex = nDstIndex;
+				pVertex->nLocalSurfaceIndex = nSurfaceIndex;
+				pVertex->nLocalVertexIndex = nVertexIndex;
+
+				int4* pNormal = &normals[nVertexOffset++];
+				pNormal->x = (int)(surface.normal.x * 1024.0);
+				pNormal->y = (int)(surface.normal.y * 1024.0);
+				pNormal->z = (int)(surface.normal.z * 1024.0);
+				pNormal->w = 1;
+			}
+		}
+		nSurfaceOffset += nNumSurfaces;
+	}
+
+	BuildEmissiveSurfaces(scene);
+}
+
+void BuildBakeScene(const SSceneSnapshot& snapshot, uint32_t nBakeFlags, SBakeScene& scene)
+{
+	SLevelInfo& levelInfo = scene.levelInfo;
+	levelInfo.nBakeFlags = nBakeFlags;
+
+	BuildLights(snapshot, scene);
+	BuildGeometry(snapshot, scene);
+	BuildSectorBvhs(scene);
+	BuildSectorVisibility(scene);
+	BuildSectorLightLists(scene);
+
+	levelInfo.nTotalSectors = (int)scene.sectors.size();
+	levelInfo.nTotalSurfaces = (int)scene.surfaces.size();
+	levelInfo.nTotalVertices = (int)scene.vertices.size();
+	levelInfo.nTotalLights = (int)scene.lights.size();
+}
+
+namespace
+{
+	// what a traced vertex depends on besides its sector, the position bits and the smoothed normal
+	struct SWeldKey
+	{
+		uint32_t aPosition[3];
+		int32_t  aNormal[3];
+
+		bool operator==(const SWeldKey& other) const { return memcmp(this, &other, sizeof(SWeldKey)) == 0; }
+	};
+
+	struct SWeldKeyHash
+	{
+		size_t operator()(const SWeldKey& key) const
+		{
+			// FNV-1a over the key
+			uint64_t nHash = 0xcbf29ce484222325ull;
+			const uint8_t* pBytes = (const uint8_t*)&key;
+			for (size_t i = 0; i < sizeof(SWeldKey); ++i)
+				nHash = (nHash ^ pBytes[i]) * 0x100000001b3ull;
+			return (size_t)nHash;
+		}
+	};
+}
+
+int BuildVertexWelds(SBakeScene& scene)
+{
+	const uint32_t nNumVertices = (uint32_t)scene.vertices.size();
+	scene.vertexWelds.resize(nNumVertices);
+
+	// the vertices of a sector are contiguous, so the groups are only looked for within a sector
+	int nNumTraced = 0;
+	std::unordered_map<SWeldKey, uint32_t, SWeldKeyHash> groups;
+	for (const SSector& sector : scene.sectors)
+	{
+		groups.clear();
+		for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+		{
+			const SSurface& surface = scene.surfaces[nSurfaceIndex];
+			for (uint32_t nVertexIndex = surface.nFirstVertex; nVertexIndex < surface.nFirstVertex + surface.nNumVertices; ++nVertexIndex)
+			{
+				// invisible surfaces are skipped by the passes, their vertices can't stand in for visible ones
+				if (!(surface.nFlags & ESurface_IsVisible))
+				{
+					scene.vertexWelds[nVertexIndex] = nVertexIndex;
+					++nNumTraced;
+					continue;
+				}
+
+				const float4& position = scene.vertices[nVertexIndex].position;
+				const int4& normal = scene.normals[nVertexIndex];
+
+				SWeldKey key;
+				memcpy(&key.aPosition[0], &position.x, sizeof(float));
+				memcpy(&key.aPosition[1], &position.y, sizeof(float));
+				memcpy(&key.aPosition[2], &position.z, sizeof(float));
+				key.aNormal[0] = normal.x;
+				key.aNormal[1] = normal.y;
+				key.aNormal[2] = normal.z;
+
+				const auto result = groups.emplace(key, nVertexIndex);
+				scene.vertexWelds[nVertexIndex] = result.first->second;
+				if (result.second)
+					++nNumTraced;
+			}
+		}
+	}
+
+	return nNumTraced;
+}
+
+void ScatterWeldedVertices(const SBakeScene& scene, std::vector<float4>& colors)
+{
+	if (scene.vertexWelds.size() != colors.size())
+		return;
+
+	for (size_t nVertexIndex = 0; nVertexIndex < colors.size(); ++nVertexIndex)
+		colors[nVertexIndex] = colors[scene.vertexWelds[nVertexIndex]];
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// Builds the bake scene (SBakeScene) from a scene source, shared by every frontend
+
+#include "BakeScene.h"
+#include "SceneSource.h"
+
+// Everything read from the source, in one pass over the level
+struct SSceneSnapshot
+{
+	std::vector<SSceneSector> sectors;
+	std::vector<SSceneLight>  lights;
+	int nNumLayers = 0;
+	int nTotalSurfaces = 0;
+	int nTotalVertices = 0; // surface vertices, one baked color each
+};
+
+void TakeSceneSnapshot(ISceneSource& source, SSceneSnapshot& snapshot);
+
+// fills the lights, geometry, sector bvhs and sector light lists of the scene as well as the light indices, totals and flags of its level info
+// masks, ray counts and smoothing are left to the caller
+void BuildBakeScene(const SSceneSnapshot& snapshot, uint32_t nBakeFlags, SBakeScene& scene);
+
+// The visible solid surfaces that give off light, the sky/emissive pass samples points on them by their power and area
+// instead of waiting for its hemisphere rays to hit them. Fills scene.emissiveSurfaces, scene.emissiveTriangleCdf and
+// levelInfo.nNumEmissiveSurfaces, BuildBakeScene runs it after the geometry
+void BuildEmissiveSurfaces(SBakeScene& scene);
+
+// Welds the surface vertices that bake to the same light: the same sector vertex (position) with the same normal on a
+// visible surface. Only the first vertex of every group is traced, run it once the normals are smoothed.
+// Fills scene.vertexWelds, returns the number of vertices that are still traced
+int BuildVertexWelds(SBakeScene& scene);
+
+// copies the color of every traced vertex to the vertices welded to it
+void ScatterWeldedVertices(const SBakeScene& scene, std::vector<float4>& colors);
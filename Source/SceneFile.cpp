@@ -0,0 +1,265 @@
+#include "SceneFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// calls func(eArray, vector) for every stored array of the scene, in file order
+template <typename TScene, typename Func>
+static void VisitSceneArrays(TScene& scene, Func&& func)
+{
+	func(ESceneArray_SectorMasks, scene.sectorMasks);
+	func(ESceneArray_LayerMasks, scene.layerMasks);
+	func(ESceneArray_Sectors, scene.sectors);
+	func(ESceneArray_Surfaces, scene.surfaces);
+	func(ESceneArray_Vertices, scene.vertices);
+	func(ESceneArray_Lights, scene.lights);
+	func(ESceneArray_Normals, scene.normals);
+	func(ESceneArray_EmissiveSurfaces, scene.emissiveSurfaces);
+	func(ESceneArray_EmissiveTriangleCdf, scene.emissiveTriangleCdf);
+	func(ESceneArray_EdgePlanes, scene.edgePlanes);
+	func(ESceneArray_BvhNodes, scene.bvhNodes);
+	func(ESceneArray_BvhSurfaces, scene.bvhSurfaces);
+	func(ESceneArray_SectorVisibilityOffsets, scene.sectorVisibilityOffsets);
+	func(ESceneArray_SectorVisibility, scene.sectorVisibility);
+	func(ESceneArray_SectorLightOffsets, scene.sectorLightOffsets);
+	func(ESceneArray_SectorLights, scene.sectorLights);
+}
+
+// zeros between the arrays
+static const char kSceneFilePadding[kSceneFileAlignment] = {};
+
+static uint64_t AlignSceneFileOffset(uint64_t nOffset)
+{
+	return (nOffset + kSceneFileAlignment - 1) & ~(kSceneFileAlignment - 1);
+}
+
+std::string GetSceneFilePath(const std::string& sLevelPath)
+{
+	const size_t nDot = sLevelPath.find_last_of('.');
+	const size_t nSlash = sLevelPath.find_last_of("/\\");
+	if (nDot == std::string::npos || (nSlash != std::string::npos && nDot < nSlash))
+		return sLevelPath + ".lbscene";
+
+	return sLevelPath.substr(0, nDot) + ".lbscene";
+}
+
+void WriteSceneFile(std::ostream& file, const SBakeScene& scene)
+{
+	SSceneFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.nMagic = kSceneFileMagic;
+	header.nVersion = kSceneFileVersion;
+	header.levelInfo = scene.levelInfo;
+
+	uint64_t nOffset = AlignSceneFileOffset(sizeof(header));
+	VisitSceneArrays(scene, [&](ESceneArray eArray, const auto& values)
+	{
+		SSceneFileArray& array = header.arrays[eArray];
+		array.nOffset = nOffset;
+		array.nCount = values.size();
+		array.nStride = (uint32_t)sizeof(values[0]);
+		nOffset = AlignSceneFileOffset(nOffset + array.nCount * array.nStride);
+	});
+
+	file.write((const char*)&header, sizeof(header));
+	uint64_t nWritten = sizeof(header);
+	VisitSceneArrays(scene, [&](ESceneArray eArray, const auto& values)
+	{
+		const SSceneFileArray& array = header.arrays[eArray];
+		file.write(kSceneFilePadding, (std::streamsize)(array.nOffset - nWritten));
+		file.write((const char*)values.data(), (std::streamsize)(array.nCount * array.nStride));
+		nWritten = array.nOffset + array.nCount * array.nStride;
+	});
+}
+
+bool SaveSceneFile(const std::string& sPath, const SBakeScene& scene, std::string& sError)
+{
+	std::ofstream file(sPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		sError = "Failed to open file for writing";
+		return false;
+	}
+
+	WriteSceneFile(file, scene);
+	if (!file)
+	{
+		sError = "Failed to write file";
+		return false;
+	}
+	return true;
+}
+
+// checks the header and that every array is inside the data
+static bool ValidateSceneFile(const uint8_t* pData, size_t nSize, std::string& sError)
+{
+	if (nSize < sizeof(SSceneFileHeader))
+	{
+		sError = "Not a scene file";
+		return false;
+	}
+
+	const SSceneFileHeader& header = *(const SSceneFileHeader*)pData;
+	if (header.nMagic != kSceneFileMagic)
+	{
+		sError = "Not a scene file";
+		return false;
+	}
+
+	if (header.nVersion != kSceneFileVersion)
+	{
+		sError = "Scene file from another version";
+		return false;
+	}
+
+	// the strides catch a file written by a build with other struct layouts
+	bool bValid = true;
+	SBakeScene layout;
+	VisitSceneArrays(layout, [&](ESceneArray eArray, const auto& values)
+	{
+		const SSceneFileArray& array = header.arrays[eArray];
+		const uint64_t nStride = sizeof(values[0]);
+		bValid &= array.nStride == nStride && array.nOffset % kSceneFileAlignment == 0 && array.nOffset <= nSize
+			&& array.nCount <= (nSize - array.nOffset) / nStride;
+	});
+
+	// the passes index the arrays by the totals of the level info
+	const SLevelInfo& levelInfo = header.levelInfo;
+	bValid &= header.arrays[ESceneArray_Sectors].nCount == (uint64_t)levelInfo.nTotalSectors
+		&& header.arrays[ESceneArray_Surfaces].nCount == (uint64_t)levelInfo.nTotalSurfaces
+		&& header.arrays[ESceneArray_Vertices].nCount == (uint64_t)levelInfo.nTotalVertices
+		&& header.arrays[ESceneArray_Normals].nCount == (uint64_t)levelInfo.nTotalVertices
+		&& header.arrays[ESceneArray_Lights].nCount == (uint64_t)levelInfo.nTotalLights
+		&& header.arrays[ESceneArray_EmissiveSurfaces].nCount == (uint64_t)levelInfo.nNumEmissiveSurfaces;
+
+	if (!bValid)
+	{
+		sError = "Truncated or broken scene file";
+		return false;
+	}
+	return true;
+}
+
+// one copy per array
+static void CopySceneFileArrays(const uint8_t* pData, SBakeScene& scene)
+{
+	const SSceneFileHeader& header = *(const SSceneFileHeader*)pData;
+	scene.Clear();
+	scene.levelInfo = header.levelInfo;
+	VisitSceneArrays(scene, [&](ESceneArray eArray, auto& values)
+	{
+		using TValue = std::remove_reference_t<decltype(values[0])>;
+		const SSceneFileArray& array = header.arrays[eArray];
+		const TValue* paValues = (const TValue*)(pData + array.nOffset);
+		values.assign(paValues, paValues + array.nCount);
+	});
+}
+
+bool ReadSceneFile(const void* pData, size_t nSize, SBakeScene& scene, std::string& sError)
+{
+	if (!ValidateSceneFile((const uint8_t*)pData, nSize, sError))
+		return false;
+
+	CopySceneFileArrays((const uint8_t*)pData, scene);
+	return true;
+}
+
+bool CMappedSceneFile::Open(const std::string& sPath, std::string& sError)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(sPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		sError = "Failed to open file";
+		return false;
+	}
+	m_hFile = hFile;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart < (LONGLONG)sizeof(SSceneFileHeader))
+	{
+		Close();
+		sError = "Not a scene file";
+		return false;
+	}
+	m_nSize = (size_t)size.QuadPart;
+
+	m_hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	m_pData = m_hMapping ? (const uint8_t*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+	m_nFile = open(sPath.c_str(), O_RDONLY);
+	if (m_nFile < 0)
+	{
+		sError = "Failed to open file";
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(m_nFile, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(SSceneFileHeader))
+	{
+		Close();
+		sError = "Not a scene file";
+		return false;
+	}
+	m_nSize = (size_t)fileStat.st_size;
+
+	void* pData = mmap(nullptr, m_nSize, PROT_READ, MAP_PRIVATE, m_nFile, 0);
+	m_pData = (pData != MAP_FAILED) ? (const uint8_t*)pData : nullptr;
+#endif
+
+	if (!m_pData)
+	{
+		Close();
+		sError = "Failed to map file";
+		return false;
+	}
+
+	if (!ValidateSceneFile(m_pData, m_nSize, sError))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void CMappedSceneFile::Close()
+{
+#ifdef _WIN32
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	if (m_hFile)
+		CloseHandle(m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = nullptr;
+#else
+	if (m_pData)
+		munmap((void*)m_pData, m_nSize);
+	if (m_nFile >= 0)
+		close(m_nFile);
+	m_nFile = -1;
+#endif
+	m_pData = nullptr;
+	m_nSize = 0;
+}
+
+void CMappedSceneFile::CopyTo(SBakeScene& scene) const
+{
+	CopySceneFileArrays(m_pData, scene);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+// Binary scene file (.lbscene) for headless and batch bakes.
+// Holds the arrays of an SBakeScene exactly as the bake passes and the GPU buffers read them, each at a 16 byte aligned
+// offset listed in the header. A mapped file is baked without parsing the level, loading its materials or building the
+// BVHs and light lists again, so many bake configurations can run against one export (see lightbake --export-scene).
+// The normals are stored smoothed and levelInfo.normalSmoothCos is 1, the smoothing angle is fixed by the export.
+// Structs are stored in their native layout, kSceneFileVersion changes with them.
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "BakeScene.h"
+
+static constexpr uint32_t kSceneFileMagic = 0x4E43534Cu; // "LSCN"
+static constexpr uint32_t kSceneFileVersion = 3;
+static constexpr uint64_t kSceneFileAlignment = 16;
+
+enum ESceneArray
+{
+	ESceneArray_SectorMasks,
+	ESceneArray_LayerMasks,
+	ESceneArray_Sectors,
+	ESceneArray_Surfaces,
+	ESceneArray_Vertices,
+	ESceneArray_Lights,
+	ESceneArray_Normals,
+	ESceneArray_EmissiveSurfaces,
+	ESceneArray_EmissiveTriangleCdf,
+	ESceneArray_EdgePlanes,
+	ESceneArray_BvhNodes,
+	ESceneArray_BvhSurfaces,
+	ESceneArray_SectorVisibilityOffsets,
+	ESceneArray_SectorVisibility,
+	ESceneArray_SectorLightOffsets,
+	ESceneArray_SectorLights,
+
+	ESceneArray_Count
+};
+
+struct SSceneFileArray
+{
+	uint64_t nOffset; // from the start of the file
+	uint64_t nCount;
+	uint32_t nStride; // sizeof the element, checked against this build when opening
+	uint32_t _padding0;
+};
+
+struct SSceneFileHeader
+{
+	uint32_t        nMagic;
+	uint32_t        nVersion;
+	SLevelInfo      levelInfo;
+	SSceneFileArray arrays[ESceneArray_Count];
+};
+
+std::string GetSceneFilePath(const std::string& sLevelPath);
+
+// scene.normals have to be smoothed already (or levelInfo.normalSmoothCos 1), see CCpuBaker::ComputeSmoothNormals
+bool SaveSceneFile(const std::string& sPath, const SBakeScene& scene, std::string& sError);
+void WriteSceneFile(std::ostream& file, const SBakeScene& scene);
+
+// reads a scene file from memory, e.g. one sent to the workers of a distributed bake
+bool ReadSceneFile(const void* pData, size_t nSize, SBakeScene& scene, std::string& sError);
+
+// Read only mapping of a scene file, the arrays stay valid until Close
+class CMappedSceneFile
+{
+public:
+	CMappedSceneFile() = default;
+	~CMappedSceneFile() { Close(); }
+
+	CMappedSceneFile(const CMappedSceneFile&) = delete;
+	CMappedSceneFile& operator=(const CMappedSceneFile&) = delete;
+
+	// maps the file and checks the header and that every array is inside the file
+	bool Open(const std::string& sPath, std::string& sError);
+	void Close();
+
+	const SSceneFileHeader& GetHeader() const { return *(const SSceneFileHeader*)m_pData; }
+
+	template <typename T>
+	const T* GetArray(ESceneArray eArray, size_t& nCount) const
+	{
+		const SSceneFileArray& array = GetHeader().arrays[eArray];
+		nCount = (size_t)array.nCount;
+		return (const T*)(m_pData + array.nOffset);
+	}
+
+	// copies the mapped arrays into scene, one copy per array
+	void CopyTo(SBakeScene& scene) const;
+
+private:
+	const uint8_t* m_pData = nullptr;
+	size_t         m_nSize = 0;
+#ifdef _WIN32
+	void*          m_hFile = nullptr;
+	void*          m_hMapping = nullptr;
+#else
+	int            m_nFile = -1;
+#endif
+};
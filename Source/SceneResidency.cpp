@@ -0,0 +1,186 @@
+#include "SceneResidency.h"
+#include "Hash.h"
+
+#include <cstring>
+
+uint32_t GetSceneBufferCount(const SBakeScene& scene, ESceneBuffer eBuffer)
+{
+	switch (eBuffer)
+	{
+	case ESceneBuffer_Sectors:     return (uint32_t)scene.sectors.size();
+	case ESceneBuffer_Surfaces:    return (uint32_t)scene.surfaces.size();
+	case ESceneBuffer_Vertices:    return (uint32_t)scene.vertices.size();
+	case ESceneBuffer_Normals:     return (uint32_t)scene.normals.size();
+	case ESceneBuffer_EdgePlanes:  return (uint32_t)scene.edgePlanes.size();
+	case ESceneBuffer_BvhNodes:    return (uint32_t)scene.bvhNodes.size();
+	case ESceneBuffer_BvhSurfaces: return (uint32_t)scene.bvhSurfaces.size();
+	default:                       return 0;
+	}
+}
+
+uint32_t GetSceneBufferStride(ESceneBuffer eBuffer)
+{
+	switch (eBuffer)
+	{
+	case ESceneBuffer_Sectors:     return sizeof(SSector);
+	case ESceneBuffer_Surfaces:    return sizeof(SSurface);
+	case ESceneBuffer_Vertices:    return sizeof(SVertex);
+	case ESceneBuffer_Normals:     return sizeof(int4);
+	case ESceneBuffer_EdgePlanes:  return sizeof(float4);
+	case ESceneBuffer_BvhNodes:    return sizeof(SBvhNode);
+	case ESceneBuffer_BvhSurfaces: return sizeof(uint32_t);
+	default:                       return 0;
+	}
+}
+
+const void* GetSceneBufferData(const SBakeScene& scene, ESceneBuffer eBuffer)
+{
+	switch (eBuffer)
+	{
+	case ESceneBuffer_Sectors:     return scene.sectors.data();
+	case ESceneBuffer_Surfaces:    return scene.surfaces.data();
+	case ESceneBuffer_Vertices:    return scene.vertices.data();
+	case ESceneBuffer_Normals:     return scene.normals.data();
+	case ESceneBuffer_EdgePlanes:  return scene.edgePlanes.data();
+	case ESceneBuffer_BvhNodes:    return scene.bvhNodes.data();
+	case ESceneBuffer_BvhSurfaces: return scene.bvhSurfaces.data();
+	default:                       return nullptr;
+	}
+}
+
+// Element ranges a sector owns in each buffer. BuildBakeScene lays out the surfaces and vertices, and BuildSectorBvhs the
+// nodes and leaf lists, sector by sector so these are contiguous and together cover every buffer
+static void GetSectorRanges(const SBakeScene& scene, uint32_t nSectorIndex, SSceneRange aRanges[ESceneBuffer_Count])
+{
+	const SSector& sector = scene.sectors[nSectorIndex];
+	aRanges[ESceneBuffer_Sectors] = { nSectorIndex, 1 };
+	aRanges[ESceneBuffer_Surfaces] = { sector.nFirstSurface, sector.nNumSurfaces };
+
+	// the surfaces are sorted (adjoins first) but their vertices stay in level order
+	uint32_t nFirstVertex = UINT32_MAX, nEndVertex = 0;
+	for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		nFirstVertex = surface.nFirstVertex < nFirstVertex ? surface.nFirstVertex : nFirstVertex;
+		nEndVertex = surface.nFirstVertex + surface.nNumVertices > nEndVertex ? surface.nFirstVertex + surface.nNumVertices : nEndVertex;
+	}
+	const SSceneRange vertices = (nFirstVertex < nEndVertex) ? SSceneRange{ nFirstVertex, nEndVertex - nFirstVertex } : SSceneRange{ 0, 0 };
+	aRanges[ESceneBuffer_Vertices] = vertices;
+	aRanges[ESceneBuffer_Normals] = vertices;
+	aRanges[ESceneBuffer_EdgePlanes] = vertices;
+
+	const uint32_t nEndNode = (nSectorIndex + 1 < scene.sectors.size()) ? scene.sectors[nSectorIndex + 1].nBvhRoot : (uint32_t)scene.bvhNodes.size();
+	aRanges[ESceneBuffer_BvhNodes] = { sector.nBvhRoot, nEndNode - sector.nBvhRoot };
+
+	uint32_t nFirstLeafSurface = UINT32_MAX, nEndLeafSurface = 0;
+	for (uint32_t nNodeIndex = sector.nBvhRoot; nNodeIndex < nEndNode; ++nNodeIndex)
+	{
+		const SBvhNode& node = scene.bvhNodes[nNodeIndex];
+		if (node.nCount == 0)
+			continue;
+
+		nFirstLeafSurface = node.nFirst < nFirstLeafSurface ? node.nFirst : nFirstLeafSurface;
+		nEndLeafSurface = node.nFirst + node.nCount > nEndLeafSurface ? node.nFirst + node.nCount : nEndLeafSurface;
+	}
+	aRanges[ESceneBuffer_BvhSurfaces] = (nFirstLeafSurface < nEndLeafSurface) ? SSceneRange{ nFirstLeafSurface, nEndLeafSurface - nFirstLeafSurface } : SSceneRange{ 0, 0 };
+}
+
+static void AddUpload(std::vector<SSceneRange>& uploads, const SSceneRange& range)
+{
+	if (range.nCount == 0)
+		return;
+
+	if (!uploads.empty() && uploads.back().nFirst + uploads.back().nCount == range.nFirst)
+		uploads.back().nCount += range.nCount;
+	else
+		uploads.push_back(range);
+}
+
+void CSceneResidency::Invalidate()
+{
+	m_sectorHashes.clear();
+	for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+		m_abInvalid[nBuffer] = true;
+}
+
+void CSceneResidency::InvalidateBuffer(ESceneBuffer eBuffer)
+{
+	m_abInvalid[eBuffer] = true;
+}
+
+void CSceneResidency::Update(const SBakeScene& scene, std::vector<SSceneRange> aUploads[ESceneBuffer_Count])
+{
+	for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+	{
+		aUploads[nBuffer].clear();
+		if (m_abInvalid[nBuffer])
+			AddUpload(aUploads[nBuffer], { 0, GetSceneBufferCount(scene, (ESceneBuffer)nBuffer) });
+	}
+
+	// the ranges and offsets are part of the hashed data, a sector that moved in a buffer is dirty as well
+	const uint32_t nNumSectors = (uint32_t)scene.sectors.size();
+	m_sectorHashes.resize(nNumSectors, 0);
+	m_nNumDirtySectors = 0;
+	for (uint32_t nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		SSceneRange aRanges[ESceneBuffer_Count];
+		GetSectorRanges(scene, nSectorIndex, aRanges);
+
+		uint64_t nHash = kHashSeed;
+		for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+		{
+			const uint32_t nStride = GetSceneBufferStride((ESceneBuffer)nBuffer);
+			const uint8_t* pData = (const uint8_t*)GetSceneBufferData(scene, (ESceneBuffer)nBuffer);
+			nHash = HashBytes(nHash, &aRanges[nBuffer], sizeof(SSceneRange));
+			nHash = HashBytes(nHash, pData + (size_t)aRanges[nBuffer].nFirst * nStride, (size_t)aRanges[nBuffer].nCount * nStride);
+		}
+
+		if (nHash == m_sectorHashes[nSectorIndex])
+			continue;
+
+		m_sectorHashes[nSectorIndex] = nHash;
+		++m_nNumDirtySectors;
+		for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+		{
+			if (!m_abInvalid[nBuffer])
+				AddUpload(aUploads[nBuffer], aRanges[nBuffer]);
+		}
+	}
+
+	for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+		m_abInvalid[nBuffer] = false;
+}
+
+size_t CCpuSceneBuffers::Upload(const SBakeScene& scene, CSceneResidency& residency)
+{
+	for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+	{
+		const uint32_t nStride = GetSceneBufferStride((ESceneBuffer)nBuffer);
+		const uint32_t nCapacity = (uint32_t)(m_aBuffers[nBuffer].size() / nStride);
+		const uint32_t nNewCapacity = GrowCapacity(nCapacity, GetSceneBufferCount(scene, (ESceneBuffer)nBuffer));
+		if (nNewCapacity != nCapacity)
+		{
+			// a new buffer like on the GPU, the old content isn't kept
+			m_aBuffers[nBuffer].assign((size_t)nNewCapacity * nStride, 0);
+			residency.InvalidateBuffer((ESceneBuffer)nBuffer);
+		}
+	}
+
+	std::vector<SSceneRange> aUploads[ESceneBuffer_Count];
+	residency.Update(scene, aUploads);
+
+	size_t nUploadedBytes = 0;
+	for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+	{
+		const uint32_t nStride = GetSceneBufferStride((ESceneBuffer)nBuffer);
+		const uint8_t* pData = (const uint8_t*)GetSceneBufferData(scene, (ESceneBuffer)nBuffer);
+		for (const SSceneRange& range : aUploads[nBuffer])
+		{
+			const size_t nOffset = (size_t)range.nFirst * nStride;
+			const size_t nSize = (size_t)range.nCount * nStride;
+			memcpy(m_aBuffers[nBuffer].data() + nOffset, pData + nOffset, nSize);
+			nUploadedBytes += nSize;
+		}
+	}
+	return nUploadedBytes;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+// Keeps a resident copy of the bake scene (the GPU buffers of the plugin, or CCpuSceneBuffers) up to date between bakes.
+// Every sector is hashed over everything it owns in the scene buffers, only the ranges of sectors whose hash changed since
+// the last Update are uploaded again. Buffers grow geometrically so small edits don't reallocate them.
+
+#include <cstdint>
+#include <vector>
+
+#include "BakeScene.h"
+
+// per sector data of SBakeScene, the masks and lights are small and always uploaded whole
+enum ESceneBuffer
+{
+	ESceneBuffer_Sectors,
+	ESceneBuffer_Surfaces,
+	ESceneBuffer_Vertices,
+	ESceneBuffer_Normals, // unsmoothed, the smoothing pass works on a copy
+	ESceneBuffer_EdgePlanes,
+	ESceneBuffer_BvhNodes,
+	ESceneBuffer_BvhSurfaces,
+	ESceneBuffer_Count
+};
+
+// element range of a scene buffer
+struct SSceneRange
+{
+	uint32_t nFirst;
+	uint32_t nCount;
+};
+
+// capacity for nCount elements, grows by half of the current capacity so repeated growth is amortized
+inline uint32_t GrowCapacity(uint32_t nCapacity, uint32_t nCount)
+{
+	if (nCount <= nCapacity)
+		return nCapacity;
+
+	const uint32_t nGrown = nCapacity + nCapacity / 2;
+	return nGrown > nCount ? nGrown : nCount;
+}
+
+uint32_t GetSceneBufferCount(const SBakeScene& scene, ESceneBuffer eBuffer);
+uint32_t GetSceneBufferStride(ESceneBuffer eBuffer);
+const void* GetSceneBufferData(const SBakeScene& scene, ESceneBuffer eBuffer);
+
+class CSceneResidency
+{
+public:
+	// the resident copy is gone (device lost/released), the next Update uploads everything
+	void Invalidate();
+
+	// a single buffer was reallocated and lost its content
+	void InvalidateBuffer(ESceneBuffer eBuffer);
+
+	// compares every sector with the last Update and fills the ranges to upload per buffer, adjacent ranges are merged
+	void Update(const SBakeScene& scene, std::vector<SSceneRange> aUploads[ESceneBuffer_Count]);
+
+	// sectors uploaded by the last Update
+	int GetNumDirtySectors() const { return m_nNumDirtySectors; }
+
+private:
+	std::vector<uint64_t> m_sectorHashes;
+	bool                  m_abInvalid[ESceneBuffer_Count] = { true, true, true, true, true, true, true };
+	int                   m_nNumDirtySectors = 0;
+};
+
+// CPU side resident copy of the scene buffers, the same uploads as the GPU buffers get
+class CCpuSceneBuffers
+{
+public:
+	// grows the buffers for scene (invalidating the ones that reallocated) and applies the uploads of residency.Update
+	// returns the number of bytes uploaded
+	size_t Upload(const SBakeScene& scene, CSceneResidency& residency);
+
+	const std::vector<uint8_t>& GetBuffer(ESceneBuffer eBuffer) const { return m_aBuffers[eBuffer]; }
+
+private:
+	std::vector<uint8_t> m_aBuffers[ESceneBuffer_Count];
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+// Where the baker gets the level from, the editor (CJedSceneSource), a .jkl file (lightbake) or memory (CMemorySceneSource)
+// Sectors are fetched whole in one call so implementations can batch their reads instead of going through
+// the level one surface/vertex at a time.
+
+#include <vector>
+
+#include "Assets.h"
+
+struct SSceneSurface
+{
+	int      nAdjoinSector = -1; // as stored in the level, light blocking adjoins are resolved by the builder
+	uint32_t nAdjoinFlags = 0;
+	uint32_t nSurfFlags = 0;
+	uint32_t nFaceFlags = 0;
+	int      nGeo = 0;
+	bool     bHasMaterial = false;
+	uint32_t nFillColor = 0;     // material fill color, only meaningful with a sector colormap
+	const SMaterialColor* pMaterial = nullptr; // owned by the source, without one the fill color is used
+	float    extraLight = 0.0f;
+	float3   normal = { 0,0,0 };
+	uint32_t nFirstIndex = 0;    // range in SSceneSector::indices
+	uint32_t nNumIndices = 0;
+};
+
+struct SSceneSector
+{
+	uint32_t         nFlags = 0;
+	int              nLayer = 0;
+	const SColormap* pColormap = nullptr; // owned by the source
+
+	std::vector<float3>        vertices; // sector vertices
+	std::vector<uint32_t>      indices;  // sector vertex of every surface vertex
+	std::vector<SSceneSurface> surfaces;
+
+	// keeps the allocations around so snapshots can be retaken cheaply
+	void Clear()
+	{
+		nFlags = 0;
+		nLayer = 0;
+		pColormap = nullptr;
+		vertices.clear();
+		indices.clear();
+		surfaces.clear();
+	}
+};
+
+struct SSceneLight
+{
+	float3   position = { 0,0,0 };
+	float    intensity = 0.0f;
+	float    range = 0.0f;
+	float3   color = { 1,1,1 }; // not gamma corrected
+	float    rgbIntensity = 0.0f;
+	uint32_t nFlags = 0;
+	int      nLayer = 0;
+	int      nSectorIndex = -1;
+};
+
+class ISceneSource
+{
+public:
+	virtual ~ISceneSource() {}
+
+	virtual int  GetNumSectors() = 0;
+	virtual int  GetNumLayers() = 0;
+	virtual int  GetNumLights() = 0;
+
+	// fills the whole sector, vertices, surfaces and their colors
+	virtual void GetSector(int nSectorIndex, SSceneSector& sector) = 0;
+	virtual void GetLight(int nLightIndex, SSceneLight& light) = 0;
+};
+
+// Scene held in memory, for tools and tests that generate their levels
+class CMemorySceneSource
+	: public ISceneSource
+{
+public:
+	int  GetNumSectors() override { return (int)sectors.size(); }
+	int  GetNumLayers() override  { return nNumLayers; }
+	int  GetNumLights() override  { return (int)lights.size(); }
+
+	void GetSector(int nSectorIndex, SSceneSector& sector) override { sector = sectors[nSectorIndex]; }
+	void GetLight(int nLightIndex, SSceneLight& light) override     { light = lights[nLightIndex]; }
+
+	std::vector<SSceneSector> sectors;
+	std::vector<SSceneLight>  lights;
+	int                       nNumLayers = 1;
+};
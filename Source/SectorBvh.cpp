@@ -0,0 +1,235 @@
+#include "SectorBvh.h"
+
+#include <algorithm>
+#include <cfloat>
+
+// same tolerance as the edge test in IsPointOnSurface
+static constexpr float kEdgeEpsilon = 1e-3f;
+
+// SAH build settings, the traversal cost is relative to testing one surface
+static constexpr int   kBvhBinCount = 12;
+static constexpr float kBvhTraversalCost = 1.0f;
+
+struct SSurfaceRef
+{
+	uint32_t nSurfaceIndex;
+	float3   boxMin;
+	float3   boxMax;
+	float3   center;
+};
+
+static float GetAxis(const float3& v, int nAxis)
+{
+	return nAxis == 0 ? v.x : (nAxis == 1 ? v.y : v.z);
+}
+
+static void GrowBox(float3& boxMin, float3& boxMax, const float3& otherMin, const float3& otherMax)
+{
+	boxMin = { std::min(boxMin.x, otherMin.x), std::min(boxMin.y, otherMin.y), std::min(boxMin.z, otherMin.z) };
+	boxMax = { std::max(boxMax.x, otherMax.x), std::max(boxMax.y, otherMax.y), std::max(boxMax.z, otherMax.z) };
+}
+
+static float GetHalfArea(const float3& boxMin, const float3& boxMax)
+{
+	const float3 extent = boxMax - boxMin;
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+static void MakeLeaf(SBakeScene& scene, std::vector<SSurfaceRef>& refs, uint32_t nBegin, uint32_t nEnd, uint32_t nNodeIndex, const float3& boxMin, const float3& boxMax)
+{
+	// ascending surface order lets the traversal stop at the first hit of a leaf
+	std::sort(refs.begin() + nBegin, refs.begin() + nEnd, [](const SSurfaceRef& a, const SSurfaceRef& b) { return a.nSurfaceIndex < b.nSurfaceIndex; });
+
+	SBvhNode& node = scene.bvhNodes[nNodeIndex];
+	node.boxMin = boxMin;
+	node.boxMax = boxMax;
+	node.nFirst = (uint32_t)scene.bvhSurfaces.size();
+	node.nCount = nEnd - nBegin;
+	for (uint32_t nRef = nBegin; nRef < nEnd; ++nRef)
+		scene.bvhSurfaces.push_back(refs[nRef].nSurfaceIndex);
+}
+
+// builds the subtree of refs [nBegin, nEnd) into the already allocated node nNodeIndex using a binned SAH
+static void BuildNode(SBakeScene& scene, std::vector<SSurfaceRef>& refs, uint32_t nBegin, uint32_t nEnd, uint32_t nNodeIndex, int nDepth)
+{
+	float3 boxMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float3 boxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float3 centerMin = boxMin;
+	float3 centerMax = boxMax;
+	for (uint32_t nRef = nBegin; nRef < nEnd; ++nRef)
+	{
+		GrowBox(boxMin, boxMax, refs[nRef].boxMin, refs[nRef].boxMax);
+		GrowBox(centerMin, centerMax, refs[nRef].center, refs[nRef].center);
+	}
+
+	const uint32_t nCount = nEnd - nBegin;
+
+	// a leaf no matter the cost once the tree gets as deep as the traversal stack allows
+	if (nCount <= 1 || nDepth >= kBvhStackSize - 2)
+	{
+		MakeLeaf(scene, refs, nBegin, nEnd, nNodeIndex, boxMin, boxMax);
+		return;
+	}
+
+	struct SBin
+	{
+		float3   boxMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float3   boxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		uint32_t nCount = 0;
+	};
+
+	// costs are relative to one surface test
+	const float leafCost = (float)nCount;
+	float bestCost = FLT_MAX;
+	int nBestAxis = -1;
+	int nBestBin = 0;
+	for (int nAxis = 0; nAxis < 3; ++nAxis)
+	{
+		const float axisMin = GetAxis(centerMin, nAxis);
+		const float axisExtent = GetAxis(centerMax, nAxis) - axisMin;
+		if (axisExtent <= 1e-6f)
+			continue;
+
+		SBin aBins[kBvhBinCount];
+		for (uint32_t nRef = nBegin; nRef < nEnd; ++nRef)
+		{
+			const int nBin = std::min((int)((GetAxis(refs[nRef].center, nAxis) - axisMin) / axisExtent * kBvhBinCount), kBvhBinCount - 1);
+			GrowBox(aBins[nBin].boxMin, aBins[nBin].boxMax, refs[nRef].boxMin, refs[nRef].boxMax);
+			++aBins[nBin].nCount;
+		}
+
+		// sweep from the right to get the cost of every right side, then from the left
+		float aRightArea[kBvhBinCount];
+		uint32_t aRightCount[kBvhBinCount];
+		SBin right;
+		for (int nBin = kBvhBinCount - 1; nBin > 0; --nBin)
+		{
+			GrowBox(right.boxMin, right.boxMax, aBins[nBin].boxMin, aBins[nBin].boxMax);
+			right.nCount += aBins[nBin].nCount;
+			aRightArea[nBin] = right.nCount ? GetHalfArea(right.boxMin, right.boxMax) : 0.0f;
+			aRightCount[nBin] = right.nCount;
+		}
+
+		SBin left;
+		for (int nBin = 0; nBin < kBvhBinCount - 1; ++nBin)
+		{
+			GrowBox(left.boxMin, left.boxMax, aBins[nBin].boxMin, aBins[nBin].boxMax);
+			left.nCount += aBins[nBin].nCount;
+			if (!left.nCount || !aRightCount[nBin + 1])
+				continue;
+
+			const float cost = GetHalfArea(left.boxMin, left.boxMax) * left.nCount + aRightArea[nBin + 1] * aRightCount[nBin + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				nBestAxis = nAxis;
+				nBestBin = nBin;
+			}
+		}
+	}
+
+	// small sectors are always a single leaf, a few surface tests beat any traversal there
+	const float parentArea = GetHalfArea(boxMin, boxMax);
+	const float splitCost = kBvhTraversalCost + (parentArea > 0.0f ? bestCost / parentArea : leafCost);
+	if (nCount <= kBvhMaxLeafSize && (nDepth == 0 || nBestAxis < 0 || leafCost <= splitCost))
+	{
+		MakeLeaf(scene, refs, nBegin, nEnd, nNodeIndex, boxMin, boxMax);
+		return;
+	}
+
+	// without a usable axis (everything shares a center) the refs are split in half as they are
+	uint32_t nMid = nBegin + nCount / 2;
+	if (nBestAxis >= 0)
+	{
+		const float axisMin = GetAxis(centerMin, nBestAxis);
+		const float axisExtent = GetAxis(centerMax, nBestAxis) - axisMin;
+		auto it = std::partition(refs.begin() + nBegin, refs.begin() + nEnd, [&](const SSurfaceRef& ref)
+		{
+			return std::min((int)((GetAxis(ref.center, nBestAxis) - axisMin) / axisExtent * kBvhBinCount), kBvhBinCount - 1) <= nBestBin;
+		});
+		nMid = (uint32_t)(it - refs.begin());
+	}
+
+	const uint32_t nLeft = (uint32_t)scene.bvhNodes.size();
+	scene.bvhNodes.resize(nLeft + 2);
+
+	SBvhNode& node = scene.bvhNodes[nNodeIndex];
+	node.boxMin = boxMin;
+	node.boxMax = boxMax;
+	node.nFirst = nLeft;
+	node.nCount = 0;
+
+	BuildNode(scene, refs, nBegin, nMid, nLeft, nDepth + 1);
+	BuildNode(scene, refs, nMid, nEnd, nLeft + 1, nDepth + 1);
+}
+
+void BuildSectorBvhs(SBakeScene& scene)
+{
+	scene.edgePlanes.resize(scene.vertices.size());
+	scene.bvhNodes.clear();
+	scene.bvhSurfaces.clear();
+	scene.bvhNodes.reserve(scene.sectors.size() + scene.surfaces.size() / 2);
+	scene.bvhSurfaces.reserve(scene.surfaces.size());
+
+	std::vector<SSurfaceRef> refs;
+	for (SSector& sector : scene.sectors)
+	{
+		refs.clear();
+		for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+		{
+			SSurface& surface = scene.surfaces[nSurfaceIndex];
+			surface.normal.w = 0.0f;
+			if (surface.nNumVertices == 0)
+				continue; // can't be crossed
+
+			const float3 normal = { surface.normal.x, surface.normal.y, surface.normal.z };
+			const float4& firstVertex = scene.vertices[surface.nFirstVertex].position;
+			surface.normal.w = dot(normal, float3(firstVertex.x, firstVertex.y, firstVertex.z));
+
+			SSurfaceRef ref;
+			ref.nSurfaceIndex = nSurfaceIndex;
+			ref.boxMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+			ref.boxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+			float minEdgeLength = FLT_MAX;
+			for (uint32_t i = 0; i < surface.nNumVertices; ++i)
+			{
+				const float4& position1 = scene.vertices[surface.nFirstVertex + i].position;
+				const float4& position2 = scene.vertices[surface.nFirstVertex + (i + 1) % surface.nNumVertices].position;
+				const float3 vertex1 = { position1.x, position1.y, position1.z };
+				const float3 vertex2 = { position2.x, position2.y, position2.z };
+
+				const float3 edgeNormal = cross(normal, vertex2 - vertex1);
+				scene.edgePlanes[surface.nFirstVertex + i] = { edgeNormal.x, edgeNormal.y, edgeNormal.z, dot(edgeNormal, vertex1) };
+
+				GrowBox(ref.boxMin, ref.boxMax, vertex1, vertex1);
+
+				// degenerate edges don't reject anything so they don't widen the tolerance either
+				const float edgeLength = length(vertex2 - vertex1);
+				if (edgeLength > 1e-6f)
+					minEdgeLength = std::min(minEdgeLength, edgeLength);
+			}
+
+			// the edge test isn't normalized, its tolerance is kEdgeEpsilon / edge length in world units
+			const float pad = kEdgeEpsilon + (minEdgeLength < FLT_MAX ? 2.0f * kEdgeEpsilon / minEdgeLength : 0.0f);
+			ref.boxMin -= float3(pad, pad, pad);
+			ref.boxMax += float3(pad, pad, pad);
+			ref.center = (ref.boxMin + ref.boxMax) * 0.5f;
+			refs.push_back(ref);
+		}
+
+		sector.nBvhRoot = (uint32_t)scene.bvhNodes.size();
+		scene.bvhNodes.emplace_back();
+		if (refs.empty())
+		{
+			// the inverted box still passes the slab test, the traversal stops at kBvhEmptyRoot instead
+			SBvhNode& root = scene.bvhNodes.back();
+			root.boxMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+			root.boxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			root.nFirst = kBvhEmptyRoot;
+			root.nCount = 0;
+			continue;
+		}
+		BuildNode(scene, refs, 0, (uint32_t)refs.size(), sector.nBvhRoot, 0);
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// Per sector acceleration for TraceSurfaces, used by both the shaders (Baking.hlsli) and the CPU tracer
+
+#include <algorithm>
+
+#include "BakeScene.h"
+
+// leaves get up to this many surfaces when the SAH says so, sectors this small are a single leaf
+static constexpr uint32_t kBvhMaxLeafSize = 8;
+
+// nFirst of the root of a sector without traceable surfaces, an inner node marker (nCount 0) without children
+static constexpr uint32_t kBvhEmptyRoot = UINT32_MAX;
+
+// traversal stack size, the build stops splitting at kBvhStackSize - 2 levels so it never overflows
+static constexpr int kBvhStackSize = 32;
+
+// Fills the surface planes (normal.w), edge planes and bvh of every sector, run after the geometry is built
+void BuildSectorBvhs(SBakeScene& scene);
+
+// 1/delta for IsSegmentInBox, zero components get a huge finite value so the slab test never sees 0 * inf
+inline float3 GetSegmentInvDelta(const float3& delta)
+{
+	return { delta.x != 0.0f ? 1.0f / delta.x : 1e30f, delta.y != 0.0f ? 1.0f / delta.y : 1e30f, delta.z != 0.0f ? 1.0f / delta.z : 1e30f };
+}
+
+// Segment [start, start + delta] against a box, invDelta comes from GetSegmentInvDelta
+inline bool IsSegmentInBox(const float3& start, const float3& invDelta, const float3& boxMin, const float3& boxMax)
+{
+	const float tx0 = (boxMin.x - start.x) * invDelta.x, tx1 = (boxMax.x - start.x) * invDelta.x;
+	const float ty0 = (boxMin.y - start.y) * invDelta.y, ty1 = (boxMax.y - start.y) * invDelta.y;
+	const float tz0 = (boxMin.z - start.z) * invDelta.z, tz1 = (boxMax.z - start.z) * invDelta.z;
+
+	const float tMin = std::max(std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1)), 0.0f);
+	const float tMax = std::min(std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1)), 1.0f);
+	return tMin <= tMax;
+}
@@ -0,0 +1,394 @@
+#include "SectorProbes.h"
+#include "CpuBaker.h"
+#include "CpuTracer.h"
+#include "JobSystem.h"
+#include "SectorBvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+// distance in world units a grid probe keeps from the surfaces of its sector
+static constexpr float kProbeInset = 0.01f;
+
+// grid spacing factor for sectors that would get more than kMaxSectorProbes probes
+static constexpr float kProbeSpacingGrowth = 1.25f;
+
+bool SSectorProbes::HasSectorProbes(int nSectorIndex) const
+{
+	return nSectorIndex + 1 < (int)sectorOffsets.size() && sectorOffsets[nSectorIndex + 1] > sectorOffsets[nSectorIndex];
+}
+
+float4 SSectorProbes::GetSectorAmbient(int nSectorIndex) const
+{
+	float4 ambient = { 0,0,0,0 };
+	if (nSectorIndex + 1 >= (int)sectorOffsets.size())
+		return ambient;
+
+	const uint32_t nFirstProbe = sectorOffsets[nSectorIndex];
+	const uint32_t nEndProbe = sectorOffsets[nSectorIndex + 1];
+	for (uint32_t nProbe = nFirstProbe; nProbe < nEndProbe; ++nProbe)
+		ambient += probes[nProbe].ambient;
+	return nEndProbe > nFirstProbe ? ambient / (float)(nEndProbe - nFirstProbe) : ambient;
+}
+
+// true if the point is at least kProbeInset in front of every surface of the sector
+static bool IsInsideSector(const SBakeScene& scene, const SSector& sector, const float3& position)
+{
+	for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		if (surface.nNumVertices < 3)
+			continue;
+
+		const float3 normal = ToFloat3(surface.normal);
+		if (dot(normal, position) - surface.normal.w < kProbeInset * length(normal))
+			return false;
+	}
+	return true;
+}
+
+static void PlaceProbes(const SBakeScene& scene, uint32_t nSectorIndex, float spacing, std::vector<SSectorProbe>& probes)
+{
+	const SSector& sector = scene.sectors[nSectorIndex];
+
+	SSectorProbe probe = {};
+	probe.nSectorIndex = nSectorIndex;
+	probe.position = ToFloat3(sector.center);
+
+	float3 boxMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float3 boxMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		for (uint32_t nVertexIndex = surface.nFirstVertex; nVertexIndex < surface.nFirstVertex + surface.nNumVertices; ++nVertexIndex)
+		{
+			const float3 position = ToFloat3(scene.vertices[nVertexIndex].position);
+			boxMin = float3(std::min(boxMin.x, position.x), std::min(boxMin.y, position.y), std::min(boxMin.z, position.z));
+			boxMax = float3(std::max(boxMax.x, position.x), std::max(boxMax.y, position.y), std::max(boxMax.z, position.z));
+		}
+	}
+
+	int nCountX = 1, nCountY = 1, nCountZ = 1;
+	if (spacing > 0.0f && boxMin.x <= boxMax.x)
+	{
+		const float3 extent = boxMax - boxMin;
+		for (;;)
+		{
+			nCountX = std::max((int)ceilf(extent.x / spacing), 1);
+			nCountY = std::max((int)ceilf(extent.y / spacing), 1);
+			nCountZ = std::max((int)ceilf(extent.z / spacing), 1);
+			if ((int64_t)nCountX * nCountY * nCountZ <= kMaxSectorProbes)
+				break;
+			spacing *= kProbeSpacingGrowth;
+		}
+	}
+
+	if (nCountX * nCountY * nCountZ == 1)
+	{
+		probes.push_back(probe);
+		return;
+	}
+
+	// grid cell centers inside the sector
+	const size_t nFirstProbe = probes.size();
+	const float3 cellSize = (boxMax - boxMin) / float3((float)nCountX, (float)nCountY, (float)nCountZ);
+	for (int z = 0; z < nCountZ; ++z)
+	{
+		for (int y = 0; y < nCountY; ++y)
+		{
+			for (int x = 0; x < nCountX; ++x)
+			{
+				probe.position = boxMin + cellSize * float3((float)x + 0.5f, (float)y + 0.5f, (float)z + 0.5f);
+				if (IsInsideSector(scene, sector, probe.position))
+					probes.push_back(probe);
+			}
+		}
+	}
+
+	if (probes.size() == nFirstProbe)
+	{
+		probe.position = ToFloat3(sector.center);
+		probes.push_back(probe);
+	}
+}
+
+void PlaceSectorProbes(const SBakeScene& scene, const SProbeSettings& settings, SSectorProbes& probes)
+{
+	probes.probes.clear();
+	probes.sectorOffsets.assign(scene.sectors.size() + 1, 0);
+	for (uint32_t nSectorIndex = 0; nSectorIndex < (uint32_t)scene.sectors.size(); ++nSectorIndex)
+	{
+		probes.sectorOffsets[nSectorIndex] = (uint32_t)probes.probes.size();
+
+		// a probe in a sector without surfaces has nothing to stand in and no walls for its rays
+		const SSector& sector = scene.sectors[nSectorIndex];
+		if (TestMaskBit(scene.sectorMasks.data(), nSectorIndex) && scene.bvhNodes[sector.nBvhRoot].nFirst != kBvhEmptyRoot)
+			PlaceProbes(scene, nSectorIndex, settings.spacing, probes.probes);
+	}
+	probes.sectorOffsets[scene.sectors.size()] = (uint32_t)probes.probes.size();
+}
+
+// what every probe reads
+struct SProbeContext
+{
+	const SBakeScene& scene;
+	const CCpuTracer& tracer;
+	uint32_t nBakeFlags;
+	int      nRays;
+	float    spacing;
+	bool     bLightLists;
+	float3   sunDir;
+	float4   sunColor;
+	float4   skyColor;
+};
+
+// Adds light from one direction, color is what a vertex facing it would get. Averaged over every normal a cosine
+// (physical falloff and the sun) leaves a quarter with half of it in the linear term, the old falloff only tests the
+// side and leaves a half with three quarters in the linear term.
+static void AddProbeLight(SSectorProbe& probe, const float3& direction, const float4& color, bool bCosine)
+{
+	const float ambientScale = bCosine ? 0.25f : 0.5f;
+	const float linearScale = bCosine ? 0.5f : 0.75f;
+	probe.ambient += color * ambientScale;
+	probe.linear[0] += color * (direction.x * linearScale);
+	probe.linear[1] += color * (direction.y * linearScale);
+	probe.linear[2] += color * (direction.z * linearScale);
+}
+
+// Distance of the probe to the closest surface plane of its sector, the space around it the probe stands for
+static float GetProbeRadius(const SBakeScene& scene, const SSectorProbe& probe, float maxRadius)
+{
+	float radius = maxRadius;
+	const SSector& sector = scene.sectors[probe.nSectorIndex];
+	for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		if (surface.nNumVertices < 3)
+			continue;
+
+		const float3 normal = ToFloat3(surface.normal);
+		radius = std::min(radius, (dot(normal, probe.position) - surface.normal.w) / std::max(length(normal), 1e-6f));
+	}
+	return std::max(radius, kProbeInset);
+}
+
+// Light of a point light at the probe itself. The falloff at no distance is the clamp of the inverse square falloff,
+// so it's averaged over the ball of the radius around the probe instead (midpoint rule over the distance, weighted by the
+// volume of each shell) and over every normal like AddProbeLight.
+static bool ComputeProbeCenterLight(const CCpuTracer& tracer, const SLight& light, uint32_t nBakeFlags, float radius, float4& color)
+{
+	static constexpr int kRadiusSteps = 16;
+
+	if (light.nSectorIndex < 0 || (light.nFlags & ELight_Sun) || (light.nFlags & ELight_Sky) || light.range <= 0.0f)
+		return false;
+
+	if (!tracer.IsSectorVisible(light.nSectorIndex) || !tracer.IsLayerVisible(light.nLayerIndex))
+		return false;
+
+	float atten = 0.0f;
+	for (int nStep = 0; nStep < kRadiusSteps; ++nStep)
+	{
+		const float shell = ((float)nStep + 0.5f) / (float)kRadiusSteps;
+		const float dist = shell * radius;
+		if (dist < light.range)
+			atten += 3.0f * shell * shell * GetLightFalloff(light, dist * dist, nBakeFlags);
+	}
+	atten /= (float)kRadiusSteps;
+
+	const float ambientScale = (nBakeFlags & ELightBake_PhysicalFalloff) ? 0.25f : 0.5f;
+	color = light.color * (atten * ambientScale);
+	return true;
+}
+
+// The passes of the vertex bake for every direction around a probe, the rays stand in for the sky/emissive pass and
+// the bounces like the lightmap texels
+static void TraceProbe(const SProbeContext& context, SSectorProbe& probe, STraceCounters& counters)
+{
+	const CCpuTracer& tracer = context.tracer;
+	const SBakeScene& scene = context.scene;
+	const uint32_t nBakeFlags = context.nBakeFlags;
+
+	for (float4& linear : probe.linear)
+		linear = float4(0, 0, 0, 0);
+	probe.ambient = float4(0, 0, 0, 0);
+
+	if (nBakeFlags & ELightBake_Sun)
+	{
+		SRayPayload payload;
+		const bool bRayHit = tracer.TraceRay(payload, probe.nSectorIndex, probe.position, kSkyDistance * context.sunDir + probe.position);
+		CountRay(counters, payload);
+		if (bRayHit && (tracer.GetSurfaceHot(payload.nHitSurfaceIndex).nFlags & ESurface_IsSky))
+			AddProbeLight(probe, context.sunDir, payload.attenuation * context.sunColor, true);
+	}
+
+	if (nBakeFlags & ELightBake_Lights)
+	{
+		SVertexData vertexData;
+		vertexData.nVertexIndex = -1;
+		vertexData.nSectorIndex = probe.nSectorIndex;
+		vertexData.nLayerIndex = scene.sectors[probe.nSectorIndex].nLayerIndex;
+		vertexData.nSurfaceIndex = -1;
+		vertexData.vertex = probe.position;
+
+		const uint32_t nFirstEntry = context.bLightLists ? scene.sectorLightOffsets[probe.nSectorIndex] : 0;
+		const uint32_t nEndEntry = context.bLightLists ? scene.sectorLightOffsets[probe.nSectorIndex + 1] : (uint32_t)scene.levelInfo.nTotalLights;
+		for (uint32_t nEntry = nFirstEntry; nEntry < nEndEntry; ++nEntry)
+		{
+			const SLight& light = scene.lights[context.bLightLists ? scene.sectorLights[nEntry] : nEntry];
+			const float3 lightDir = ToFloat3(light.position) - probe.position;
+			if (dot(lightDir, lightDir) < 1e-12f)
+			{
+				// a light at the probe (the sector center) reaches it unoccluded from no direction in particular, no
+				// linear term
+				float4 lightColor;
+				if (ComputeProbeCenterLight(tracer, light, nBakeFlags, GetProbeRadius(scene, probe, 0.5f * context.spacing), lightColor))
+					probe.ambient += lightColor;
+				continue;
+			}
+
+			// the light as seen by a vertex facing it
+			vertexData.normal = normalize(lightDir);
+
+			float4 lightColor;
+			if (ComputeDirectLight(tracer, light, vertexData, nBakeFlags, lightColor, &counters))
+				AddProbeLight(probe, vertexData.normal, lightColor, (nBakeFlags & ELightBake_PhysicalFalloff) != 0);
+		}
+	}
+
+	if (!(nBakeFlags & (ELightBake_Sky | ELightBake_Emissive | ELightBake_Indirect)) || context.nRays <= 0)
+		return;
+
+	// uniform rays, the mean is the average over every normal and twice the first moment its linear term
+	float4 gather = { 0,0,0,0 };
+	float4 gatherLinear[3] = { { 0,0,0,0 }, { 0,0,0,0 }, { 0,0,0,0 } };
+	for (int nFirstRay = 0; nFirstRay < context.nRays; nFirstRay += kRayPacketSize)
+	{
+		SRayPacket packet;
+		float3 aRayDirs[kRayPacketSize];
+		for (int nRayIndex = nFirstRay; nRayIndex < std::min(nFirstRay + kRayPacketSize, context.nRays); ++nRayIndex)
+		{
+			aRayDirs[packet.nCount] = GenSphereRay(nRayIndex, context.nRays);
+			packet.Set(packet.nCount, probe.position, kSkyDistance * aRayDirs[packet.nCount] + probe.position);
+			++packet.nCount;
+		}
+
+		SRayPayload aPayloads[kRayPacketSize];
+		const int nHitMask = tracer.TraceRayPacket(aPayloads, probe.nSectorIndex, packet);
+		for (int nLane = 0; nLane < packet.nCount; ++nLane)
+		{
+			const SRayPayload& payload = aPayloads[nLane];
+			CountRay(counters, payload);
+			if (!(nHitMask & (1 << nLane)))
+				continue;
+
+			float4 color = { 0,0,0,0 };
+			const uint32_t hitFlags = tracer.GetSurfaceHot(payload.nHitSurfaceIndex).nFlags;
+			if ((nBakeFlags & ELightBake_Sky) && (hitFlags & ESurface_IsSky))
+				color += context.skyColor * payload.attenuation;
+			else if ((nBakeFlags & ELightBake_Emissive) && (hitFlags & ESurface_IsVisible))
+				color += tracer.GetSurfaceCold(payload.nHitSurfaceIndex).emissive * payload.attenuation;
+
+			if ((nBakeFlags & ELightBake_Indirect) && (hitFlags & ESurface_IsVisible))
+			{
+				const float4 surfaceLight = tracer.InterpolateSurfaceLight(payload.nHitSurfaceIndex, payload.hitPos);
+				const float4 bounce = tracer.GetSurfaceCold(payload.nHitSurfaceIndex).albedo * surfaceLight * payload.attenuation + payload.reflection;
+				color += bounce * payload.attenuation;
+			}
+
+			gather += color;
+			gatherLinear[0] += color * aRayDirs[nLane].x;
+			gatherLinear[1] += color * aRayDirs[nLane].y;
+			gatherLinear[2] += color * aRayDirs[nLane].z;
+		}
+	}
+
+	const float invRays = 1.0f / (float)context.nRays;
+	probe.ambient += gather * invRays;
+	for (int nAxis = 0; nAxis < 3; ++nAxis)
+		probe.linear[nAxis] += gatherLinear[nAxis] * (2.0f * invRays);
+}
+
+void TraceSectorProbes(const SBakeScene& scene, const std::vector<float4>& vertexColors, const SProbeSettings& settings, CJobSystem* pJobSystem,
+	SSectorProbes& probes, STraceCounters& counters)
+{
+	const CCpuTracer tracer(scene, vertexColors.data());
+	const SLevelInfo& levelInfo = scene.levelInfo;
+
+	SProbeContext context = { scene, tracer, levelInfo.nBakeFlags, settings.nRays, settings.spacing, scene.sectorLightOffsets.size() == scene.sectors.size() + 1,
+		float3(0,0,0), float4(0,0,0,0), float4(0,0,0,0) };
+	if (levelInfo.nSunLightIndex >= 0)
+	{
+		float3 sunPos = ToFloat3(scene.lights[levelInfo.nSunLightIndex].position);
+		if (levelInfo.nAnchorLightIndex >= 0)
+			sunPos -= ToFloat3(scene.lights[levelInfo.nAnchorLightIndex].position);
+		context.sunDir = normalize(sunPos);
+		context.sunColor = scene.lights[levelInfo.nSunLightIndex].color;
+	}
+	else
+	{
+		context.nBakeFlags &= ~ELightBake_Sun;
+	}
+
+	if (levelInfo.nSkyLightIndex >= 0)
+		context.skyColor = scene.lights[levelInfo.nSkyLightIndex].color;
+	else
+		context.nBakeFlags &= ~ELightBake_Sky;
+
+	// every probe of the level in one loop
+	std::mutex counterMutex;
+	const CJobSystem::RangeFunc traceProbes = [&](int nBegin, int nEnd)
+	{
+		STraceCounters probeCounters;
+		for (int nProbe = nBegin; nProbe < nEnd; ++nProbe)
+			TraceProbe(context, probes.probes[nProbe], probeCounters);
+
+		std::lock_guard<std::mutex> lock(counterMutex);
+		counters += probeCounters;
+	};
+
+	if (pJobSystem)
+		pJobSystem->ParallelFor((int)probes.probes.size(), 1, traceProbes);
+	else
+		traceProbes(0, (int)probes.probes.size());
+}
+
+bool SaveSectorProbes(const std::string& sPath, const SSectorProbes& probes, std::string& sError)
+{
+	std::ofstream file(sPath, std::ios::trunc);
+	if (!file)
+	{
+		sError = "Failed to open file for writing";
+		return false;
+	}
+
+	file << "sector,x,y,z,r,g,b,light";
+	for (const char* sAxis : { "x", "y", "z" })
+		file << ",r_" << sAxis << ",g_" << sAxis << ",b_" << sAxis << ",light_" << sAxis;
+	file << "\n";
+
+	for (const SSectorProbe& probe : probes.probes)
+	{
+		char line[512];
+		int nLength = snprintf(line, sizeof(line), "%u,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f", probe.nSectorIndex, probe.position.x, probe.position.y, probe.position.z,
+			probe.ambient.x, probe.ambient.y, probe.ambient.z, probe.ambient.w);
+		for (const float4& linear : probe.linear)
+			nLength += snprintf(line + nLength, sizeof(line) - nLength, ",%.6f,%.6f,%.6f,%.6f", linear.x, linear.y, linear.z, linear.w);
+		file << line << "\n";
+	}
+
+	if (!file)
+	{
+		sError = "Failed to write file";
+		return false;
+	}
+	return true;
+}
+
+std::string GetSectorProbesPath(const std::string& sLevelPath)
+{
+	return sLevelPath + ".probes.csv";
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+// Light probes for the sector ambient (lightbake --probes, "Ambient Probes" in the dialog). Instead of averaging the vertex
+// light of a sector, probes at the center of the sector (or a grid of them in large sectors) trace a sphere of rays after
+// the bake. A probe gets the light a vertex at its position would get, averaged over every direction: the point lights
+// and the sun it can see, plus the sky, emissive surfaces and the bounce light of the surfaces its rays hit, interpolated
+// from the finished vertex light. All probes of the level are traced in one parallel pass, the cost follows the number
+// of sectors instead of the vertices.
+// Along with the average every probe keeps the linear term of the light over the direction (L1 spherical harmonics), the
+// light towards a normal n is about ambient + n.x * linear[0] + n.y * linear[1] + n.z * linear[2].
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BakeScene.h"
+#include "BakeScheduler.h"
+
+class CJobSystem;
+
+static constexpr int   kDefaultProbeRays = 256;
+static constexpr float kDefaultProbeSpacing = 4.0f;
+
+// sectors that would need more probes than this get a coarser grid
+static constexpr int   kMaxSectorProbes = 64;
+
+struct SProbeSettings
+{
+	float spacing = kDefaultProbeSpacing; // world units between the probes of a sector, a smaller sector gets one at its center
+	int   nRays = kDefaultProbeRays;      // rays per probe over the whole sphere
+};
+
+struct SSectorProbe
+{
+	uint32_t nSectorIndex;
+	float3   position;
+	float4   ambient;   // accumulated light like the vertex colors, before gamma and tone mapping
+	float4   linear[3]; // per axis
+};
+
+struct SSectorProbes
+{
+	std::vector<SSectorProbe> probes;        // in sector order
+	std::vector<uint32_t>     sectorOffsets; // per sector the first probe, one more entry at the end
+
+	bool IsEmpty() const { return probes.empty(); }
+
+	// false for the sectors outside the mask and those without traceable surfaces, their ambient stays the vertex average
+	bool HasSectorProbes(int nSectorIndex) const;
+
+	// accumulated average of the probes of a sector, 0 without probes
+	float4 GetSectorAmbient(int nSectorIndex) const;
+};
+
+// Places the probes of the sectors in scene.sectorMasks, a grid of spacing world units clipped to the surfaces of the
+// sector. Sectors without a grid point inside (a single cell, or a broken sector) get one probe at their center, sectors
+// without traceable surfaces (an empty bvh) get none.
+void PlaceSectorProbes(const SBakeScene& scene, const SProbeSettings& settings, SSectorProbes& probes);
+
+// Traces the placed probes against the accumulated vertex light of a bake, the rays traced are added to counters
+void TraceSectorProbes(const SBakeScene& scene, const std::vector<float4>& vertexColors, const SProbeSettings& settings, CJobSystem* pJobSystem,
+	SSectorProbes& probes, STraceCounters& counters);
+
+// The probes as a .csv table, one line per probe with the sector, the position, the ambient and the linear terms
+bool SaveSectorProbes(const std::string& sPath, const SSectorProbes& probes, std::string& sError);
+
+// <level>.probes.csv next to the level
+std::string GetSectorProbesPath(const std::string& sLevelPath);
@@ -0,0 +1,401 @@
+#include "SectorVisibility.h"
+#include "CpuTracer.h"
+
+#include <algorithm>
+#include <cmath>
+
+// slack of the plane tests and clips, the tracer accepts hits slightly outside a surface's edges
+static constexpr float kVisibilityEpsilon = 0.005f;
+
+// an adjoin of a sector, the plane faces the sector it leads into
+struct SPortal
+{
+	uint32_t nToSector;
+	float3   normal;
+	float    distance;
+	uint32_t nFirstPoint;
+	uint32_t nNumPoints;
+};
+
+typedef std::vector<float3> Winding;
+
+struct SVisibilityContext
+{
+	const SBakeScene&     scene;
+	std::vector<SPortal>  portals;
+	std::vector<uint32_t> sectorPortalOffsets; // per sector the first portal, one more entry at the end
+	std::vector<float3>   points;
+	std::vector<uint32_t> mightSee;            // per portal the sectors a line through it could reach, nBuckets each
+	uint32_t              nBuckets;
+};
+
+// state of the clipped flood from one sector
+struct SVisibilityFlow
+{
+	uint32_t*                          pVisible;
+	int                                nSteps;
+	std::vector<std::vector<uint32_t>> mightStack; // per depth
+};
+
+static float GetPlaneDistance(const SPortal& portal, const float3& point)
+{
+	return dot(portal.normal, point) - portal.distance;
+}
+
+// keeps the part of the winding in front of the plane, with kVisibilityEpsilon of slack
+static bool ClipWinding(const Winding& in, const float3& normal, float distance, Winding& out)
+{
+	out.clear();
+	const size_t nNumPoints = in.size();
+	for (size_t i = 0; i < nNumPoints; ++i)
+	{
+		const float3& a = in[i];
+		const float3& b = in[(i + 1) % nNumPoints];
+		const float distA = dot(normal, a) - distance + kVisibilityEpsilon;
+		const float distB = dot(normal, b) - distance + kVisibilityEpsilon;
+		if (distA >= 0.0f)
+			out.push_back(a);
+		if ((distA >= 0.0f) != (distB >= 0.0f))
+			out.push_back(a + (b - a) * (distA / (distA - distB)));
+	}
+	return out.size() >= 3;
+}
+
+// True if a line through the base adjoin could go on through the other one: part of it in front of the base and part
+// of the base behind it
+static bool IsPortalInFront(const SVisibilityContext& context, const SPortal& base, const SPortal& portal)
+{
+	bool bInFront = false;
+	for (uint32_t i = 0; i < portal.nNumPoints && !bInFront; ++i)
+		bInFront = GetPlaneDistance(base, context.points[portal.nFirstPoint + i]) > kVisibilityEpsilon;
+
+	bool bBehind = false;
+	for (uint32_t i = 0; i < base.nNumPoints && !bBehind; ++i)
+		bBehind = GetPlaneDistance(portal, context.points[base.nFirstPoint + i]) < -kVisibilityEpsilon;
+
+	return bInFront && bBehind;
+}
+
+// Clips the target to the separating planes of the source and the pass winding, the planes through an edge of one and a
+// point of the other with the two on opposite sides. With bFlipClip the source is the pass winding of the flood.
+static bool ClipToSeparators(const Winding& source, const Winding& pass, Winding& target, bool bFlipClip, Winding& scratch)
+{
+	const size_t nNumSource = source.size();
+	for (size_t i = 0; i < nNumSource; ++i)
+	{
+		const size_t l = (i + 1) % nNumSource;
+		const float3 edge = source[l] - source[i];
+		for (size_t j = 0; j < pass.size(); ++j)
+		{
+			float3 normal = cross(edge, pass[j] - source[i]);
+			const float lengthSqr = dot(normal, normal);
+			if (lengthSqr < 1e-12f)
+				continue;
+			normal = normal / sqrtf(lengthSqr);
+			float distance = dot(normal, pass[j]);
+
+			// the side of the plane the source is on
+			bool bFlip = false;
+			size_t k = 0;
+			for (; k < nNumSource; ++k)
+			{
+				if (k == i || k == l)
+					continue;
+				const float d = dot(normal, source[k]) - distance;
+				if (d < -kVisibilityEpsilon)
+					break;
+				if (d > kVisibilityEpsilon)
+				{
+					bFlip = true;
+					break;
+				}
+			}
+			if (k == nNumSource)
+				continue; // planar with the source
+
+			if (bFlip)
+			{
+				normal = normal * -1.0f;
+				distance = -distance;
+			}
+
+			// a separator has the pass winding in front
+			int nNumFront = 0;
+			for (k = 0; k < pass.size(); ++k)
+			{
+				if (k == j)
+					continue;
+				const float d = dot(normal, pass[k]) - distance;
+				if (d < -kVisibilityEpsilon)
+					break;
+				nNumFront += d > kVisibilityEpsilon;
+			}
+			if (k != pass.size() || nNumFront == 0)
+				continue;
+
+			if (bFlipClip)
+			{
+				normal = normal * -1.0f;
+				distance = -distance;
+			}
+
+			if (!ClipWinding(target, normal, distance, scratch))
+				return false;
+			target.swap(scratch);
+		}
+	}
+	return true;
+}
+
+static void GetWinding(const SVisibilityContext& context, const SPortal& portal, Winding& winding)
+{
+	winding.assign(context.points.begin() + portal.nFirstPoint, context.points.begin() + portal.nFirstPoint + portal.nNumPoints);
+}
+
+// Floods on from a sector reached through the pass winding, source is the first adjoin of the line
+static void RecursiveFlow(const SVisibilityContext& context, SVisibilityFlow& flow, uint32_t nSectorIndex, const Winding& source,
+	const float3& sourceNormal, float sourceDistance, const Winding& pass, const float3& passNormal, float passDistance, int nDepth)
+{
+	const uint32_t nBuckets = context.nBuckets;
+	if (flow.mightStack.size() <= (size_t)nDepth + 1)
+		flow.mightStack.resize(nDepth + 2, std::vector<uint32_t>(nBuckets));
+	const uint32_t* paMight = flow.mightStack[nDepth].data();
+	uint32_t* paNextMight = flow.mightStack[nDepth + 1].data();
+
+	Winding target, clippedSource, scratch;
+	for (uint32_t nPortal = context.sectorPortalOffsets[nSectorIndex]; nPortal < context.sectorPortalOffsets[nSectorIndex + 1]; ++nPortal)
+	{
+		const SPortal& portal = context.portals[nPortal];
+		if (!TestMaskBit(paMight, portal.nToSector))
+			continue;
+
+		// nothing to find behind it that isn't visible yet
+		const uint32_t* paPortalMight = &context.mightSee[(size_t)nPortal * nBuckets];
+		bool bMore = false;
+		for (uint32_t nBucket = 0; nBucket < nBuckets; ++nBucket)
+		{
+			paNextMight[nBucket] = paMight[nBucket] & paPortalMight[nBucket];
+			bMore |= (paNextMight[nBucket] & ~flow.pVisible[nBucket]) != 0;
+		}
+		if (!bMore && TestMaskBit(flow.pVisible, portal.nToSector))
+			continue;
+
+		if (--flow.nSteps < 0)
+			return;
+
+		// the part of the adjoin beyond the source and the pass winding, and the part of the source behind the adjoin
+		GetWinding(context, portal, scratch);
+		if (!ClipWinding(scratch, sourceNormal, sourceDistance, target) || !ClipWinding(target, passNormal, passDistance, scratch))
+			continue;
+		target.swap(scratch);
+
+		if (!ClipWinding(source, portal.normal * -1.0f, -portal.distance, clippedSource))
+			continue;
+
+		// the first adjoin behind the source can be seen through all of it
+		if (nDepth > 0)
+		{
+			if (!ClipToSeparators(clippedSource, pass, target, false, scratch) || !ClipToSeparators(pass, clippedSource, target, true, scratch))
+				continue;
+		}
+
+		SetMaskBit(flow.pVisible, portal.nToSector);
+		if (bMore)
+		{
+			RecursiveFlow(context, flow, portal.nToSector, clippedSource, sourceNormal, sourceDistance, target, portal.normal, portal.distance, nDepth + 1);
+
+			// the stack may have grown
+			paMight = flow.mightStack[nDepth].data();
+			paNextMight = flow.mightStack[nDepth + 1].data();
+		}
+
+		if (flow.nSteps < 0)
+			return;
+	}
+}
+
+// a sector with its center in front of all its surfaces, rays starting in it end at one of them
+static bool IsClosedSector(const SBakeScene& scene, const SSector& sector)
+{
+	if (sector.nNumSurfaces < 4)
+		return false;
+
+	const float3 center = ToFloat3(sector.center);
+	for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		if (surface.nNumVertices < 3 || dot(ToFloat3(surface.normal), center) - surface.normal.w < kVisibilityEpsilon)
+			return false;
+	}
+	return true;
+}
+
+// Zero runs as a 0 byte and the run length, other bytes as they are
+static void CompressRow(const uint32_t* paMask, uint32_t nNumBytes, std::vector<uint8_t>& data)
+{
+	for (uint32_t nByte = 0; nByte < nNumBytes; )
+	{
+		const uint8_t value = (uint8_t)(paMask[nByte / 4] >> (8 * (nByte % 4)));
+		if (value)
+		{
+			data.push_back(value);
+			++nByte;
+			continue;
+		}
+
+		uint32_t nRun = 0;
+		while (nByte < nNumBytes && nRun < 255 && !(uint8_t)(paMask[nByte / 4] >> (8 * (nByte % 4))))
+		{
+			++nRun;
+			++nByte;
+		}
+		data.push_back(0);
+		data.push_back((uint8_t)nRun);
+	}
+}
+
+void BuildSectorVisibility(SBakeScene& scene)
+{
+	const uint32_t nNumSectors = (uint32_t)scene.sectors.size();
+	SVisibilityContext context = { scene, {}, {}, {}, {}, GetMaskBucketCount(nNumSectors) };
+	const uint32_t nBuckets = context.nBuckets;
+
+	context.sectorPortalOffsets.assign(nNumSectors + 1, 0);
+	for (uint32_t nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		context.sectorPortalOffsets[nSectorIndex] = (uint32_t)context.portals.size();
+		const SSector& sector = scene.sectors[nSectorIndex];
+		for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+		{
+			const SSurface& surface = scene.surfaces[nSurfaceIndex];
+			if (surface.nAdjoinSector < 0 || surface.nNumVertices < 3)
+				continue;
+
+			// the surfaces face into their sector, the portal faces away from it
+			SPortal portal;
+			portal.nToSector = (uint32_t)surface.nAdjoinSector;
+			portal.normal = ToFloat3(surface.normal) * -1.0f;
+			portal.distance = -surface.normal.w;
+			portal.nFirstPoint = (uint32_t)context.points.size();
+			portal.nNumPoints = surface.nNumVertices;
+			for (uint32_t i = 0; i < surface.nNumVertices; ++i)
+				context.points.push_back(ToFloat3(scene.vertices[surface.nFirstVertex + i].position));
+			context.portals.push_back(portal);
+		}
+	}
+	context.sectorPortalOffsets[nNumSectors] = (uint32_t)context.portals.size();
+
+	// per portal the sectors reached through the portals that pass the plane test against it
+	const uint32_t nNumPortals = (uint32_t)context.portals.size();
+	context.mightSee.assign((size_t)nNumPortals * nBuckets, 0);
+	std::vector<uint32_t> queue;
+	for (uint32_t nBase = 0; nBase < nNumPortals; ++nBase)
+	{
+		const SPortal& base = context.portals[nBase];
+		uint32_t* paMight = &context.mightSee[(size_t)nBase * nBuckets];
+		SetMaskBit(paMight, base.nToSector);
+		queue.assign(1, base.nToSector);
+		for (size_t nQueueIndex = 0; nQueueIndex < queue.size(); ++nQueueIndex)
+		{
+			const uint32_t nSectorIndex = queue[nQueueIndex];
+			for (uint32_t nPortal = context.sectorPortalOffsets[nSectorIndex]; nPortal < context.sectorPortalOffsets[nSectorIndex + 1]; ++nPortal)
+			{
+				const SPortal& portal = context.portals[nPortal];
+				if (TestMaskBit(paMight, portal.nToSector) || !IsPortalInFront(context, base, portal))
+					continue;
+
+				SetMaskBit(paMight, portal.nToSector);
+				queue.push_back(portal.nToSector);
+			}
+		}
+	}
+
+	std::vector<uint32_t> rows((size_t)nNumSectors * nBuckets, 0);
+	SVisibilityFlow flow;
+	Winding winding;
+	for (uint32_t nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		flow.pVisible = &rows[(size_t)nSectorIndex * nBuckets];
+		flow.nSteps = kMaxVisibilitySteps;
+		SetMaskBit(flow.pVisible, nSectorIndex);
+
+		for (uint32_t nPortal = context.sectorPortalOffsets[nSectorIndex]; nPortal < context.sectorPortalOffsets[nSectorIndex + 1] && flow.nSteps >= 0; ++nPortal)
+		{
+			const SPortal& portal = context.portals[nPortal];
+			SetMaskBit(flow.pVisible, portal.nToSector);
+
+			if (flow.mightStack.empty())
+				flow.mightStack.resize(2, std::vector<uint32_t>(nBuckets));
+			std::copy_n(&context.mightSee[(size_t)nPortal * nBuckets], nBuckets, flow.mightStack[0].data());
+
+			GetWinding(context, portal, winding);
+			RecursiveFlow(context, flow, portal.nToSector, winding, portal.normal, portal.distance, winding, portal.normal, portal.distance, 0);
+		}
+
+		// too many lines to follow, everything the cheap flood reaches
+		if (flow.nSteps < 0)
+		{
+			for (uint32_t nPortal = context.sectorPortalOffsets[nSectorIndex]; nPortal < context.sectorPortalOffsets[nSectorIndex + 1]; ++nPortal)
+			{
+				for (uint32_t nBucket = 0; nBucket < nBuckets; ++nBucket)
+					flow.pVisible[nBucket] |= context.mightSee[(size_t)nPortal * nBuckets + nBucket];
+			}
+		}
+	}
+
+	// the flood follows the adjoins out of a sector and the shadow rays come from the other end, a sector sees what sees it
+	for (uint32_t nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		for (uint32_t nOtherIndex = nSectorIndex + 1; nOtherIndex < nNumSectors; ++nOtherIndex)
+		{
+			uint32_t* paRow = &rows[(size_t)nSectorIndex * nBuckets];
+			uint32_t* paOtherRow = &rows[(size_t)nOtherIndex * nBuckets];
+			if (TestMaskBit(paRow, nOtherIndex) != TestMaskBit(paOtherRow, nSectorIndex))
+			{
+				SetMaskBit(paRow, nOtherIndex);
+				SetMaskBit(paOtherRow, nSectorIndex);
+			}
+		}
+	}
+
+	for (uint32_t nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		if (IsClosedSector(scene, scene.sectors[nSectorIndex]))
+			continue;
+
+		std::fill_n(&rows[(size_t)nSectorIndex * nBuckets], nBuckets, ~0u);
+		for (uint32_t nOtherIndex = 0; nOtherIndex < nNumSectors; ++nOtherIndex)
+			SetMaskBit(&rows[(size_t)nOtherIndex * nBuckets], nSectorIndex);
+	}
+
+	const uint32_t nNumBytes = (nNumSectors + 7) / 8;
+	scene.sectorVisibility.clear();
+	scene.sectorVisibilityOffsets.assign(nNumSectors + 1, 0);
+	for (uint32_t nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+	{
+		scene.sectorVisibilityOffsets[nSectorIndex] = (uint32_t)scene.sectorVisibility.size();
+		CompressRow(&rows[(size_t)nSectorIndex * nBuckets], nNumBytes, scene.sectorVisibility);
+	}
+	scene.sectorVisibilityOffsets[nNumSectors] = (uint32_t)scene.sectorVisibility.size();
+}
+
+void AddVisibleSectors(const SBakeScene& scene, int nSectorIndex, uint32_t* paMask)
+{
+	const uint32_t nNumSectors = (uint32_t)scene.sectors.size();
+	if (scene.sectorVisibilityOffsets.size() != nNumSectors + 1)
+	{
+		std::fill_n(paMask, GetMaskBucketCount(nNumSectors), ~0u);
+		return;
+	}
+
+	const uint32_t nNumBytes = (nNumSectors + 7) / 8;
+	uint32_t nByte = 0;
+	for (uint32_t nOffset = scene.sectorVisibilityOffsets[nSectorIndex]; nOffset < scene.sectorVisibilityOffsets[nSectorIndex + 1] && nByte < nNumBytes; ++nOffset)
+	{
+		const uint8_t value = scene.sectorVisibility[nOffset];
+		if (value)
+			paMask[nByte / 4] |= (uint32_t)value << (8 * (nByte % 4));
+
+		nByte += value ? 1 : scene.sectorVisibility[++nOffset];
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+// Conservative sector to sector visibility (PVS) for culling the point lights. A shadow ray that gets through walks a
+// straight line from the vertex sector to the light's sector through a chain of adjoins, so a sector that no line through
+// the adjoins reaches from the light's sector can't get its light.
+// The visible sectors of a sector are found by a portal flood like Quake's vis: from each of its adjoins through the
+// adjoins of the sectors behind it, every adjoin clipped to the part a line through the first adjoin and the last one
+// can still pass (the separating planes between the two). A cheap flood per adjoin that only tests the adjoin planes
+// bounds what the clipped flood has to look at. The rows are made symmetric, the rays come from the other end.
+// Sectors that aren't closed around their center (rays can leave them without a hit) see and are seen by every sector.
+// The rows are run length compressed bitsets, BuildSectorLightLists and the light cache only keep the sectors the light's
+// sector can see.
+
+#include <cstdint>
+
+#include "BakeScene.h"
+
+// adjoins clipped for a sector before its row falls back to the cheap flood
+static constexpr int kMaxVisibilitySteps = 1 << 16;
+
+// Fills scene.sectorVisibilityOffsets and scene.sectorVisibility, run after BuildSectorBvhs (needs the surface planes)
+void BuildSectorVisibility(SBakeScene& scene);
+
+// ORs the sectors visible from a sector into a bitmask of GetMaskBucketCount(sectors) buckets, all of them if the scene
+// has no PVS
+void AddVisibleSectors(const SBakeScene& scene, int nSectorIndex, uint32_t* paMask);
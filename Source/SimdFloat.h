@@ -0,0 +1,132 @@
+#pragma once
+
+// Minimal SIMD lanes for the packet tracer: vfloat/vint hold kSimdWidth values, comparisons return a lane mask.
+// AVX2 builds use 8 lanes, SSE2 (any x64 or default x86 build) 4 lanes, anything else falls back to plain loops.
+// Min/Max match std::min/std::max operand order so results are bit identical to the scalar tracer.
+
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#define SIMD_FLOAT_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_FLOAT_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(SIMD_FLOAT_AVX2)
+
+static constexpr int kSimdWidth = 8;
+
+struct vfloat { __m256 v; };
+struct vint   { __m256i v; };
+
+inline vfloat Broadcast(float value)                    { return { _mm256_set1_ps(value) }; }
+inline vfloat Load(const float* paValues)               { return { _mm256_loadu_ps(paValues) }; }
+inline void   Store(float* paValues, const vfloat& a)   { _mm256_storeu_ps(paValues, a.v); }
+inline vint   BroadcastInt(int32_t value)               { return { _mm256_set1_epi32(value) }; }
+inline vint   LoadInt(const int32_t* paValues)          { return { _mm256_loadu_si256((const __m256i*)paValues) }; }
+
+inline vfloat operator+(const vfloat& a, const vfloat& b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline vfloat operator-(const vfloat& a, const vfloat& b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline vfloat operator*(const vfloat& a, const vfloat& b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline vfloat operator/(const vfloat& a, const vfloat& b) { return { _mm256_div_ps(a.v, b.v) }; }
+
+inline vfloat Min(const vfloat& a, const vfloat& b) { return { _mm256_min_ps(b.v, a.v) }; }
+inline vfloat Max(const vfloat& a, const vfloat& b) { return { _mm256_max_ps(b.v, a.v) }; }
+inline vfloat Abs(const vfloat& a)                  { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+
+inline vfloat operator<(const vfloat& a, const vfloat& b)  { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline vfloat operator<=(const vfloat& a, const vfloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline vfloat operator>(const vfloat& a, const vfloat& b)  { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline vfloat operator>(const vint& a, const vint& b)      { return { _mm256_castsi256_ps(_mm256_cmpgt_epi32(a.v, b.v)) }; }
+
+inline vfloat operator&(const vfloat& a, const vfloat& b) { return { _mm256_and_ps(a.v, b.v) }; }
+inline vfloat operator|(const vfloat& a, const vfloat& b) { return { _mm256_or_ps(a.v, b.v) }; }
+inline vfloat AndNot(const vfloat& a, const vfloat& b)    { return { _mm256_andnot_ps(b.v, a.v) }; } // a & ~b
+
+inline int    GetMask(const vfloat& mask)                                     { return _mm256_movemask_ps(mask.v); }
+inline vfloat MaskFromBits(int nBits)                                         { const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128); return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(nBits), bits), bits)) }; }
+inline vfloat Select(const vfloat& mask, const vfloat& a, const vfloat& b)    { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+
+#elif defined(SIMD_FLOAT_SSE2)
+
+static constexpr int kSimdWidth = 4;
+
+struct vfloat { __m128 v; };
+struct vint   { __m128i v; };
+
+inline vfloat Broadcast(float value)                    { return { _mm_set1_ps(value) }; }
+inline vfloat Load(const float* paValues)               { return { _mm_loadu_ps(paValues) }; }
+inline void   Store(float* paValues, const vfloat& a)   { _mm_storeu_ps(paValues, a.v); }
+inline vint   BroadcastInt(int32_t value)               { return { _mm_set1_epi32(value) }; }
+inline vint   LoadInt(const int32_t* paValues)          { return { _mm_loadu_si128((const __m128i*)paValues) }; }
+
+inline vfloat operator+(const vfloat& a, const vfloat& b) { return { _mm_add_ps(a.v, b.v) }; }
+inline vfloat operator-(const vfloat& a, const vfloat& b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline vfloat operator*(const vfloat& a, const vfloat& b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline vfloat operator/(const vfloat& a, const vfloat& b) { return { _mm_div_ps(a.v, b.v) }; }
+
+inline vfloat Min(const vfloat& a, const vfloat& b) { return { _mm_min_ps(b.v, a.v) }; }
+inline vfloat Max(const vfloat& a, const vfloat& b) { return { _mm_max_ps(b.v, a.v) }; }
+inline vfloat Abs(const vfloat& a)                  { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+
+inline vfloat operator<(const vfloat& a, const vfloat& b)  { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline vfloat operator<=(const vfloat& a, const vfloat& b) { return { _mm_cmple_ps(a.v, b.v) }; }
+inline vfloat operator>(const vfloat& a, const vfloat& b)  { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline vfloat operator>(const vint& a, const vint& b)      { return { _mm_castsi128_ps(_mm_cmpgt_epi32(a.v, b.v)) }; }
+
+inline vfloat operator&(const vfloat& a, const vfloat& b) { return { _mm_and_ps(a.v, b.v) }; }
+inline vfloat operator|(const vfloat& a, const vfloat& b) { return { _mm_or_ps(a.v, b.v) }; }
+inline vfloat AndNot(const vfloat& a, const vfloat& b)    { return { _mm_andnot_ps(b.v, a.v) }; } // a & ~b
+
+inline int    GetMask(const vfloat& mask)                                     { return _mm_movemask_ps(mask.v); }
+inline vfloat MaskFromBits(int nBits)                                         { const __m128i bits = _mm_setr_epi32(1, 2, 4, 8); return { _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(nBits), bits), bits)) }; }
+inline vfloat Select(const vfloat& mask, const vfloat& a, const vfloat& b)    { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+
+#else
+
+#include <string.h>
+
+static constexpr int kSimdWidth = 4;
+
+// masks are stored as all bits set (-nan) or 0.0f like the intrinsic versions
+struct vfloat { float v[kSimdWidth]; };
+struct vint   { int32_t v[kSimdWidth]; };
+
+inline float MaskLane(bool bValue) { const uint32_t nBits = bValue ? 0xFFFFFFFFu : 0u; float value; memcpy(&value, &nBits, sizeof(value)); return value; }
+inline bool  TestLane(float mask)  { uint32_t nBits; memcpy(&nBits, &mask, sizeof(nBits)); return nBits != 0; }
+
+#define SIMD_FLOAT_LANES(expr) for (int i = 0; i < kSimdWidth; ++i) { expr; }
+
+inline vfloat Broadcast(float value)                    { vfloat r; SIMD_FLOAT_LANES(r.v[i] = value); return r; }
+inline vfloat Load(const float* paValues)               { vfloat r; SIMD_FLOAT_LANES(r.v[i] = paValues[i]); return r; }
+inline void   Store(float* paValues, const vfloat& a)   { SIMD_FLOAT_LANES(paValues[i] = a.v[i]); }
+inline vint   BroadcastInt(int32_t value)               { vint r; SIMD_FLOAT_LANES(r.v[i] = value); return r; }
+inline vint   LoadInt(const int32_t* paValues)          { vint r; SIMD_FLOAT_LANES(r.v[i] = paValues[i]); return r; }
+
+inline vfloat operator+(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = a.v[i] + b.v[i]); return r; }
+inline vfloat operator-(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = a.v[i] - b.v[i]); return r; }
+inline vfloat operator*(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = a.v[i] * b.v[i]); return r; }
+inline vfloat operator/(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = a.v[i] / b.v[i]); return r; }
+
+inline vfloat Min(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = (b.v[i] < a.v[i]) ? b.v[i] : a.v[i]); return r; }
+inline vfloat Max(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = (a.v[i] < b.v[i]) ? b.v[i] : a.v[i]); return r; }
+inline vfloat Abs(const vfloat& a)                  { vfloat r; SIMD_FLOAT_LANES(r.v[i] = a.v[i] < 0.0f ? -a.v[i] : a.v[i]); return r; }
+
+inline vfloat operator<(const vfloat& a, const vfloat& b)  { vfloat r; SIMD_FLOAT_LANES(r.v[i] = MaskLane(a.v[i] < b.v[i])); return r; }
+inline vfloat operator<=(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = MaskLane(a.v[i] <= b.v[i])); return r; }
+inline vfloat operator>(const vfloat& a, const vfloat& b)  { vfloat r; SIMD_FLOAT_LANES(r.v[i] = MaskLane(a.v[i] > b.v[i])); return r; }
+inline vfloat operator>(const vint& a, const vint& b)      { vfloat r; SIMD_FLOAT_LANES(r.v[i] = MaskLane(a.v[i] > b.v[i])); return r; }
+
+inline vfloat operator&(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = MaskLane(TestLane(a.v[i]) && TestLane(b.v[i]))); return r; }
+inline vfloat operator|(const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = MaskLane(TestLane(a.v[i]) || TestLane(b.v[i]))); return r; }
+inline vfloat AndNot(const vfloat& a, const vfloat& b)    { vfloat r; SIMD_FLOAT_LANES(r.v[i] = MaskLane(TestLane(a.v[i]) && !TestLane(b.v[i]))); return r; }
+
+inline int    GetMask(const vfloat& mask)                                  { int nBits = 0; SIMD_FLOAT_LANES(nBits |= TestLane(mask.v[i]) ? (1 << i) : 0); return nBits; }
+inline vfloat MaskFromBits(int nBits)                                      { vfloat r; SIMD_FLOAT_LANES(r.v[i] = MaskLane((nBits >> i) & 1)); return r; }
+inline vfloat Select(const vfloat& mask, const vfloat& a, const vfloat& b) { vfloat r; SIMD_FLOAT_LANES(r.v[i] = TestLane(mask.v[i]) ? a.v[i] : b.v[i]); return r; }
+
+#undef SIMD_FLOAT_LANES
+
+#endif
@@ -0,0 +1,319 @@
+#include "Socket.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static constexpr int kListenBacklog = 64;
+static constexpr int kConnectRetryMs = 250;
+
+#ifdef _WIN32
+static bool InitSockets()
+{
+	static const bool bInitialized = []()
+	{
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	return bInitialized;
+}
+
+static void CloseSocket(intptr_t nSocket)
+{
+	closesocket((SOCKET)nSocket);
+}
+#else
+static bool InitSockets()
+{
+	return true;
+}
+
+static void CloseSocket(intptr_t nSocket)
+{
+	close((int)nSocket);
+}
+#endif
+
+static bool IsUnixAddress(const std::string& sAddress)
+{
+	return sAddress.compare(0, 5, "unix:") == 0;
+}
+
+// host:port, an empty host is any interface when listening and the local machine when connecting
+static bool SplitAddress(const std::string& sAddress, std::string& sHost, std::string& sPort)
+{
+	const size_t nColon = sAddress.find_last_of(':');
+	if (nColon == std::string::npos || nColon + 1 == sAddress.size())
+		return false;
+
+	sHost = sAddress.substr(0, nColon);
+	sPort = sAddress.substr(nColon + 1);
+	return true;
+}
+
+// the messages of the distributed bake are small requests followed by large arrays, don't hold the requests back
+static void SetNoDelay(intptr_t nSocket)
+{
+	int nValue = 1;
+	setsockopt(nSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&nValue, sizeof(nValue));
+}
+
+CSocket::CSocket(CSocket&& other) noexcept
+	: m_nSocket(other.m_nSocket)
+	, m_sUnixPath(std::move(other.m_sUnixPath))
+{
+	other.m_nSocket = kInvalidSocket;
+	other.m_sUnixPath.clear();
+}
+
+CSocket& CSocket::operator=(CSocket&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		m_nSocket = other.m_nSocket;
+		m_sUnixPath = std::move(other.m_sUnixPath);
+		other.m_nSocket = kInvalidSocket;
+		other.m_sUnixPath.clear();
+	}
+	return *this;
+}
+
+bool CSocket::Listen(const std::string& sAddress, std::string& sError)
+{
+	Close();
+	if (!InitSockets())
+	{
+		sError = "Failed to initialize sockets";
+		return false;
+	}
+
+	if (IsUnixAddress(sAddress))
+	{
+#ifdef _WIN32
+		sError = "Unix sockets aren't supported on Windows";
+		return false;
+#else
+		const std::string sPath = sAddress.substr(5);
+		sockaddr_un address = {};
+		if (sPath.empty() || sPath.size() >= sizeof(address.sun_path))
+		{
+			sError = "Bad socket path";
+			return false;
+		}
+		address.sun_family = AF_UNIX;
+		memcpy(address.sun_path, sPath.c_str(), sPath.size());
+
+		// a socket file left behind by an earlier run would fail the bind
+		unlink(sPath.c_str());
+		m_nSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (m_nSocket < 0 || bind((int)m_nSocket, (const sockaddr*)&address, sizeof(address)) != 0 || listen((int)m_nSocket, kListenBacklog) != 0)
+		{
+			Close();
+			sError = "Failed to listen on the socket";
+			return false;
+		}
+		m_sUnixPath = sPath;
+		return true;
+#endif
+	}
+
+	std::string sHost, sPort;
+	if (!SplitAddress(sAddress, sHost, sPort))
+	{
+		sError = "Expected host:port";
+		return false;
+	}
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	addrinfo* pResults = nullptr;
+	if (getaddrinfo(sHost.empty() ? nullptr : sHost.c_str(), sPort.c_str(), &hints, &pResults) != 0)
+	{
+		sError = "Failed to resolve the address";
+		return false;
+	}
+
+	for (const addrinfo* pInfo = pResults; pInfo && !IsOpen(); pInfo = pInfo->ai_next)
+	{
+		m_nSocket = (intptr_t)socket(pInfo->ai_family, pInfo->ai_socktype, pInfo->ai_protocol);
+		if (!IsOpen())
+			continue;
+
+		int nReuse = 1;
+		setsockopt(m_nSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&nReuse, sizeof(nReuse));
+		if (bind(m_nSocket, pInfo->ai_addr, (int)pInfo->ai_addrlen) != 0 || listen(m_nSocket, kListenBacklog) != 0)
+			Close();
+	}
+	freeaddrinfo(pResults);
+
+	if (!IsOpen())
+	{
+		sError = "Failed to listen on the address";
+		return false;
+	}
+	return true;
+}
+
+bool CSocket::Accept(CSocket& client, std::string& sError)
+{
+	client.Close();
+	const intptr_t nSocket = (intptr_t)accept(m_nSocket, nullptr, nullptr);
+	if (nSocket == kInvalidSocket)
+	{
+		sError = "Failed to accept a connection";
+		return false;
+	}
+
+	client.m_nSocket = nSocket;
+	if (m_sUnixPath.empty())
+		SetNoDelay(nSocket);
+	return true;
+}
+
+bool CSocket::Connect(const std::string& sAddress, int nTimeoutMs, std::string& sError)
+{
+	Close();
+	if (!InitSockets())
+	{
+		sError = "Failed to initialize sockets";
+		return false;
+	}
+
+	const auto endTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeoutMs);
+	for (;;)
+	{
+		if (IsUnixAddress(sAddress))
+		{
+#ifdef _WIN32
+			sError = "Unix sockets aren't supported on Windows";
+			return false;
+#else
+			const std::string sPath = sAddress.substr(5);
+			sockaddr_un address = {};
+			if (sPath.empty() || sPath.size() >= sizeof(address.sun_path))
+			{
+				sError = "Bad socket path";
+				return false;
+			}
+			address.sun_family = AF_UNIX;
+			memcpy(address.sun_path, sPath.c_str(), sPath.size());
+
+			m_nSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (IsOpen() && connect((int)m_nSocket, (const sockaddr*)&address, sizeof(address)) == 0)
+				return true;
+			Close();
+#endif
+		}
+		else
+		{
+			std::string sHost, sPort;
+			if (!SplitAddress(sAddress, sHost, sPort))
+			{
+				sError = "Expected host:port";
+				return false;
+			}
+
+			addrinfo hints = {};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+
+			addrinfo* pResults = nullptr;
+			if (getaddrinfo(sHost.empty() ? "localhost" : sHost.c_str(), sPort.c_str(), &hints, &pResults) == 0)
+			{
+				for (const addrinfo* pInfo = pResults; pInfo && !IsOpen(); pInfo = pInfo->ai_next)
+				{
+					m_nSocket = (intptr_t)socket(pInfo->ai_family, pInfo->ai_socktype, pInfo->ai_protocol);
+					if (IsOpen() && connect(m_nSocket, pInfo->ai_addr, (int)pInfo->ai_addrlen) != 0)
+						Close();
+				}
+				freeaddrinfo(pResults);
+			}
+
+			if (IsOpen())
+			{
+				SetNoDelay(m_nSocket);
+				return true;
+			}
+		}
+
+		if (std::chrono::steady_clock::now() >= endTime)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(kConnectRetryMs));
+	}
+
+	sError = "Failed to connect";
+	return false;
+}
+
+bool CSocket::Send(const void* pData, size_t nSize)
+{
+	const char* pBytes = (const char*)pData;
+	while (nSize > 0)
+	{
+		// chunks fit the int size of send on Windows
+		const int nChunk = (int)(nSize < (1u << 30) ? nSize : (1u << 30));
+#ifdef _WIN32
+		const int nSent = send((SOCKET)m_nSocket, pBytes, nChunk, 0);
+#else
+		const int nSent = (int)send((int)m_nSocket, pBytes, nChunk, MSG_NOSIGNAL);
+#endif
+		if (nSent <= 0)
+			return false;
+
+		pBytes += nSent;
+		nSize -= nSent;
+	}
+	return true;
+}
+
+bool CSocket::Receive(void* pData, size_t nSize)
+{
+	char* pBytes = (char*)pData;
+	while (nSize > 0)
+	{
+		const int nChunk = (int)(nSize < (1u << 30) ? nSize : (1u << 30));
+#ifdef _WIN32
+		const int nReceived = recv((SOCKET)m_nSocket, pBytes, nChunk, 0);
+#else
+		const int nReceived = (int)recv((int)m_nSocket, pBytes, nChunk, 0);
+#endif
+		if (nReceived <= 0)
+			return false;
+
+		pBytes += nReceived;
+		nSize -= nReceived;
+	}
+	return true;
+}
+
+void CSocket::Close()
+{
+	if (IsOpen())
+		CloseSocket(m_nSocket);
+	m_nSocket = kInvalidSocket;
+
+#ifndef _WIN32
+	if (!m_sUnixPath.empty())
+		unlink(m_sUnixPath.c_str());
+#endif
+	m_sUnixPath.clear();
+}
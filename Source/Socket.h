@@ -0,0 +1,39 @@
+#pragma once
+
+// Minimal blocking stream socket for the distributed bake (see DistributedBake.h).
+// Addresses are host:port for TCP, or unix:path for a Unix domain socket (not on Windows).
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class CSocket
+{
+public:
+	CSocket() = default;
+	~CSocket() { Close(); }
+
+	CSocket(const CSocket&) = delete;
+	CSocket& operator=(const CSocket&) = delete;
+	CSocket(CSocket&& other) noexcept;
+	CSocket& operator=(CSocket&& other) noexcept;
+
+	bool Listen(const std::string& sAddress, std::string& sError);
+	bool Accept(CSocket& client, std::string& sError);
+
+	// retries for up to nTimeoutMs so workers can be started before the coordinator
+	bool Connect(const std::string& sAddress, int nTimeoutMs, std::string& sError);
+
+	// both block until every byte is through, false if the connection closed or failed
+	bool Send(const void* pData, size_t nSize);
+	bool Receive(void* pData, size_t nSize);
+
+	void Close();
+	bool IsOpen() const { return m_nSocket != kInvalidSocket; }
+
+private:
+	static constexpr intptr_t kInvalidSocket = -1;
+
+	intptr_t    m_nSocket = kInvalidSocket;
+	std::string m_sUnixPath; // of a listening Unix socket, removed on Close
+};
@@ -0,0 +1,58 @@
+#include "VertexHash.h"
+
+static uint32_t FindSlot(const std::vector<SVertexHashCell>& cells, int32_t x, int32_t y, int32_t z)
+{
+	const uint32_t nMask = (uint32_t)cells.size() - 1;
+	uint32_t nSlot = GetVertexHashSlot(x, y, z, nMask);
+	while (cells[nSlot].nCount > 0 && (cells[nSlot].x != x || cells[nSlot].y != y || cells[nSlot].z != z))
+		nSlot = (nSlot + 1) & nMask;
+	return nSlot;
+}
+
+void BuildVertexHash(const SBakeScene& scene, SVertexHash& hash)
+{
+	const SVertexHashCell emptyCell = { 0, 0, 0, 0, 0 };
+	hash.cells.assign(GetVertexHashSize((int)scene.vertices.size()), emptyCell);
+	hash.vertices.resize(scene.vertices.size());
+
+	// count the vertices per cell, then hand out the ranges and fill them in vertex order
+	std::vector<uint32_t> vertexSlots(scene.vertices.size());
+	for (size_t nVertexIndex = 0; nVertexIndex < scene.vertices.size(); ++nVertexIndex)
+	{
+		const float4& position = scene.vertices[nVertexIndex].position;
+		const int32_t x = GetVertexHashCoord(position.x);
+		const int32_t y = GetVertexHashCoord(position.y);
+		const int32_t z = GetVertexHashCoord(position.z);
+
+		const uint32_t nSlot = FindSlot(hash.cells, x, y, z);
+		SVertexHashCell& cell = hash.cells[nSlot];
+		cell.x = x;
+		cell.y = y;
+		cell.z = z;
+		++cell.nCount;
+		vertexSlots[nVertexIndex] = nSlot;
+	}
+
+	uint32_t nFirst = 0;
+	for (SVertexHashCell& cell : hash.cells)
+	{
+		cell.nFirst = nFirst;
+		nFirst += cell.nCount;
+	}
+
+	std::vector<uint32_t> cellFill(hash.cells.size(), 0);
+	for (size_t nVertexIndex = 0; nVertexIndex < scene.vertices.size(); ++nVertexIndex)
+	{
+		const uint32_t nSlot = vertexSlots[nVertexIndex];
+		hash.vertices[hash.cells[nSlot].nFirst + cellFill[nSlot]++] = (uint32_t)nVertexIndex;
+	}
+}
+
+const SVertexHashCell* FindVertexHashCell(const SVertexHash& hash, int32_t x, int32_t y, int32_t z)
+{
+	if (hash.cells.empty())
+		return nullptr;
+
+	const SVertexHashCell& cell = hash.cells[FindSlot(hash.cells, x, y, z)];
+	return cell.nCount > 0 ? &cell : nullptr;
+}
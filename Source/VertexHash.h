@@ -0,0 +1,47 @@
+#pragma once
+
+// Spatial hash of the vertex positions, finds the coincident vertices for normal smoothing in near linear time.
+// Built on the CPU, the CPU baker and GenSmoothNormals.hlsl look up the same table.
+
+#include <cmath>
+
+#include "BakeScene.h"
+
+// vertices closer than this are smoothed (squared distance)
+static constexpr float kSmoothDistanceSqr = 1e-5f;
+
+// a few times the smoothing distance, so every vertex in range is in one of the 27 cells around a vertex
+// even if the shader rounds the cell of a vertex on a cell border the other way. Mirrored in GenSmoothNormals.hlsl
+static constexpr float kVertexHashCellSize = 0.01f;
+
+struct SVertexHash
+{
+	std::vector<SVertexHashCell> cells;    // open addressing with linear probing, GetVertexHashSize slots
+	std::vector<uint32_t>        vertices; // vertex indices, grouped by cell
+};
+
+// table size for nNumVertices vertices, a power of two with at most half the slots in use, the shader derives it the same way
+inline uint32_t GetVertexHashSize(int nNumVertices)
+{
+	uint32_t nSize = 1;
+	while (nSize < 2u * (uint32_t)nNumVertices)
+		nSize <<= 1;
+	return nSize;
+}
+
+inline int32_t GetVertexHashCoord(float position)
+{
+	return (int32_t)floorf(position * (1.0f / kVertexHashCellSize));
+}
+
+// mirrored in GenSmoothNormals.hlsl
+inline uint32_t GetVertexHashSlot(int32_t x, int32_t y, int32_t z, uint32_t nMask)
+{
+	return (((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u) ^ ((uint32_t)z * 83492791u)) & nMask;
+}
+
+// puts every vertex of the scene in the cell of its position
+void BuildVertexHash(const SBakeScene& scene, SVertexHash& hash);
+
+// the cell at x, y, z or null if it has no vertices
+const SVertexHashCell* FindVertexHashCell(const SVertexHash& hash, int32_t x, int32_t y, int32_t z);
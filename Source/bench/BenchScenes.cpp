@@ -0,0 +1,334 @@
+#include "BenchScenes.h"
+
+#include "../BakeTypes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// adds nU x nV quads spanning origin + u, origin + v, cross(u, v) has to point along the normal (into the sector)
+static void AddGridFace(SSceneSector& sector, const float3& origin, const float3& u, const float3& v, int nU, int nV, const float3& normal, uint32_t nSurfFlags)
+{
+	const uint32_t nFirstVertex = (uint32_t)sector.vertices.size();
+	for (int j = 0; j <= nV; ++j)
+	{
+		for (int i = 0; i <= nU; ++i)
+			sector.vertices.push_back(origin + u * ((float)i / nU) + v * ((float)j / nV));
+	}
+
+	for (int j = 0; j < nV; ++j)
+	{
+		for (int i = 0; i < nU; ++i)
+		{
+			SSceneSurface surface;
+			surface.nGeo = 4;
+			surface.bHasMaterial = true;
+			surface.nSurfFlags = nSurfFlags;
+			surface.normal = normal;
+			surface.nFirstIndex = (uint32_t)sector.indices.size();
+			surface.nNumIndices = 4;
+
+			// counter clockwise seen from the normal side
+			const uint32_t nCorner = nFirstVertex + j * (nU + 1) + i;
+			sector.indices.push_back(nCorner);
+			sector.indices.push_back(nCorner + 1);
+			sector.indices.push_back(nCorner + 1 + (nU + 1));
+			sector.indices.push_back(nCorner + (nU + 1));
+
+			sector.surfaces.push_back(surface);
+		}
+	}
+}
+
+void MakeOpenSectorScene(CMemorySceneSource& source, int nGridSize, float size, float height)
+{
+	source.sectors.assign(1, SSceneSector());
+	source.lights.clear();
+	source.nNumLayers = 1;
+
+	SSceneSector& sector = source.sectors[0];
+
+	const float3 x = { size, 0, 0 };
+	const float3 y = { 0, size, 0 };
+	const float3 z = { 0, 0, height };
+	const float3 origin = { 0, 0, 0 };
+	const float3 top = { 0, 0, height };
+
+	AddGridFace(sector, origin, x, y, nGridSize, nGridSize, float3(0, 0, 1), 0);
+	AddGridFace(sector, top, y, x, nGridSize, nGridSize, float3(0, 0, -1), ESky_Ceiling);
+	AddGridFace(sector, origin, z, x, 1, nGridSize, float3(0, 1, 0), 0);
+	AddGridFace(sector, y, x, z, nGridSize, 1, float3(0, -1, 0), 0);
+	AddGridFace(sector, origin, y, z, nGridSize, 1, float3(1, 0, 0), 0);
+	AddGridFace(sector, x, z, y, 1, nGridSize, float3(-1, 0, 0), 0);
+
+	SSceneLight light;
+	light.position = { size * 0.5f, size * 0.5f, height * 0.5f };
+	light.intensity = 1.0f;
+	light.range = size;
+	light.rgbIntensity = 1.0f;
+	light.nSectorIndex = 0;
+	source.lights.push_back(light);
+}
+
+// Box sector from origin to origin + extent, the floor and ceiling are split into nTiles x nTiles surfaces. aNeighbors are
+// the sectors behind the -y, +y, -x and +x walls, those walls are adjoins (-1 for a solid wall)
+static void AddBoxSector(SSceneSector& sector, const float3& origin, const float3& extent, int nTiles, const int aNeighbors[4], uint32_t nCeilingFlags)
+{
+	const float3 x = { extent.x, 0, 0 };
+	const float3 y = { 0, extent.y, 0 };
+	const float3 z = { 0, 0, extent.z };
+
+	AddGridFace(sector, origin, x, y, nTiles, nTiles, float3(0, 0, 1), 0);
+	AddGridFace(sector, origin + z, y, x, nTiles, nTiles, float3(0, 0, -1), nCeilingFlags);
+
+	struct SWall { float3 origin, u, v, normal; };
+	const SWall aWalls[] =
+	{
+		{ origin,     z, x, float3(0, 1, 0)  },
+		{ origin + y, x, z, float3(0, -1, 0) },
+		{ origin,     y, z, float3(1, 0, 0)  },
+		{ origin + x, z, y, float3(-1, 0, 0) },
+	};
+	for (int nWall = 0; nWall < 4; ++nWall)
+	{
+		const SWall& wall = aWalls[nWall];
+		AddGridFace(sector, wall.origin, wall.u, wall.v, 1, 1, wall.normal, 0);
+		if (aNeighbors[nWall] >= 0)
+		{
+			SSceneSurface& surface = sector.surfaces.back();
+			surface.nAdjoinSector = aNeighbors[nWall];
+			surface.nGeo = 0;
+			surface.bHasMaterial = false;
+		}
+	}
+}
+
+static SSceneLight MakePointLight(const float3& position, float range, int nSectorIndex)
+{
+	SSceneLight light;
+	light.position = position;
+	light.intensity = 1.0f;
+	light.range = range;
+	light.rgbIntensity = 1.0f;
+	light.nSectorIndex = nSectorIndex;
+	return light;
+}
+
+// nCells x nCells box sectors joined to their neighbors, only through the walls set in pOpenWalls (4 per cell) if given
+static void MakeCellGrid(CMemorySceneSource& source, int nCells, const float3& extent, int nTiles, const std::vector<char>* pOpenWalls, uint32_t nCeilingFlags)
+{
+	source.sectors.assign(nCells * nCells, SSceneSector());
+	source.lights.clear();
+	source.nNumLayers = 1;
+
+	for (int nCellY = 0; nCellY < nCells; ++nCellY)
+	{
+		for (int nCellX = 0; nCellX < nCells; ++nCellX)
+		{
+			const int nSectorIndex = nCellY * nCells + nCellX;
+			int aNeighbors[4] =
+			{
+				nCellY > 0 ? nSectorIndex - nCells : -1,
+				nCellY < nCells - 1 ? nSectorIndex + nCells : -1,
+				nCellX > 0 ? nSectorIndex - 1 : -1,
+				nCellX < nCells - 1 ? nSectorIndex + 1 : -1,
+			};
+			for (int nWall = 0; nWall < 4 && pOpenWalls; ++nWall)
+			{
+				if (!(*pOpenWalls)[nSectorIndex * 4 + nWall])
+					aNeighbors[nWall] = -1;
+			}
+
+			const float3 origin = { nCellX * extent.x, nCellY * extent.y, 0 };
+			AddBoxSector(source.sectors[nSectorIndex], origin, extent, nTiles, aNeighbors, nCeilingFlags);
+		}
+	}
+}
+
+void MakeRoomGridScene(CMemorySceneSource& source, int nRooms, int nTiles, float size, float height)
+{
+	MakeCellGrid(source, nRooms, float3(size, size, height), nTiles, nullptr, 0);
+
+	for (int nSectorIndex = 0; nSectorIndex < nRooms * nRooms; ++nSectorIndex)
+	{
+		const float3 origin = { (nSectorIndex % nRooms) * size, (nSectorIndex / nRooms) * size, 0 };
+		source.lights.push_back(MakePointLight(origin + float3(size * 0.5f, size * 0.5f, height * 0.5f), size * 1.5f, nSectorIndex));
+	}
+}
+
+void MakeCorridorScene(CMemorySceneSource& source, int nSegments, float length, float width, float height)
+{
+	source.sectors.assign(nSegments, SSceneSector());
+	source.lights.clear();
+	source.nNumLayers = 1;
+
+	const float3 extent = { length, width, height };
+	for (int nSectorIndex = 0; nSectorIndex < nSegments; ++nSectorIndex)
+	{
+		const int aNeighbors[4] = { -1, -1, nSectorIndex - 1, nSectorIndex < nSegments - 1 ? nSectorIndex + 1 : -1 };
+		const float3 origin = { nSectorIndex * length, 0, 0 };
+		AddBoxSector(source.sectors[nSectorIndex], origin, extent, 2, aNeighbors, 0);
+
+		if (nSectorIndex % 2 == 0)
+			source.lights.push_back(MakePointLight(origin + extent * 0.5f, length * 2.0f, nSectorIndex));
+	}
+}
+
+void MakeCourtyardScene(CMemorySceneSource& source, int nCells, float size, float height)
+{
+	MakeCellGrid(source, nCells, float3(size, size, height), 4, nullptr, ESky_Ceiling);
+
+	// a low sun, so the walls cast long shadows, and the sky
+	SSceneLight sun;
+	sun.position = { 0.4f, 0.3f, 0.6f };
+	sun.color = { 1.0f, 0.9f, 0.8f };
+	sun.intensity = 1.0f;
+	sun.rgbIntensity = 1.0f;
+	sun.nFlags = ELight_Sun;
+	source.lights.push_back(sun);
+
+	SSceneLight sky;
+	sky.color = { 0.4f, 0.5f, 0.7f };
+	sky.intensity = 0.5f;
+	sky.rgbIntensity = 0.5f;
+	sky.nFlags = ELight_Sky;
+	source.lights.push_back(sky);
+}
+
+void MakeMazeScene(CMemorySceneSource& source, int nCells, float size, float height, unsigned nSeed)
+{
+	// depth first maze over the cells, then some extra openings so rays find loops
+	std::mt19937 rng(nSeed);
+	std::vector<char> openWalls(nCells * nCells * 4, 0);
+	std::vector<char> visited(nCells * nCells, 0);
+	std::vector<int> stack = { 0 };
+	visited[0] = 1;
+
+	static const int aDx[4] = { 0, 0, -1, 1 };
+	static const int aDy[4] = { -1, 1, 0, 0 };
+	static const int aOpposite[4] = { 1, 0, 3, 2 };
+	auto open = [&](int nCell, int nWall)
+	{
+		const int nOther = nCell + aDy[nWall] * nCells + aDx[nWall];
+		openWalls[nCell * 4 + nWall] = 1;
+		openWalls[nOther * 4 + aOpposite[nWall]] = 1;
+	};
+	auto isInside = [&](int nCell, int nWall)
+	{
+		const int x = nCell % nCells + aDx[nWall], y = nCell / nCells + aDy[nWall];
+		return x >= 0 && y >= 0 && x < nCells && y < nCells;
+	};
+
+	while (!stack.empty())
+	{
+		const int nCell = stack.back();
+		int anWalls[4], nNumWalls = 0;
+		for (int nWall = 0; nWall < 4; ++nWall)
+		{
+			if (isInside(nCell, nWall) && !visited[nCell + aDy[nWall] * nCells + aDx[nWall]])
+				anWalls[nNumWalls++] = nWall;
+		}
+
+		if (nNumWalls == 0)
+		{
+			stack.pop_back();
+			continue;
+		}
+
+		const int nWall = anWalls[rng() % nNumWalls];
+		const int nNext = nCell + aDy[nWall] * nCells + aDx[nWall];
+		open(nCell, nWall);
+		visited[nNext] = 1;
+		stack.push_back(nNext);
+	}
+
+	for (int nCell = 0; nCell < nCells * nCells; ++nCell)
+	{
+		const int nWall = rng() % 4;
+		if (rng() % 8 == 0 && isInside(nCell, nWall))
+			open(nCell, nWall);
+	}
+
+	MakeCellGrid(source, nCells, float3(size, size, height), 2, &openWalls, 0);
+
+	for (int nSectorIndex = 0; nSectorIndex < nCells * nCells; nSectorIndex += 4)
+	{
+		const float3 origin = { (nSectorIndex % nCells) * size, (nSectorIndex / nCells) * size, 0 };
+		source.lights.push_back(MakePointLight(origin + float3(size * 0.5f, size * 0.5f, height * 0.5f), size * 3.0f, nSectorIndex));
+	}
+}
+
+void MakeHallScene(CMemorySceneSource& source, int nCells, int nLightsPerCell, float size, float height, unsigned nSeed)
+{
+	MakeCellGrid(source, nCells, float3(size, size, height), 4, nullptr, 0);
+
+	std::mt19937 rng(nSeed);
+	std::uniform_real_distribution<float> unit(0.1f, 0.9f);
+	for (int nSectorIndex = 0; nSectorIndex < nCells * nCells; ++nSectorIndex)
+	{
+		const float3 origin = { (nSectorIndex % nCells) * size, (nSectorIndex / nCells) * size, 0 };
+		for (int nLight = 0; nLight < nLightsPerCell; ++nLight)
+		{
+			SSceneLight light = MakePointLight(origin + float3(size * unit(rng), size * unit(rng), height * unit(rng)), size * 1.5f, nSectorIndex);
+			light.color = { unit(rng), unit(rng), unit(rng) };
+			source.lights.push_back(light);
+		}
+	}
+}
+
+// adds a surface over the sector vertices in anIndices, wound so its normal points towards inside
+static void AddPolygon(SSceneSector& sector, std::initializer_list<uint32_t> anIndices, const float3& inside)
+{
+	std::vector<uint32_t> indices(anIndices);
+	const float3 v0 = sector.vertices[indices[0]];
+	float3 normal = normalize(cross(sector.vertices[indices[1]] - v0, sector.vertices[indices[2]] - v0));
+	if (dot(normal, inside - v0) < 0.0f)
+	{
+		std::reverse(indices.begin(), indices.end());
+		normal = normal * -1.0f;
+	}
+
+	SSceneSurface surface;
+	surface.nGeo = 4;
+	surface.bHasMaterial = true;
+	surface.normal = normal;
+	surface.nFirstIndex = (uint32_t)sector.indices.size();
+	surface.nNumIndices = (uint32_t)indices.size();
+	sector.indices.insert(sector.indices.end(), indices.begin(), indices.end());
+	sector.surfaces.push_back(surface);
+}
+
+void MakeDomeScene(CMemorySceneSource& source, int nSegments, float radius)
+{
+	source.sectors.assign(1, SSceneSector());
+	source.lights.clear();
+	source.nNumLayers = 1;
+
+	SSceneSector& sector = source.sectors[0];
+	const int nRings = std::max(nSegments / 4, 1);
+	const float3 inside = { 0, 0, radius * 0.25f };
+
+	// the top, then nRings rings of nSegments vertices down to the floor, then the floor center
+	const uint32_t nTop = 0;
+	sector.vertices.push_back(float3(0, 0, radius));
+	for (int nRing = 1; nRing <= nRings; ++nRing)
+	{
+		const float elevation = 1.5707963f * (1.0f - (float)nRing / nRings);
+		for (int nSegment = 0; nSegment < nSegments; ++nSegment)
+		{
+			const float azimuth = 6.2831853f * nSegment / nSegments;
+			sector.vertices.push_back(float3(cosf(azimuth) * cosf(elevation), sinf(azimuth) * cosf(elevation), sinf(elevation)) * radius);
+		}
+	}
+	const uint32_t nCenter = (uint32_t)sector.vertices.size();
+	sector.vertices.push_back(float3(0, 0, 0));
+
+	auto ringVertex = [&](int nRing, int nSegment) { return (uint32_t)(1 + (nRing - 1) * nSegments + nSegment % nSegments); };
+	for (int nSegment = 0; nSegment < nSegments; ++nSegment)
+	{
+		AddPolygon(sector, { nTop, ringVertex(1, nSegment), ringVertex(1, nSegment + 1) }, inside);
+		for (int nRing = 1; nRing < nRings; ++nRing)
+			AddPolygon(sector, { ringVertex(nRing, nSegment), ringVertex(nRing + 1, nSegment), ringVertex(nRing + 1, nSegment + 1), ringVertex(nRing, nSegment + 1) }, inside);
+		AddPolygon(sector, { nCenter, ringVertex(nRings, nSegment), ringVertex(nRings, nSegment + 1) }, inside);
+	}
+}
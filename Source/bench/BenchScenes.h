@@ -0,0 +1,31 @@
+#pragma once
+
+// Procedural levels for the benchmarks, built straight into a CMemorySceneSource
+
+#include "../SceneSource.h"
+
+// Single box sector of size x size x height, the floor, walls and sky ceiling are split into
+// nGridSize x nGridSize tiles, giving 2 * nGridSize^2 + 4 * nGridSize surfaces (a big outdoor sector)
+void MakeOpenSectorScene(CMemorySceneSource& source, int nGridSize, float size, float height);
+
+// nRooms x nRooms grid of box sectors of size x size x height joined by full wall adjoins, the floor and ceiling of every
+// room are split into nTiles x nTiles surfaces and every room has a light in its center reaching into the next rooms
+void MakeRoomGridScene(CMemorySceneSource& source, int nRooms, int nTiles, float size, float height);
+
+// Chain of nSegments box sectors of length x width x height joined end to end, a light in every other one (an indoor
+// corridor, rays cross many adjoins along it)
+void MakeCorridorScene(CMemorySceneSource& source, int nSegments, float length, float width, float height);
+
+// nCells x nCells open grid of sectors with sky ceilings and solid outer walls, lit by a sun and a sky light
+void MakeCourtyardScene(CMemorySceneSource& source, int nCells, float size, float height);
+
+// nCells x nCells grid of small sectors joined by the passages of a random maze (plus some loops), a light in every
+// fourth cell
+void MakeMazeScene(CMemorySceneSource& source, int nCells, float size, float height, unsigned nSeed);
+
+// nCells x nCells open grid of sectors with nLightsPerCell randomly placed and colored lights each
+void MakeHallScene(CMemorySceneSource& source, int nCells, int nLightsPerCell, float size, float height, unsigned nSeed);
+
+// Single sector dome of nSegments x nSegments / 4 facets with a floor fanning out from its center, high valence vertices for
+// the smoothing benchmark (nSegments surfaces meet at the top and at the floor center)
+void MakeDomeScene(CMemorySceneSource& source, int nSegments, float radius);
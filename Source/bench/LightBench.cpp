@@ -0,0 +1,1831 @@
+// lightbench: micro benchmarks for the CPU baker on procedural levels, see PrintUsage for the options
+
+#include <cfloat>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "../BakeProfile.h"
+#include "../CompactLayout.h"
+#include "../CpuBaker.h"
+#include "../CpuTracer.h"
+#include "../DistributedBake.h"
+#include "../JobSystem.h"
+#include "../LightCache.h"
+#include "../LightCulling.h"
+#include "../SceneBuilder.h"
+#include "../SceneFile.h"
+#include "../SceneResidency.h"
+#include "../SectorBvh.h"
+#include "../SectorProbes.h"
+#include "../SectorVisibility.h"
+#include "../VertexHash.h"
+#include "BenchScenes.h"
+
+struct SOptions
+{
+	std::string      sMode;
+	std::vector<int> gridSizes = { 4, 8, 16, 32 };
+	int              nRays = 200000;
+	int              nMoves = 16;
+	int              nTileVertices = 4096;
+	int              nBatchRays = 64;
+	float            adaptiveThreshold = kDefaultAdaptiveThreshold;
+	int              nLightsPerRoom = 8;
+	unsigned         nSeed = 1234;
+	std::string      sScenes = "corridor,courtyard,maze,hall";
+	std::string      sJsonPath; // stdout if empty
+	std::string      sAddress;  // coordinator of a worker process of the distributed check
+	std::string      sExePath;  // argv[0], started again for the worker processes
+};
+
+// The original linear TraceSurfaces (every surface, edges rebuilt from the vertices), the baseline for the trace benchmark
+static bool IsPointOnSurfaceLinear(const SBakeScene& scene, int nSurfaceIndex, const float3& position)
+{
+	const SSurface& surface = scene.surfaces[nSurfaceIndex];
+	const float3 normal = ToFloat3(surface.normal);
+	for (uint32_t i = 0; i < surface.nNumVertices; ++i)
+	{
+		const float3 vertex1 = ToFloat3(scene.vertices[surface.nFirstVertex + i].position);
+		const float3 vertex2 = ToFloat3(scene.vertices[surface.nFirstVertex + (i + 1) % surface.nNumVertices].position);
+		if (dot(cross(normal, vertex2 - vertex1), position - vertex1) < -1e-3f)
+			return false;
+	}
+	return true;
+}
+
+static bool TraceSurfacesLinear(const SBakeScene& scene, int nSectorIndex, const float3& start, const float3& end, float3& hitPos, int& nHitSurfaceIndex)
+{
+	const SSector& sector = scene.sectors[nSectorIndex];
+	for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const SSurface& surface = scene.surfaces[nSurfaceIndex];
+		const float3 normal = ToFloat3(surface.normal);
+		if (surface.nNumVertices == 0 || dot(normal, end - start) >= 0)
+			continue;
+
+		const float3 vertex = ToFloat3(scene.vertices[surface.nFirstVertex].position);
+		const float distToStart = dot(normal, start - vertex);
+		const float distToEnd = dot(normal, end - vertex);
+		if ((distToStart > 0.0001f && distToEnd > 0.0001f) || (distToStart < -0.0001f && distToEnd < -0.0001f))
+			continue;
+
+		if (fabsf(distToStart) <= 0.0001f && fabsf(distToEnd) <= 0.0001f)
+		{
+			hitPos = start;
+			nHitSurfaceIndex = nSurfaceIndex;
+			return true;
+		}
+
+		const float s = distToStart / (distToStart - distToEnd);
+		hitPos = start + s * (end - start);
+		if (IsPointOnSurfaceLinear(scene, nSurfaceIndex, hitPos))
+		{
+			nHitSurfaceIndex = nSurfaceIndex;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void PrintUsage()
+{
+	printf(
+		"usage: lightbench <mode> [options]\n"
+		"\n"
+		"modes:\n"
+		"  trace               rays/second of TraceSurfaces in one big sector, linear scan vs sector bvh\n"
+		"  packet              rays/second of hemisphere rays in one big sector, TraceRay vs TraceRayPacket\n"
+		"  relight             moving single lights in a grid of rooms, full direct bake vs CLightCache::Update\n"
+		"  upload              editing single rooms in a grid of rooms, bytes uploaded by CSceneResidency vs the whole scene\n"
+		"  progressive         lights and indirect light in a grid of rooms, one shot bake vs CBakeScheduler tiles and batches\n"
+		"  adaptive            indirect light in a grid of rooms, fixed ray count vs adaptive ray count at the same budget\n"
+		"  weld                lights and indirect light in a grid of rooms, every vertex traced vs welded vertices\n"
+		"  smooth              normal smoothing of a dome with 8 * grid segments, pair scan per sector vs vertex hash\n"
+		"  lights              direct light of a grid of rooms with --lights lights each, every light vs sector light lists\n"
+		"  visibility          direct light of a maze of grid x grid cells, sector light lists without vs with the sector PVS\n"
+		"  emissive            emissive light of a grid of rooms lit by one ceiling tile each, hemisphere rays vs emissive samples\n"
+		"                      at 16 to 256 rays, error against a 4096 ray reference\n"
+		"  scenefile           scene setup of a grid of rooms, building and smoothing it vs mapping an exported scene file\n"
+		"  layout              hemisphere rays and indirect bakes in a grid of rooms, full vs compact layout, bytes read per ray\n"
+		"  check               correctness checks that don't depend on timing, exits with 1 if one of them fails\n"
+		"  worker              worker process of the distributed bake check, bakes the jobs of the coordinator on --address\n"
+		"  suite               every pass of a full bake of the --scenes levels, rays/s, adjoin hops per ray, vertices/s and\n"
+		"                      peak memory as JSON. The grid size is the cells per side (corridor: grid^2 segments)\n"
+		"\n"
+		"options:\n"
+		"  --grid <n,n,...>    tiles per side of the benchmark sector, rooms per side for relight (default 4,8,16,32)\n"
+		"  --rays <n>          rays per run (default 200000)\n"
+		"  --moves <n>         light moves per relight run (default 16)\n"
+		"  --tile <n>          vertices per work item of the progressive bake (default 4096)\n"
+		"  --batch <n>         rays per vertex in a batch of the progressive bake (default 64)\n"
+		"  --threshold <x>     relative error the adaptive bake stops a vertex at (default 0.004)\n"
+		"  --lights <n>        lights per room of the lights benchmark (default 8)\n"
+		"  --seed <n>          random seed (default 1234)\n"
+		"  --scenes <a,b,...>  levels of the suite: corridor, courtyard, maze, hall (default all)\n"
+		"  --json <file>       write the suite results to a file instead of stdout\n"
+		"  --address <address> coordinator of the worker mode, host:port or unix:path\n");
+}
+
+static bool ParseOptions(int argc, char** argv, SOptions& options)
+{
+	if (argc < 2)
+		return false;
+
+	options.sMode = argv[1];
+	options.sExePath = argv[0];
+	for (int i = 2; i < argc; ++i)
+	{
+		const std::string sArg = argv[i];
+		const char* sValue = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (sArg == "--grid" && sValue)
+		{
+			options.gridSizes.clear();
+			for (const char* s = sValue; *s; )
+			{
+				char* sEnd = nullptr;
+				const long nSize = strtol(s, &sEnd, 10);
+				if (sEnd == s || nSize < 1)
+					return false;
+				options.gridSizes.push_back((int)nSize);
+				s = (*sEnd == ',') ? sEnd + 1 : sEnd;
+			}
+			++i;
+		}
+		else if (sArg == "--rays" && sValue)
+		{
+			options.nRays = atoi(sValue);
+			++i;
+		}
+		else if (sArg == "--moves" && sValue)
+		{
+			options.nMoves = atoi(sValue);
+			++i;
+		}
+		else if (sArg == "--tile" && sValue)
+		{
+			options.nTileVertices = atoi(sValue);
+			++i;
+		}
+		else if (sArg == "--batch" && sValue)
+		{
+			options.nBatchRays = atoi(sValue);
+			++i;
+		}
+		else if (sArg == "--threshold" && sValue)
+		{
+			options.adaptiveThreshold = (float)atof(sValue);
+			++i;
+		}
+		else if (sArg == "--lights" && sValue)
+		{
+			options.nLightsPerRoom = atoi(sValue);
+			++i;
+		}
+		else if (sArg == "--seed" && sValue)
+		{
+			options.nSeed = (unsigned)strtoul(sValue, nullptr, 10);
+			++i;
+		}
+		else if (sArg == "--scenes" && sValue)
+		{
+			options.sScenes = sValue;
+			++i;
+		}
+		else if (sArg == "--json" && sValue)
+		{
+			options.sJsonPath = sValue;
+			++i;
+		}
+		else if (sArg == "--address" && sValue)
+		{
+			options.sAddress = sValue;
+			++i;
+		}
+		else
+		{
+			fprintf(stderr, "error: unknown option '%s'.\n", sArg.c_str());
+			return false;
+		}
+	}
+	return options.nRays > 0 && options.nMoves > 0 && options.nTileVertices > 0 && options.nBatchRays > 0 && options.nLightsPerRoom > 0 && !options.gridSizes.empty();
+}
+
+static int RunTraceBench(const SOptions& options)
+{
+	static constexpr float kSize = 256.0f;
+	static constexpr float kHeight = 64.0f;
+
+	printf("%8s %8s %14s %14s %8s %10s\n", "grid", "surfaces", "linear rays/s", "bvh rays/s", "speedup", "mismatches");
+	for (int nGridSize : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeOpenSectorScene(source, nGridSize, kSize, kHeight);
+
+		SSceneSnapshot snapshot;
+		TakeSceneSnapshot(source, snapshot);
+
+		SBakeScene scene;
+		BuildBakeScene(snapshot, ELightBake_Direct, scene);
+
+		// sky length rays from random points inside the sector
+		std::mt19937 rng(options.nSeed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<float3> starts(options.nRays), ends(options.nRays);
+		for (int nRay = 0; nRay < options.nRays; ++nRay)
+		{
+			const float3 start = { kSize * (0.01f + 0.98f * unit(rng)), kSize * (0.01f + 0.98f * unit(rng)), kHeight * (0.01f + 0.98f * unit(rng)) };
+			const float cosTheta = 2.0f * unit(rng) - 1.0f;
+			const float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+			const float phi = 2.0f * 3.141592f * unit(rng);
+			starts[nRay] = start;
+			ends[nRay] = start + float3(cosf(phi) * sinTheta, sinf(phi) * sinTheta, cosTheta) * kSkyDistance;
+		}
+
+		std::vector<int> linearHits(options.nRays, -1), bvhHits(options.nRays, -1);
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (int nRay = 0; nRay < options.nRays; ++nRay)
+		{
+			float3 hitPos;
+			TraceSurfacesLinear(scene, 0, starts[nRay], ends[nRay], hitPos, linearHits[nRay]);
+		}
+		const std::chrono::duration<double> linearTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		const CCpuTracer tracer(scene, nullptr);
+		startTime = std::chrono::high_resolution_clock::now();
+		for (int nRay = 0; nRay < options.nRays; ++nRay)
+		{
+			float3 hitPos;
+			tracer.TraceSurfaces(0, starts[nRay], ends[nRay], hitPos, bvhHits[nRay]);
+		}
+		const std::chrono::duration<double> bvhTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		int nMismatches = 0;
+		for (int nRay = 0; nRay < options.nRays; ++nRay)
+			nMismatches += linearHits[nRay] != bvhHits[nRay];
+
+		const double linearRate = options.nRays / linearTime.count();
+		const double bvhRate = options.nRays / bvhTime.count();
+		printf("%8d %8d %14.0f %14.0f %7.2fx %10d\n", nGridSize, (int)scene.surfaces.size(), linearRate, bvhRate, bvhRate / linearRate, nMismatches);
+	}
+	return 0;
+}
+
+static bool IsSamePayload(const SRayPayload& a, const SRayPayload& b)
+{
+	return a.nHitSurfaceIndex == b.nHitSurfaceIndex
+		&& a.hitPos.x == b.hitPos.x && a.hitPos.y == b.hitPos.y && a.hitPos.z == b.hitPos.z
+		&& memcmp(&a.attenuation, &b.attenuation, sizeof(float4)) == 0
+		&& memcmp(&a.reflection, &b.reflection, sizeof(float4)) == 0;
+}
+
+// bake scene of the source with every sector and layer enabled
+static void BuildBenchScene(CMemorySceneSource& source, uint32_t nBakeFlags, SBakeScene& scene)
+{
+	SSceneSnapshot snapshot;
+	TakeSceneSnapshot(source, snapshot);
+
+	scene.Clear();
+	BuildBakeScene(snapshot, nBakeFlags, scene);
+	scene.sectorMasks.assign(GetMaskBucketCount(scene.levelInfo.nTotalSectors), 0);
+	for (int nSectorIndex = 0; nSectorIndex < scene.levelInfo.nTotalSectors; ++nSectorIndex)
+		SetMaskBit(scene.sectorMasks.data(), nSectorIndex);
+	scene.layerMasks.assign(GetMaskBucketCount(snapshot.nNumLayers), 0);
+	for (int nLayerIndex = 0; nLayerIndex < snapshot.nNumLayers; ++nLayerIndex)
+		SetMaskBit(scene.layerMasks.data(), nLayerIndex);
+}
+
+// like the sky and indirect passes, a full hemisphere of rays per point
+static constexpr int kPacketBenchRaysPerPoint = 256;
+
+struct SPacketBenchResult
+{
+	double scalarRate = 0.0;
+	double packetRate = 0.0;
+	int    nMismatches = 0;
+};
+
+// Hemisphere rays of every point from its sector, TraceRay against TraceRayPacket
+static SPacketBenchResult RunPacketRays(const SBakeScene& scene, const std::vector<float3>& points, const std::vector<float3>& normals,
+	const std::vector<int>& pointSectors)
+{
+	const int nTotalRays = (int)points.size() * kPacketBenchRaysPerPoint;
+	std::vector<float3> starts(nTotalRays), ends(nTotalRays);
+	for (size_t nPoint = 0; nPoint < points.size(); ++nPoint)
+	{
+		const STangentFrame frame = GenerateTangentFrame(normals[nPoint]);
+		for (int nRayIndex = 0; nRayIndex < kPacketBenchRaysPerPoint; ++nRayIndex)
+		{
+			const float3 rayDir = TransformRay(GenRay(nRayIndex, kPacketBenchRaysPerPoint), frame);
+			starts[nPoint * kPacketBenchRaysPerPoint + nRayIndex] = points[nPoint] + rayDir * kRayBias;
+			ends[nPoint * kPacketBenchRaysPerPoint + nRayIndex] = kSkyDistance * rayDir + points[nPoint];
+		}
+	}
+
+	std::vector<SRayPayload> scalarPayloads(nTotalRays), packetPayloads(nTotalRays);
+	std::vector<char> scalarHits(nTotalRays), packetHits(nTotalRays);
+	const CCpuTracer tracer(scene, nullptr);
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	for (int nRay = 0; nRay < nTotalRays; ++nRay)
+		scalarHits[nRay] = tracer.TraceRay(scalarPayloads[nRay], pointSectors[nRay / kPacketBenchRaysPerPoint], starts[nRay], ends[nRay]);
+	const std::chrono::duration<double> scalarTime = std::chrono::high_resolution_clock::now() - startTime;
+
+	// kPacketBenchRaysPerPoint is a multiple of the packet size, packets never straddle two points
+	startTime = std::chrono::high_resolution_clock::now();
+	for (int nRay = 0; nRay < nTotalRays; nRay += kRayPacketSize)
+	{
+		SRayPacket packet;
+		packet.nCount = kRayPacketSize;
+		for (int nLane = 0; nLane < kRayPacketSize; ++nLane)
+			packet.Set(nLane, starts[nRay + nLane], ends[nRay + nLane]);
+
+		const int nHitMask = tracer.TraceRayPacket(&packetPayloads[nRay], pointSectors[nRay / kPacketBenchRaysPerPoint], packet);
+		for (int nLane = 0; nLane < kRayPacketSize; ++nLane)
+			packetHits[nRay + nLane] = (nHitMask >> nLane) & 1;
+	}
+	const std::chrono::duration<double> packetTime = std::chrono::high_resolution_clock::now() - startTime;
+
+	SPacketBenchResult result;
+	for (int nRay = 0; nRay < nTotalRays; ++nRay)
+		result.nMismatches += scalarHits[nRay] != packetHits[nRay] || !IsSamePayload(scalarPayloads[nRay], packetPayloads[nRay]);
+	result.scalarRate = nTotalRays / scalarTime.count();
+	result.packetRate = nTotalRays / packetTime.count();
+	return result;
+}
+
+static int RunPacketBench(const SOptions& options)
+{
+	static constexpr float kSize = 256.0f;
+	static constexpr float kHeight = 64.0f;
+	static constexpr float kRoomSize = 64.0f;
+	static constexpr float kRoomHeight = 32.0f;
+
+	const int nNumPoints = (options.nRays + kPacketBenchRaysPerPoint - 1) / kPacketBenchRaysPerPoint;
+
+	printf("packet size %d\n", kRayPacketSize);
+	printf("%8s %8s %8s %14s %14s %8s %10s\n", "scene", "grid", "surfaces", "scalar rays/s", "packet rays/s", "speedup", "mismatches");
+	for (int nGridSize : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeOpenSectorScene(source, nGridSize, kSize, kHeight);
+
+		SSceneSnapshot snapshot;
+		TakeSceneSnapshot(source, snapshot);
+
+		SBakeScene scene;
+		BuildBakeScene(snapshot, ELightBake_Direct, scene);
+
+		// random points on the floor and the walls, facing into the sector
+		std::mt19937 rng(options.nSeed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<float3> points(nNumPoints), normals(nNumPoints);
+		for (int nPoint = 0; nPoint < nNumPoints; ++nPoint)
+		{
+			const float u = kSize * unit(rng);
+			const float v = unit(rng);
+			switch (nPoint % 3)
+			{
+			case 0: points[nPoint] = { u, kSize * v, 0.0f }; normals[nPoint] = { 0, 0, 1 }; break;
+			case 1: points[nPoint] = { u, 0.0f, kHeight * v }; normals[nPoint] = { 0, 1, 0 }; break;
+			default: points[nPoint] = { 0.0f, u, kHeight * v }; normals[nPoint] = { 1, 0, 0 }; break;
+			}
+		}
+
+		const SPacketBenchResult result = RunPacketRays(scene, points, normals, std::vector<int>(nNumPoints, 0));
+		printf("%8s %8d %8d %14.0f %14.0f %7.2fx %10d\n", "open", nGridSize, (int)scene.surfaces.size(), result.scalarRate, result.packetRate,
+			result.packetRate / result.scalarRate, result.nMismatches);
+	}
+
+	// rays through the wall adjoins of a grid of rooms, the lanes of a packet split up over the sectors they reach
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, 4, kRoomSize, kRoomHeight);
+
+		SBakeScene scene;
+		BuildBenchScene(source, ELightBake_Direct, scene);
+
+		// random points on the floors, facing up
+		std::mt19937 rng(options.nSeed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<float3> points(nNumPoints), normals(nNumPoints, float3(0, 0, 1));
+		std::vector<int> pointSectors(nNumPoints);
+		for (int nPoint = 0; nPoint < nNumPoints; ++nPoint)
+		{
+			const int nRoom = nPoint % (nRooms * nRooms);
+			points[nPoint] = { ((nRoom % nRooms) + unit(rng)) * kRoomSize, ((nRoom / nRooms) + unit(rng)) * kRoomSize, 0.0f };
+			pointSectors[nPoint] = nRoom;
+		}
+
+		const SPacketBenchResult result = RunPacketRays(scene, points, normals, pointSectors);
+		printf("%8s %8d %8d %14.0f %14.0f %7.2fx %10d\n", "rooms", nRooms, (int)scene.surfaces.size(), result.scalarRate, result.packetRate,
+			result.packetRate / result.scalarRate, result.nMismatches);
+	}
+	return 0;
+}
+
+static int RunRelightBench(const SOptions& options)
+{
+	static constexpr int kTiles = 8;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+
+	CJobSystem jobSystem;
+	printf("%d threads\n", jobSystem.GetNumThreads());
+	printf("%8s %8s %8s %12s %12s %8s %14s %10s\n", "rooms", "vertices", "lights", "full ms", "update ms", "speedup", "traced/update", "max error");
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+
+		SBakeScene scene;
+		BuildBenchScene(source, ELightBake_Lights, scene);
+		scene.levelInfo.normalSmoothCos = cosf(35.0f * (3.141592f / 180.0f));
+
+		// the bake smooths the normals in place, every full bake starts from the unsmoothed scene
+		const SBakeScene sourceScene = scene;
+		CCpuBaker baker(&jobSystem);
+		CLightCache cache;
+
+		std::vector<float4> accumulation;
+		const uint64_t nSceneHash = CLightCache::HashScene(scene);
+		baker.BakeDirectPasses(scene, accumulation);
+		cache.Store(nSceneHash, scene, accumulation);
+
+		std::mt19937 rng(options.nSeed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::chrono::duration<double> fullTime(0), updateTime(0);
+		long long nTracedVertices = 0;
+		float maxError = 0.0f;
+		for (int nMove = 0; nMove < options.nMoves; ++nMove)
+		{
+			// somewhere else inside the same room
+			const int nLightIndex = (int)(unit(rng) * scene.lights.size()) % (int)scene.lights.size();
+			SLight& light = scene.lights[nLightIndex];
+			const float3 roomMin = { (nLightIndex % nRooms) * kSize, (nLightIndex / nRooms) * kSize, 0.0f };
+			light.position = float4(roomMin.x + kSize * (0.1f + 0.8f * unit(rng)), roomMin.y + kSize * (0.1f + 0.8f * unit(rng)), kHeight * (0.1f + 0.8f * unit(rng)), light.position.w);
+
+			// like a fresh snapshot of the level
+			scene.normals = sourceScene.normals;
+			if (!cache.CanUpdate(CLightCache::HashScene(scene)))
+			{
+				fprintf(stderr, "error: moving a light changed the scene hash.\n");
+				return 1;
+			}
+
+			SLightCacheStats stats;
+			auto startTime = std::chrono::high_resolution_clock::now();
+			cache.Update(scene, &jobSystem, stats);
+			updateTime += std::chrono::high_resolution_clock::now() - startTime;
+			nTracedVertices += stats.nTracedVertices;
+
+			SBakeScene fullScene = sourceScene;
+			fullScene.lights = scene.lights;
+			BuildSectorLightLists(fullScene);
+			std::vector<float4> reference;
+			startTime = std::chrono::high_resolution_clock::now();
+			baker.BakeDirectPasses(fullScene, reference);
+			fullTime += std::chrono::high_resolution_clock::now() - startTime;
+
+			const std::vector<float4>& directLight = cache.GetDirectLight();
+			for (size_t nVertexIndex = 0; nVertexIndex < reference.size(); ++nVertexIndex)
+			{
+				const float4 error = directLight[nVertexIndex] - reference[nVertexIndex];
+				maxError = std::max(maxError, std::max(std::max(fabsf(error.x), fabsf(error.y)), std::max(fabsf(error.z), fabsf(error.w))));
+			}
+		}
+
+		const double fullMs = fullTime.count() * 1000.0 / options.nMoves;
+		const double updateMs = updateTime.count() * 1000.0 / options.nMoves;
+		printf("%8d %8d %8d %12.3f %12.3f %7.1fx %14lld %10.2g\n", nRooms * nRooms, (int)scene.vertices.size(), (int)scene.lights.size(),
+			fullMs, updateMs, fullMs / updateMs, nTracedVertices / options.nMoves, maxError);
+	}
+	return 0;
+}
+
+static int RunUploadBench(const SOptions& options)
+{
+	static constexpr int kTiles = 8;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+
+	printf("%8s %8s %12s %14s %14s %12s %10s\n", "rooms", "edit", "scene KB", "uploaded KB", "dirty sectors", "update ms", "mismatches");
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+
+		SBakeScene scene;
+		BuildBenchScene(source, ELightBake_Lights, scene);
+
+		CSceneResidency residency;
+		CCpuSceneBuffers buffers;
+		buffers.Upload(scene, residency);
+
+		std::mt19937 rng(options.nSeed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		for (int nMove = 0; nMove < options.nMoves; ++nMove)
+		{
+			// alternately move a floor vertex of a room (same layout) and split a wall of a room (every later sector shifts)
+			const bool bSplit = (nMove & 1) != 0;
+			SSceneSector& sector = source.sectors[(int)(unit(rng) * source.sectors.size()) % source.sectors.size()];
+			if (bSplit)
+			{
+				SSceneSurface& wall = sector.surfaces.back();
+				const uint32_t nCorner0 = sector.indices[wall.nFirstIndex];
+				const uint32_t nCorner1 = sector.indices[wall.nFirstIndex + 1];
+				sector.vertices.push_back((sector.vertices[nCorner0] + sector.vertices[nCorner1]) * 0.5f);
+				sector.indices.insert(sector.indices.begin() + wall.nFirstIndex + 1, (uint32_t)sector.vertices.size() - 1);
+				++wall.nNumIndices;
+			}
+			else
+			{
+				sector.vertices[(int)(unit(rng) * kTiles * kTiles) % (kTiles * kTiles)].z += 0.25f;
+			}
+
+			BuildBenchScene(source, ELightBake_Lights, scene);
+
+			auto startTime = std::chrono::high_resolution_clock::now();
+			const size_t nUploadedBytes = buffers.Upload(scene, residency);
+			const std::chrono::duration<double> updateTime = std::chrono::high_resolution_clock::now() - startTime;
+
+			size_t nSceneBytes = 0;
+			int nMismatches = 0;
+			for (int nBuffer = 0; nBuffer < ESceneBuffer_Count; ++nBuffer)
+			{
+				const size_t nSize = (size_t)GetSceneBufferCount(scene, (ESceneBuffer)nBuffer) * GetSceneBufferStride((ESceneBuffer)nBuffer);
+				nSceneBytes += nSize;
+				nMismatches += memcmp(buffers.GetBuffer((ESceneBuffer)nBuffer).data(), GetSceneBufferData(scene, (ESceneBuffer)nBuffer), nSize) != 0;
+			}
+
+			printf("%8d %8s %12.1f %14.1f %14d %12.3f %10d\n", nRooms * nRooms, bSplit ? "split" : "move", nSceneBytes / 1024.0,
+				nUploadedBytes / 1024.0, residency.GetNumDirtySectors(), updateTime.count() * 1000.0, nMismatches);
+		}
+	}
+	return 0;
+}
+
+static float GetMaxError(const std::vector<float4>& a, const std::vector<float4>& b)
+{
+	float maxError = 0.0f;
+	for (size_t nVertexIndex = 0; nVertexIndex < a.size(); ++nVertexIndex)
+	{
+		const float4 error = a[nVertexIndex] - b[nVertexIndex];
+		maxError = std::max(maxError, std::max(std::max(fabsf(error.x), fabsf(error.y)), fabsf(error.z)));
+	}
+	return maxError;
+}
+
+// mean error relative to the mean brightness of reference
+static float GetRelativeError(const std::vector<float4>& a, const std::vector<float4>& reference)
+{
+	double error = 0.0, brightness = 0.0;
+	for (size_t nVertexIndex = 0; nVertexIndex < a.size(); ++nVertexIndex)
+	{
+		const float4 diff = a[nVertexIndex] - reference[nVertexIndex];
+		error += fabsf(diff.x) + fabsf(diff.y) + fabsf(diff.z);
+		brightness += fabsf(reference[nVertexIndex].x) + fabsf(reference[nVertexIndex].y) + fabsf(reference[nVertexIndex].z);
+	}
+	return brightness > 0.0 ? (float)(error / brightness) : 0.0f;
+}
+
+// notices the first item after which every vertex has some indirect light, the accumulation is the first full preview then
+class CPreviewBakeBackend : public CCpuBakeBackend
+{
+public:
+	CPreviewBakeBackend(CCpuBaker& baker, SBakeScene& scene, std::vector<float4>& accumulation)
+		: CCpuBakeBackend(baker, scene, accumulation)
+		, m_nTotalVertices(scene.levelInfo.nTotalVertices)
+	{
+	}
+
+	void Run(const SBakeWorkItem& item) override
+	{
+		CCpuBakeBackend::Run(item);
+		if (item.ePass == EBakePass_Indirect && item.nBounce == 0 && item.nRayOffset == 0 && item.nFirstVertex + item.nNumVertices == m_nTotalVertices)
+			m_bFullPreview = true;
+	}
+
+	bool HasFullPreview() const { return m_bFullPreview; }
+
+private:
+	int  m_nTotalVertices;
+	bool m_bFullPreview = false;
+};
+
+static int RunProgressiveBench(const SOptions& options)
+{
+	static constexpr int kTiles = 8;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+	static constexpr int kBounces = 2;
+	static constexpr int kIndirectRays = 256;
+
+	CJobSystem jobSystem;
+	printf("%d threads, %d bounces of %d rays, %d vertices per tile, %d rays per batch\n", jobSystem.GetNumThreads(), kBounces, kIndirectRays,
+		options.nTileVertices, options.nBatchRays);
+	printf("%8s %8s %8s %12s %12s %12s %14s %10s %10s\n", "rooms", "vertices", "items", "one shot ms", "tiled ms", "preview ms",
+		"preview err %", "max error", "cancelled");
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+
+		SBakeScene scene;
+		BuildBenchScene(source, ELightBake_Lights | ELightBake_Indirect, scene);
+		scene.levelInfo.nIndirectRays = kIndirectRays;
+		const SBakeScene sourceScene = scene;
+
+		CCpuBaker baker(&jobSystem);
+		std::vector<float4> reference;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		baker.Bake(scene, kBounces, reference);
+		const std::chrono::duration<double> oneShotTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		SBakeScheduleSettings settings;
+		settings.nTileVertices = options.nTileVertices;
+		settings.nBatchRays = options.nBatchRays;
+
+		// the first preview that covers the whole level is the one after the first batch of the first bounce
+		scene = sourceScene;
+		std::vector<float4> accumulation, preview;
+		CBakeScheduler scheduler;
+		CPreviewBakeBackend backend(baker, scene, accumulation);
+		startTime = std::chrono::high_resolution_clock::now();
+		baker.BeginBake(scene, accumulation);
+		scheduler.Begin(scene.levelInfo, kBounces, settings);
+		std::chrono::duration<double> previewTime(0);
+		while (scheduler.Step(backend))
+		{
+			if (preview.empty() && backend.HasFullPreview())
+			{
+				previewTime = std::chrono::high_resolution_clock::now() - startTime;
+				preview = accumulation;
+				ScatterWeldedVertices(scene, preview);
+			}
+		}
+		const std::chrono::duration<double> tiledTime = std::chrono::high_resolution_clock::now() - startTime;
+		const float maxError = GetMaxError(accumulation, reference);
+
+		// cancelling halfway stops before the next item
+		scene = sourceScene;
+		baker.BeginBake(scene, accumulation);
+		scheduler.Begin(scene.levelInfo, kBounces, settings);
+		bool bCancelled = true;
+		while (scheduler.Step(backend))
+		{
+			if (scheduler.GetProgress() >= 0.5f)
+			{
+				scheduler.Cancel();
+				bCancelled = !scheduler.Step(backend) && !scheduler.IsDone() && scheduler.GetProgress() < 1.0f;
+				break;
+			}
+		}
+
+		printf("%8d %8d %8d %12.3f %12.3f %12.3f %14.2f %10.2g %10s\n", nRooms * nRooms, (int)scene.vertices.size(), scheduler.GetNumItems(),
+			oneShotTime.count() * 1000.0, tiledTime.count() * 1000.0, previewTime.count() * 1000.0,
+			preview.empty() ? 0.0f : GetRelativeError(preview, reference) * 100.0f, maxError,
+			bCancelled ? "yes" : "NO");
+	}
+	return 0;
+}
+
+// bakes a copy of sourceScene through the scheduler, returns the milliseconds
+static double BakeScheduled(CCpuBaker& baker, const SBakeScene& sourceScene, int nBounces, std::vector<float4>& accumulation)
+{
+	SBakeScene scene = sourceScene;
+	CBakeScheduler scheduler;
+	CCpuBakeBackend backend(baker, scene, accumulation);
+
+	const auto startTime = std::chrono::high_resolution_clock::now();
+	baker.BeginBake(scene, accumulation);
+	scheduler.Begin(scene.levelInfo, nBounces, SBakeScheduleSettings());
+	scheduler.Run(backend);
+	const std::chrono::duration<double> time = std::chrono::high_resolution_clock::now() - startTime;
+	return time.count() * 1000.0;
+}
+
+static int RunAdaptiveBench(const SOptions& options)
+{
+	static constexpr int kTiles = 8;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+	static constexpr int kBounces = 2;
+	static constexpr int kIndirectRays = 128;
+	static constexpr int kReferenceRays = 2048;
+
+	CJobSystem jobSystem;
+	printf("%d threads, %d bounces, %d rays fixed and adaptive budget (threshold %g), reference %d rays\n", jobSystem.GetNumThreads(), kBounces,
+		kIndirectRays, options.adaptiveThreshold, kReferenceRays);
+	printf("%8s %8s %10s %10s %10s %12s %12s %12s %12s\n", "rooms", "vertices", "fixed ms", "fixed err %", "fixed rays",
+		"adaptive ms", "adaptive err %", "adaptive rays", "max rays");
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+
+		SBakeScene sourceScene;
+		BuildBenchScene(source, ELightBake_Lights | ELightBake_Indirect, sourceScene);
+
+		CCpuBaker baker(&jobSystem);
+		std::vector<float4> reference, fixed, adaptive;
+		sourceScene.levelInfo.nIndirectRays = kReferenceRays;
+		BakeScheduled(baker, sourceScene, kBounces, reference);
+
+		sourceScene.levelInfo.nIndirectRays = kIndirectRays;
+		const double fixedMs = BakeScheduled(baker, sourceScene, kBounces, fixed);
+		const float fixedRays = baker.GetIndirectRayStats().GetAverageRays();
+
+		EnableAdaptiveRays(sourceScene.levelInfo, options.adaptiveThreshold);
+		const double adaptiveMs = BakeScheduled(baker, sourceScene, kBounces, adaptive);
+		const float adaptiveRays = baker.GetIndirectRayStats().GetAverageRays();
+
+		printf("%8d %8d %10.3f %10.2f %10.1f %12.3f %12.2f %12.1f %12d\n", nRooms * nRooms, (int)sourceScene.vertices.size(),
+			fixedMs, GetRelativeError(fixed, reference) * 100.0f, fixedRays,
+			adaptiveMs, GetRelativeError(adaptive, reference) * 100.0f, adaptiveRays, sourceScene.levelInfo.nIndirectRays * kAdaptiveMaxRayScale);
+	}
+	return 0;
+}
+
+static int RunWeldBench(const SOptions& options)
+{
+	static constexpr int kTiles = 8;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+	static constexpr int kBounces = 2;
+	static constexpr int kIndirectRays = 128;
+
+	CJobSystem jobSystem;
+	printf("%d threads, %d bounces of %d rays\n", jobSystem.GetNumThreads(), kBounces, kIndirectRays);
+	printf("%8s %8s %8s %12s %12s %8s %10s\n", "rooms", "vertices", "traced", "all ms", "welded ms", "speedup", "max error");
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+
+		SBakeScene sourceScene;
+		BuildBenchScene(source, ELightBake_Lights | ELightBake_Indirect, sourceScene);
+		sourceScene.levelInfo.nIndirectRays = kIndirectRays;
+
+		CCpuBaker baker(&jobSystem);
+		std::vector<float4> reference, welded;
+		SBakeScheduleSettings settings;
+		settings.bWeldVertices = false;
+
+		SBakeScene scene = sourceScene;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		baker.Bake(scene, kBounces, reference, settings);
+		const std::chrono::duration<double> allTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		settings.bWeldVertices = true;
+		scene = sourceScene;
+		startTime = std::chrono::high_resolution_clock::now();
+		baker.Bake(scene, kBounces, welded, settings);
+		const std::chrono::duration<double> weldedTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		printf("%8d %8d %8d %12.3f %12.3f %7.2fx %10.2g\n", nRooms * nRooms, (int)scene.vertices.size(), baker.GetNumTracedVertices(),
+			allTime.count() * 1000.0, weldedTime.count() * 1000.0, allTime.count() / weldedTime.count(), GetMaxError(welded, reference));
+	}
+	return 0;
+}
+
+// The original smoothing, every vertex of a sector against every other vertex of the sector and every vertex of the
+// adjoined sectors (once per adjoin), the baseline for the smoothing benchmark
+static void ComputeSmoothNormalsPairScan(SBakeScene& scene)
+{
+	const std::vector<SSurface>& surfaces = scene.surfaces;
+	const std::vector<SVertex>& vertices = scene.vertices;
+
+	auto accumulate = [&](uint32_t nVertexIndex, const float3& normal)
+	{
+		scene.normals[nVertexIndex].x += int(normal.x * 1024.0f);
+		scene.normals[nVertexIndex].y += int(normal.y * 1024.0f);
+		scene.normals[nVertexIndex].z += int(normal.z * 1024.0f);
+	};
+
+	auto smooth = [&](uint32_t nVertexIndex0, uint32_t nVertexIndex1, bool bBoth)
+	{
+		const float3 diff = ToFloat3(vertices[nVertexIndex1].position) - ToFloat3(vertices[nVertexIndex0].position);
+		const float3 normal0 = ToFloat3(surfaces[vertices[nVertexIndex0].nSurfaceIndex].normal);
+		const float3 normal1 = ToFloat3(surfaces[vertices[nVertexIndex1].nSurfaceIndex].normal);
+		if (dot(diff, diff) >= kSmoothDistanceSqr || dot(normal0, normal1) <= scene.levelInfo.normalSmoothCos)
+			return;
+
+		accumulate(nVertexIndex0, normal1);
+		if (bBoth)
+			accumulate(nVertexIndex1, normal0);
+	};
+
+	for (const SSector& sector : scene.sectors)
+	{
+		const uint32_t nLastSurface = sector.nFirstSurface + sector.nNumSurfaces;
+		for (uint32_t nSurfaceIndex0 = sector.nFirstSurface; nSurfaceIndex0 < nLastSurface; ++nSurfaceIndex0)
+		{
+			const SSurface& surface0 = surfaces[nSurfaceIndex0];
+			for (uint32_t nVertexIndex0 = surface0.nFirstVertex; nVertexIndex0 < surface0.nFirstVertex + surface0.nNumVertices; ++nVertexIndex0)
+			{
+				for (uint32_t nSurfaceIndex1 = nSurfaceIndex0; nSurfaceIndex1 < nLastSurface; ++nSurfaceIndex1)
+				{
+					const SSurface& surface1 = surfaces[nSurfaceIndex1];
+					const uint32_t nStart = (nSurfaceIndex0 == nSurfaceIndex1) ? nVertexIndex0 + 1 : surface1.nFirstVertex;
+					for (uint32_t nVertexIndex1 = nStart; nVertexIndex1 < surface1.nFirstVertex + surface1.nNumVertices; ++nVertexIndex1)
+						smooth(nVertexIndex0, nVertexIndex1, true);
+				}
+
+				for (uint32_t nSurfaceIndex1 = sector.nFirstSurface; nSurfaceIndex1 < nLastSurface; ++nSurfaceIndex1)
+				{
+					const int nAdjoinSector = surfaces[nSurfaceIndex1].nAdjoinSector;
+					if (nAdjoinSector < 0)
+						continue;
+
+					const SSector& adjoined = scene.sectors[nAdjoinSector];
+					for (uint32_t nSurfaceIndex2 = adjoined.nFirstSurface; nSurfaceIndex2 < adjoined.nFirstSurface + adjoined.nNumSurfaces; ++nSurfaceIndex2)
+					{
+						const SSurface& surface2 = surfaces[nSurfaceIndex2];
+						for (uint32_t nVertexIndex1 = surface2.nFirstVertex; nVertexIndex1 < surface2.nFirstVertex + surface2.nNumVertices; ++nVertexIndex1)
+							smooth(nVertexIndex0, nVertexIndex1, false);
+					}
+				}
+			}
+		}
+	}
+}
+
+static int RunSmoothBench(const SOptions& options)
+{
+	static constexpr float kRadius = 64.0f;
+	static constexpr float kSmoothAngle = 45.0f;
+
+	CJobSystem jobSystem;
+	printf("%d threads, %g degree smoothing angle, the room grid adds adjoins\n", jobSystem.GetNumThreads(), kSmoothAngle);
+	printf("%8s %8s %8s %12s %12s %8s %10s\n", "scene", "size", "vertices", "pair ms", "hash ms", "speedup", "mismatches");
+	for (int nGridSize : options.gridSizes)
+	{
+		for (int nScene = 0; nScene < 2; ++nScene)
+		{
+			CMemorySceneSource source;
+			if (nScene == 0)
+				MakeDomeScene(source, nGridSize * 8, kRadius);
+			else
+				MakeRoomGridScene(source, nGridSize, 8, kRadius, kRadius * 0.5f);
+
+			SBakeScene sourceScene;
+			BuildBenchScene(source, 0, sourceScene);
+			sourceScene.levelInfo.normalSmoothCos = cosf(kSmoothAngle * (3.141592f / 180.0f));
+
+			SBakeScene pairScene = sourceScene;
+			auto startTime = std::chrono::high_resolution_clock::now();
+			ComputeSmoothNormalsPairScan(pairScene);
+			const std::chrono::duration<double> pairTime = std::chrono::high_resolution_clock::now() - startTime;
+
+			CCpuBaker baker(&jobSystem);
+			SBakeScene hashScene = sourceScene;
+			startTime = std::chrono::high_resolution_clock::now();
+			baker.ComputeSmoothNormals(hashScene);
+			const std::chrono::duration<double> hashTime = std::chrono::high_resolution_clock::now() - startTime;
+
+			int nMismatches = 0;
+			for (size_t nVertexIndex = 0; nVertexIndex < hashScene.normals.size(); ++nVertexIndex)
+				nMismatches += memcmp(&hashScene.normals[nVertexIndex], &pairScene.normals[nVertexIndex], sizeof(int4)) != 0;
+
+			printf("%8s %8d %8d %12.3f %12.3f %7.2fx %10d\n", nScene == 0 ? "dome" : "rooms", nGridSize, (int)hashScene.vertices.size(),
+				pairTime.count() * 1000.0, hashTime.count() * 1000.0, pairTime.count() / hashTime.count(), nMismatches);
+		}
+	}
+	return 0;
+}
+
+static int RunLightsBench(const SOptions& options)
+{
+	static constexpr int kTiles = 2;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+
+	CJobSystem jobSystem;
+	std::mt19937 rng(options.nSeed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	printf("%d threads, %d lights per room\n", jobSystem.GetNumThreads(), options.nLightsPerRoom);
+	printf("%8s %8s %8s %12s %12s %12s %8s %14s %10s\n", "rooms", "vertices", "lights", "all ms", "lists ms", "culled ms", "speedup",
+		"lights/sector", "max error");
+	for (int nRooms : options.gridSizes)
+	{
+		// the lights of MakeRoomGridScene reach the next rooms, the extra ones are smaller and spread over the room
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+		const size_t nRoomLights = source.lights.size();
+		for (size_t nRoom = 0; nRoom < nRoomLights; ++nRoom)
+		{
+			for (int nLight = 1; nLight < options.nLightsPerRoom; ++nLight)
+			{
+				SSceneLight light = source.lights[nRoom];
+				const float3 roomMin = { (float)(nRoom % nRooms) * kSize, (float)(nRoom / nRooms) * kSize, 0.0f };
+				light.position = roomMin + float3(kSize * (0.1f + 0.8f * unit(rng)), kSize * (0.1f + 0.8f * unit(rng)), kHeight * (0.1f + 0.8f * unit(rng)));
+				light.range = kSize * (0.25f + 0.5f * unit(rng));
+				source.lights.push_back(light);
+			}
+		}
+
+		SBakeScene scene;
+		BuildBenchScene(source, ELightBake_Lights, scene);
+		const SBakeWorkItem item = { EBakePass_Direct, 0, 0, scene.levelInfo.nTotalVertices, 0, 1 };
+
+		CCpuBaker baker(&jobSystem);
+		std::vector<float4> culled, all;
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		BuildSectorLightLists(scene);
+		const std::chrono::duration<double> listTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		baker.BeginBake(scene, culled);
+		startTime = std::chrono::high_resolution_clock::now();
+		baker.BakeDirect(scene, culled, item);
+		const std::chrono::duration<double> culledTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		const float lightsPerSector = (float)scene.sectorLights.size() / (float)scene.sectors.size();
+		scene.sectorLightOffsets.clear();
+		baker.BeginBake(scene, all);
+		startTime = std::chrono::high_resolution_clock::now();
+		baker.BakeDirect(scene, all, item);
+		const std::chrono::duration<double> allTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		printf("%8d %8d %8d %12.3f %12.3f %12.3f %7.1fx %14.1f %10.2g\n", nRooms * nRooms, (int)scene.vertices.size(), (int)scene.lights.size(),
+			allTime.count() * 1000.0, listTime.count() * 1000.0, culledTime.count() * 1000.0,
+			allTime.count() / (listTime.count() + culledTime.count()), lightsPerSector, GetMaxError(culled, all));
+	}
+	return 0;
+}
+
+static int RunVisibilityBench(const SOptions& options)
+{
+	static constexpr float kSize = 16.0f;
+	static constexpr float kHeight = 16.0f;
+
+	CJobSystem jobSystem;
+
+	printf("%d threads\n", jobSystem.GetNumThreads());
+	printf("%8s %8s %8s %10s %10s %10s %12s %12s %12s %8s %10s\n", "cells", "vertices", "lights", "pvs ms", "pvs KB", "bitset KB",
+		"seen/sector", "lights before", "lights after", "speedup", "max error");
+	for (int nCells : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeMazeScene(source, nCells, kSize, kHeight, options.nSeed);
+
+		SBakeScene scene;
+		BuildBenchScene(source, ELightBake_Lights, scene);
+		const SBakeWorkItem item = { EBakePass_Direct, 0, 0, scene.levelInfo.nTotalVertices, 0, 1 };
+		const int nNumSectors = (int)scene.sectors.size();
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		BuildSectorVisibility(scene);
+		const std::chrono::duration<double> visibilityTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		uint64_t nNumVisible = 0;
+		std::vector<uint32_t> visibleSectors(GetMaskBucketCount(nNumSectors));
+		for (int nSectorIndex = 0; nSectorIndex < nNumSectors; ++nSectorIndex)
+		{
+			std::fill(visibleSectors.begin(), visibleSectors.end(), 0u);
+			AddVisibleSectors(scene, nSectorIndex, visibleSectors.data());
+			for (int nOtherIndex = 0; nOtherIndex < nNumSectors; ++nOtherIndex)
+				nNumVisible += TestMaskBit(visibleSectors.data(), nOtherIndex);
+		}
+		const uint64_t nVisibilityBytes = scene.sectorVisibility.size() + scene.sectorVisibilityOffsets.size() * sizeof(uint32_t);
+
+		CCpuBaker baker(&jobSystem);
+		std::vector<float4> culled, open;
+
+		BuildSectorLightLists(scene);
+		const float lightsAfter = (float)scene.sectorLights.size() / (float)nNumSectors;
+		baker.BeginBake(scene, culled);
+		startTime = std::chrono::high_resolution_clock::now();
+		baker.BakeDirect(scene, culled, item);
+		const std::chrono::duration<double> culledTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		scene.sectorVisibilityOffsets.clear();
+		scene.sectorVisibility.clear();
+		BuildSectorLightLists(scene);
+		const float lightsBefore = (float)scene.sectorLights.size() / (float)nNumSectors;
+		baker.BeginBake(scene, open);
+		startTime = std::chrono::high_resolution_clock::now();
+		baker.BakeDirect(scene, open, item);
+		const std::chrono::duration<double> openTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		printf("%8d %8d %8d %10.3f %10.1f %10.1f %12.1f %12.1f %12.1f %7.1fx %10.2g\n", nCells * nCells, (int)scene.vertices.size(),
+			(int)scene.lights.size(), visibilityTime.count() * 1000.0, nVisibilityBytes / 1024.0,
+			(uint64_t)nNumSectors * ((nNumSectors + 7) / 8) / 1024.0, (double)nNumVisible / nNumSectors, lightsBefore, lightsAfter,
+			openTime.count() / culledTime.count(), GetMaxError(culled, open));
+	}
+	return 0;
+}
+
+// sky/emissive pass of the whole scene at nRays rays per vertex, returns the milliseconds
+static double BakeSkyEmissivePass(CCpuBaker& baker, SBakeScene& scene, int nRays, std::vector<float4>& accumulation)
+{
+	scene.levelInfo.nSkyEmissiveRays = nRays;
+	const SBakeWorkItem item = { EBakePass_SkyEmissive, 0, 0, scene.levelInfo.nTotalVertices, 0, 1 };
+
+	baker.BeginBake(scene, accumulation);
+	const auto startTime = std::chrono::high_resolution_clock::now();
+	baker.BeginRayPass(scene);
+	baker.BakeSkyEmissive(scene, accumulation, item);
+	const std::chrono::duration<double> time = std::chrono::high_resolution_clock::now() - startTime;
+	return time.count() * 1000.0;
+}
+
+static int RunEmissiveBench(const SOptions& options)
+{
+	static constexpr int kTiles = 8;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+	static constexpr int kReferenceRays = 4096;
+	static const int s_anRays[] = { 16, 64, 256 };
+
+	CJobSystem jobSystem;
+	printf("%d threads, reference %d emissive samples\n", jobSystem.GetNumThreads(), kReferenceRays);
+	printf("%8s %8s %8s %8s %12s %12s %12s %12s %10s\n", "rooms", "vertices", "emitters", "rays", "hemi ms", "hemi err %",
+		"sampled ms", "sampled err %", "err ratio");
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+
+		SBakeScene scene;
+		BuildBenchScene(source, ELightBake_Emissive, scene);
+
+		// the ceiling tile closest to the center of every room gives off light, the rest of the room is dark
+		for (const SSector& sector : scene.sectors)
+		{
+			int nLampIndex = -1;
+			float bestDistSqr = FLT_MAX;
+			for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+			{
+				const SSurface& surface = scene.surfaces[nSurfaceIndex];
+				if (surface.nAdjoinSector >= 0 || surface.normal.z > -0.5f)
+					continue;
+
+				float3 center = { 0,0,0 };
+				for (uint32_t nVertex = 0; nVertex < surface.nNumVertices; ++nVertex)
+					center += ToFloat3(scene.vertices[surface.nFirstVertex + nVertex].position);
+				const float3 toCenter = center / (float)surface.nNumVertices - ToFloat3(sector.center);
+				const float distSqr = toCenter.x * toCenter.x + toCenter.y * toCenter.y;
+				if (distSqr < bestDistSqr)
+				{
+					bestDistSqr = distSqr;
+					nLampIndex = (int)nSurfaceIndex;
+				}
+			}
+			for (uint32_t nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+				scene.surfaces[nSurfaceIndex].emissive = ((int)nSurfaceIndex == nLampIndex) ? float4(8,8,8,8) : float4(0,0,0,0);
+		}
+		BuildEmissiveSurfaces(scene);
+		const int nNumEmitters = (int)scene.emissiveSurfaces.size();
+
+		CCpuBaker baker(&jobSystem);
+		std::vector<float4> reference, hemisphere, sampled;
+		BakeSkyEmissivePass(baker, scene, kReferenceRays, reference);
+
+		for (int nRays : s_anRays)
+		{
+			const double sampledMs = BakeSkyEmissivePass(baker, scene, nRays, sampled);
+
+			// without the list the pass only has the hemisphere rays
+			SBakeScene blindScene = scene;
+			blindScene.emissiveSurfaces.clear();
+			blindScene.emissiveTriangleCdf.clear();
+			blindScene.levelInfo.nNumEmissiveSurfaces = 0;
+			const double hemisphereMs = BakeSkyEmissivePass(baker, blindScene, nRays, hemisphere);
+
+			const float hemisphereError = GetRelativeError(hemisphere, reference);
+			const float sampledError = GetRelativeError(sampled, reference);
+			printf("%8d %8d %8d %8d %12.3f %12.2f %12.3f %12.2f %9.1fx\n", nRooms * nRooms, (int)scene.vertices.size(), nNumEmitters, nRays,
+				hemisphereMs, hemisphereError * 100.0f, sampledMs, sampledError * 100.0f, sampledError > 0.0f ? hemisphereError / sampledError : 0.0f);
+		}
+	}
+	return 0;
+}
+
+template <typename T>
+static bool IsSameArray(const std::vector<T>& a, const std::vector<T>& b)
+{
+	return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+static int RunSceneFileBench(const SOptions& options)
+{
+	static constexpr int kTiles = 8;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+	static constexpr float kSmoothAngle = 35.0f;
+
+	const std::string sPath = (std::filesystem::temp_directory_path() / "lightbench.lbscene").string();
+
+	CJobSystem jobSystem;
+	printf("%d threads, the procedural rooms have no materials to load so a real level gains more\n", jobSystem.GetNumThreads());
+	printf("%8s %8s %10s %12s %12s %12s %8s %10s\n", "rooms", "vertices", "file KB", "build ms", "map ms", "copy ms", "speedup", "identical");
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+
+		// what lightbake does for a level: snapshot, build (BVHs and light lists) and smoothing
+		CCpuBaker baker(&jobSystem);
+		SBakeScene built;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		BuildBenchScene(source, ELightBake_Lights | ELightBake_Indirect, built);
+		built.levelInfo.normalSmoothCos = cosf(kSmoothAngle * (3.141592f / 180.0f));
+		baker.ComputeSmoothNormals(built);
+		built.levelInfo.normalSmoothCos = 1.0f;
+		const std::chrono::duration<double> buildTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		std::string sError;
+		if (!SaveSceneFile(sPath, built, sError))
+		{
+			fprintf(stderr, "error: %s '%s'.\n", sError.c_str(), sPath.c_str());
+			return 1;
+		}
+
+		CMappedSceneFile file;
+		startTime = std::chrono::high_resolution_clock::now();
+		if (!file.Open(sPath, sError))
+		{
+			fprintf(stderr, "error: %s '%s'.\n", sError.c_str(), sPath.c_str());
+			return 1;
+		}
+		const std::chrono::duration<double> mapTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		SBakeScene mapped;
+		startTime = std::chrono::high_resolution_clock::now();
+		file.CopyTo(mapped);
+		const std::chrono::duration<double> copyTime = std::chrono::high_resolution_clock::now() - startTime;
+		file.Close();
+
+		const bool bIdentical = memcmp(&built.levelInfo, &mapped.levelInfo, sizeof(SLevelInfo)) == 0
+			&& IsSameArray(built.sectors, mapped.sectors) && IsSameArray(built.surfaces, mapped.surfaces)
+			&& IsSameArray(built.vertices, mapped.vertices) && IsSameArray(built.lights, mapped.lights)
+			&& IsSameArray(built.normals, mapped.normals) && IsSameArray(built.emissiveSurfaces, mapped.emissiveSurfaces)
+			&& IsSameArray(built.emissiveTriangleCdf, mapped.emissiveTriangleCdf) && IsSameArray(built.edgePlanes, mapped.edgePlanes)
+			&& IsSameArray(built.bvhNodes, mapped.bvhNodes) && IsSameArray(built.bvhSurfaces, mapped.bvhSurfaces)
+			&& IsSameArray(built.sectorVisibilityOffsets, mapped.sectorVisibilityOffsets) && IsSameArray(built.sectorVisibility, mapped.sectorVisibility)
+			&& IsSameArray(built.sectorLightOffsets, mapped.sectorLightOffsets) && IsSameArray(built.sectorLights, mapped.sectorLights);
+
+		printf("%8d %8d %10d %12.3f %12.3f %12.3f %7.1fx %10s\n", nRooms * nRooms, (int)built.vertices.size(),
+			(int)(std::filesystem::file_size(sPath) / 1024), buildTime.count() * 1000.0, mapTime.count() * 1000.0, copyTime.count() * 1000.0,
+			buildTime.count() / (mapTime.count() + copyTime.count()), bIdentical ? "yes" : "no");
+	}
+
+	std::error_code ec;
+	std::filesystem::remove(sPath, ec);
+	return 0;
+}
+
+// Bytes of the scene arrays a TraceRay reads, replaying its traversal. Every record read counts its whole stride once per
+// visit (a surface tested twice counts twice), the surface light interpolation counts every vertex of the surface once.
+static size_t CountTraceRayBytes(const CCpuTracer& tracer, const SBakeScene& scene, bool bCompact, int nSectorIndex, const float3& start, const float3& end)
+{
+	const size_t nSurfaceBytes = bCompact ? sizeof(SSurfaceHot) : sizeof(SSurface);
+	const size_t nColdBytes = bCompact ? sizeof(SSurfaceCold) : 0; // the full surface record was read by the traversal already
+	const size_t nVertexBytes = (bCompact ? sizeof(SVertexCompact) : sizeof(SVertex)) + sizeof(float4) + (scene.vertexWelds.empty() ? 0 : sizeof(uint32_t));
+	const size_t nQuantizationBytes = bCompact ? sizeof(float4) : 0;
+
+	const float3 delta = end - start;
+	const float3 invDelta = GetSegmentInvDelta(delta);
+
+	size_t nBytes = 0;
+	int nCurrentSector = nSectorIndex;
+	int nPreviousSector = -1;
+	for (int nRecurseLevel = 0; nCurrentSector >= 0 && nCurrentSector != nPreviousSector && nRecurseLevel < kMaxRecursion; ++nRecurseLevel)
+	{
+		// TraceSurfaces
+		nBytes += sizeof(SSector);
+		uint32_t nBestSurface = UINT32_MAX;
+		uint32_t aStack[kBvhStackSize];
+		int nStackSize = 0;
+		aStack[nStackSize++] = scene.sectors[nCurrentSector].nBvhRoot;
+		while (nStackSize > 0)
+		{
+			const SBvhNode& node = scene.bvhNodes[aStack[--nStackSize]];
+			nBytes += sizeof(SBvhNode);
+			if (!IsSegmentInBox(start, invDelta, node.boxMin, node.boxMax))
+				continue;
+
+			if (node.nCount == 0)
+			{
+				if (node.nFirst != kBvhEmptyRoot)
+				{
+					aStack[nStackSize++] = node.nFirst;
+					aStack[nStackSize++] = node.nFirst + 1;
+				}
+				continue;
+			}
+
+			for (uint32_t nEntry = node.nFirst; nEntry < node.nFirst + node.nCount; ++nEntry)
+			{
+				const uint32_t nSurfaceIndex = scene.bvhSurfaces[nEntry];
+				nBytes += sizeof(uint32_t);
+				if (nSurfaceIndex >= nBestSurface)
+					break;
+
+				nBytes += nSurfaceBytes;
+				const SSurfaceHot& surface = tracer.GetSurfaceHot(nSurfaceIndex);
+				const float3 normal = ToFloat3(surface.normal);
+				if (surface.nNumVertices == 0 || dot(normal, delta) >= 0)
+					continue;
+
+				// IsSurfCrossed, the edge planes are read until one rejects the hit
+				const float distToStart = dot(normal, start) - surface.normal.w;
+				const float distToEnd = dot(normal, end) - surface.normal.w;
+				if ((distToStart > 0.0001f && distToEnd > 0.0001f) || (distToStart < -0.0001f && distToEnd < -0.0001f))
+					continue;
+
+				bool bInside = true;
+				if (fabsf(distToStart) > 0.0001f || fabsf(distToEnd) > 0.0001f)
+				{
+					const float3 hitPos = start + (distToStart / (distToStart - distToEnd)) * (end - start);
+					for (uint32_t i = 0; i < surface.nNumVertices && bInside; ++i)
+					{
+						const float4& edgePlane = scene.edgePlanes[surface.nFirstVertex + i];
+						nBytes += sizeof(float4);
+						bInside = edgePlane.x * hitPos.x + edgePlane.y * hitPos.y + edgePlane.z * hitPos.z - edgePlane.w >= -1e-3f;
+					}
+				}
+				if (!bInside)
+					continue;
+
+				nBestSurface = nSurfaceIndex;
+				break;
+			}
+		}
+
+		if (nBestSurface == UINT32_MAX)
+			break;
+
+		// AddAdjoinContribution, the caller shades the final hit the same way
+		const SSurfaceHot& hitSurface = tracer.GetSurfaceHot(nBestSurface);
+		if (hitSurface.nFlags & ESurface_IsVisible)
+			nBytes += nColdBytes + nQuantizationBytes + hitSurface.nNumVertices * nVertexBytes;
+
+		nPreviousSector = nCurrentSector;
+		nCurrentSector = hitSurface.nAdjoinSector;
+	}
+	return nBytes;
+}
+
+static int RunLayoutBench(const SOptions& options)
+{
+	static constexpr int kTiles = 8;
+	static constexpr float kSize = 64.0f;
+	static constexpr float kHeight = 32.0f;
+	static constexpr int kBounces = 2;
+	static constexpr int kIndirectRays = 128;
+	static constexpr int kRaysPerPoint = 256;
+
+	CJobSystem jobSystem;
+	printf("single thread rays, %d threads for the bakes of %d bounces of %d rays\n", jobSystem.GetNumThreads(), kBounces, kIndirectRays);
+	printf("%8s %10s %10s %10s %10s %12s %12s %8s %10s %10s %10s\n", "rooms", "full KB", "compact KB", "full B/ray", "comp B/ray",
+		"full rays/s", "comp rays/s", "speedup", "full ms", "compact ms", "rel error");
+	for (int nRooms : options.gridSizes)
+	{
+		CMemorySceneSource source;
+		MakeRoomGridScene(source, nRooms, kTiles, kSize, kHeight);
+
+		SBakeScene scene;
+		BuildBenchScene(source, ELightBake_Lights | ELightBake_Indirect, scene);
+		scene.levelInfo.nIndirectRays = kIndirectRays;
+
+		SBakeScene compactScene = scene;
+		if (!BuildCompactLayout(compactScene))
+		{
+			fprintf(stderr, "error: too many sectors for the compact layout.\n");
+			return 1;
+		}
+
+		// hemisphere rays of random vertices, shading the adjoins with random light like a bounce
+		std::mt19937 rng(options.nSeed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<float4> vertexColors(scene.vertices.size());
+		for (float4& color : vertexColors)
+			color = { unit(rng), unit(rng), unit(rng), unit(rng) };
+
+		const CCpuTracer fullTracer(scene, vertexColors.data());
+		const CCpuTracer compactTracer(compactScene, vertexColors.data());
+
+		const int nNumPoints = (options.nRays + kRaysPerPoint - 1) / kRaysPerPoint;
+		std::vector<int> sectors;
+		std::vector<float3> starts, ends;
+		while ((int)sectors.size() < nNumPoints * kRaysPerPoint)
+		{
+			SVertexData vertexData;
+			if (!fullTracer.GetVertexData(vertexData, (int)(unit(rng) * scene.vertices.size()) % (int)scene.vertices.size()))
+				continue;
+
+			const STangentFrame frame = GenerateTangentFrame(vertexData.normal);
+			for (int nRayIndex = 0; nRayIndex < kRaysPerPoint; ++nRayIndex)
+			{
+				const float3 rayDir = TransformRay(GenRay(nRayIndex, kRaysPerPoint), frame);
+				sectors.push_back(vertexData.nSectorIndex);
+				starts.push_back(vertexData.vertex + rayDir * kRayBias);
+				ends.push_back(kSkyDistance * rayDir + vertexData.vertex);
+			}
+		}
+
+		const int nTotalRays = (int)sectors.size();
+		std::vector<SRayPayload> fullPayloads(nTotalRays), compactPayloads(nTotalRays);
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (int nRay = 0; nRay < nTotalRays; ++nRay)
+			fullTracer.TraceRay(fullPayloads[nRay], sectors[nRay], starts[nRay], ends[nRay]);
+		const std::chrono::duration<double> fullRayTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		startTime = std::chrono::high_resolution_clock::now();
+		for (int nRay = 0; nRay < nTotalRays; ++nRay)
+			compactTracer.TraceRay(compactPayloads[nRay], sectors[nRay], starts[nRay], ends[nRay]);
+		const std::chrono::duration<double> compactRayTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		double fullBytes = 0.0, compactBytes = 0.0;
+		for (int nRay = 0; nRay < nTotalRays; ++nRay)
+		{
+			fullBytes += (double)CountTraceRayBytes(fullTracer, scene, false, sectors[nRay], starts[nRay], ends[nRay]);
+			compactBytes += (double)CountTraceRayBytes(compactTracer, compactScene, true, sectors[nRay], starts[nRay], ends[nRay]);
+		}
+
+		// the whole bake, the quantized positions only change the interpolated bounce light
+		CCpuBaker baker(&jobSystem);
+		std::vector<float4> reference, compact;
+		SBakeScene bakeScene = scene;
+		startTime = std::chrono::high_resolution_clock::now();
+		baker.Bake(bakeScene, kBounces, reference);
+		const std::chrono::duration<double> fullBakeTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		bakeScene = compactScene;
+		startTime = std::chrono::high_resolution_clock::now();
+		baker.Bake(bakeScene, kBounces, compact);
+		const std::chrono::duration<double> compactBakeTime = std::chrono::high_resolution_clock::now() - startTime;
+
+		const double fullRate = nTotalRays / fullRayTime.count();
+		const double compactRate = nTotalRays / compactRayTime.count();
+		printf("%8d %10d %10d %10.0f %10.0f %12.0f %12.0f %7.2fx %10.3f %10.3f %10.2g\n", nRooms * nRooms,
+			(int)(GetTraceLayoutBytes(scene, false) / 1024), (int)(GetTraceLayoutBytes(compactScene, true) / 1024),
+			fullBytes / nTotalRays, compactBytes / nTotalRays, fullRate, compactRate, compactRate / fullRate,
+			fullBakeTime.count() * 1000.0, compactBakeTime.count() * 1000.0, GetRelativeError(compact, reference));
+	}
+	return 0;
+}
+
+// peak working set of the process so far, it only grows so run the scenes from small to large
+static uint64_t GetPeakMemoryBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? (uint64_t)counters.PeakWorkingSetSize : 0;
+#else
+	rusage usage = {};
+	return getrusage(RUSAGE_SELF, &usage) == 0 ? (uint64_t)usage.ru_maxrss * 1024 : 0;
+#endif
+}
+
+template <typename T>
+static uint64_t GetArrayBytes(const std::vector<T>& array)
+{
+	return (uint64_t)array.size() * sizeof(T);
+}
+
+static uint64_t GetSceneBytes(const SBakeScene& scene)
+{
+	return GetArrayBytes(scene.sectorMasks) + GetArrayBytes(scene.layerMasks) + GetArrayBytes(scene.sectors) + GetArrayBytes(scene.surfaces)
+		+ GetArrayBytes(scene.vertices) + GetArrayBytes(scene.lights) + GetArrayBytes(scene.normals) + GetArrayBytes(scene.emissiveSurfaces)
+		+ GetArrayBytes(scene.emissiveTriangleCdf) + GetArrayBytes(scene.edgePlanes)
+		+ GetArrayBytes(scene.bvhNodes) + GetArrayBytes(scene.bvhSurfaces) + GetArrayBytes(scene.sectorVisibilityOffsets)
+		+ GetArrayBytes(scene.sectorVisibility) + GetArrayBytes(scene.sectorLightOffsets) + GetArrayBytes(scene.sectorLights)
+		+ GetArrayBytes(scene.vertexWelds);
+}
+
+static bool MakeSuiteScene(const std::string& sName, int nSize, const SOptions& options, CMemorySceneSource& source)
+{
+	if (sName == "corridor")
+		MakeCorridorScene(source, nSize * nSize, 16.0f, 8.0f, 8.0f);
+	else if (sName == "courtyard")
+		MakeCourtyardScene(source, nSize, 32.0f, 48.0f);
+	else if (sName == "maze")
+		MakeMazeScene(source, nSize, 8.0f, 8.0f, options.nSeed);
+	else if (sName == "hall")
+		MakeHallScene(source, nSize, options.nLightsPerRoom, 32.0f, 24.0f, options.nSeed);
+	else
+		return false;
+	return true;
+}
+
+static int RunSuiteBench(const SOptions& options)
+{
+	static constexpr int kBounces = 2;
+	static constexpr int kRays = 128;
+	static constexpr float kSmoothAngle = 35.0f;
+
+	std::vector<std::string> sceneNames;
+	for (size_t nStart = 0; nStart <= options.sScenes.size(); )
+	{
+		const size_t nEnd = std::min(options.sScenes.find(',', nStart), options.sScenes.size());
+		if (nEnd > nStart)
+			sceneNames.push_back(options.sScenes.substr(nStart, nEnd - nStart));
+		nStart = nEnd + 1;
+	}
+
+	FILE* pFile = options.sJsonPath.empty() ? stdout : fopen(options.sJsonPath.c_str(), "w");
+	if (!pFile)
+	{
+		fprintf(stderr, "error: Failed to open file '%s'.\n", options.sJsonPath.c_str());
+		return 1;
+	}
+
+	CJobSystem jobSystem;
+	CCpuBaker baker(&jobSystem);
+	fprintf(pFile, "{\n  \"threads\": %d,\n  \"bounces\": %d,\n  \"sky_emissive_rays\": %d,\n  \"indirect_rays\": %d,\n  \"runs\": [",
+		jobSystem.GetNumThreads(), kBounces, kRays, kRays);
+
+	int nResult = 0;
+	bool bFirstRun = true;
+	for (const std::string& sName : sceneNames)
+	{
+		for (int nSize : options.gridSizes)
+		{
+			CMemorySceneSource source;
+			if (!MakeSuiteScene(sName, nSize, options, source))
+			{
+				fprintf(stderr, "error: unknown scene '%s'.\n", sName.c_str());
+				nResult = 2;
+				break;
+			}
+
+			SBakeScene scene;
+			BuildBenchScene(source, ELightBake_Direct | ELightBake_Indirect, scene);
+			SLevelInfo& levelInfo = scene.levelInfo;
+			levelInfo.nSkyEmissiveRays = kRays;
+			levelInfo.nIndirectRays = kRays;
+			levelInfo.normalSmoothCos = cosf(kSmoothAngle * (3.141592f / 180.0f));
+			if (levelInfo.nSunLightIndex < 0)
+				levelInfo.nBakeFlags &= ~ELightBake_Sun;
+			if (levelInfo.nSkyLightIndex < 0)
+				levelInfo.nBakeFlags &= ~ELightBake_Sky;
+
+			SBakeProfile profile;
+			std::vector<float4> accumulation;
+			baker.SetProfile(&profile);
+			const auto startTime = std::chrono::high_resolution_clock::now();
+			baker.Bake(scene, kBounces, accumulation);
+			const std::chrono::duration<double> bakeTime = std::chrono::high_resolution_clock::now() - startTime;
+			baker.SetProfile(nullptr);
+
+			fprintf(pFile, "%s\n    {\n      \"scene\": \"%s\",\n      \"size\": %d,\n      \"sectors\": %d,\n      \"surfaces\": %d,\n"
+				"      \"vertices\": %d,\n      \"traced_vertices\": %d,\n      \"lights\": %d,\n      \"scene_bytes\": %llu,\n"
+				"      \"peak_memory_bytes\": %llu,\n      \"total_ms\": %.3f,\n      \"passes\": [",
+				bFirstRun ? "" : ",", sName.c_str(), nSize, levelInfo.nTotalSectors, levelInfo.nTotalSurfaces, levelInfo.nTotalVertices,
+				baker.GetNumTracedVertices(), levelInfo.nTotalLights, (unsigned long long)GetSceneBytes(scene),
+				(unsigned long long)GetPeakMemoryBytes(), bakeTime.count() * 1000.0);
+			bFirstRun = false;
+
+			bool bFirstPass = true;
+			for (const SBakeStageProfile& pass : profile.stages)
+			{
+				// the smoothing and weld passes go over every vertex, the light passes over the traced ones
+				const bool bLightPass = pass.ePass != EBakePass_SmoothNormals && pass.ePass != EBakePass_WeldVertices;
+				const int nVertices = bLightPass ? baker.GetNumTracedVertices() : levelInfo.nTotalVertices;
+				const double seconds = std::max(pass.seconds, 1e-9);
+				fprintf(pFile, "%s\n        { \"pass\": \"%s\", \"bounce\": %d, \"ms\": %.3f, \"vertices_per_sec\": %.0f, \"rays\": %lld, "
+					"\"rays_per_sec\": %.0f, \"adjoin_hops_per_ray\": %.3f, \"max_recursion_rays\": %lld }",
+					bFirstPass ? "" : ",", GetBakePassName(pass.ePass), pass.nBounce, pass.seconds * 1000.0, nVertices / seconds,
+					(long long)pass.counters.nRays, pass.counters.nRays / seconds, pass.counters.GetAverageHops(), (long long)pass.counters.nMaxRecursionRays);
+				bFirstPass = false;
+			}
+			fprintf(pFile, "\n      ]\n    }");
+		}
+		if (nResult)
+			break;
+	}
+	fprintf(pFile, "\n  ]\n}\n");
+
+	if (pFile != stdout)
+		fclose(pFile);
+	return nResult;
+}
+
+// 2x2 grid of rooms behind a sector without surfaces. Sector 0 is the empty one, so a bvh root that isn't recognized as
+// empty sends the traversal back to itself.
+static void MakeEmptySectorScene(CMemorySceneSource& source)
+{
+	MakeRoomGridScene(source, 2, 2, 64.0f, 32.0f);
+	for (SSceneSector& sector : source.sectors)
+	{
+		for (SSceneSurface& surface : sector.surfaces)
+			surface.nAdjoinSector += surface.nAdjoinSector >= 0 ? 1 : 0;
+	}
+	for (SSceneLight& light : source.lights)
+		++light.nSectorIndex;
+	source.sectors.insert(source.sectors.begin(), SSceneSector());
+}
+
+// Rays from a sector without surfaces (which JklLevel accepts) have nothing to hit, scalar and packet traces must agree
+static bool CheckEmptySectorTrace()
+{
+	static constexpr int kRays = 4 * kRayPacketSize;
+
+	CMemorySceneSource source;
+	MakeEmptySectorScene(source);
+
+	SBakeScene scene;
+	BuildBenchScene(source, ELightBake_Lights, scene);
+	const int nEmptySector = 0;
+	const CCpuTracer tracer(scene, nullptr);
+
+	const float3 start = { 32.0f, 32.0f, 16.0f };
+	int nScalarHits = 0, nPacketHits = 0;
+	for (int nRay = 0; nRay < kRays; nRay += kRayPacketSize)
+	{
+		SRayPacket packet;
+		packet.nCount = kRayPacketSize;
+		for (int nLane = 0; nLane < kRayPacketSize; ++nLane)
+		{
+			const float3 end = start + GenSphereRay(nRay + nLane, kRays) * kSkyDistance;
+			packet.Set(nLane, start, end);
+
+			SRayPayload payload = {};
+			nScalarHits += tracer.TraceRay(payload, nEmptySector, start, end);
+		}
+
+		SRayPayload aPayloads[kRayPacketSize] = {};
+		nPacketHits += std::popcount((unsigned)tracer.TraceRayPacket(aPayloads, nEmptySector, packet));
+	}
+
+	printf("%-24s %d scalar and %d packet hits of %d rays\n", "empty sector trace", nScalarHits, nPacketHits, kRays);
+	return nScalarHits == 0 && nPacketHits == 0;
+}
+
+// Probes after a bake of the same level, the empty sector gets none (its ambient stays the vertex average) and the
+// rooms get theirs
+static bool CheckEmptySectorProbes(CJobSystem& jobSystem)
+{
+	CMemorySceneSource source;
+	MakeEmptySectorScene(source);
+
+	SBakeScene scene;
+	BuildBenchScene(source, ELightBake_Lights | ELightBake_Indirect, scene);
+	scene.levelInfo.nIndirectRays = 16;
+
+	CCpuBaker baker(&jobSystem);
+	std::vector<float4> accumulation;
+	baker.Bake(scene, 1, accumulation);
+
+	SProbeSettings settings;
+	settings.nRays = 64;
+	SSectorProbes probes;
+	STraceCounters counters;
+	PlaceSectorProbes(scene, settings, probes);
+	TraceSectorProbes(scene, accumulation, settings, &jobSystem, probes, counters);
+
+	int nRoomsWithProbes = 0;
+	for (int nSectorIndex = 1; nSectorIndex < (int)scene.sectors.size(); ++nSectorIndex)
+		nRoomsWithProbes += probes.HasSectorProbes(nSectorIndex) && probes.GetSectorAmbient(nSectorIndex).w > 0.0f;
+
+	printf("%-24s %d probes in the empty sector, %d of %d rooms lit by probes\n", "empty sector probes",
+		probes.sectorOffsets[1] - probes.sectorOffsets[0], nRoomsWithProbes, (int)scene.sectors.size() - 1);
+	return !probes.HasSectorProbes(0) && nRoomsWithProbes == (int)scene.sectors.size() - 1;
+}
+
+// tiles and batches only change the order of the float sums, so their results differ from a one shot bake by rounding
+static constexpr float kCheckMaxError = 1e-4f;
+
+// 2x2 grid of rooms with smoothed normals, lights and two bounces of indirect light
+static void BuildCheckScene(SBakeScene& scene)
+{
+	CMemorySceneSource source;
+	MakeRoomGridScene(source, 2, 4, 64.0f, 32.0f);
+	BuildBenchScene(source, ELightBake_Lights | ELightBake_Indirect, scene);
+	scene.levelInfo.nIndirectRays = 32;
+	scene.levelInfo.normalSmoothCos = cosf(35.0f * (3.141592f / 180.0f));
+}
+
+// A bake split into small tiles and ray batches matches the same bake in one work item per pass
+static bool CheckTiledBake(CJobSystem& jobSystem)
+{
+	static constexpr int kBounces = 2;
+
+	SBakeScene sourceScene;
+	BuildCheckScene(sourceScene);
+
+	CCpuBaker baker(&jobSystem);
+	std::vector<float4> reference, tiled;
+	SBakeScene scene = sourceScene;
+	baker.Bake(scene, kBounces, reference);
+
+	SBakeScheduleSettings settings;
+	settings.nTileVertices = 97;
+	settings.nBatchRays = 8;
+	scene = sourceScene;
+	baker.Bake(scene, kBounces, tiled, settings);
+
+	const float maxError = GetMaxError(tiled, reference);
+	printf("%-24s %d vertices in tiles of %d and batches of %d rays, max error %g\n", "tiled bake",
+		(int)scene.vertices.size(), settings.nTileVertices, settings.nBatchRays, maxError);
+	return tiled.size() == reference.size() && maxError <= kCheckMaxError;
+}
+
+#ifdef _WIN32
+typedef HANDLE WorkerProcess;
+#else
+typedef pid_t WorkerProcess;
+#endif
+
+// starts this executable again as "lightbench worker --address sAddress"
+static bool StartWorkerProcess(const SOptions& options, const std::string& sAddress, WorkerProcess& process)
+{
+#ifdef _WIN32
+	char sExePath[MAX_PATH];
+	if (!GetModuleFileNameA(nullptr, sExePath, MAX_PATH))
+		return false;
+
+	std::string sCommandLine = std::string("\"") + sExePath + "\" worker --address " + sAddress;
+	STARTUPINFOA startupInfo = { sizeof(startupInfo) };
+	PROCESS_INFORMATION processInfo = {};
+	if (!CreateProcessA(nullptr, sCommandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processInfo))
+		return false;
+
+	CloseHandle(processInfo.hThread);
+	process = processInfo.hProcess;
+	return true;
+#else
+	process = fork();
+	if (process == 0)
+	{
+		execlp(options.sExePath.c_str(), options.sExePath.c_str(), "worker", "--address", sAddress.c_str(), (char*)nullptr);
+		_exit(127);
+	}
+	return process > 0;
+#endif
+}
+
+// waits for a worker process to exit, true if it exited with 0
+static bool WaitWorkerProcess(WorkerProcess process)
+{
+#ifdef _WIN32
+	DWORD nExitCode = 1;
+	WaitForSingleObject(process, INFINITE);
+	GetExitCodeProcess(process, &nExitCode);
+	CloseHandle(process);
+	return nExitCode == 0;
+#else
+	int nStatus = 0;
+	return waitpid(process, &nStatus, 0) == process && WIFEXITED(nStatus) && WEXITSTATUS(nStatus) == 0;
+#endif
+}
+
+// A bake of the coordinator on worker processes matches a local bake of the same level. The workers are this
+// executable in worker mode, on a Unix socket next to the temporary files (TCP on Windows).
+static bool CheckDistributedBake(const SOptions& options, CJobSystem& jobSystem)
+{
+	static constexpr int kBounces = 2;
+	static constexpr int kWorkers = 2;
+
+	// the coordinator wants the normals smoothed up front, like lightbake does it
+	SBakeScene sourceScene;
+	BuildCheckScene(sourceScene);
+	CCpuBaker baker(&jobSystem);
+	baker.ComputeSmoothNormals(sourceScene);
+	sourceScene.levelInfo.normalSmoothCos = 1.0f;
+
+	std::vector<float4> reference, distributed;
+	SBakeScene scene = sourceScene;
+	baker.Bake(scene, kBounces, reference);
+
+#ifdef _WIN32
+	const std::string sAddress = "127.0.0.1:" + std::to_string(20000 + GetCurrentProcessId() % 20000);
+#else
+	const std::string sAddress = "unix:" + (std::filesystem::temp_directory_path() / ("lightbench-" + std::to_string(getpid()) + ".sock")).string();
+#endif
+
+	std::vector<WorkerProcess> workers;
+	std::string sError;
+	bool bOk = true;
+	for (int nWorker = 0; nWorker < kWorkers && bOk; ++nWorker)
+	{
+		WorkerProcess process;
+		bOk = StartWorkerProcess(options, sAddress, process);
+		if (bOk)
+			workers.push_back(process);
+		else
+			sError = "could not start a worker process";
+	}
+
+	CBakeCoordinator coordinator;
+	if (bOk)
+	{
+		scene = sourceScene;
+		bOk = coordinator.Start(sAddress, kWorkers, sError) && coordinator.Bake(scene, kBounces, distributed, sError);
+	}
+	coordinator.Stop();
+
+	int nFailedWorkers = 0;
+	for (WorkerProcess process : workers)
+		nFailedWorkers += !WaitWorkerProcess(process);
+
+	if (!bOk)
+	{
+		printf("%-24s %s\n", "distributed bake", sError.c_str());
+		return false;
+	}
+
+	const float maxError = GetMaxError(distributed, reference);
+	printf("%-24s %d vertices on %d worker processes (%d failed), max error %g\n", "distributed bake",
+		(int)scene.vertices.size(), kWorkers, nFailedWorkers, maxError);
+	return nFailedWorkers == 0 && distributed.size() == reference.size() && maxError <= kCheckMaxError;
+}
+
+static int RunChecks(const SOptions& options)
+{
+	CJobSystem jobSystem;
+	int nFailed = 0;
+	nFailed += !CheckEmptySectorTrace();
+	nFailed += !CheckEmptySectorProbes(jobSystem);
+	nFailed += !CheckTiledBake(jobSystem);
+	nFailed += !CheckDistributedBake(options, jobSystem);
+
+	printf("%s\n", nFailed ? "FAILED" : "ok");
+	return nFailed ? 1 : 0;
+}
+
+// one worker process of the distributed bake check
+static int RunWorker(const SOptions& options)
+{
+	CJobSystem jobSystem;
+	std::string sError;
+	if (!RunBakeWorker(options.sAddress, &jobSystem, sError))
+	{
+		fprintf(stderr, "error: %s\n", sError.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	SOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	if (options.sMode == "trace")
+		return RunTraceBench(options);
+	if (options.sMode == "packet")
+		return RunPacketBench(options);
+	if (options.sMode == "relight")
+		return RunRelightBench(options);
+	if (options.sMode == "upload")
+		return RunUploadBench(options);
+	if (options.sMode == "progressive")
+		return RunProgressiveBench(options);
+	if (options.sMode == "adaptive")
+		return RunAdaptiveBench(options);
+	if (options.sMode == "weld")
+		return RunWeldBench(options);
+	if (options.sMode == "smooth")
+		return RunSmoothBench(options);
+	if (options.sMode == "lights")
+		return RunLightsBench(options);
+	if (options.sMode == "visibility")
+		return RunVisibilityBench(options);
+	if (options.sMode == "emissive")
+		return RunEmissiveBench(options);
+	if (options.sMode == "scenefile")
+		return RunSceneFileBench(options);
+	if (options.sMode == "layout")
+		return RunLayoutBench(options);
+	if (options.sMode == "suite")
+		return RunSuiteBench(options);
+	if (options.sMode == "check")
+		return RunChecks(options);
+	if (options.sMode == "worker")
+		return RunWorker(options);
+
+	fprintf(stderr, "error: unknown mode '%s'.\n", options.sMode.c_str());
+	PrintUsage();
+	return 2;
+}
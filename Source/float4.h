@@ -39,7 +39,7 @@ struct float4
 		x -= other.x;
 		y -= other.y;
 		z -= other.z;
-		z -= other.w;
+		w -= other.w;
 		return *this;
 	}
 
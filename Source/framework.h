@@ -51,31 +51,7 @@
 
 #include "IJed.h"
 
-#include <cmath>
-#include <math.h>
-
-static constexpr float SRGB_GAMMA = 1.0f / 2.2f;
-static constexpr float SRGB_INVERSE_GAMMA = 2.2f;
-static constexpr float SRGB_ALPHA = 0.055f;
-
-// Converts a single linear channel to srgb
-inline float ToSRGB(float channel)
-{
-	if (channel <= 0.0031308)
-		return 12.92f * channel;
-	else
-		return (1.0f + SRGB_ALPHA) * powf(channel, 1.0f / 2.4f) - SRGB_ALPHA;
-}
-
-// Converts a single srgb channel to rgb
-inline float ToLinear(float channel)
-{
-	if (channel <= 0.04045f)
-		return channel / 12.92f;
-	else
-		return powf((channel + SRGB_ALPHA) / (1.0f + SRGB_ALPHA), 2.4f);
-}
-
+#include "Gamma.h"
 #include "float3.h"
 #include "float4.h"
 
@@ -0,0 +1,1079 @@
+// lightbake: headless light baker, reads .jkl levels directly and writes the baked vertex light back
+// Runs the same passes as the plugin on the CPU, see PrintUsage for the options.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../AssetIndex.h"
+#include "../Assets.h"
+#include "../BakeCacheFile.h"
+#include "../BakeProfile.h"
+#include "../BakeScene.h"
+#include "../CompactLayout.h"
+#include "../CpuBaker.h"
+#include "../DistributedBake.h"
+#include "../GameFileSystem.h"
+#include "../JklLevel.h"
+#include "../JobSystem.h"
+#include "../LightCache.h"
+#include "../Lightmap.h"
+#include "../SectorProbes.h"
+#include "../SceneFile.h"
+#include "../SceneBuilder.h"
+
+// same defaults as the plugin dialog
+static constexpr int kDefIndirectBounces = 3;
+static constexpr int kMinIndirectBounces = 1;
+static constexpr int kMaxIndirectBounces = 5;
+static constexpr int kDefNormalSmoothAngle = 35;
+static constexpr int kDefRaysPerVertex = 1024;
+
+enum EMessageType
+{
+	EMessage_Info,
+	EMessage_Warning,
+	EMessage_Error
+};
+
+static std::mutex g_messageMutex;
+
+template <typename... Args>
+void PrintMessage(EMessageType eType, const std::string& sLevel, const char* sFmt, Args&&... args)
+{
+	char msg[512];
+	snprintf(msg, sizeof(msg), sFmt, std::forward<Args>(args)...);
+
+	static const char* const kPrefixes[] = { "", "warning: ", "error: " };
+
+	std::lock_guard<std::mutex> lock(g_messageMutex);
+	FILE* pStream = eType == EMessage_Info ? stdout : stderr;
+	if (sLevel.empty())
+		fprintf(pStream, "%s%s\n", kPrefixes[eType], msg);
+	else
+		fprintf(pStream, "%s: %s%s\n", sLevel.c_str(), kPrefixes[eType], msg);
+	fflush(pStream);
+}
+
+struct SOptions
+{
+	uint32_t nBakeFlags = ELightBake_Direct | ELightBake_Indirect | ELightBake_GammaCorrect | ELightBake_PhysicalFalloff;
+	int      nSkyEmissiveRays = kDefRaysPerVertex;
+	int      nIndirectRays = kDefRaysPerVertex;
+	int      nIndirectBounces = kDefIndirectBounces;
+	int      nNormalSmoothingAngle = kDefNormalSmoothAngle;
+	float    adaptiveThreshold = kDefaultAdaptiveThreshold;
+	int      nThreads = 0;
+	int      nJobs = 1;
+	bool     bCache = false;
+	bool     bExportScene = false;
+	bool     bCompactLayout = false;
+	bool     bLightmap = false;
+	bool     bProbes = false;
+	bool     bProbeTable = false;
+	int      nWorkers = 1;
+
+	SLightmapSettings        lightmap;
+	SProbeSettings           probes;
+
+	std::string              sListenAddress; // coordinator of a distributed bake
+	std::string              sWorkerAddress; // worker of a distributed bake
+	std::string              sProfilePath;   // time and rays of every stage, .csv or .json
+	std::string              sAssetIndexPath; // parsed colormaps and materials kept between runs
+
+	std::string              sOutDir;
+	std::vector<std::string> searchPaths;
+	std::vector<std::string> levels;
+};
+
+// Colormaps and materials shared by every level in the batch
+class CAssetCache
+{
+public:
+	CAssetCache(const CGameFileSystem& fileSystem, CAssetIndex* pIndex)
+		: m_fileSystem(fileSystem)
+		, m_pIndex(pIndex)
+	{
+	}
+
+	// Loads the colormaps of the sectors and the materials of the sectors with a colormap in one go, the files that
+	// aren't cached yet are read and parsed in parallel in the materials stage of pProfile
+	void Preload(const CJklLevel& level, const std::string& sLevel, CJobSystem* pJobSystem, SBakeProfile* pProfile);
+
+	// files that aren't cached yet are loaded in the materials stage of pProfile
+	const SColormap*      LoadColormap(const std::string& sFileName, const std::string& sLevel, SBakeProfile* pProfile);
+	const SMaterialColor* LoadMaterialColor(const std::string& sFileName, const std::string& sLevel, SBakeProfile* pProfile);
+
+private:
+	// loads the files that aren't cached yet and adds them to the cache
+	void LoadMissing(EAssetType eType, const std::vector<std::string>& names, const std::string& sLevel, CJobSystem* pJobSystem,
+		SBakeProfile* pProfile);
+
+	const CGameFileSystem& m_fileSystem;
+	CAssetIndex*           m_pIndex;
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, std::unique_ptr<SColormap>>      m_colormapCache; // null when missing/broken
+	std::unordered_map<std::string, std::unique_ptr<SMaterialColor>> m_materialColorCache; // null when missing/broken
+};
+
+void CAssetCache::Preload(const CJklLevel& level, const std::string& sLevel, CJobSystem* pJobSystem, SBakeProfile* pProfile)
+{
+	const std::vector<std::string>& colormaps = level.GetColormaps();
+	const std::vector<std::string>& materials = level.GetMaterials();
+
+	std::vector<bool> used(colormaps.size(), false);
+	std::vector<std::string> names;
+	for (const SJklSector& sector : level.GetSectors())
+	{
+		if (sector.nColormap >= 0 && sector.nColormap < (int)colormaps.size() && !used[sector.nColormap])
+		{
+			used[sector.nColormap] = true;
+			names.push_back(colormaps[sector.nColormap]);
+		}
+	}
+	LoadMissing(EAsset_Colormap, names, sLevel, pJobSystem, pProfile);
+
+	// materials are only looked at in sectors with a colormap
+	used.assign(materials.size(), false);
+	names.clear();
+	for (const SJklSector& sector : level.GetSectors())
+	{
+		if (sector.nColormap < 0 || sector.nColormap >= (int)colormaps.size() || !LoadColormap(colormaps[sector.nColormap], sLevel, pProfile))
+			continue;
+
+		for (int nSurfaceIndex = sector.nFirstSurface; nSurfaceIndex < sector.nFirstSurface + sector.nNumSurfaces; ++nSurfaceIndex)
+		{
+			const int nMaterial = level.GetSurfaces()[nSurfaceIndex].nMaterial;
+			if (nMaterial >= 0 && nMaterial < (int)materials.size() && !used[nMaterial])
+			{
+				used[nMaterial] = true;
+				names.push_back(materials[nMaterial]);
+			}
+		}
+	}
+	LoadMissing(EAsset_Material, names, sLevel, pJobSystem, pProfile);
+}
+
+void CAssetCache::LoadMissing(EAssetType eType, const std::vector<std::string>& names, const std::string& sLevel, CJobSystem* pJobSystem,
+	SBakeProfile* pProfile)
+{
+	std::vector<SAssetLoad> loads;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (const std::string& sName : names)
+		{
+			const bool bCached = (eType == EAsset_Colormap) ? m_colormapCache.count(sName) != 0 : m_materialColorCache.count(sName) != 0;
+			if (sName.empty() || bCached)
+				continue;
+
+			loads.emplace_back();
+			loads.back().eType = eType;
+			loads.back().sName = sName;
+		}
+	}
+	if (loads.empty())
+		return;
+
+	CScopedBakeTimer timer(pProfile, EBakeStage_Materials);
+	for (SAssetLoad& load : loads)
+	{
+		if (!m_fileSystem.GetFileStamp(load.sName, load.nStamp))
+			load.nStamp = 0;
+	}
+
+	LoadAssets(loads, m_pIndex, pJobSystem, [this](const std::string& sName, std::vector<uint8_t>& data)
+	{
+		return m_fileSystem.ReadGameFile(sName, data);
+	}, true);
+
+	// another level of the batch can have loaded the same files in the meantime, the first one is kept and reported
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (SAssetLoad& load : loads)
+	{
+		const bool bAdded = (eType == EAsset_Colormap)
+			? m_colormapCache.emplace(load.sName, std::move(load.pColormap)).second
+			: m_materialColorCache.emplace(load.sName, load.bLoaded ? std::make_unique<SMaterialColor>(load.material) : nullptr).second;
+		if (!bAdded)
+			continue;
+
+		if (load.sError)
+			PrintMessage(EMessage_Error, sLevel, "%s in '%s'.", load.sError, load.sName.c_str());
+		else if (!load.bFound && eType == EAsset_Colormap)
+			PrintMessage(EMessage_Warning, sLevel, "Colormap '%s' not found, using default colors.", load.sName.c_str());
+	}
+}
+
+const SColormap* CAssetCache::LoadColormap(const std::string& sFileName, const std::string& sLevel, SBakeProfile* pProfile)
+{
+	if (sFileName.empty())
+		return nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_colormapCache.find(sFileName);
+		if (it != m_colormapCache.end())
+			return it->second.get();
+	}
+
+	LoadMissing(EAsset_Colormap, { sFileName }, sLevel, nullptr, pProfile);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_colormapCache[sFileName].get();
+}
+
+const SMaterialColor* CAssetCache::LoadMaterialColor(const std::string& sFileName, const std::string& sLevel, SBakeProfile* pProfile)
+{
+	if (sFileName.empty())
+		return nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_materialColorCache.find(sFileName);
+		if (it != m_materialColorCache.end())
+			return it->second.get();
+	}
+
+	LoadMissing(EAsset_Material, { sFileName }, sLevel, nullptr, pProfile);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_materialColorCache[sFileName].get();
+}
+
+// Scene source over a parsed .jkl, assets resolved through the shared cache
+class CJklSceneSource
+	: public ISceneSource
+{
+public:
+	CJklSceneSource(const CJklLevel& level, CAssetCache& assets, const std::string& sLevelName, SBakeProfile* pProfile)
+		: m_level(level)
+		, m_assets(assets)
+		, m_sLevelName(sLevelName)
+		, m_pProfile(pProfile)
+	{
+	}
+
+	int GetNumSectors() override { return (int)m_level.GetSectors().size(); }
+	int GetNumLights() override  { return (int)m_level.GetLights().size(); }
+
+	// the jkl doesn't store a layer count, use the highest layer referenced
+	int GetNumLayers() override
+	{
+		int nNumLayers = 1;
+		for (const SJklSector& sector : m_level.GetSectors())
+			nNumLayers = std::max(nNumLayers, sector.nLayer + 1);
+		return nNumLayers;
+	}
+
+	void GetSector(int nSectorIndex, SSceneSector& sector) override;
+	void GetLight(int nLightIndex, SSceneLight& light) override;
+
+private:
+	const CJklLevel&   m_level;
+	CAssetCache&       m_assets;
+	const std::string& m_sLevelName;
+	SBakeProfile*      m_pProfile;
+
+	std::unordered_map<int, uint32_t> m_sectorVertexMap; // level vertex -> sector vertex, reused between sectors
+};
+
+void CJklSceneSource::GetSector(int nSectorIndex, SSceneSector& sector)
+{
+	const SJklSector& levelSector = m_level.GetSectors()[nSectorIndex];
+	const std::vector<SJklSurface>& levelSurfaces = m_level.GetSurfaces();
+	const std::vector<float3>& levelVertices = m_level.GetVertices();
+	const std::vector<std::string>& materials = m_level.GetMaterials();
+	const std::vector<std::string>& colormaps = m_level.GetColormaps();
+
+	const bool bHasColormap = levelSector.nColormap >= 0 && levelSector.nColormap < (int)colormaps.size();
+	sector.nFlags = levelSector.nFlags;
+	sector.nLayer = levelSector.nLayer;
+	sector.pColormap = bHasColormap ? m_assets.LoadColormap(colormaps[levelSector.nColormap], m_sLevelName, m_pProfile) : nullptr;
+
+	m_sectorVertexMap.clear();
+	sector.vertices.reserve(levelSector.vertices.size());
+	for (int nVertex : levelSector.vertices)
+	{
+		m_sectorVertexMap.emplace(nVertex, (uint32_t)sector.vertices.size());
+		sector.vertices.push_back(levelVertices[nVertex]);
+	}
+
+	sector.surfaces.resize(levelSector.nNumSurfaces);
+	for (int nSurfaceIndex = 0; nSurfaceIndex < levelSector.nNumSurfaces; ++nSurfaceIndex)
+	{
+		const int nLevelSurfaceIndex = levelSector.nFirstSurface + nSurfaceIndex;
+		const SJklSurface& levelSurface = levelSurfaces[nLevelSurfaceIndex];
+
+		SSceneSurface& surface = sector.surfaces[nSurfaceIndex];
+		surface.nAdjoinSector = m_level.GetAdjoinSector(nLevelSurfaceIndex);
+		surface.nAdjoinFlags = levelSurface.nAdjoin >= 0 ? m_level.GetAdjoins()[levelSurface.nAdjoin].nFlags : 0;
+		surface.nSurfFlags = levelSurface.nSurfFlags;
+		surface.nFaceFlags = levelSurface.nFaceFlags;
+		surface.nGeo = levelSurface.nGeo;
+		surface.bHasMaterial = levelSurface.nMaterial >= 0 && levelSurface.nMaterial < (int)materials.size();
+		surface.pMaterial = (sector.pColormap && surface.bHasMaterial) ? m_assets.LoadMaterialColor(materials[levelSurface.nMaterial], m_sLevelName, m_pProfile) : nullptr;
+		surface.nFillColor = surface.pMaterial ? surface.pMaterial->nFillColor : 0;
+		surface.extraLight = levelSurface.extraLight;
+		surface.normal = levelSurface.normal;
+
+		surface.nFirstIndex = (uint32_t)sector.indices.size();
+		surface.nNumIndices = (uint32_t)levelSurface.vertices.size();
+		for (int nVertex : levelSurface.vertices)
+		{
+			// surfaces may reference vertices missing from the sector list, give them a slot of their own
+			auto it = m_sectorVertexMap.find(nVertex);
+			if (it == m_sectorVertexMap.end())
+			{
+				it = m_sectorVertexMap.emplace(nVertex, (uint32_t)sector.vertices.size()).first;
+				sector.vertices.push_back(levelVertices[nVertex]);
+			}
+			sector.indices.push_back(it->second);
+		}
+	}
+}
+
+void CJklSceneSource::GetLight(int nLightIndex, SSceneLight& light)
+{
+	const SJklLight& levelLight = m_level.GetLights()[nLightIndex];
+	light.position = levelLight.position;
+	light.intensity = levelLight.intensity;
+	light.range = levelLight.range;
+	light.color = levelLight.color;
+	light.rgbIntensity = levelLight.rgbIntensity;
+	light.nFlags = levelLight.nFlags;
+	light.nLayer = levelLight.nLayer;
+	light.nSectorIndex = m_level.FindSectorForPoint(levelLight.position);
+}
+
+// equivalent of CLightBakerDlg::ApplyToLevel, the sector ambient comes from the probes of the sector if it has any
+static void ApplyToLevel(CJklLevel& level, const SBakeScene& scene, const std::vector<float4>& vertexColors, const SSectorProbes& probes)
+{
+	const uint32_t nBakeFlags = scene.levelInfo.nBakeFlags;
+	const std::vector<SJklSector>& levelSectors = level.GetSectors();
+
+	// the vertices of a sector follow each other in the order of its surfaces, the ambient is summed in the same order
+	uint32_t nVertexIndex = 0;
+	for (int nSectorIndex = 0; nSectorIndex < (int)levelSectors.size(); ++nSectorIndex)
+	{
+		const SJklSector& sector = levelSectors[nSectorIndex];
+		const bool bProbeAmbient = probes.HasSectorProbes(nSectorIndex);
+
+		float ambient = 0.0f;
+		float totalAmbient = 0.0f;
+		for (; nVertexIndex < scene.vertices.size() && scene.vertices[nVertexIndex].nSectorIndex == (uint32_t)nSectorIndex; ++nVertexIndex)
+		{
+			const SVertex& vertex = scene.vertices[nVertexIndex];
+			const int nLevelSurfaceIndex = sector.nFirstSurface + vertex.nLocalSurfaceIndex;
+			if (scene.surfaces[vertex.nSurfaceIndex].nFlags & ESurface_IsVisible)
+				level.SetVertexLight(nLevelSurfaceIndex, vertex.nLocalVertexIndex, ResolveVertexColor(vertexColors[nVertexIndex], nBakeFlags));
+
+			if (!bProbeAmbient)
+			{
+				ambient += level.GetVertexLight(nLevelSurfaceIndex, vertex.nLocalVertexIndex).w;
+				totalAmbient += 1.0f;
+			}
+		}
+
+		if ((sector.nFlags & ESector_NoAmbientLightRGB) || (sector.nFlags & ESector_NoAmbientLight))
+			continue;
+
+		if (bProbeAmbient)
+			level.SetSectorAmbient(nSectorIndex, ResolveVertexColor(probes.GetSectorAmbient(nSectorIndex), nBakeFlags).w);
+		else
+			level.SetSectorAmbient(nSectorIndex, totalAmbient < 1e-5f ? 0.0f : ambient / totalAmbient);
+	}
+}
+
+// Bake with the cache file next to the written level: an unchanged level takes the stored colors, a level that only differs
+// in its point lights rebakes those and the bounces, anything else is baked in full. The cache is rewritten after baking.
+// Returns false if the colors came from the cache, the normals of the scene aren't smoothed then.
+static bool BakeLevelCached(const std::string& sLevelName, const std::string& sCachePath, SBakeScene& scene, const SOptions& options,
+	CJobSystem* pJobSystem, CCpuBaker& baker, std::vector<float4>& vertexColors)
+{
+	SBakeProfile* pProfile = baker.GetProfile();
+	const uint64_t nSceneHash = CLightCache::HashScene(scene);
+
+	SBakeCacheResult result;
+	result.nResultHash = HashBakeResult(scene, options.nIndirectBounces, SBakeScheduleSettings());
+	result.levelInfo = scene.levelInfo;
+	result.nIndirectBounces = options.nIndirectBounces;
+
+	SBakeCacheResult cached;
+	CLightCache lightCache;
+	std::string sError;
+	{
+		CScopedBakeTimer timer(pProfile, EBakeStage_CacheFile);
+		if (std::filesystem::exists(sCachePath) && !LoadBakeCache(sCachePath, cached, lightCache, sError))
+			PrintMessage(EMessage_Warning, sLevelName, "%s '%s', baking without it.", sError.c_str(), sCachePath.c_str());
+	}
+
+	if (cached.nResultHash == result.nResultHash && cached.vertexColors.size() == scene.vertices.size())
+	{
+		PrintMessage(EMessage_Info, sLevelName, "Unchanged since the cached bake, nothing traced.");
+		vertexColors = std::move(cached.vertexColors);
+		return false;
+	}
+
+	if (lightCache.CanUpdate(nSceneHash))
+	{
+		SLightCacheStats stats;
+		{
+			CScopedBakeTimer timer(pProfile, EBakeStage_ChangedLights);
+			lightCache.Update(scene, pJobSystem, stats);
+		}
+		PrintMessage(EMessage_Info, sLevelName, "Rebaked %d changed lights from the cache (%d vertices traced).", stats.nChangedLights, stats.nTracedVertices);
+
+		vertexColors = lightCache.GetDirectLight();
+		baker.ResetRayStats();
+		baker.BakeIndirect(scene, options.nIndirectBounces, vertexColors);
+	}
+	else
+	{
+		// the light cache needs the direct light on its own
+		baker.BakeDirectPasses(scene, vertexColors);
+		lightCache.Store(nSceneHash, scene, vertexColors);
+		baker.BakeIndirect(scene, options.nIndirectBounces, vertexColors);
+	}
+
+	result.vertexColors = vertexColors;
+	CScopedBakeTimer timer(pProfile, EBakeStage_CacheFile);
+	if (!SaveBakeCache(sCachePath, result, lightCache, sError))
+		PrintMessage(EMessage_Warning, sLevelName, "%s '%s'.", sError.c_str(), sCachePath.c_str());
+	return true;
+}
+
+// builds the scene from the level and its materials, with the smoothing angle of the options
+static void BuildLevelScene(const CJklLevel& level, CAssetCache& assets, const std::string& sLevelName, const SOptions& options, SBakeScene& scene,
+	CJobSystem* pJobSystem, SBakeProfile* pProfile)
+{
+	CJklSceneSource source(level, assets, sLevelName, pProfile);
+	SSceneSnapshot snapshot;
+	{
+		CScopedBakeTimer timer(pProfile, EBakeStage_Extract);
+		assets.Preload(level, sLevelName, pJobSystem, pProfile);
+		TakeSceneSnapshot(source, snapshot);
+	}
+
+	CScopedBakeTimer timer(pProfile, EBakeStage_BuildScene);
+	BuildBakeScene(snapshot, options.nBakeFlags, scene);
+
+	SLevelInfo& levelInfo = scene.levelInfo;
+	levelInfo.normalSmoothCos = cosf((float)options.nNormalSmoothingAngle * (3.141592f / 180.0f));
+
+	// headless bakes always cover every sector and layer
+	scene.sectorMasks.assign(GetMaskBucketCount(levelInfo.nTotalSectors), 0);
+	for (int nSectorIndex = 0; nSectorIndex < levelInfo.nTotalSectors; ++nSectorIndex)
+		SetMaskBit(scene.sectorMasks.data(), nSectorIndex);
+
+	scene.layerMasks.assign(GetMaskBucketCount(snapshot.nNumLayers), 0);
+	for (int nLayerIndex = 0; nLayerIndex < snapshot.nNumLayers; ++nLayerIndex)
+		SetMaskBit(scene.layerMasks.data(), nLayerIndex);
+}
+
+// The scene file keeps the surface colors and lights converted with the gamma and extra light flags of the export
+// and the normals smoothed with its angle, the other flags and the ray counts come from the options.
+static constexpr uint32_t kSceneFileBakeFlags = ELightBake_GammaCorrect | ELightBake_ExtraLightEmissive;
+
+static bool LoadLevelSceneFile(const std::string& sPath, const CJklLevel& level, const SOptions& options, SBakeScene& scene, std::string& sError)
+{
+	CMappedSceneFile file;
+	if (!file.Open(sPath, sError))
+		return false;
+
+	const SLevelInfo& levelInfo = file.GetHeader().levelInfo;
+	if (levelInfo.nTotalSectors != (int)level.GetSectors().size() || levelInfo.nTotalSurfaces != (int)level.GetSurfaces().size())
+	{
+		sError = "Scene file doesn't match the level";
+		return false;
+	}
+
+	file.CopyTo(scene);
+	scene.levelInfo.nBakeFlags = (scene.levelInfo.nBakeFlags & kSceneFileBakeFlags) | (options.nBakeFlags & ~kSceneFileBakeFlags);
+	return true;
+}
+
+// the smoothing pass up front, for scene files and the workers of a distributed bake
+static void SmoothSceneNormals(SBakeScene& scene, CJobSystem* pJobSystem, SBakeProfile* pProfile)
+{
+	if (scene.levelInfo.normalSmoothCos < 1.0f)
+	{
+		CScopedBakeTimer timer(pProfile, EBakePass_SmoothNormals, 0);
+		CCpuBaker baker(pJobSystem);
+		baker.ComputeSmoothNormals(scene);
+		scene.levelInfo.normalSmoothCos = 1.0f;
+	}
+}
+
+// Texels of the lightmap atlas on top of the vertex light, written next to the level with its table
+static bool BakeLevelLightmap(const std::string& sLevelName, const std::string& sOutPath, const SBakeScene& scene, const std::vector<float4>& vertexColors,
+	const SOptions& options, CJobSystem* pJobSystem, SBakeProfile* pProfile)
+{
+	CScopedBakeTimer timer(pProfile, EBakeStage_Lightmap);
+
+	SLightmapLayout layout;
+	BuildLightmapLayout(scene, options.lightmap, layout);
+	if (layout.rects.empty())
+	{
+		PrintMessage(EMessage_Info, sLevelName, "No visible surfaces for the lightmap.");
+		return true;
+	}
+
+	const std::string sImagePath = GetLightmapImagePath(sOutPath);
+	const std::string sTablePath = GetLightmapTablePath(sOutPath);
+	STraceCounters counters;
+	std::string sError;
+	if (!BakeLightmap(scene, layout, vertexColors, options.lightmap, pJobSystem, counters, sImagePath, sError))
+	{
+		PrintMessage(EMessage_Error, sLevelName, "%s '%s'.", sError.c_str(), sImagePath.c_str());
+		return false;
+	}
+	if (!SaveLightmapTable(sTablePath, scene, layout, sError))
+	{
+		PrintMessage(EMessage_Error, sLevelName, "%s '%s'.", sError.c_str(), sTablePath.c_str());
+		return false;
+	}
+
+	if (pProfile)
+	{
+		SBakeStageProfile& stage = pProfile->GetStage(EBakeStage_Lightmap);
+		stage.counters += counters;
+		stage.bCountedHops = true;
+	}
+
+	PrintMessage(EMessage_Info, sLevelName, "Baked %lld texels of %d surfaces into a %dx%d lightmap '%s'.", (long long)layout.GetNumTexels(),
+		(int)layout.rects.size(), layout.nWidth, layout.nHeight, sImagePath.c_str());
+	return true;
+}
+
+// Sector probes for the ambient on top of the vertex light, with --probe-sh their table is written next to the level
+static bool BakeLevelProbes(const std::string& sLevelName, const std::string& sOutPath, const SBakeScene& scene, const std::vector<float4>& vertexColors,
+	const SOptions& options, CJobSystem* pJobSystem, SBakeProfile* pProfile, SSectorProbes& probes)
+{
+	CScopedBakeTimer timer(pProfile, EBakeStage_Probes);
+
+	STraceCounters counters;
+	PlaceSectorProbes(scene, options.probes, probes);
+	TraceSectorProbes(scene, vertexColors, options.probes, pJobSystem, probes, counters);
+
+	if (pProfile)
+	{
+		SBakeStageProfile& stage = pProfile->GetStage(EBakeStage_Probes);
+		stage.counters += counters;
+		stage.bCountedHops = true;
+	}
+
+	if (options.bProbeTable)
+	{
+		const std::string sTablePath = GetSectorProbesPath(sOutPath);
+		std::string sError;
+		if (!SaveSectorProbes(sTablePath, probes, sError))
+		{
+			PrintMessage(EMessage_Error, sLevelName, "%s '%s'.", sError.c_str(), sTablePath.c_str());
+			return false;
+		}
+	}
+
+	PrintMessage(EMessage_Info, sLevelName, "Traced %d probes for the ambient of %d sectors.", (int)probes.probes.size(), (int)scene.sectors.size());
+	return true;
+}
+
+// pProfile gets the time of every stage if it isn't null
+static bool BakeLevel(const std::string& sPath, const SOptions& options, CAssetCache& assets, CJobSystem* pJobSystem, CBakeCoordinator* pCoordinator,
+	SBakeProfile* pProfile)
+{
+	// a scene file is baked into the level of the same name next to it
+	const bool bSceneFile = std::filesystem::path(sPath).extension() == ".lbscene";
+	const std::string sLevelPath = bSceneFile ? std::filesystem::path(sPath).replace_extension(".jkl").string() : sPath;
+	const std::string sLevelName = std::filesystem::path(sLevelPath).filename().string();
+	const auto startTime = std::chrono::high_resolution_clock::now();
+	if (pProfile)
+		pProfile->sLevel = sLevelName;
+
+	CJklLevel level;
+	std::string sError;
+	bool bLoaded;
+	{
+		CScopedBakeTimer timer(pProfile, EBakeStage_Extract);
+		bLoaded = level.Load(sLevelPath.c_str(), sError);
+	}
+	if (!bLoaded)
+	{
+		PrintMessage(EMessage_Error, sLevelName, "%s.", sError.c_str());
+		return false;
+	}
+
+	if (level.GetLights().empty())
+	{
+		PrintMessage(EMessage_Info, sLevelName, "No lights available for baking, level left untouched.");
+		return true;
+	}
+
+	SBakeScene scene;
+	if (!bSceneFile)
+	{
+		BuildLevelScene(level, assets, sLevelName, options, scene, pJobSystem, pProfile);
+	}
+	else
+	{
+		CScopedBakeTimer timer(pProfile, EBakeStage_Extract);
+		if (!LoadLevelSceneFile(sPath, level, options, scene, sError))
+		{
+			PrintMessage(EMessage_Error, sLevelName, "%s '%s'.", sError.c_str(), sPath.c_str());
+			return false;
+		}
+	}
+
+	SLevelInfo& levelInfo = scene.levelInfo;
+	levelInfo.nSkyEmissiveRays = options.nSkyEmissiveRays;
+	levelInfo.nIndirectRays = options.nIndirectRays;
+	if (levelInfo.nBakeFlags & ELightBake_Adaptive)
+		EnableAdaptiveRays(levelInfo, options.adaptiveThreshold);
+
+	const std::string sOutPath = options.sOutDir.empty() ? sLevelPath : (std::filesystem::path(options.sOutDir) / sLevelName).string();
+	if (options.bExportScene)
+	{
+		const std::string sScenePath = GetSceneFilePath(sOutPath);
+		SmoothSceneNormals(scene, pJobSystem, pProfile);
+		if (!SaveSceneFile(sScenePath, scene, sError))
+		{
+			PrintMessage(EMessage_Error, sLevelName, "%s '%s'.", sError.c_str(), sScenePath.c_str());
+			return false;
+		}
+
+		PrintMessage(EMessage_Info, sLevelName, "Exported %d sectors, %d vertices and %d lights to '%s'.",
+			levelInfo.nTotalSectors, levelInfo.nTotalVertices, levelInfo.nTotalLights, sScenePath.c_str());
+		return true;
+	}
+
+	// remove flags if no sun/sky were found
+	if (levelInfo.nSunLightIndex < 0)
+		levelInfo.nBakeFlags &= ~ELightBake_Sun;
+
+	if (levelInfo.nSkyLightIndex < 0)
+		levelInfo.nBakeFlags &= ~ELightBake_Sky;
+
+	if (options.bCompactLayout)
+	{
+		CScopedBakeTimer timer(pProfile, EBakeStage_BuildScene);
+		if (!BuildCompactLayout(scene))
+			PrintMessage(EMessage_Warning, sLevelName, "More than %d sectors, tracing without the compact layout.", kMaxCompactSectors);
+	}
+
+	PrintMessage(EMessage_Info, sLevelName, "%d sectors, %d vertices, %d lights queued for baking.", levelInfo.nTotalSectors, levelInfo.nTotalVertices, levelInfo.nTotalLights);
+
+	const std::string sCachePath = GetBakeCachePath(sOutPath);
+
+	std::vector<float4> vertexColors;
+	CCpuBaker baker(pJobSystem);
+	baker.SetProfile(pProfile);
+	if (pCoordinator)
+	{
+		SmoothSceneNormals(scene, pJobSystem, pProfile);
+		CScopedBakeTimer timer(pProfile, EBakeStage_Workers);
+		if (!pCoordinator->Bake(scene, options.nIndirectBounces, vertexColors, sError))
+		{
+			PrintMessage(EMessage_Error, sLevelName, "%s.", sError.c_str());
+			return false;
+		}
+	}
+	else if (options.bCache)
+	{
+		// the lightmap interpolates the smoothed normals
+		if (!BakeLevelCached(sLevelName, sCachePath, scene, options, pJobSystem, baker, vertexColors) && options.bLightmap)
+			SmoothSceneNormals(scene, pJobSystem, pProfile);
+	}
+	else
+	{
+		baker.Bake(scene, options.nIndirectBounces, vertexColors);
+	}
+
+	if (baker.GetNumTracedVertices() > 0 && baker.GetNumTracedVertices() < levelInfo.nTotalVertices)
+		PrintMessage(EMessage_Info, sLevelName, "%d vertices traced, the others share a position and normal with one of them.", baker.GetNumTracedVertices());
+
+	if (levelInfo.nBakeFlags & ELightBake_Adaptive)
+	{
+		const SRayPassStats& skyEmissiveRayStats = pCoordinator ? pCoordinator->GetSkyEmissiveRayStats() : baker.GetSkyEmissiveRayStats();
+		const SRayPassStats& indirectRayStats = pCoordinator ? pCoordinator->GetIndirectRayStats() : baker.GetIndirectRayStats();
+		PrintMessage(EMessage_Info, sLevelName, "%.1f sky/emissive and %.1f indirect rays per vertex on average.",
+			skyEmissiveRayStats.GetAverageRays(), indirectRayStats.GetAverageRays());
+	}
+
+	SSectorProbes probes;
+	if (options.bProbes && !BakeLevelProbes(sLevelName, sOutPath, scene, vertexColors, options, pJobSystem, pProfile, probes))
+		return false;
+
+	{
+		CScopedBakeTimer timer(pProfile, EBakeStage_Writeback);
+		ApplyToLevel(level, scene, vertexColors, probes);
+
+		if (!level.Save(sOutPath.c_str(), sError))
+		{
+			PrintMessage(EMessage_Error, sLevelName, "%s '%s'.", sError.c_str(), sOutPath.c_str());
+			return false;
+		}
+	}
+
+	if (options.bLightmap && !BakeLevelLightmap(sLevelName, sOutPath, scene, vertexColors, options, pJobSystem, pProfile))
+		return false;
+
+	const std::chrono::duration<float> deltaTime = std::chrono::high_resolution_clock::now() - startTime;
+	if (pProfile)
+	{
+		pProfile->totalSeconds = deltaTime.count();
+		for (const SBakeStageProfile& stage : pProfile->stages)
+			PrintMessage(EMessage_Info, sLevelName, "  %s", FormatBakeStage(stage).c_str());
+	}
+	PrintMessage(EMessage_Info, sLevelName, "Finished light bake in %g seconds.", deltaTime.count());
+
+	return true;
+}
+
+static void PrintUsage()
+{
+	printf(
+		"usage: lightbake [options] <level.jkl | @list.txt>...\n"
+		"\n"
+		"Bakes vertex lighting into JKL levels on the CPU, levels are rewritten in place unless --out-dir is given.\n"
+		"A @file argument reads one level path per line.\n"
+		"\n"
+		"options:\n"
+		"  -r, --res <dir|gob>      add a resource search path (mat/, misc/cmp/), repeatable, searched in order\n"
+		"  -o, --out-dir <dir>      write the baked levels to this directory\n"
+		"  -t, --threads <n>        worker threads, default is one per core\n"
+		"  -j, --jobs <n>           levels baked at the same time, default 1\n"
+		"      --cache              keep the result in <level>.lbcache next to the written level, unchanged levels are\n"
+		"                           not traced again and changed point lights only retrace the vertices in their range\n"
+		"      --export-scene       write <level>.lbscene instead of baking, a scene file given as a level is baked into the\n"
+		"                           .jkl next to it without loading materials, its gamma, extra light and smoothing\n"
+		"                           settings are fixed by the export\n"
+		"      --listen <address>   bake on worker processes, waits for --workers workers to connect on host:port\n"
+		"                           (or unix:path) and bakes the levels one after another on all of them\n"
+		"      --workers <n>        workers of a distributed bake, default 1\n"
+		"      --worker <address>   run as a worker of the coordinator on host:port (or unix:path) until it is done,\n"
+		"                           takes no levels\n"
+		"      --rays <n>           sky/emissive rays per vertex, default %d\n"
+		"      --indirect-rays <n>  indirect rays per vertex, default %d\n"
+		"      --bounces <n>        indirect bounces (%d-%d), default %d\n"
+		"      --smooth-angle <deg> normal smoothing angle, 0 disables, default %d\n"
+		"      --adaptive [<x>]     adaptive ray count, vertices stop at an error of x of their light (default %g) and\n"
+		"                           leave their rays to the noisy ones, at most the ray counts on average\n"
+		"      --no-lights | --no-sun | --no-sky | --no-emissive | --no-indirect\n"
+		"                           skip a light source\n"
+		"      --no-gamma           disable gamma correct lighting\n"
+		"      --jed-falloff        use the original JED light falloff\n"
+		"      --extralight-emissive use extra light as emissive\n"
+		"      --tonemap            tone map the result\n"
+		"      --compact            trace a compact copy of the surfaces and 16 bit vertex positions, less memory\n"
+		"                           traffic per ray, the bounces differ slightly from a full precision bake\n"
+		"      --profile <file>     print the time of every stage of the bake (reading the level, materials, every\n"
+		"                           pass and bounce, writing) with the rays traced and the adjoins they crossed, and\n"
+		"                           write them to a .csv file, or a .json file for any other extension\n"
+		"      --asset-index <file> keep the parsed colormaps and materials in this file, later runs only read the\n"
+		"                           files that changed since\n"
+		"      --lightmap [<size>]  also bake the surfaces into <level>.lightmap.hdr with texels of size world units\n"
+		"                           (default %g) and write where every surface is to <level>.lightmap.csv\n"
+		"      --lightmap-width <n> width of the lightmap atlas in texels, default %d\n"
+		"      --lightmap-rays <n>  sky, emissive and bounce rays per lightmap texel, default %d\n"
+		"      --probes [<spacing>] set the sector ambient from probes that trace a sphere of rays, one at the center\n"
+		"                           of a sector or a grid spacing world units apart in large ones (default %g),\n"
+		"                           instead of the average of its vertex light\n"
+		"      --probe-rays <n>     rays per probe, default %d\n"
+		"      --probe-sh           also write the probes with the linear (L1) terms of their light to\n"
+		"                           <level>.probes.csv\n"
+		"  -h, --help               show this message\n",
+		kDefRaysPerVertex, kDefRaysPerVertex, kMinIndirectBounces, kMaxIndirectBounces, kDefIndirectBounces, kDefNormalSmoothAngle,
+		kDefaultAdaptiveThreshold, kDefaultLightmapTexelSize, kDefaultLightmapWidth, kDefaultLightmapRays, kDefaultProbeSpacing, kDefaultProbeRays);
+}
+
+static bool ParseOptions(int argc, char** argv, SOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string sArg = argv[i];
+		auto next = [&](int& nValue) -> bool
+		{
+			if (i + 1 >= argc)
+				return false;
+			nValue = atoi(argv[++i]);
+			return true;
+		};
+		auto nextString = [&](std::string& sValue) -> bool
+		{
+			if (i + 1 >= argc)
+				return false;
+			sValue = argv[++i];
+			return true;
+		};
+
+		bool bOk = true;
+		std::string sValue;
+		if (sArg == "-h" || sArg == "--help")
+		{
+			PrintUsage();
+			exit(0);
+		}
+		else if (sArg == "-r" || sArg == "--res")
+		{
+			bOk = nextString(sValue);
+			options.searchPaths.push_back(sValue);
+		}
+		else if (sArg == "-o" || sArg == "--out-dir")   bOk = nextString(options.sOutDir);
+		else if (sArg == "-t" || sArg == "--threads")   bOk = next(options.nThreads);
+		else if (sArg == "-j" || sArg == "--jobs")      bOk = next(options.nJobs);
+		else if (sArg == "--cache")                     options.bCache = true;
+		else if (sArg == "--export-scene")              options.bExportScene = true;
+		else if (sArg == "--compact")                   options.bCompactLayout = true;
+		else if (sArg == "--profile")                   bOk = nextString(options.sProfilePath);
+		else if (sArg == "--asset-index")               bOk = nextString(options.sAssetIndexPath);
+		else if (sArg == "--listen")                    bOk = nextString(options.sListenAddress);
+		else if (sArg == "--workers")                   bOk = next(options.nWorkers);
+		else if (sArg == "--worker")                    bOk = nextString(options.sWorkerAddress);
+		else if (sArg == "--rays")                      bOk = next(options.nSkyEmissiveRays);
+		else if (sArg == "--indirect-rays")             bOk = next(options.nIndirectRays);
+		else if (sArg == "--bounces")                   bOk = next(options.nIndirectBounces);
+		else if (sArg == "--smooth-angle")              bOk = next(options.nNormalSmoothingAngle);
+		else if (sArg == "--adaptive")
+		{
+			options.nBakeFlags |= ELightBake_Adaptive;
+
+			// the threshold is optional
+			char* sEnd = nullptr;
+			const float threshold = (i + 1 < argc) ? strtof(argv[i + 1], &sEnd) : 0.0f;
+			if (sEnd && sEnd != argv[i + 1] && *sEnd == 0 && threshold > 0.0f)
+			{
+				options.adaptiveThreshold = threshold;
+				++i;
+			}
+		}
+		else if (sArg == "--lightmap")
+		{
+			options.bLightmap = true;
+
+			// the texel size is optional
+			char* sEnd = nullptr;
+			const float texelSize = (i + 1 < argc) ? strtof(argv[i + 1], &sEnd) : 0.0f;
+			if (sEnd && sEnd != argv[i + 1] && *sEnd == 0 && texelSize > 0.0f)
+			{
+				options.lightmap.texelSize = texelSize;
+				++i;
+			}
+		}
+		else if (sArg == "--lightmap-width")            bOk = next(options.lightmap.nWidth);
+		else if (sArg == "--lightmap-rays")             bOk = next(options.lightmap.nRays);
+		else if (sArg == "--probes")
+		{
+			options.bProbes = true;
+
+			// the spacing is optional
+			char* sEnd = nullptr;
+			const float spacing = (i + 1 < argc) ? strtof(argv[i + 1], &sEnd) : 0.0f;
+			if (sEnd && sEnd != argv[i + 1] && *sEnd == 0 && spacing > 0.0f)
+			{
+				options.probes.spacing = spacing;
+				++i;
+			}
+		}
+		else if (sArg == "--probe-rays")                bOk = next(options.probes.nRays);
+		else if (sArg == "--probe-sh")                  options.bProbes = options.bProbeTable = true;
+		else if (sArg == "--no-lights")                 options.nBakeFlags &= ~ELightBake_Lights;
+		else if (sArg == "--no-sun")                    options.nBakeFlags &= ~ELightBake_Sun;
+		else if (sArg == "--no-sky")                    options.nBakeFlags &= ~ELightBake_Sky;
+		else if (sArg == "--no-emissive")               options.nBakeFlags &= ~ELightBake_Emissive;
+		else if (sArg == "--no-indirect")               options.nBakeFlags &= ~ELightBake_Indirect;
+		else if (sArg == "--no-gamma")                  options.nBakeFlags &= ~ELightBake_GammaCorrect;
+		else if (sArg == "--jed-falloff")               options.nBakeFlags &= ~ELightBake_PhysicalFalloff;
+		else if (sArg == "--extralight-emissive")       options.nBakeFlags |= ELightBake_ExtraLightEmissive;
+		else if (sArg == "--tonemap")                   options.nBakeFlags |= ELightBake_ToneMap;
+		else if (sArg[0] == '@')
+		{
+			std::ifstream list(sArg.substr(1));
+			if (!list)
+			{
+				PrintMessage(EMessage_Error, "", "Failed to open level list '%s'.", sArg.c_str() + 1);
+				return false;
+			}
+
+			std::string sLine;
+			while (std::getline(list, sLine))
+			{
+				while (!sLine.empty() && isspace((unsigned char)sLine.back()))
+					sLine.pop_back();
+				if (!sLine.empty() && sLine[0] != '#')
+					options.levels.push_back(sLine);
+			}
+		}
+		else if (sArg[0] == '-')
+		{
+			PrintMessage(EMessage_Error, "", "Unknown option '%s'.", sArg.c_str());
+			return false;
+		}
+		else
+		{
+			options.levels.push_back(sArg);
+		}
+
+		if (!bOk)
+		{
+			PrintMessage(EMessage_Error, "", "Missing value for '%s'.", sArg.c_str());
+			return false;
+		}
+	}
+
+	// a worker gets everything from the coordinator
+	if (options.levels.empty() && options.sWorkerAddress.empty())
+	{
+		PrintUsage();
+		return false;
+	}
+
+	options.nIndirectBounces = std::min(std::max(options.nIndirectBounces, kMinIndirectBounces), kMaxIndirectBounces);
+	options.nNormalSmoothingAngle = std::min(std::max(options.nNormalSmoothingAngle, 0), 180);
+	options.nSkyEmissiveRays = std::max(options.nSkyEmissiveRays, 1);
+	options.nIndirectRays = std::max(options.nIndirectRays, 1);
+	options.nJobs = std::max(options.nJobs, 1);
+	options.nWorkers = std::max(options.nWorkers, 1);
+	options.lightmap.nWidth = std::min(std::max(options.lightmap.nWidth, kLightmapTileSize), kMaxLightmapWidth);
+	options.lightmap.nRays = std::max(options.lightmap.nRays, 0);
+	options.probes.nRays = std::max(options.probes.nRays, 0);
+
+	// the levels of a distributed bake run one after another on all workers
+	if (!options.sListenAddress.empty())
+	{
+		if (options.bCache)
+			PrintMessage(EMessage_Warning, "", "--cache is ignored for distributed bakes.");
+		options.nJobs = 1;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	SOptions options;
+	if (!ParseOptions(argc, argv, options))
+		return 2;
+
+	CGameFileSystem fileSystem;
+	for (const std::string& sSearchPath : options.searchPaths)
+	{
+		std::string sError;
+		if (!fileSystem.AddSearchPath(sSearchPath, sError))
+		{
+			PrintMessage(EMessage_Error, "", "%s.", sError.c_str());
+			return 2;
+		}
+	}
+
+	if (!options.sOutDir.empty())
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(options.sOutDir, ec);
+	}
+
+	CJobSystem jobSystem(options.nThreads);
+	CAssetIndex assetIndex;
+	if (!options.sAssetIndexPath.empty())
+	{
+		std::string sError;
+		if (!assetIndex.Load(options.sAssetIndexPath, sError))
+			PrintMessage(EMessage_Warning, "", "%s '%s', rebuilding it.", sError.c_str(), options.sAssetIndexPath.c_str());
+	}
+	CAssetCache assets(fileSystem, options.sAssetIndexPath.empty() ? nullptr : &assetIndex);
+
+	if (!options.sWorkerAddress.empty())
+	{
+		PrintMessage(EMessage_Info, "", "Baking for the coordinator on %s with %d threads.", options.sWorkerAddress.c_str(), jobSystem.GetNumThreads());
+
+		std::string sError;
+		if (!RunBakeWorker(options.sWorkerAddress, &jobSystem, sError))
+		{
+			PrintMessage(EMessage_Error, "", "%s.", sError.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	std::unique_ptr<CBakeCoordinator> pCoordinator;
+	if (!options.sListenAddress.empty() && !options.bExportScene)
+	{
+		PrintMessage(EMessage_Info, "", "Waiting for %d worker(s) on %s.", options.nWorkers, options.sListenAddress.c_str());
+
+		std::string sError;
+		pCoordinator.reset(new CBakeCoordinator());
+		if (!pCoordinator->Start(options.sListenAddress, options.nWorkers, sError))
+		{
+			PrintMessage(EMessage_Error, "", "%s '%s'.", sError.c_str(), options.sListenAddress.c_str());
+			return 1;
+		}
+		PrintMessage(EMessage_Info, "", "Baking %d level(s) on %d worker(s).", (int)options.levels.size(), pCoordinator->GetNumWorkers());
+	}
+	else
+	{
+		PrintMessage(EMessage_Info, "", "%s %d level(s) on the CPU with %d threads.", options.bExportScene ? "Exporting" : "Baking", (int)options.levels.size(), jobSystem.GetNumThreads());
+	}
+
+	// one profile per level, filled by the thread that bakes it
+	std::vector<SBakeProfile> profiles(options.sProfilePath.empty() ? 0 : options.levels.size());
+
+	// levels are picked up by the batch threads, the vertex ranges of every level share the same job system
+	std::atomic<int> nNextLevel = 0;
+	std::atomic<int> nNumFailed = 0;
+	auto worker = [&]()
+	{
+		for (int nLevel = nNextLevel++; nLevel < (int)options.levels.size(); nLevel = nNextLevel++)
+		{
+			SBakeProfile* pProfile = profiles.empty() ? nullptr : &profiles[nLevel];
+			if (!BakeLevel(options.levels[nLevel], options, assets, &jobSystem, pCoordinator.get(), pProfile))
+				++nNumFailed;
+		}
+	};
+
+	std::vector<std::thread> batchThreads;
+	for (int i = 1; i < std::min(options.nJobs, (int)options.levels.size()); ++i)
+		batchThreads.emplace_back(worker);
+	worker();
+	for (std::thread& thread : batchThreads)
+		thread.join();
+
+	// lets the workers exit
+	if (pCoordinator)
+		pCoordinator->Stop();
+
+	if (assetIndex.IsDirty())
+	{
+		std::string sError;
+		if (!assetIndex.Save(options.sAssetIndexPath, sError))
+			PrintMessage(EMessage_Warning, "", "%s '%s'.", sError.c_str(), options.sAssetIndexPath.c_str());
+	}
+
+	if (!profiles.empty())
+	{
+		// levels that failed or had nothing to bake have no stages
+		profiles.erase(std::remove_if(profiles.begin(), profiles.end(), [](const SBakeProfile& profile) { return profile.stages.empty(); }), profiles.end());
+
+		std::string sError;
+		if (!SaveBakeProfiles(options.sProfilePath, profiles, sError))
+		{
+			PrintMessage(EMessage_Error, "", "%s '%s'.", sError.c_str(), options.sProfilePath.c_str());
+			return 1;
+		}
+	}
+
+	if (nNumFailed > 0)
+	{
+		PrintMessage(EMessage_Error, "", "%d of %d level(s) failed.", (int)nNumFailed, (int)options.levels.size());
+		return 1;
+	}
+	return 0;
+}
@@ -27,6 +27,9 @@
 #define IDC_NORMAL_SMOOTH_SPIN          1023
 #define IDC_COMBO_RAYS                  1025
 #define IDC_COMBO_INDIRECT_RAYS         1026
+#define IDC_BAKE_PROGRESS               1027
+#define IDC_CHECK_ADAPTIVE_RAYS         1028
+#define IDC_CHECK_PROBE_AMBIENT         1029
 #define IDD_LIGHTBAKER_DLG              2000
 #define IDC_CHECK_POINT                 2001
 #define IDC_CHECK_SUN                   2002
@@ -35,6 +38,7 @@
 #define IDC_BUTTON_BAKE_ALL             2005
 #define IDC_BUTTON_BAKE_SEL             2006
 #define IDC_BUTTON_BAKE_LAYERS          2007
+#define IDC_BUTTON_CANCEL_BAKE          2008
 
 // Next default values for new objects
 // 
@@ -42,7 +46,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        1011
 #define _APS_NEXT_COMMAND_VALUE         32771
-#define _APS_NEXT_CONTROL_VALUE         1026
+#define _APS_NEXT_CONTROL_VALUE         1030
 #define _APS_NEXT_SYMED_VALUE           1000
 #endif
 #endif